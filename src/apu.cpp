@@ -13,104 +13,222 @@ void ApuDevice::set_cpu(Emu6502 * cpu) {
     m_cpu = cpu;
 }
 
-uint8_t ApuDevice::get(uint16_t addr) {
-    return 0;
+void ApuDevice::set_scheduler(Scheduler * scheduler) {
+    m_scheduler = scheduler;
+    m_sync_cycle = m_scheduler->now();
+    // at power up the frame counter runs as if $4017 was written with 0
+    restart_frame_counter();
 }
 
-void ApuDevice::set(uint16_t addr , uint8_t value) {
-    uint8_t retval;
-    float dur, freq;
+void ApuDevice::set_audio_export(ShmExporter * exporter) {
+    m_sound_engine.setExport(exporter);
+}
 
-    switch (addr) {
-    case KEY_PULSE1_DUTY_ENVELOPE:
-        m_square[0].duty_cycle_no = value >> 6;
-        m_sound_engine.setDutyCycle(0, DUTY_CYCLE_VALUES[m_square[0].duty_cycle_no]);
-        m_square[0].constant_volume = ((value & BIT4) != 0);
-        if (m_square[0].constant_volume) {
-            m_square[0].volume = value & 0b1111;
-            m_square[0].envolope_decay_speed = 0;
-        } else {
-            m_square[0].volume = 15;
-            m_square[0].envolope_decay_speed = value & 0b1111;
-            m_square[0].decay_counter = m_square[0].envolope_decay_speed;
-            m_sound_engine.setAmplitude(0, MAX_AMPLITUDE); // init amplitude
+void ApuDevice::set_audio_muted(bool muted) {
+    m_sound_engine.setMuted(muted);
+}
+
+void ApuDevice::set_expansion_audio(ExpansionAudio * expansion) {
+    m_sound_engine.setExpansion(expansion, static_cast<float>(CLOCK_FREQUENCY) / SAMPLE_RATE);
+}
 
+void ApuDevice::get_state(State * state) {
+    state->square[0] = m_square[0];
+    state->square[1] = m_square[1];
+    state->triangle = m_triangle;
+    state->irq_inhibit = m_irq_inhibit;
+    state->frame_irq = m_frame_irq;
+    state->sequencer_mode = m_sequencer_mode;
+    state->frame_start = m_frame_start;
+    state->frame_step = m_frame_step;
+    state->sync_cycle = m_sync_cycle;
+    state->sample_clock = m_sample_clock;
+}
+
+void ApuDevice::set_state(const State& state) {
+    m_square[0] = state.square[0];
+    m_square[1] = state.square[1];
+    m_triangle = state.triangle;
+    m_irq_inhibit = state.irq_inhibit;
+    m_frame_irq = state.frame_irq;
+    m_sequencer_mode = state.sequencer_mode;
+    m_frame_start = state.frame_start;
+    m_frame_step = state.frame_step;
+    // the samples up to sync_cycle were rendered when the state was taken
+    m_sync_cycle = state.sync_cycle;
+    m_sample_clock = state.sample_clock;
+    // the pending frame event is restored with the scheduler
+    update_square_output(0);
+    update_square_output(1);
+    update_triangle_output();
+}
+
+void ApuDevice::sync() {
+    /*
+    Render the samples elapsed since the last sync, with the channel
+    settings of that whole span : called before anything changes them
+    (register writes, frame sequencer steps), so the audio costs one
+    block loop per change instead of work at each cycle. The frame
+    sequencer events bound a block to ~7457 cycles (~180 samples).
+    */
+    uint64_t now = m_scheduler->now();
+    if (now < m_sync_cycle) {
+        // went back in time (state restored), nothing to render
+        m_sync_cycle = now;
+        return;
+    }
+    m_sample_clock += (now - m_sync_cycle) * SAMPLE_RATE;
+    m_sync_cycle = now;
+    uint64_t nsamples = m_sample_clock / CLOCK_FREQUENCY;
+    m_sample_clock -= nsamples * CLOCK_FREQUENCY;
+    if (nsamples > 0) {
+        m_sound_engine.render(nsamples);
+    }
+}
+
+uint8_t ApuDevice::get(uint16_t addr) {
+    sync();
+    uint8_t retval = 0;
+    switch (addr) {
+    case KEY_STATUS:
+        // TODO : DMC bits
+        if (m_square[0].length_counter > 0) {
+            retval |= BIT0;
+        }
+        if (m_square[1].length_counter > 0) {
+            retval |= BIT1;
+        }
+        if (m_triangle.length_counter > 0) {
+            retval |= BIT2;
+        }
+        if (m_frame_irq) {
+            retval |= BIT6;
         }
+        // reading acknowledges the frame IRQ
+        set_frame_irq(false);
         break;
 
-    case KEY_PULSE1_PERIOD_LOW:
-        m_square[0].period = (m_square[0].period & 0xff00) | static_cast<uint16_t>(value);
-        break;
-    
-    case KEY_PULSE1_PERIOD_HIGH:
-        m_square[0].period = (static_cast<uint16_t>(value & 0b111) << 8) | (m_square[0].period & 0x00ff);
-        m_square[0].length = APU_LENGTH_COUNTER_LOAD[(value & 0b11111000) >> 3];
-        m_sound_engine.setFrequency(
-            0, 
-            CLOCK_FREQUENCY / (16.0f*( static_cast<float>(m_square[0].period) + 1)), 
-            m_square[0].length / 240.0f
-        );
+    default:
         break;
+    }
+    return retval;
+}
 
+uint8_t ApuDevice::peek(uint16_t addr) {
+    // the frame IRQ left pending, no audio rendered
+    if (addr != KEY_STATUS) {
+        return 0;
+    }
+    return (m_square[0].length_counter > 0 ? BIT0 : 0)
+        | (m_square[1].length_counter > 0 ? BIT1 : 0)
+        | (m_triangle.length_counter > 0 ? BIT2 : 0)
+        | (m_frame_irq ? BIT6 : 0);
+}
+
+void ApuDevice::set(uint16_t addr , uint8_t value) {
+    sync();
+    int chan_no;
+
+    switch (addr) {
+    case KEY_PULSE1_DUTY_ENVELOPE:
     case KEY_PULSE2_DUTY_ENVELOPE:
-        m_square[1].duty_cycle_no = value >> 6;
-        m_sound_engine.setDutyCycle(1, DUTY_CYCLE_VALUES[m_square[1].duty_cycle_no]);
-        m_square[1].constant_volume = ((value & BIT4) != 0);
-        if (m_square[1].constant_volume) {
-            m_square[1].volume = value & 0b1111;
-            m_square[1].envolope_decay_speed = 0;
+        chan_no = (addr == KEY_PULSE1_DUTY_ENVELOPE) ? 0 : 1;
+        m_square[chan_no].duty_cycle_no = value >> 6;
+        m_sound_engine.setDutyCycle(chan_no, DUTY_CYCLE_VALUES[m_square[chan_no].duty_cycle_no]);
+        m_square[chan_no].length_halt = ((value & BIT5) != 0);
+        m_square[chan_no].constant_volume = ((value & BIT4) != 0);
+        if (m_square[chan_no].constant_volume) {
+            m_square[chan_no].volume = value & 0b1111;
+            m_square[chan_no].envolope_decay_speed = 0;
         } else {
-            m_square[1].volume = 15;
-            m_square[1].envolope_decay_speed = value & 0b1111;
-            m_square[1].decay_counter = m_square[1].envolope_decay_speed;
-            m_sound_engine.setAmplitude(1, MAX_AMPLITUDE); // init amplitude
+            m_square[chan_no].volume = 15;
+            m_square[chan_no].envolope_decay_speed = value & 0b1111;
+            m_square[chan_no].decay_counter = m_square[chan_no].envolope_decay_speed;
+            m_sound_engine.setAmplitude(chan_no, MAX_AMPLITUDE); // init amplitude
         }
         break;
-    
+
+    case KEY_PULSE1_SWEEP:
+    case KEY_PULSE2_SWEEP:
+        chan_no = (addr == KEY_PULSE1_SWEEP) ? 0 : 1;
+        m_square[chan_no].sweep_enable = ((value & BIT7) != 0);
+        m_square[chan_no].sweep_period = (value >> 4) & 0b111;
+        m_square[chan_no].sweep_negate = ((value & BIT3) != 0);
+        m_square[chan_no].sweep_shift = value & 0b111;
+        m_square[chan_no].sweep_reload = true;
+        // the sweep can mute the channel
+        update_square_output(chan_no);
+        break;
+
+    case KEY_PULSE1_PERIOD_LOW:
     case KEY_PULSE2_PERIOD_LOW:
-        m_square[1].period = (m_square[1].period & 0xff00) | static_cast<uint16_t>(value);
+        chan_no = (addr == KEY_PULSE1_PERIOD_LOW) ? 0 : 1;
+        m_square[chan_no].period = (m_square[chan_no].period & 0xff00) | static_cast<uint16_t>(value);
+        update_square_output(chan_no);
         break;
-    
+
+    case KEY_PULSE1_PERIOD_HIGH:
     case KEY_PULSE2_PERIOD_HIGH:
-        m_square[1].period = (static_cast<uint16_t>(value & 0b111) << 8) | (m_square[1].period & 0x00ff);
-        m_square[1].length = APU_LENGTH_COUNTER_LOAD[(value & 0b11111000) >> 3];
-        m_sound_engine.setFrequency(
-            1, 
-            CLOCK_FREQUENCY /  (16.0f*( static_cast<float>(m_square[1].period) + 1)), 
-            m_square[1].length / 240.0f
-        );
+        chan_no = (addr == KEY_PULSE1_PERIOD_HIGH) ? 0 : 1;
+        m_square[chan_no].period = (static_cast<uint16_t>(value & 0b111) << 8) | (m_square[chan_no].period & 0x00ff);
+        // the length counter is only loaded while the channel is enabled
+        if (m_square[chan_no].enable) {
+            m_square[chan_no].length_counter = APU_LENGTH_COUNTER_LOAD[(value & 0b11111000) >> 3];
+        }
+        update_square_output(chan_no);
+        break;
+
+    case KEY_TRI_SETUP:
+        m_triangle.control = ((value & BIT7) != 0);
+        m_triangle.linear_reload_value = value & 0b01111111;
         break;
 
     case KEY_TRI_PERIOD_LOW:
         m_triangle.period = (m_triangle.period & 0xff00) | static_cast<uint16_t>(value);
+        update_triangle_output();
         break;
 
     case KEY_TRI_PERIOD_HIGH:
         m_triangle.period = (static_cast<uint16_t>(value & 0b111) << 8) | (m_triangle.period & 0x00ff);
-
-        m_triangle.length = APU_LENGTH_COUNTER_LOAD[(value & 0b11111000) >> 3];
-        freq = CLOCK_FREQUENCY / 2.0f / (16.0f*( static_cast<float>(m_triangle.period) + 1));
-        dur = m_triangle.length / 6.0f / 240.0f; // why 6 ?
-        dur = static_cast<float>(static_cast<int>(dur*freq)/freq); // round duration to a multiple of the period, to prevent popping when ending the sound
-        m_sound_engine.setFrequency(2, freq, dur); 
+        if (m_triangle.enable) {
+            m_triangle.length_counter = APU_LENGTH_COUNTER_LOAD[(value & 0b11111000) >> 3];
+        }
+        m_triangle.linear_reload = true;
+        update_triangle_output();
         break;
 
     case KEY_STATUS:
         // TODO : send 0 on powerup / reset
-        // TODO : partially implemented
-        m_sound_engine.setChannelEnable(0, (value & BIT0) != 0);
-        m_sound_engine.setChannelEnable(1, (value & BIT1) != 0);
-        m_sound_engine.setChannelEnable(2, (value & BIT2) != 0);
+        // TODO : noise and DMC
+        m_square[0].enable = ((value & BIT0) != 0);
+        m_square[1].enable = ((value & BIT1) != 0);
+        m_triangle.enable = ((value & BIT2) != 0);
+        // disabling a channel clears its length counter
+        for (chan_no = 0; chan_no < 2; chan_no++) {
+            if (!m_square[chan_no].enable) {
+                m_square[chan_no].length_counter = 0;
+            }
+            update_square_output(chan_no);
+        }
+        if (!m_triangle.enable) {
+            m_triangle.length_counter = 0;
+        }
+        update_triangle_output();
         break;
 
     case KEY_SETMODE:
-        m_enable_irq = ((value & BIT6) == 0); // BIT6 is IRQ inhibit
-        m_sequencer_mode = ((value & BIT6) != 0); // 0 : 4 step, 1 : 5 steps
-        // writing here trigger the reset of the apu counter
-        // and call the quarter and half frame tick
-        quarter_frame_tick();
-        half_frame_tick();
-        m_apu_cycle_count == 0;
+        m_irq_inhibit = ((value & BIT6) != 0);
+        m_sequencer_mode = ((value & BIT7) != 0); // 0 : 4 step, 1 : 5 steps
+        if (m_irq_inhibit) {
+            set_frame_irq(false);
+        }
+        // writing here restarts the sequence, the 5 step mode
+        // also clocks the quarter and half frame units at once
+        if (m_sequencer_mode == SEQUENCER_5STEP_MODE) {
+            quarter_frame_tick();
+            half_frame_tick();
+        }
+        restart_frame_counter();
         break;
 
     default:
@@ -120,50 +238,39 @@ void ApuDevice::set(uint16_t addr , uint8_t value) {
     return ;
 }
 
-// https://www.nesdev.org/wiki/APU_Frame_Counter
-void ApuDevice::tick() {
-    m_apu_cycle_count++;
-    if (m_apu_cycle_count % APU_FRAME_CYCLE_COUNT == 0) {
-        if (m_apu_cycle_count == APU_FRAME_CYCLE_COUNT) {
-            // step 1
-            quarter_frame_tick();
-        } else if (m_apu_cycle_count == 2*APU_FRAME_CYCLE_COUNT) {
-            // step 2
-            quarter_frame_tick();
-            half_frame_tick();
-
-        } else if (m_apu_cycle_count == 3*APU_FRAME_CYCLE_COUNT) {
-            // step 3
-            // We run this step at cycle count 11184 but apparently
-            // it runs normally at 11185
-            // it probably don't matter
-            quarter_frame_tick();
-
-        } else if (m_apu_cycle_count == 4*APU_FRAME_CYCLE_COUNT) {
-            // step 4
-            // We run this step at cycle count 14912 but apparently
-            // it runs normally at 14914
-            // it probably don't matter
-            if (m_sequencer_mode == SEQUENCER_5STEP_MODE) {
-                // in 5 step mode this step is skipped
-                return;
-            }
-            quarter_frame_tick();
-            half_frame_tick();
-            m_apu_cycle_count = 0;
+void ApuDevice::restart_frame_counter() {
+    // TODO : the hardware delays the restart by 3 or 4 cycles
+    m_frame_start = m_scheduler->now();
+    m_frame_step = 0;
+    schedule_frame_step();
+}
 
-        } else if (m_apu_cycle_count == 5*APU_FRAME_CYCLE_COUNT) {
-            // step 5
-            // runs at the right cycle count for this one
-            // necessarily in 5 steps mode here because it has not been
-            // reset on step 4
-            quarter_frame_tick();
-            half_frame_tick();
-            m_apu_cycle_count = 0;
+void ApuDevice::schedule_frame_step() {
+    m_scheduler->schedule(EVENT_APU_FRAME, m_frame_start + APU_FRAME_STEPS[m_sequencer_mode][m_frame_step]);
+}
 
+void ApuDevice::frame_event(uint64_t cycle) {
+    // nothing happens between two steps, so the APU doesn't tick
+    sync();
+    quarter_frame_tick();
+    if (m_frame_step == 1 || m_frame_step == 3) {
+        half_frame_tick();
+    }
+    if (m_frame_step == 3) {
+        if (m_sequencer_mode == SEQUENCER_4STEP_MODE && !m_irq_inhibit) {
+            set_frame_irq(true);
         }
+        m_frame_start += APU_FRAME_PERIOD[m_sequencer_mode];
+        m_frame_step = 0;
+    } else {
+        m_frame_step++;
     }
-    return;
+    schedule_frame_step();
+}
+
+void ApuDevice::set_frame_irq(bool on) {
+    m_frame_irq = on;
+    m_cpu->set_irq_line(IRQ_SOURCE_APU_FRAME, on);
 }
 
 void ApuDevice::quarter_frame_tick() {
@@ -181,7 +288,70 @@ void ApuDevice::quarter_frame_tick() {
             }
         }
     }
+
+    // triangle linear counter
+    if (m_triangle.linear_reload) {
+        m_triangle.linear_counter = m_triangle.linear_reload_value;
+    } else if (m_triangle.linear_counter > 0) {
+        m_triangle.linear_counter--;
+    }
+    if (!m_triangle.control) {
+        m_triangle.linear_reload = false;
+    }
+    update_triangle_output();
 }
 
 void ApuDevice::half_frame_tick() {
+    // length counters
+    for (int chan_no = 0; chan_no < 2; chan_no++) {
+        if (!m_square[chan_no].length_halt && m_square[chan_no].length_counter > 0) {
+            m_square[chan_no].length_counter--;
+        }
+    }
+    if (!m_triangle.control && m_triangle.length_counter > 0) {
+        m_triangle.length_counter--;
+    }
+
+    // sweep units
+    for (int chan_no = 0; chan_no < 2; chan_no++) {
+        squarePulse * square = &m_square[chan_no];
+        uint16_t target = sweep_target(chan_no);
+        if (square->sweep_divider == 0 && square->sweep_enable && square->sweep_shift > 0
+                && square->period >= 8 && target <= 0x7ff) {
+            square->period = target;
+        }
+        if (square->sweep_divider == 0 || square->sweep_reload) {
+            square->sweep_divider = square->sweep_period;
+            square->sweep_reload = false;
+        } else {
+            square->sweep_divider--;
+        }
+        update_square_output(chan_no);
+    }
+    update_triangle_output();
+}
+
+uint16_t ApuDevice::sweep_target(int chan_no) {
+    const squarePulse& square = m_square[chan_no];
+    uint16_t change = square.period >> square.sweep_shift;
+    if (!square.sweep_negate) {
+        return square.period + change;
+    }
+    // pulse 1 negates with ones' complement, pulse 2 with two's complement
+    uint16_t sub = change + (chan_no == 0 ? 1 : 0);
+    return sub > square.period ? 0 : square.period - sub;
+}
+
+void ApuDevice::update_square_output(int chan_no) {
+    const squarePulse& square = m_square[chan_no];
+    // the sweep mutes the channel when its period is out of range,
+    // even when disabled
+    bool muted = square.period < 8 || sweep_target(chan_no) > 0x7ff;
+    m_sound_engine.setChannelEnable(chan_no, square.enable && square.length_counter > 0 && !muted);
+    m_sound_engine.setFrequency(chan_no, CLOCK_FREQUENCY / (16.0f*( static_cast<float>(square.period) + 1)));
+}
+
+void ApuDevice::update_triangle_output() {
+    m_sound_engine.setChannelEnable(2, m_triangle.enable && m_triangle.length_counter > 0 && m_triangle.linear_counter > 0);
+    m_sound_engine.setFrequency(2, CLOCK_FREQUENCY / 2.0f / (16.0f*( static_cast<float>(m_triangle.period) + 1)));
 }
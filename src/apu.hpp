@@ -2,13 +2,16 @@
 #include "device.hpp"
 #include "audio.hpp"
 #include "cpu.hpp"
+#include "scheduler.hpp"
 
 enum {
     KEY_PULSE1_DUTY_ENVELOPE = 0x4000,
+    KEY_PULSE1_SWEEP = 0x4001,
     KEY_PULSE1_PERIOD_LOW = 0x4002,
     KEY_PULSE1_PERIOD_HIGH = 0x4003,
 
     KEY_PULSE2_DUTY_ENVELOPE = 0x4004,
+    KEY_PULSE2_SWEEP = 0x4005,
     KEY_PULSE2_PERIOD_LOW = 0x4006,
     KEY_PULSE2_PERIOD_HIGH = 0x4007,
 
@@ -26,22 +29,75 @@ enum {
 struct squarePulse {
     uint16_t period = 0;
     uint8_t duty_cycle_no = 0;
-    float length = 0;
+    uint8_t length_counter = 0;
+    bool length_halt = false;
     bool constant_volume = false;
     uint8_t volume = 0; // volume to be used in constant volume mode
     uint8_t envolope_decay_speed = 0;
     uint8_t decay_counter = 0;
     bool enable = 0;
+    // sweep unit
+    bool sweep_enable = false;
+    uint8_t sweep_period = 0;
+    bool sweep_negate = false;
+    uint8_t sweep_shift = 0;
+    uint8_t sweep_divider = 0;
+    bool sweep_reload = false;
 };
 
 struct trianglePulse {
     uint16_t period = 0;
-    float length = 0;
+    uint8_t length_counter = 0;
+    bool control = false; // length counter halt and linear counter control
+    uint8_t linear_reload_value = 0;
+    uint8_t linear_counter = 0;
+    bool linear_reload = false;
+    bool enable = false;
 };
 
+// cartridge expansion audio channels, see expaudio.hpp
+// divider : cpu cycles left before the next step of the sequencer
+
+struct vrc6Pulse {
+    uint16_t period = 0;
+    uint8_t duty = 0;
+    uint8_t volume = 0;
+    bool ignore_duty = false; // "mode" bit, constant output
+    bool enable = false;
+    uint8_t step = 0;
+    float divider = 0;
+};
+
+struct vrc6Saw {
+    uint16_t period = 0;
+    uint8_t rate = 0;
+    bool enable = false;
+    uint8_t step = 0; // 0-13, the accumulator is reset at 14
+    uint8_t accumulator = 0;
+    float divider = 0;
+};
+
+// Sunsoft 5B tone channel (AY-3-8910)
+struct ayTone {
+    uint16_t period = 0;
+    uint8_t volume = 0;
+    bool use_envelope = false;
+    bool tone_disable = false;
+    bool noise_disable = false;
+    bool output = false;
+    float divider = 0;
+};
+
+// the Namco 163 channels live in the chip sound RAM, and are
+// synthesised lane-wise, see Namco163Audio
+
 static int const CLOCK_FREQUENCY = 1789773;
 static int const MAX_AMPLITUDE = 4000;
-const long APU_FRAME_CYCLE_COUNT = 3728; // NTSC
+// https://www.nesdev.org/wiki/APU_Frame_Counter
+// NTSC, in cpu cycles after the $4017 write. Steps 1 and 3 clock the
+// envelopes (quarter frame), 2 and 4 also the length counters and sweeps
+const uint64_t APU_FRAME_STEPS[2][4] = {{7457, 14913, 22371, 29829}, {7457, 14913, 22371, 37281}};
+const uint64_t APU_FRAME_PERIOD[2] = {29830, 37282};
 
 const float DUTY_CYCLE_VALUES[4] = {0.125, 0.25, 0.5, 0.75};
 
@@ -54,29 +110,67 @@ const uint8_t APU_LENGTH_COUNTER_LOAD[32] = {10, 254, 20, 2, 40, 4, 80, 6, 160,
 
 class ApuDevice : public Device {
  public:
+    // the sound engine is output only and is not part of the state
+    struct State {
+        squarePulse square[2];
+        trianglePulse triangle;
+        bool irq_inhibit;
+        bool frame_irq;
+        bool sequencer_mode;
+        uint64_t frame_start;
+        int frame_step;
+        uint64_t sync_cycle;
+        uint64_t sample_clock;
+    };
+
     ApuDevice();
-    void tick();
     uint8_t get(uint16_t addr);
+    uint8_t peek(uint16_t addr);
     void set(uint16_t addr, uint8_t val);
     void start_sound();
     void set_cpu(Emu6502 * cpu);
+    // the frame sequencer runs on EVENT_APU_FRAME, restarted from now
+    void set_scheduler(Scheduler * scheduler);
+    // optional, the rendered samples are also exported
+    void set_audio_export(ShmExporter * exporter);
+    void set_audio_muted(bool muted);
+    // EVENT_APU_FRAME handler
+    void frame_event(uint64_t cycle);
+    void get_state(State * state);
+    void set_state(const State& state);
+    // render the audio up to now, before an expansion chip register changes
+    void sync();
+    void set_expansion_audio(ExpansionAudio * expansion);
 
  private:
     void quarter_frame_tick();
     void half_frame_tick();
+    void restart_frame_counter();
+    void schedule_frame_step();
+    void set_frame_irq(bool on);
+    uint16_t sweep_target(int chan_no);
+    void update_square_output(int chan_no);
+    void update_triangle_output();
 
 private:
     // TODO : needed to call IRQ, bu can do better than this
     Emu6502 * m_cpu;
+    Scheduler * m_scheduler = nullptr;
     squarePulse m_square[2];
     trianglePulse m_triangle;
 
     // set by 0x4017
-    // TODO : handle IRQ flag?
-    bool m_enable_irq = false;
+    bool m_irq_inhibit = false;
+    bool m_frame_irq = false;
     bool m_sequencer_mode = false;
 
-    long m_apu_cycle_count = 0;
+    // cpu cycle of the $4017 write or of the last sequence end
+    uint64_t m_frame_start = 0;
+    int m_frame_step = 0; // next step
+
+    // audio is synthesised up to this cycle, see sync()
+    uint64_t m_sync_cycle = 0;
+    uint64_t m_sample_clock = 0; // SAMPLE_RATE * cycles not yet rendered
 
     SoundEngine m_sound_engine;
 };
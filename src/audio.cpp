@@ -1,8 +1,86 @@
+#include <algorithm>
+
 #include "audio.hpp"
+#include "shmexport.hpp"
 
 void audio_callback(void*, Uint8*, int);
 
-SoundEngine::SoundEngine() {
+static const int RENDER_BLOCK = 256;
+
+OutputFilter::OutputFilter(float sample_rate) {
+    // y[n] = a * (y[n-1] + x[n] - x[n-1]) for the high-pass
+    // y[n] = y[n-1] + b * (x[n] - y[n-1]) for the low-pass
+    float dt = 1.0f / sample_rate;
+    float rc90 = 1.0f / (2.0f * M_PI * 90.0f);
+    float rc440 = 1.0f / (2.0f * M_PI * 440.0f);
+    float rc14k = 1.0f / (2.0f * M_PI * 14000.0f);
+    m_hp90_a = rc90 / (rc90 + dt);
+    m_hp440_a = rc440 / (rc440 + dt);
+    m_lp14k_b = dt / (rc14k + dt);
+}
+
+void OutputFilter::process(float * samples, int length) {
+    float hp90_x = m_hp90_x, hp90_y = m_hp90_y;
+    float hp440_x = m_hp440_x, hp440_y = m_hp440_y;
+    float lp14k_y = m_lp14k_y;
+    for (int i = 0; i < length; i++) {
+        float x = samples[i];
+        hp90_y = m_hp90_a * (hp90_y + x - hp90_x);
+        hp90_x = x;
+        hp440_y = m_hp440_a * (hp440_y + hp90_y - hp440_x);
+        hp440_x = hp90_y;
+        lp14k_y += m_lp14k_b * (hp440_y - lp14k_y);
+        samples[i] = lp14k_y;
+    }
+    // a decaying state would end up denormal, which is very slow to compute
+    // with, flush it once negligible (blocks are short, it can't get there within one)
+    if (std::fabs(hp90_y) < 1e-15f) {
+        hp90_y = 0;
+    }
+    if (std::fabs(hp440_y) < 1e-15f) {
+        hp440_y = 0;
+    }
+    if (std::fabs(lp14k_y) < 1e-15f) {
+        lp14k_y = 0;
+    }
+    m_hp90_x = hp90_x;
+    m_hp90_y = hp90_y;
+    m_hp440_x = hp440_x;
+    m_hp440_y = hp440_y;
+    m_lp14k_y = lp14k_y;
+}
+
+size_t AudioRing::size() const {
+    return m_write.load(std::memory_order_acquire) - m_read.load(std::memory_order_acquire);
+}
+
+size_t AudioRing::push(const Sint16 * samples, size_t n) {
+    size_t write = m_write.load(std::memory_order_relaxed);
+    size_t room = CAPACITY - (write - m_read.load(std::memory_order_acquire));
+    if (n > room) {
+        n = room;
+    }
+    for (size_t i = 0; i < n; i++) {
+        m_buffer[(write + i) & (CAPACITY - 1)] = samples[i];
+    }
+    m_write.store(write + n, std::memory_order_release);
+    return n;
+}
+
+size_t AudioRing::pop(Sint16 * samples, size_t n) {
+    size_t read = m_read.load(std::memory_order_relaxed);
+    size_t available = m_write.load(std::memory_order_acquire) - read;
+    if (n > available) {
+        n = available;
+    }
+    for (size_t i = 0; i < n; i++) {
+        samples[i] = m_buffer[(read + i) & (CAPACITY - 1)];
+    }
+    m_read.store(read + n, std::memory_order_release);
+    return n;
+}
+
+SoundEngine::SoundEngine() : m_filter(SAMPLE_RATE) {
     m_square[2].current_phase = M_PI/2.0f; // set init phase of tri wave so that the sound wave starts at 0
 }
 
@@ -41,11 +119,10 @@ void SoundEngine::validateChannelNo(int channel) {
     }
 }
 
-void SoundEngine::setFrequency(int channel, float frequency, float duration)
+void SoundEngine::setFrequency(int channel, float frequency)
 {   
     validateChannelNo(channel);
     m_square[channel].frequency = frequency;
-    m_square[channel].left_duration = duration;
 }
 
 void SoundEngine::setAmplitude(int channel, float amplitude)
@@ -66,19 +143,39 @@ void SoundEngine::setChannelEnable(int channel, float enable)
     m_square[channel].enabled = enable;
 }
 
-void SoundEngine::generateSamples(Sint16 *stream, int length)
+void SoundEngine::setFilterEnable(bool enable)
+{
+    m_filter_enabled = enable;
+}
+
+void SoundEngine::setExport(ShmExporter * exporter)
+{
+    m_export = exporter;
+}
+
+void SoundEngine::setMuted(bool muted)
+{
+    m_muted = muted;
+}
+
+void SoundEngine::setExpansion(ExpansionAudio * expansion, float cycles_per_sample)
+{
+    m_expansion = expansion;
+    m_cycles_per_sample = cycles_per_sample;
+}
+
+void SoundEngine::generateSamples(float *stream, int length)
 {
     for (int i = 0; i < length; i++) {
         stream[i] = 0;
         
         for (int chan_no=0; chan_no < 2; chan_no++) {
             squareWave * channel = &m_square[chan_no];
-            // std::cout << channel->enabled << " " << channel->left_duration << " " << channel->duty_cycle << " " << channel->current_phase << " " << channel->amplitude << std::endl;
-            if (!(channel->enabled && channel->left_duration > 0)) {
+            // std::cout << channel->enabled << " " << channel->duty_cycle << " " << channel->current_phase << " " << channel->amplitude << std::endl;
+            if (!channel->enabled) {
                 continue;
             }
             stream[i] += channel->amplitude * ((channel->current_phase < 2 * M_PI * channel->duty_cycle) ? 1.0f:-1.0f);
-            channel->left_duration -= 1.0f/SAMPLE_RATE;
             // increase phase only if playing
             channel->current_phase += 2 * M_PI * channel->frequency / SAMPLE_RATE;
             // Wrap phase to avoid overflow
@@ -89,7 +186,7 @@ void SoundEngine::generateSamples(Sint16 *stream, int length)
 
         squareWave * channel = &m_square[2];
 
-        if ((channel->enabled && channel->left_duration > 0)) {
+        if (channel->enabled) {
             if (channel->current_phase < M_PI) {
                 stream[i] += 2*channel->amplitude * (channel->current_phase/M_PI*2 - 1);
             } else {
@@ -98,7 +195,6 @@ void SoundEngine::generateSamples(Sint16 *stream, int length)
         } else {
             channel->current_phase = M_PI/2.0f; // resets phase so that we start at 0
         }
-        channel->left_duration -= 1.0f/SAMPLE_RATE;
         // increase phase only if playing
         channel->current_phase += 2 * M_PI * channel->frequency / SAMPLE_RATE;
         // Wrap phase to avoid overflow
@@ -109,11 +205,47 @@ void SoundEngine::generateSamples(Sint16 *stream, int length)
     }
 }
 
+void SoundEngine::render(int nsamples)
+{
+    float mixed[RENDER_BLOCK];
+    Sint16 block[RENDER_BLOCK];
+    while (nsamples > 0) {
+        int length = std::min(nsamples, RENDER_BLOCK);
+        generateSamples(mixed, length);
+        if (m_expansion != nullptr) {
+            m_expansion->render(mixed, length, m_cycles_per_sample);
+        }
+        if (m_filter_enabled) {
+            m_filter.process(mixed, length);
+        }
+        for (int i = 0; i < length; i++) {
+            block[i] = static_cast<Sint16>(std::max(-32768.0f, std::min(32767.0f, mixed[i])));
+        }
+        nsamples -= length;
+        if (m_muted) {
+            // the expansion chips still had to render, their state may change
+            continue;
+        }
+        m_ring.push(block, length);
+        if (m_export != nullptr) {
+            m_export->write_audio(block, length);
+        }
+    }
+}
+
+void SoundEngine::playSamples(Sint16 *stream, int length)
+{
+    int played = m_ring.pop(stream, length);
+    for (int i = played; i < length; i++) {
+        stream[i] = 0;
+    }
+}
+
 void audio_callback(void *_beeper, Uint8 *_stream, int _length)
 {
     Sint16 *stream = (Sint16*) _stream;
     int length = _length / 2;
     SoundEngine* beeper = (SoundEngine*) _beeper;
 
-    beeper->generateSamples(stream, length);
+    beeper->playSamples(stream, length);
 }
@@ -3,6 +3,7 @@
 #include <SDL2/SDL_audio.h>
 #include <cmath>
 #include <iostream>
+#include <atomic>
 
 const int AMPLITUDE = 28000;
 const int SAMPLE_RATE = 44100;
@@ -19,18 +20,87 @@ enum {
 
 struct squareWave {
     float frequency = 400;
-    float left_duration = 0;
     float amplitude = AMPLITUDE/4; // TODO : try setting at 0 the init amplitude
     double current_phase = 0; // Tracks the phase of the wave
     float duty_cycle = 0.5;
-    bool enabled = true;
+    bool enabled = false; // gated by the APU length counters
 };
 
+class ShmExporter;
+
+/*
+Cartridge sound chips, mixed with the APU channels before the output filters
+Like the APU channels, they are rendered in blocks on the emulation thread :
+the mapper syncs the APU before changing a register of the chip.
+*/
+class ExpansionAudio {
+ public:
+    virtual ~ExpansionAudio() {}
+    // add nsamples to mix, cycles_per_sample cpu cycles apart
+    virtual void render(float * mix, int nsamples, float cycles_per_sample) = 0;
+};
+
+/*
+The filters of the console output stage
+https://www.nesdev.org/wiki/APU_Mixer
+Two first-order high-pass (90 Hz, 440 Hz) remove the DC offset of the
+channels, a first-order low-pass (14 kHz) the harshest aliasing. The
+recursions are serial in time, so the three stages run fused in a single
+branch-free loop over the block, with the state kept in registers.
+*/
+class OutputFilter {
+ public:
+    OutputFilter(float sample_rate);
+    void process(float * samples, int length);
+
+ private:
+    float m_hp90_a;
+    float m_hp440_a;
+    float m_lp14k_b;
+    float m_hp90_x = 0;
+    float m_hp90_y = 0;
+    float m_hp440_x = 0;
+    float m_hp440_y = 0;
+    float m_lp14k_y = 0;
+};
+
+/*
+Samples from the emulation thread to the SDL audio callback
+Single producer / single consumer, the samples which don't fit are dropped
+(emulation ahead of the audio device) and the missing ones are played as
+silence (emulation paused or late).
+*/
+class AudioRing {
+ public:
+    size_t push(const Sint16 * samples, size_t n);
+    size_t pop(Sint16 * samples, size_t n);
+    size_t size() const;
+
+ private:
+    static const size_t CAPACITY = 8192; // ~190 ms, power of 2
+    Sint16 m_buffer[CAPACITY];
+    std::atomic<size_t> m_read {0};
+    std::atomic<size_t> m_write {0};
+};
+
+/*
+The channels are synthesised on the emulation thread, in blocks : the APU
+calls render() with the number of samples elapsed since its last sync
+(register access or frame sequencer step), the audio callback only
+copies them out of the ring.
+*/
 class SoundEngine
 {
 private:
     Uint32 start_time;  // Tracks the start time for modulation
     squareWave m_square[3];
+    AudioRing m_ring;
+    OutputFilter m_filter;
+    bool m_filter_enabled = true;
+    ExpansionAudio * m_expansion = nullptr;
+    ShmExporter * m_export = nullptr;
+    bool m_muted = false;
+    float m_cycles_per_sample = 0;
     void validateChannelNo(int channel);
     float getWave(float phase, int duty_cycle);
 
@@ -38,9 +108,19 @@ public:
     SoundEngine();
     ~SoundEngine();
     void startSound();
-    void setFrequency(int channel, float frequency, float duration);
+    void setFrequency(int channel, float frequency);
     void setAmplitude(int channel, float amplitude);
     void setDutyCycle(int channel, float duty_cycle);
     void setChannelEnable(int channel, float enable);
-    void generateSamples(Sint16 *stream, int length);
+    void setFilterEnable(bool enable);
+    void setExpansion(ExpansionAudio * expansion, float cycles_per_sample);
+    // optional, also gets the rendered samples
+    void setExport(ShmExporter * exporter);
+    // rendered but not output, while the emulation replays (netplay rollbacks)
+    void setMuted(bool muted);
+    void generateSamples(float *stream, int length);
+    // synthesise nsamples with the current settings into the ring
+    void render(int nsamples);
+    // audio callback side
+    void playSamples(Sint16 *stream, int length);
 };
@@ -0,0 +1,76 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "cdl.hpp"
+#include "mapper.hpp"
+
+CodeDataLogger::CodeDataLogger(Memory * mem, const MapperDevice * mapper, size_t prg_size, size_t chr_size)
+    : m_mem(mem), m_mapper(mapper), m_rom_base_addr(mapper != nullptr ? 0x6000 : 0xc000), m_prg_flags(prg_size, 0), m_chr_flags(chr_size, 0) {
+}
+
+void CodeDataLogger::log_prg(uint16_t addr, uint8_t flag) {
+    long offset;
+    if (m_mapper != nullptr) {
+        // -1 for the PRG RAM and the registers
+        offset = m_mapper->prg_offset(addr);
+    } else {
+        offset = addr >= m_rom_base_addr ? (addr - m_rom_base_addr) % m_prg_flags.size() : -1;
+    }
+    if (offset < 0 || static_cast<size_t>(offset) >= m_prg_flags.size()) {
+        // code running from RAM
+        return;
+    }
+    // the window bits only cover 0x8000-0xffff
+    uint8_t window = addr >= 0x8000 ? ((addr >> 13) & 0b11) << 2 : 0;
+    m_prg_flags[offset] |= flag | window;
+}
+
+void CodeDataLogger::log_chr(uint16_t chr_addr, uint16_t length, uint8_t flag) {
+    if (m_chr_flags.empty()) {
+        return;
+    }
+    for (uint16_t i = 0; i < length; i++) {
+        uint16_t addr = (chr_addr + i) & 0x1fff;
+        long offset = m_mapper != nullptr ? m_mapper->chr_offset(addr) : addr % m_chr_flags.size();
+        if (offset >= 0 && static_cast<size_t>(offset) < m_chr_flags.size()) {
+            m_chr_flags[offset] |= flag;
+        }
+    }
+}
+
+CodeDataLogger::~CodeDataLogger() {
+    stop();
+}
+
+void CodeDataLogger::start() {
+    if (!m_pages.empty()) {
+        return;
+    }
+    for (int page_no = m_rom_base_addr >> 8; page_no < 256; page_no++) {
+        m_pages.push_back(std::make_unique<RomPageDevice>(this, m_mem->get_page_device(page_no)));
+        m_mem->set_page_device(page_no, m_pages.back().get());
+    }
+}
+
+void CodeDataLogger::stop() {
+    // same as the cheats, reset restores the direct pointers
+    // of the pages that were not wrapped by another overlay
+    int page_no = m_rom_base_addr >> 8;
+    for (auto& page : m_pages) {
+        m_mem->reset_page_device(page_no);
+        if (m_mem->get_page_device(page_no) != page->get_inner()) {
+            m_mem->set_page_device(page_no, page->get_inner());
+        }
+        page_no++;
+    }
+    m_pages.clear();
+}
+
+void CodeDataLogger::save(const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    file.write(reinterpret_cast<const char*>(m_prg_flags.data()), m_prg_flags.size());
+    file.write(reinterpret_cast<const char*>(m_chr_flags.data()), m_chr_flags.size());
+}
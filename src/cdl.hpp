@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "device.hpp"
+#include "cpumem.hpp"
+
+class MapperDevice;
+
+// FCEUX .cdl flags, one byte per PRG byte
+// https://fceux.com/web/help/CodeDataLogger.html
+const uint8_t CDL_PRG_CODE          = BIT0;
+const uint8_t CDL_PRG_DATA          = BIT1;
+// BIT2-3 : 8KB window the byte was accessed from (0 : 0x8000 ... 3 : 0xe000)
+const uint8_t CDL_PRG_INDIRECT_CODE = BIT4;
+const uint8_t CDL_PRG_INDIRECT_DATA = BIT5;
+const uint8_t CDL_PRG_PCM           = BIT6;
+// then one byte per CHR byte
+const uint8_t CDL_CHR_RENDERED      = BIT0;
+const uint8_t CDL_CHR_READ          = BIT1;
+
+/*
+Code/Data Logger
+Code is logged by the cpu before each instruction (log_code), data by
+overlays installed on the ROM pages of the memory, so no other page
+is slowed down. Bytes fetched as part of the current instruction are not
+counted as data.
+The flags are by offset in the PRG and CHR ROMs, as in the .cdl file :
+with a mapper, the addresses are translated through its current banks,
+otherwise the 16 KB of PRG are at 0xc000 and the CHR as is.
+*/
+class CodeDataLogger {
+ public:
+    // mapper : nullptr for NROM. chr_size : 0 for CHR RAM, nothing logged
+    CodeDataLogger(Memory * mem, const MapperDevice * mapper, size_t prg_size, size_t chr_size);
+    ~CodeDataLogger();
+
+    void start();
+    void stop();
+
+    // the opcode is read before its length is known
+    void log_fetch(uint16_t addr) {
+        m_code_start = addr;
+        m_code_length = 1;
+    }
+
+    void log_code(uint16_t addr, uint8_t length) {
+        m_code_start = addr;
+        m_code_length = length;
+        for (uint8_t i = 0; i < length; i++) {
+            log_prg(addr + i, CDL_PRG_CODE);
+        }
+    }
+
+    void log_data(uint16_t addr) {
+        if (static_cast<uint16_t>(addr - m_code_start) >= m_code_length) {
+            log_prg(addr, CDL_PRG_DATA);
+        }
+    }
+
+    void log_chr(uint16_t chr_addr, uint16_t length, uint8_t flag);
+
+    void save(const std::string& filename);
+
+ private:
+    class RomPageDevice : public Device {
+     public:
+        RomPageDevice(CodeDataLogger * cdl, Device * inner) : m_cdl(cdl), m_inner(inner) {}
+        uint8_t get(uint16_t addr) { m_cdl->log_data(addr); return m_inner->get(addr); }
+        uint8_t peek(uint16_t addr) { return m_inner->peek(addr); }
+        void set(uint16_t addr, uint8_t val) { m_inner->set(addr, val); }
+        Device * get_inner() { return m_inner; }
+     private:
+        CodeDataLogger * m_cdl;
+        Device * m_inner;
+    };
+
+    void log_prg(uint16_t addr, uint8_t flag);
+
+    Memory * m_mem;
+    const MapperDevice * m_mapper;
+    // first page wrapped
+    uint16_t m_rom_base_addr;
+    std::vector<uint8_t> m_prg_flags;
+    std::vector<uint8_t> m_chr_flags;
+    std::vector<std::unique_ptr<RomPageDevice>> m_pages;
+
+    uint16_t m_code_start = 0;
+    uint16_t m_code_length = 0;
+};
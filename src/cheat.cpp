@@ -0,0 +1,147 @@
+#include <stdexcept>
+#include <cctype>
+
+#include "cheat.hpp"
+
+static const std::string GAME_GENIE_LETTERS = "APZLGITYEOXUKSVN";
+
+uint8_t CheatPageDevice::get(uint16_t addr) {
+    for (const auto& cheat : m_cheats) {
+        if (cheat.addr != addr) {
+            continue;
+        }
+        if (cheat.type == CHEAT_RAM_FREEZE) {
+            return cheat.value;
+        }
+        if (!cheat.has_compare || m_inner->get(addr) == cheat.compare) {
+            return cheat.value;
+        }
+    }
+    return m_inner->get(addr);
+}
+
+uint8_t CheatPageDevice::peek(uint16_t addr) {
+    // as get, the patched values included
+    for (const auto& cheat : m_cheats) {
+        if (cheat.addr != addr) {
+            continue;
+        }
+        if (cheat.type == CHEAT_RAM_FREEZE) {
+            return cheat.value;
+        }
+        if (!cheat.has_compare || m_inner->peek(addr) == cheat.compare) {
+            return cheat.value;
+        }
+    }
+    return m_inner->peek(addr);
+}
+
+void CheatPageDevice::set(uint16_t addr, uint8_t val) {
+    for (const auto& cheat : m_cheats) {
+        if (cheat.addr == addr && cheat.type == CHEAT_RAM_FREEZE) {
+            // keep the frozen value in RAM, so that direct readers see it too
+            val = cheat.value;
+        }
+    }
+    m_inner->set(addr, val);
+}
+
+void CheatPageDevice::add_cheat(const Cheat& cheat) {
+    m_cheats.push_back(cheat);
+    if (cheat.type == CHEAT_RAM_FREEZE) {
+        m_inner->set(cheat.addr, cheat.value);
+    }
+}
+
+Device * CheatPageDevice::get_inner() {
+    return m_inner;
+}
+
+CheatEngine::CheatEngine(Memory * mem) : m_mem(mem) {
+}
+
+CheatEngine::~CheatEngine() {
+    uninstall();
+}
+
+/*
+https://www.nesdev.org/wiki/Game_Genie
+Each letter encodes 4 bits, scrambled into the address (15 bits,
+always in ROM), the value and for 8 letters codes the compare value.
+*/
+Cheat CheatEngine::decode_game_genie(const std::string& code) {
+    if (code.size() != 6 && code.size() != 8) {
+        throw std::runtime_error("Game Genie codes have 6 or 8 letters");
+    }
+    uint8_t n[8];
+    for (size_t i = 0; i < code.size(); i++) {
+        size_t pos = GAME_GENIE_LETTERS.find(std::toupper(static_cast<unsigned char>(code[i])));
+        if (pos == std::string::npos) {
+            throw std::runtime_error("Invalid Game Genie letter");
+        }
+        n[i] = pos;
+    }
+
+    Cheat cheat;
+    cheat.type = CHEAT_ROM_PATCH;
+    cheat.addr = 0x8000
+        + (((n[3] & 7) << 12)
+        | ((n[5] & 7) << 8) | ((n[4] & 8) << 8)
+        | ((n[2] & 7) << 4) | ((n[1] & 8) << 4)
+        | (n[4] & 7) | (n[3] & 8));
+    cheat.value = ((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7);
+    if (code.size() == 6) {
+        cheat.value |= (n[5] & 8);
+    } else {
+        cheat.value |= (n[7] & 8);
+        cheat.has_compare = true;
+        cheat.compare = ((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8);
+    }
+    return cheat;
+}
+
+void CheatEngine::add_game_genie(const std::string& code) {
+    uninstall();
+    m_cheats.push_back(decode_game_genie(code));
+    install();
+}
+
+void CheatEngine::add_freeze(uint16_t addr, uint8_t value) {
+    uninstall();
+    Cheat cheat;
+    cheat.type = CHEAT_RAM_FREEZE;
+    cheat.addr = addr;
+    cheat.value = value;
+    m_cheats.push_back(cheat);
+    install();
+}
+
+void CheatEngine::clear() {
+    uninstall();
+    m_cheats.clear();
+}
+
+void CheatEngine::install() {
+    for (const auto& cheat : m_cheats) {
+        uint8_t page_no = cheat.addr >> 8;
+        if (m_pages.find(page_no) == m_pages.end()) {
+            m_pages[page_no] = std::make_unique<CheatPageDevice>(m_mem->get_page_device(page_no));
+            m_mem->set_page_device(page_no, m_pages[page_no].get());
+        }
+        m_pages[page_no]->add_cheat(cheat);
+    }
+}
+
+void CheatEngine::uninstall() {
+    for (auto& pair : m_pages) {
+        // one overlay per page, the pages are independent : the overlay
+        // is replaced by the device it wrapped. If that is the memory map
+        // device, reset also restores its direct pointers
+        Device * inner = pair.second->get_inner();
+        m_mem->reset_page_device(pair.first);
+        if (m_mem->get_page_device(pair.first) != inner) {
+            m_mem->set_page_device(pair.first, inner);
+        }
+    }
+    m_pages.clear();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "device.hpp"
+#include "cpumem.hpp"
+
+enum {
+    CHEAT_ROM_PATCH = 0, // substitutes a ROM read (Game Genie)
+    CHEAT_RAM_FREEZE = 1, // forces a RAM value
+};
+
+struct Cheat {
+    int type = CHEAT_ROM_PATCH;
+    uint16_t addr = 0;
+    uint8_t value = 0;
+    bool has_compare = false; // 8 letters Game Genie codes
+    uint8_t compare = 0; // only patch if the ROM holds this value
+};
+
+// Overlay for a page holding at least one cheat
+class CheatPageDevice : public Device {
+ public:
+    CheatPageDevice(Device * inner) : m_inner(inner) {}
+    uint8_t get(uint16_t addr);
+    uint8_t peek(uint16_t addr);
+    void set(uint16_t addr, uint8_t val);
+    void add_cheat(const Cheat& cheat);
+    Device * get_inner();
+
+ private:
+    Device * m_inner;
+    std::vector<Cheat> m_cheats;
+};
+
+/*
+Cheats are compiled into the memory page table : only the pages holding
+a cheat are redirected to a CheatPageDevice, all the others keep their
+direct pointer so cheats cost nothing outside the patched pages.
+*/
+class CheatEngine {
+ public:
+    CheatEngine(Memory * mem);
+    ~CheatEngine();
+
+    void add_game_genie(const std::string& code);
+    void add_freeze(uint16_t addr, uint8_t value);
+    void clear();
+
+    static Cheat decode_game_genie(const std::string& code);
+
+ private:
+    void install();
+    void uninstall();
+
+    Memory * m_mem;
+    std::vector<Cheat> m_cheats;
+    std::map<uint8_t, std::unique_ptr<CheatPageDevice>> m_pages;
+};
@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef NESQUICK_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+#include "checkpoint.hpp"
+#include "utils.hpp"
+
+static_assert(std::is_trivially_copyable<Nes::State>::value, "Nes::State is written as is");
+
+static const char CHECKPOINT_MAGIC[8] = "NESCKPT";
+static const uint32_t CHECKPOINT_VERSION = 2;
+static const int CHECKPOINT_ZSTD_LEVEL = 3;
+
+static std::string checkpoint_name(long sequence) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "checkpoint-%08ld.nesck", sequence);
+    return name;
+}
+
+// the sequence of a checkpoint file name, -1 if it isn't one
+static long checkpoint_sequence(const std::string& name) {
+    long sequence;
+    char end;
+    if (name.size() != checkpoint_name(0).size() || std::sscanf(name.c_str(), "checkpoint-%8ld.nesc%c", &sequence, &end) != 2 || end != 'k') {
+        return -1;
+    }
+    return sequence;
+}
+
+static bool write_all(int fd, const void * data, size_t size) {
+    const uint8_t * bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+void CheckpointWriter::Stats::add(double us) {
+    count++;
+    total_us += us;
+    max_us = std::max(max_us, us);
+}
+
+void CheckpointWriter::Stats::print(std::ostream& out, const char * name) {
+    out << "  " << name << ": " << (count > 0 ? total_us / count : 0) << " us avg, " << max_us << " us max, " << count << " checkpoints" << std::endl;
+}
+
+CheckpointWriter::CheckpointWriter(Nes * nes, uint32_t rom_crc, const std::string& dir, long interval, int keep)
+    : m_nes(nes), m_rom_crc(rom_crc), m_dir(dir), m_interval(interval), m_keep(keep), m_slots(NSLOTS) {
+    if (m_interval <= 0) {
+        throw std::runtime_error("Bad checkpoint interval " + std::to_string(m_interval));
+    }
+    if (mkdir(m_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Unable to create the checkpoint directory " + m_dir);
+    }
+    // numbered after the ones of the previous runs, the newest is the latest
+    for (const std::string& name : list(m_dir)) {
+        m_files.push_back(m_dir + "/" + name);
+        m_sequence = checkpoint_sequence(name) + 1;
+    }
+    m_next_frame = m_nes->ppu.get_frame_no() + m_interval;
+    for (Slot& slot : m_slots) {
+        m_free.push(&slot);
+    }
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    stop();
+}
+
+void CheckpointWriter::start() {
+    if (m_thread.joinable()) {
+        return;
+    }
+    m_done = false;
+    m_thread = std::thread(&CheckpointWriter::run, this);
+}
+
+void CheckpointWriter::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    m_done = true;
+    m_thread.join();
+}
+
+void CheckpointWriter::take() {
+    auto start = Clock::now();
+    m_next_frame = m_nes->ppu.get_frame_no() + m_interval;
+    Slot * slot;
+    if (!m_free.pop(&slot)) {
+        m_skipped++;
+        return;
+    }
+    m_nes->get_state(&slot->state);
+    slot->frame_no = m_nes->ppu.get_frame_no();
+    // as many slots as the ring holds, never full
+    m_taken.push(slot);
+    m_stall_stats.add(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+}
+
+void CheckpointWriter::run() {
+    for (;;) {
+        Slot * slot;
+        if (!m_taken.pop(&slot)) {
+            // the last ones are written before stopping
+            if (m_done) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+        write(slot);
+        m_free.push(slot);
+    }
+}
+
+void CheckpointWriter::write(Slot * slot) {
+    const uint8_t * state = reinterpret_cast<const uint8_t*>(&slot->state);
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.state_size = sizeof(Nes::State);
+    header.frame_no = slot->frame_no;
+    header.cycles = slot->state.cycles;
+    header.rom_crc = m_rom_crc;
+
+    auto start = Clock::now();
+    header.crc = crc32(state, sizeof(Nes::State));
+    const uint8_t * payload = state;
+    header.codec = CHECKPOINT_RAW;
+    header.payload_size = sizeof(Nes::State);
+#ifdef NESQUICK_HAS_ZSTD
+    m_payload.resize(ZSTD_compressBound(sizeof(Nes::State)));
+    size_t size = ZSTD_compress(m_payload.data(), m_payload.size(), state, sizeof(Nes::State), CHECKPOINT_ZSTD_LEVEL);
+    if (!ZSTD_isError(size)) {
+        payload = m_payload.data();
+        header.codec = CHECKPOINT_ZSTD;
+        header.payload_size = size;
+    }
+#endif
+    auto compressed = Clock::now();
+    m_compress_stats.add(std::chrono::duration<double, std::micro>(compressed - start).count());
+
+    // complete or absent : written aside, then renamed over
+    std::string path = m_dir + "/" + checkpoint_name(m_sequence);
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    bool ok = fd >= 0 && write_all(fd, &header, sizeof(header)) && write_all(fd, payload, header.payload_size) && fsync(fd) == 0;
+    if (fd >= 0 && ::close(fd) != 0) {
+        ok = false;
+    }
+    if (ok && std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        m_failed++;
+        m_last_error = tmp_path + ": " + std::strerror(errno);
+        ::unlink(tmp_path.c_str());
+        return;
+    }
+    // the rename itself is durable once the directory is synced
+    int dir_fd = ::open(m_dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+    m_write_stats.add(std::chrono::duration<double, std::micro>(Clock::now() - compressed).count());
+    m_raw_bytes += sizeof(Nes::State);
+    m_written_bytes += sizeof(header) + header.payload_size;
+    m_sequence++;
+
+    m_files.push_back(path);
+    while (static_cast<int>(m_files.size()) > m_keep) {
+        ::unlink(m_files.front().c_str());
+        m_files.pop_front();
+    }
+}
+
+std::vector<std::string> CheckpointWriter::list(const std::string& dir) {
+    // the checkpoint file names, oldest first
+    std::vector<std::string> names;
+    DIR * d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return names;
+    }
+    while (dirent * entry = readdir(d)) {
+        if (checkpoint_sequence(entry->d_name) >= 0) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+void CheckpointWriter::load(const std::string& path, uint32_t rom_crc, Nes::State * state, CheckpointHeader * header) {
+    std::unique_ptr<FILE, int(*)(FILE*)> file(std::fopen(path.c_str(), "rb"), std::fclose);
+    if (!file) {
+        throw std::runtime_error("Unable to open checkpoint " + path);
+    }
+    CheckpointHeader head;
+    if (std::fread(&head, sizeof(head), 1, file.get()) != 1 || std::memcmp(head.magic, CHECKPOINT_MAGIC, sizeof(head.magic)) != 0) {
+        throw std::runtime_error("Not a checkpoint " + path);
+    }
+    if (head.version != CHECKPOINT_VERSION || head.state_size != sizeof(Nes::State)) {
+        throw std::runtime_error("Checkpoint of another version " + path);
+    }
+    if (head.rom_crc != rom_crc) {
+        throw std::runtime_error("Checkpoint of another game " + path);
+    }
+    // streamed, decompressed chunk by chunk straight into the state
+    uint8_t * out = reinterpret_cast<uint8_t*>(state);
+    if (head.codec == CHECKPOINT_RAW) {
+        if (head.payload_size != sizeof(Nes::State) || std::fread(out, sizeof(Nes::State), 1, file.get()) != 1) {
+            throw std::runtime_error("Truncated checkpoint " + path);
+        }
+#ifdef NESQUICK_HAS_ZSTD
+    } else if (head.codec == CHECKPOINT_ZSTD) {
+        std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        ZSTD_outBuffer output = {out, sizeof(Nes::State), 0};
+        uint8_t chunk[16384];
+        uint64_t remaining = head.payload_size;
+        size_t pending = 1; // ZSTD_decompressStream returns 0 at the end of the frame
+        while (remaining > 0) {
+            size_t n = std::fread(chunk, 1, std::min<uint64_t>(sizeof(chunk), remaining), file.get());
+            if (n == 0) {
+                throw std::runtime_error("Truncated checkpoint " + path);
+            }
+            remaining -= n;
+            ZSTD_inBuffer input = {chunk, n, 0};
+            while (input.pos < input.size) {
+                pending = ZSTD_decompressStream(dctx.get(), &output, &input);
+                if (ZSTD_isError(pending) || (output.pos == output.size && pending != 0 && input.pos < input.size)) {
+                    throw std::runtime_error("Corrupted checkpoint " + path);
+                }
+            }
+        }
+        if (pending != 0 || output.pos != sizeof(Nes::State)) {
+            throw std::runtime_error("Truncated checkpoint " + path);
+        }
+#endif
+    } else {
+        throw std::runtime_error("Checkpoint codec unsupported by this build " + path);
+    }
+    if (crc32(out, sizeof(Nes::State)) != head.crc) {
+        throw std::runtime_error("Corrupted checkpoint " + path);
+    }
+    if (header != nullptr) {
+        *header = head;
+    }
+}
+
+bool CheckpointWriter::load_latest(const std::string& dir, uint32_t rom_crc, Nes::State * state, std::string * path) {
+    std::vector<std::string> names = list(dir);
+    for (auto name = names.rbegin(); name != names.rend(); ++name) {
+        try {
+            load(dir + "/" + *name, rom_crc, state);
+        } catch (const std::runtime_error& ex) {
+            // the previous one then
+            continue;
+        }
+        if (path != nullptr) {
+            *path = dir + "/" + *name;
+        }
+        return true;
+    }
+    return false;
+}
+
+void CheckpointWriter::print_stats(std::ostream& out) {
+    out << "checkpoints (" << (m_raw_bytes > 0 ? 100.0 * m_written_bytes / m_raw_bytes : 0) << "% of the state size)" << std::endl;
+    m_stall_stats.print(out, "stall (emulation paused)");
+    m_compress_stats.print(out, "compress");
+    m_write_stats.print(out, "write, fsync, rename");
+    out << "  " << m_skipped << " skipped, " << m_failed << " failed" << std::endl;
+    if (m_failed > 0) {
+        out << "  last error: " << m_last_error << std::endl;
+    }
+}
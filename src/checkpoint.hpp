@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nes.hpp"
+#include "spscring.hpp"
+
+// default cadence, one minute of emulation
+static const long CHECKPOINT_DEFAULT_INTERVAL = 3600; // frames
+// checkpoint files kept in the directory, the older ones are deleted
+static const int CHECKPOINT_DEFAULT_KEEP = 3;
+
+// payload codecs
+enum {
+    CHECKPOINT_RAW = 0,
+    CHECKPOINT_ZSTD = 1, // when built with zstd (NESQUICK_HAS_ZSTD)
+};
+
+// at the start of each checkpoint file, the payload follows
+struct CheckpointHeader {
+    char magic[8];          // "NESCKPT"
+    uint32_t version;
+    uint32_t codec;
+    uint64_t state_size;    // sizeof(Nes::State), same build only
+    uint64_t payload_size;
+    int64_t frame_no;
+    uint64_t cycles;
+    uint32_t crc;           // of the state
+    uint32_t rom_crc;       // rom_crc32 of the game, a state is of one game only
+};
+
+/*
+Checkpoints to disk for the long runs, without pausing the emulation
+The emulation thread only copies the state (poll(), a get_state into a
+free slot, some 10 us) and hands it over; the writer thread compresses
+it (zstd when built with it, else raw), writes it to a temp file, fsyncs
+and renames it : a checkpoint file is either complete or absent, even
+after a crash. When both slots are still being written the checkpoint
+is skipped, the emulation never waits for the disk.
+The files are numbered (checkpoint-00000042.nesck), load_latest resumes
+from the newest valid one of the same game (its rom_crc32), decompressing
+the file as it is read.
+*/
+class CheckpointWriter {
+ public:
+    typedef std::chrono::steady_clock Clock;
+
+    // rom_crc : rom_crc32 of the game running, recorded in each checkpoint
+    // interval : frames between two checkpoints, > 0, dir is created if missing
+    CheckpointWriter(Nes * nes, uint32_t rom_crc, const std::string& dir, long interval = CHECKPOINT_DEFAULT_INTERVAL, int keep = CHECKPOINT_DEFAULT_KEEP);
+    ~CheckpointWriter();
+
+    void start();
+    // writes the checkpoints handed over
+    void stop();
+
+    // emulation thread, between two instructions : a checkpoint if one is due
+    void poll() {
+        if (m_nes->ppu.get_frame_no() >= m_next_frame) {
+            take();
+        }
+    }
+    // emulation thread, a checkpoint now
+    void take();
+
+    // the newest valid checkpoint of dir for the game rom_crc into state, false if none
+    static bool load_latest(const std::string& dir, uint32_t rom_crc, Nes::State * state, std::string * path = nullptr);
+    // throws std::runtime_error if path is not a valid checkpoint of the game rom_crc
+    static void load(const std::string& path, uint32_t rom_crc, Nes::State * state, CheckpointHeader * header = nullptr);
+
+    void print_stats(std::ostream& out);
+
+ private:
+    struct Slot {
+        Nes::State state;
+        long frame_no;
+    };
+
+    struct Stats {
+        long count = 0;
+        double total_us = 0;
+        double max_us = 0;
+
+        void add(double us);
+        void print(std::ostream& out, const char * name);
+    };
+
+    static const int NSLOTS = 2;
+
+    void run();
+    void write(Slot * slot);
+    static std::vector<std::string> list(const std::string& dir);
+
+    Nes * m_nes;
+    uint32_t m_rom_crc;
+    std::string m_dir;
+    long m_interval;
+    int m_keep;
+    long m_next_frame;
+    long m_sequence = 0; // of the next file
+    std::vector<Slot> m_slots;
+    SpscRing<Slot*, NSLOTS> m_free;    // writer -> emulation
+    SpscRing<Slot*, NSLOTS> m_taken;   // emulation -> writer
+    std::deque<std::string> m_files;   // written, oldest first
+    std::vector<uint8_t> m_payload;
+    std::thread m_thread;
+    std::atomic<bool> m_done {false};
+
+    // emulation thread
+    Stats m_stall_stats;    // the emulation was paused for the copy
+    long m_skipped = 0;     // no free slot
+    // writer thread
+    Stats m_compress_stats;
+    Stats m_write_stats;    // write, fsync and rename
+    uint64_t m_raw_bytes = 0;
+    uint64_t m_written_bytes = 0;
+    long m_failed = 0;
+    std::string m_last_error;
+};
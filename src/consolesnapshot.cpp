@@ -0,0 +1,38 @@
+#include <cstring>
+
+#include "consolesnapshot.hpp"
+#include "nes.hpp"
+
+ConsoleSnapshotPublisher::ConsoleSnapshotPublisher(Nes * nes) : m_nes(nes) {
+    m_nes->ppu.set_frame_observer(this);
+}
+
+ConsoleSnapshotPublisher::~ConsoleSnapshotPublisher() {
+    m_nes->ppu.set_frame_observer(nullptr);
+}
+
+void ConsoleSnapshotPublisher::vblank_started(long frame_no) {
+    ConsoleSnapshot * snapshot = m_lock.begin_write();
+    snapshot->frame_no = frame_no;
+    snapshot->cycles = m_nes->get_cycles();
+    snapshot->lag_frame = m_nes->ppu.is_lag_frame();
+    snapshot->lag_frame_count = m_nes->ppu.get_lag_frame_count();
+    m_nes->cpu.get_state(&snapshot->cpu);
+    // contiguous, the mirrors are not
+    std::memcpy(snapshot->ram, m_nes->ram.direct_ptr(0x0000, false), sizeof(snapshot->ram));
+    if (m_nes->mapper) {
+        std::memcpy(snapshot->prg_ram, m_nes->mapper->get_prg_ram(), sizeof(snapshot->prg_ram));
+    } else {
+        std::memset(snapshot->prg_ram, 0, sizeof(snapshot->prg_ram));
+    }
+    const PpuDevice& ppu = m_nes->ppu;
+    snapshot->ppuctrl = ppu.get_ppuctrl();
+    snapshot->ppumask = ppu.get_ppumask();
+    snapshot->ppustatus = ppu.get_ppustatus();
+    snapshot->ppuaddr = ppu.get_vram_addr();
+    snapshot->ppu_tmp_addr = ppu.get_tmp_addr();
+    snapshot->fine_x = ppu.get_fine_x();
+    std::memcpy(snapshot->oam, ppu.get_oam(), sizeof(snapshot->oam));
+    std::memcpy(snapshot->palette, ppu.get_palette(), sizeof(snapshot->palette));
+    m_lock.end_write();
+}
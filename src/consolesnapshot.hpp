@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "device.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "seqlock.hpp"
+
+class Nes;
+
+// what the external tools read while the emulation runs, as of a vblank
+struct ConsoleSnapshot {
+    long frame_no;
+    uint64_t cycles; // cpu cycles since power on
+    bool lag_frame;  // the frame didn't poll the controllers
+    long lag_frame_count;
+    // the cpu may be in the middle of an instruction, see instruction_cycle
+    Emu6502::State cpu;
+    uint8_t ram[0x800];
+    // the cartridge PRG RAM at 0x6000, zeroed without a mapper
+    uint8_t prg_ram[0x2000];
+    uint8_t ppuctrl;
+    uint8_t ppumask;
+    uint8_t ppustatus;
+    uint16_t ppuaddr;      // v
+    uint16_t ppu_tmp_addr; // t
+    uint8_t fine_x;
+    uint8_t oam[256];
+    uint8_t palette[32];
+};
+
+/*
+Publishes a ConsoleSnapshot at each vblank, for the readers on other
+threads (RAM search, dashboards) which would otherwise race on the RAM
+while the emulation runs. The copy is about 3 KB per frame, 11 KB with a
+mapper, the emulation thread never waits for the readers (see Seqlock).
+*/
+class ConsoleSnapshotPublisher : public PpuFrameObserver {
+ public:
+    ConsoleSnapshotPublisher(Nes * nes);
+    ~ConsoleSnapshotPublisher();
+
+    // any thread, the last published snapshot, see Seqlock::read
+    uint32_t read(ConsoleSnapshot * snapshot) const { return m_lock.read(snapshot); }
+    uint32_t get_sequence() const { return m_lock.get_sequence(); }
+
+    // emulation thread, called by the PPU
+    void vblank_started(long frame_no) override;
+
+ private:
+    Nes * m_nes;
+    Seqlock<ConsoleSnapshot> m_lock;
+};
+
+// the internal RAM (and PRG RAM from 0x6000) of the last snapshot read,
+// for the RamSearch of the UI thread
+class SnapshotRamDevice : public Device {
+ public:
+    SnapshotRamDevice(const ConsoleSnapshotPublisher * publisher) : m_publisher(publisher) {
+        std::memset(&m_snapshot, 0, sizeof(m_snapshot));
+    }
+
+    // reads the last published snapshot
+    void refresh() {
+        m_publisher->read(&m_snapshot);
+    }
+
+    uint8_t get(uint16_t addr) {
+        if (addr >= 0x6000) {
+            return m_snapshot.prg_ram[(addr - 0x6000) & 0x1fff];
+        }
+        return m_snapshot.ram[addr & 0x7ff];
+    }
+
+    void set(uint16_t addr, uint8_t val) {
+        throw std::runtime_error("Snapshots are read only");
+    }
+
+ private:
+    const ConsoleSnapshotPublisher * m_publisher;
+    ConsoleSnapshot m_snapshot;
+};
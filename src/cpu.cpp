@@ -9,15 +9,21 @@
 
 #include "utils.hpp"
 #include "cpu.hpp"
+#include "cdl.hpp"
+#include "disasm.hpp"
 
 Emu6502::Emu6502(Memory *mem, bool debug, LstDebuggerAsm6 *lst)
-    : debug(debug), mem(mem), lst(lst) {
+    : debug(debug), mem(mem), lst(lst), cdl(nullptr), disasm(nullptr) {
     regs = {0, 0, 0, 0};
     stack_ptr = 0xff;
     prgm_ctr = 0;
-    interrupt_type = INTERRUPT_RST;
+    reset_pending = true;
+    nmi_pending = false;
+    irq_lines = 0;
     instruction_cycle = 0;
     instruction_nbcycles = 0;
+    fetch_addr = 0;
+    fetch_length = 0;
 
     check_opcode_map();
 }
@@ -33,6 +39,60 @@ void Emu6502::check_opcode_map() {
     }
 }
 
+void Emu6502::set_cdl(CodeDataLogger * _cdl) {
+    cdl = _cdl;
+}
+
+void Emu6502::set_disassembler(Disassembler * _disasm) {
+    disasm = _disasm;
+}
+
+void Emu6502::get_state(State * state) {
+    for (int reg = 0; reg < 4; reg++) {
+        state->regs[reg] = regs[reg];
+    }
+    state->stack_ptr = stack_ptr;
+    state->prgm_ctr = prgm_ctr;
+    state->reset_pending = reset_pending;
+    state->nmi_pending = nmi_pending;
+    state->irq_lines = irq_lines;
+    state->instruction_cycle = instruction_cycle;
+    state->instruction_nbcycles = instruction_nbcycles;
+}
+
+void Emu6502::set_state(const State& state) {
+    for (int reg = 0; reg < 4; reg++) {
+        regs[reg] = state.regs[reg];
+    }
+    stack_ptr = state.stack_ptr;
+    prgm_ctr = state.prgm_ctr;
+    reset_pending = state.reset_pending;
+    nmi_pending = state.nmi_pending;
+    irq_lines = state.irq_lines;
+    instruction_cycle = state.instruction_cycle;
+    instruction_nbcycles = state.instruction_nbcycles;
+}
+
+const Emu6502::Opcode * Emu6502::find_opcode(uint16_t opcode) const {
+    auto it = opcodes.find(opcode);
+    if (it == opcodes.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+uint Emu6502::op_length(const Opcode& op) const {
+    // instruction size in bytes, nbytes is the PC increment
+    // and is 0 for the ops that set the PC themselves
+    if (op.nbytes != 0) {
+        return op.nbytes;
+    }
+    if (op.addr_mode == ABSOLUTE || op.addr_mode == INDIRECT) {
+        return 3;
+    }
+    return 1;
+}
+
 void Emu6502::set_status_bit(uint8_t status_bit, bool on) {
     if (on) {
         regs[REG_S] |= status_bit;
@@ -352,14 +412,14 @@ void Emu6502::hw_interrupt(bool maskable) {
     Maskable = true : IRQ
     Maskable = false : NMI
 
-    don't do anything if IRQ and IRQ has been disabled
+    The I flag is checked when the IRQ line is polled (exec_inst),
+    and set here so that a still asserted line doesn't retrigger
+    before the handler acknowledges its source
     */
-    if (maskable && get_status_bit(STATUS_INTER)) {
-        return;
-    }
     stack_push(high_byte(prgm_ctr));
     stack_push(low_byte(prgm_ctr));
     stack_push(regs[REG_S]);
+    set_status_bit(STATUS_INTER, true);
     uint16_t prgm_ctr_addr = maskable ? 0xfffe : 0xfffa;
     prgm_ctr = (mem->get(prgm_ctr_addr + 1) << 8) + mem->get(prgm_ctr_addr);
 }
@@ -416,22 +476,24 @@ void Emu6502::dbg() {
     }
     std::cout << "\nPC\tinst\tA\tX\tY\tSP\tNV-BDIZC\n";
     std::cout << std::hex << prgm_ctr << "\t" << hex2(mem->get(prgm_ctr)) << "\t" << hex2(regs[REG_A]) << "\t" << hex2(regs[REG_X]) << "\t" << hex2(regs[REG_Y]) << "\t" << hex2(stack_ptr) << "\t" << bin8(regs[REG_S]) << "\n";
+    if (disasm != nullptr) {
+        std::cout << disasm->get_line(prgm_ctr) << "\n";
+    }
     std::cout << inst << std::endl;
     if (inst.find("bkpt") != std::string::npos) {
         std::this_thread::sleep_for(std::chrono::seconds(2));
     }
 }
 
-void Emu6502::interrupt(bool maskable) {
-    /*
-    This will set the interrupt type, causing the trigger of an
-    hw interrupt at the next op execution
-    Made to be called externally
-    */
-    if (maskable) {
-        interrupt_type = INTERRUPT_IRQ;
+void Emu6502::nmi() {
+    nmi_pending = true;
+}
+
+void Emu6502::set_irq_line(uint8_t source, bool asserted) {
+    if (asserted) {
+        irq_lines |= source;
     } else {
-        interrupt_type = INTERRUPT_NMI;
+        irq_lines &= ~source;
     }
 }
 
@@ -446,23 +508,27 @@ int Emu6502::exec_inst() {
     }
 
     uint16_t opcode = 0;
-    if (interrupt_type != INTERRUPT_NO) {
-        // hw interrupt is requested
-        // retreive the fake opcode to run the instruct
-        // as if it was any other function
-        if (interrupt_type == INTERRUPT_IRQ) {
-            opcode = OPCODE_IRQ;
-        } else if (interrupt_type == INTERRUPT_NMI) {
-            opcode = OPCODE_NMI;
-        } else if (interrupt_type == INTERRUPT_RST) {
-            opcode = OPCODE_RST;
-        } else {
-            throw std::runtime_error("Invalid interrupt type");
-        }
-        // reset interrupt type
-        interrupt_type = INTERRUPT_NO;
+    // nothing is fetched for the interrupts
+    fetch_length = 0;
+    // hw interrupts are polled between instructions, by priority
+    // and run as fake opcodes like any other function
+    // TODO : the I flag change of CLI, SEI and PLP should only be seen after the next instruction
+    if (reset_pending) {
+        opcode = OPCODE_RST;
+        reset_pending = false;
+    } else if (nmi_pending) {
+        opcode = OPCODE_NMI;
+        nmi_pending = false;
+    } else if (irq_lines != 0 && !get_status_bit(STATUS_INTER)) {
+        opcode = OPCODE_IRQ;
     } else {
         // no interrupt, run the next intruction normally
+        if (cdl != nullptr) {
+            cdl->log_fetch(prgm_ctr);
+        }
+        // the length is only known once the opcode is read
+        fetch_addr = prgm_ctr;
+        fetch_length = 1;
         opcode = mem->get(prgm_ctr);
     }
 
@@ -472,6 +538,13 @@ int Emu6502::exec_inst() {
 
     auto& op = opcodes[opcode];
 
+    if (opcode <= 0xff) {
+        fetch_length = op_length(op);
+        if (cdl != nullptr) {
+            cdl->log_code(prgm_ctr, fetch_length);
+        }
+    }
+
     // holds the addr specified depending on the addressing scheme
     op_addr = 0;
     // op_extra_cycles used only by branch ot report if the branching caused an extrac cycle
@@ -13,6 +13,8 @@
 #include "cpumem.hpp"
 #include "lstdebugger.hpp"
 
+class CodeDataLogger;
+
 // TODO : use enums instead...
 // Constants for registers
 const int REG_A = 0;
@@ -49,23 +51,72 @@ const int NOEC = 0;
 const int YESEC = 1;
 const int BRANCHEC = 2;
 
-// Interrupt types
-const int INTERRUPT_NO = 0; // No interrupt
-const int INTERRUPT_IRQ = 1; // Interrupt ReQuest
-const int INTERRUPT_NMI = 2; // Non maskable interrupt
-const int INTERRUPT_RST = 3; // Reset
+// IRQ sources, the IRQ line is low (asserted) while any of them pulls it
+const uint8_t IRQ_SOURCE_APU_FRAME = 0b001;
+const uint8_t IRQ_SOURCE_DMC       = 0b010;
+const uint8_t IRQ_SOURCE_MAPPER    = 0b100;
 
 // Opcodes for interrupts
 const uint16_t OPCODE_RST = 0xffd;
 const uint16_t OPCODE_IRQ = 0xffe;
 const uint16_t OPCODE_NMI = 0xfff;
 
+class Disassembler;
+
 class Emu6502 {
 public:
+    struct Opcode {
+        const char * mnemonic;
+        void (Emu6502::*func)();
+        uint addr_mode;
+        uint nbytes;
+        uint base_ncycle;
+        uint extra_cycle_type;
+    };
+
+    // everything needed to resume execution (save states, time travel)
+    struct State {
+        uint8_t regs[4];
+        uint8_t stack_ptr;
+        uint16_t prgm_ctr;
+        bool reset_pending;
+        bool nmi_pending;
+        uint8_t irq_lines;
+        int instruction_cycle;
+        int instruction_nbcycles;
+    };
+
     Emu6502(Memory *mem, bool debug = false, LstDebuggerAsm6 *lst = nullptr);
-    void interrupt(bool maskable);
+    // NMI is edge triggered : latched until serviced
+    void nmi();
+    // IRQ is level triggered : serviced at each instruction boundary
+    // while a source asserts it and the I flag is clear
+    void set_irq_line(uint8_t source, bool asserted);
+    uint8_t get_irq_lines() const { return irq_lines; }
     void op_reset();
     bool tick();
+    void set_cdl(CodeDataLogger * cdl);
+    void set_disassembler(Disassembler * disasm);
+    void get_state(State * state);
+    void set_state(const State& state);
+
+    // register access for the debuggers
+    uint8_t get_reg(int reg) const { return regs[reg]; }
+    void set_reg(int reg, uint8_t val) { regs[reg] = val; }
+    uint8_t get_stack_ptr() const { return stack_ptr; }
+    void set_stack_ptr(uint8_t val) { stack_ptr = val; }
+    uint16_t get_prgm_ctr() const { return prgm_ctr; }
+    void set_prgm_ctr(uint16_t val) { prgm_ctr = val; }
+    // true when the next tick executes a new instruction
+    bool at_instruction_start() const { return instruction_cycle == 0; }
+    // true when addr is a byte of the opcode or operands of the current
+    // instruction, i.e. a read of it is a fetch rather than a data read
+    bool is_fetch(uint16_t addr) const { return static_cast<uint16_t>(addr - fetch_addr) < fetch_length; }
+
+    // opcode metadata, shared with the disassembler
+    // nullptr for the unknown opcodes
+    const Opcode * find_opcode(uint16_t opcode) const;
+    uint op_length(const Opcode& op) const;
 
 private:
     void set_status_bit(uint8_t status_bit, bool on);
@@ -176,19 +227,18 @@ private:
     std::vector<uint8_t> regs;
     uint8_t stack_ptr;
     uint16_t prgm_ctr;
-    int interrupt_type;
+    bool reset_pending;
+    bool nmi_pending;
+    uint8_t irq_lines;
     Memory *mem;
     LstDebuggerAsm6 *lst;
+    CodeDataLogger *cdl;
+    Disassembler *disasm;
     int instruction_cycle;
     int instruction_nbcycles;
-
-    struct Opcode {
-        void (Emu6502::*func)();
-        uint addr_mode;
-        uint nbytes;
-        uint base_ncycle;
-        uint extra_cycle_type;
-    };
+    // the bytes of the current instruction, see is_fetch
+    uint16_t fetch_addr;
+    uint16_t fetch_length;
 
     // used specifically for opcode execution (e.g. for  passing mem addr to some opcodes)
     uint op_extra_cycles;
@@ -200,219 +250,219 @@ private:
     
     std::map<uint16_t, Opcode> opcodes {
         // INTERRUPTS
-        {OPCODE_IRQ, {&Emu6502::op_irq, IMPLICIT, 0, 7, NOEC}},
-        {OPCODE_NMI, {&Emu6502::op_nmi, IMPLICIT, 0, 7, NOEC}},
-        {OPCODE_RST, {&Emu6502::op_reset, IMPLICIT, 0, 7, NOEC}},
+        {OPCODE_IRQ, {"IRQ", &Emu6502::op_irq, IMPLICIT, 0, 7, NOEC}},
+        {OPCODE_NMI, {"NMI", &Emu6502::op_nmi, IMPLICIT, 0, 7, NOEC}},
+        {OPCODE_RST, {"RST", &Emu6502::op_reset, IMPLICIT, 0, 7, NOEC}},
     
         // BRK and RTI
-        {0x00, {&Emu6502::op_brk, IMPLICIT, 0, 7, NOEC}},
-        {0x40, {&Emu6502::op_rti, IMPLICIT, 0, 6, NOEC}},
+        {0x00, {"BRK", &Emu6502::op_brk, IMPLICIT, 0, 7, NOEC}},
+        {0x40, {"RTI", &Emu6502::op_rti, IMPLICIT, 0, 6, NOEC}},
     
         // NOP
-        {0xea, {&Emu6502::op_nop, IMPLICIT, 1, 2, NOEC}},
+        {0xea, {"NOP", &Emu6502::op_nop, IMPLICIT, 1, 2, NOEC}},
     
         // BIT TEST
-        {0x24, {&Emu6502::op_bit, ZEROPAGE, 2, 3, NOEC}},
-        {0x2c, {&Emu6502::op_bit, ABSOLUTE, 3, 4, NOEC}},
+        {0x24, {"BIT", &Emu6502::op_bit, ZEROPAGE, 2, 3, NOEC}},
+        {0x2c, {"BIT", &Emu6502::op_bit, ABSOLUTE, 3, 4, NOEC}},
     
         // ADC (Add with Carry)
-        {0x69, {&Emu6502::op_adc, IMMEDIATE, 2, 2, NOEC}},
-        {0x65, {&Emu6502::op_adc, ZEROPAGE, 2, 3, NOEC}},
-        {0x75, {&Emu6502::op_adc, ZEROPAGE_X, 2, 4, NOEC}},
-        {0x6d, {&Emu6502::op_adc, ABSOLUTE, 3, 4, NOEC}},
-        {0x7d, {&Emu6502::op_adc, ABSOLUTE_X, 3, 4, YESEC}},
-        {0x79, {&Emu6502::op_adc, ABSOLUTE_Y, 3, 4, YESEC}},
-        {0x61, {&Emu6502::op_adc, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
-        {0x71, {&Emu6502::op_adc, POST_INDEX_INDIRECT, 2, 5, YESEC}},
+        {0x69, {"ADC", &Emu6502::op_adc, IMMEDIATE, 2, 2, NOEC}},
+        {0x65, {"ADC", &Emu6502::op_adc, ZEROPAGE, 2, 3, NOEC}},
+        {0x75, {"ADC", &Emu6502::op_adc, ZEROPAGE_X, 2, 4, NOEC}},
+        {0x6d, {"ADC", &Emu6502::op_adc, ABSOLUTE, 3, 4, NOEC}},
+        {0x7d, {"ADC", &Emu6502::op_adc, ABSOLUTE_X, 3, 4, YESEC}},
+        {0x79, {"ADC", &Emu6502::op_adc, ABSOLUTE_Y, 3, 4, YESEC}},
+        {0x61, {"ADC", &Emu6502::op_adc, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
+        {0x71, {"ADC", &Emu6502::op_adc, POST_INDEX_INDIRECT, 2, 5, YESEC}},
     
         // SBC (Subtract with Carry)
-        {0xe9, {&Emu6502::op_sbc, IMMEDIATE, 2, 2, NOEC}},
-        {0xe5, {&Emu6502::op_sbc, ZEROPAGE, 2, 3, NOEC}},
-        {0xf5, {&Emu6502::op_sbc, ZEROPAGE_X, 2, 4, NOEC}},
-        {0xed, {&Emu6502::op_sbc, ABSOLUTE, 3, 4, NOEC}},
-        {0xfd, {&Emu6502::op_sbc, ABSOLUTE_X, 3, 4, YESEC}},
-        {0xf9, {&Emu6502::op_sbc, ABSOLUTE_Y, 3, 4, YESEC}},
-        {0xe1, {&Emu6502::op_sbc, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
-        {0xf1, {&Emu6502::op_sbc, POST_INDEX_INDIRECT, 2, 5, YESEC}},
+        {0xe9, {"SBC", &Emu6502::op_sbc, IMMEDIATE, 2, 2, NOEC}},
+        {0xe5, {"SBC", &Emu6502::op_sbc, ZEROPAGE, 2, 3, NOEC}},
+        {0xf5, {"SBC", &Emu6502::op_sbc, ZEROPAGE_X, 2, 4, NOEC}},
+        {0xed, {"SBC", &Emu6502::op_sbc, ABSOLUTE, 3, 4, NOEC}},
+        {0xfd, {"SBC", &Emu6502::op_sbc, ABSOLUTE_X, 3, 4, YESEC}},
+        {0xf9, {"SBC", &Emu6502::op_sbc, ABSOLUTE_Y, 3, 4, YESEC}},
+        {0xe1, {"SBC", &Emu6502::op_sbc, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
+        {0xf1, {"SBC", &Emu6502::op_sbc, POST_INDEX_INDIRECT, 2, 5, YESEC}},
     
         // AND (Logical AND)
-        {0x29, {&Emu6502::op_and, IMMEDIATE, 2, 2, NOEC}},
-        {0x25, {&Emu6502::op_and, ZEROPAGE, 2, 3, NOEC}},
-        {0x35, {&Emu6502::op_and, ZEROPAGE_X, 2, 4, NOEC}},
-        {0x2d, {&Emu6502::op_and, ABSOLUTE, 3, 4, NOEC}},
-        {0x3d, {&Emu6502::op_and, ABSOLUTE_X, 3, 4, YESEC}},
-        {0x39, {&Emu6502::op_and, ABSOLUTE_Y, 3, 4, YESEC}},
-        {0x21, {&Emu6502::op_and, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
-        {0x31, {&Emu6502::op_and, POST_INDEX_INDIRECT, 2, 5, YESEC}},
+        {0x29, {"AND", &Emu6502::op_and, IMMEDIATE, 2, 2, NOEC}},
+        {0x25, {"AND", &Emu6502::op_and, ZEROPAGE, 2, 3, NOEC}},
+        {0x35, {"AND", &Emu6502::op_and, ZEROPAGE_X, 2, 4, NOEC}},
+        {0x2d, {"AND", &Emu6502::op_and, ABSOLUTE, 3, 4, NOEC}},
+        {0x3d, {"AND", &Emu6502::op_and, ABSOLUTE_X, 3, 4, YESEC}},
+        {0x39, {"AND", &Emu6502::op_and, ABSOLUTE_Y, 3, 4, YESEC}},
+        {0x21, {"AND", &Emu6502::op_and, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
+        {0x31, {"AND", &Emu6502::op_and, POST_INDEX_INDIRECT, 2, 5, YESEC}},
     
         // ORA (Logical OR)
-        {0x09, {&Emu6502::op_ora, IMMEDIATE, 2, 2, NOEC}},
-        {0x05, {&Emu6502::op_ora, ZEROPAGE, 2, 3, NOEC}},
-        {0x15, {&Emu6502::op_ora, ZEROPAGE_X, 2, 4, NOEC}},
-        {0x0d, {&Emu6502::op_ora, ABSOLUTE, 3, 4, NOEC}},
-        {0x1d, {&Emu6502::op_ora, ABSOLUTE_X, 3, 4, YESEC}},
-        {0x19, {&Emu6502::op_ora, ABSOLUTE_Y, 3, 4, YESEC}},
-        {0x01, {&Emu6502::op_ora, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
-        {0x11, {&Emu6502::op_ora, POST_INDEX_INDIRECT, 2, 5, YESEC}},
+        {0x09, {"ORA", &Emu6502::op_ora, IMMEDIATE, 2, 2, NOEC}},
+        {0x05, {"ORA", &Emu6502::op_ora, ZEROPAGE, 2, 3, NOEC}},
+        {0x15, {"ORA", &Emu6502::op_ora, ZEROPAGE_X, 2, 4, NOEC}},
+        {0x0d, {"ORA", &Emu6502::op_ora, ABSOLUTE, 3, 4, NOEC}},
+        {0x1d, {"ORA", &Emu6502::op_ora, ABSOLUTE_X, 3, 4, YESEC}},
+        {0x19, {"ORA", &Emu6502::op_ora, ABSOLUTE_Y, 3, 4, YESEC}},
+        {0x01, {"ORA", &Emu6502::op_ora, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
+        {0x11, {"ORA", &Emu6502::op_ora, POST_INDEX_INDIRECT, 2, 5, YESEC}},
     
         // EOR (Logical Exclusive OR)
-        {0x49, {&Emu6502::op_eor, IMMEDIATE, 2, 2, NOEC}},
-        {0x45, {&Emu6502::op_eor, ZEROPAGE, 2, 3, NOEC}},
-        {0x55, {&Emu6502::op_eor, ZEROPAGE_X, 2, 4, NOEC}},
-        {0x4d, {&Emu6502::op_eor, ABSOLUTE, 3, 4, NOEC}},
-        {0x5d, {&Emu6502::op_eor, ABSOLUTE_X, 3, 4, YESEC}},
-        {0x59, {&Emu6502::op_eor, ABSOLUTE_Y, 3, 4, YESEC}},
-        {0x41, {&Emu6502::op_eor, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
-        {0x51, {&Emu6502::op_eor, POST_INDEX_INDIRECT, 2, 5, YESEC}},
+        {0x49, {"EOR", &Emu6502::op_eor, IMMEDIATE, 2, 2, NOEC}},
+        {0x45, {"EOR", &Emu6502::op_eor, ZEROPAGE, 2, 3, NOEC}},
+        {0x55, {"EOR", &Emu6502::op_eor, ZEROPAGE_X, 2, 4, NOEC}},
+        {0x4d, {"EOR", &Emu6502::op_eor, ABSOLUTE, 3, 4, NOEC}},
+        {0x5d, {"EOR", &Emu6502::op_eor, ABSOLUTE_X, 3, 4, YESEC}},
+        {0x59, {"EOR", &Emu6502::op_eor, ABSOLUTE_Y, 3, 4, YESEC}},
+        {0x41, {"EOR", &Emu6502::op_eor, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
+        {0x51, {"EOR", &Emu6502::op_eor, POST_INDEX_INDIRECT, 2, 5, YESEC}},
     
         // CLEAR STATUS
-        {0x18, {&Emu6502::op_clc, IMPLICIT, 1, 2, NOEC}}, // CLC
-        {0xd8, {&Emu6502::op_cld, IMPLICIT, 1, 2, NOEC}}, // CLD
-        {0x58, {&Emu6502::op_cli, IMPLICIT, 1, 2, NOEC}}, // CLI
-        {0xb8, {&Emu6502::op_clv, IMPLICIT, 1, 2, NOEC}}, // CLV
+        {0x18, {"CLC", &Emu6502::op_clc, IMPLICIT, 1, 2, NOEC}}, // CLC
+        {0xd8, {"CLD", &Emu6502::op_cld, IMPLICIT, 1, 2, NOEC}}, // CLD
+        {0x58, {"CLI", &Emu6502::op_cli, IMPLICIT, 1, 2, NOEC}}, // CLI
+        {0xb8, {"CLV", &Emu6502::op_clv, IMPLICIT, 1, 2, NOEC}}, // CLV
     
         // SET STATUS
-        {0x38, {&Emu6502::op_sec, IMPLICIT, 1, 2, NOEC}}, // SEC
-        {0xf8, {&Emu6502::op_sed, IMPLICIT, 1, 2, NOEC}}, // SED
-        {0x78, {&Emu6502::op_sei, IMPLICIT, 1, 2, NOEC}}, // SEI
+        {0x38, {"SEC", &Emu6502::op_sec, IMPLICIT, 1, 2, NOEC}}, // SEC
+        {0xf8, {"SED", &Emu6502::op_sed, IMPLICIT, 1, 2, NOEC}}, // SED
+        {0x78, {"SEI", &Emu6502::op_sei, IMPLICIT, 1, 2, NOEC}}, // SEI
     
         // BIT SHIFT
         // LSR
-        {0x4a, {&Emu6502::op_lsr_acc, ACCUMULATOR, 1, 2, NOEC}},
-        {0x46, {&Emu6502::op_lsr_mem, ZEROPAGE, 2, 5, NOEC}},
-        {0x56, {&Emu6502::op_lsr_mem, ZEROPAGE_X, 2, 6, NOEC}},
-        {0x4e, {&Emu6502::op_lsr_mem, ABSOLUTE, 3, 6, NOEC}},
-        {0x5e, {&Emu6502::op_lsr_mem, ABSOLUTE_X, 3, 7, NOEC}},
+        {0x4a, {"LSR", &Emu6502::op_lsr_acc, ACCUMULATOR, 1, 2, NOEC}},
+        {0x46, {"LSR", &Emu6502::op_lsr_mem, ZEROPAGE, 2, 5, NOEC}},
+        {0x56, {"LSR", &Emu6502::op_lsr_mem, ZEROPAGE_X, 2, 6, NOEC}},
+        {0x4e, {"LSR", &Emu6502::op_lsr_mem, ABSOLUTE, 3, 6, NOEC}},
+        {0x5e, {"LSR", &Emu6502::op_lsr_mem, ABSOLUTE_X, 3, 7, NOEC}},
     
         // ASL
-        {0x0a, {&Emu6502::op_asl_acc, ACCUMULATOR, 1, 2, NOEC}},
-        {0x06, {&Emu6502::op_asl_mem, ZEROPAGE, 2, 5, NOEC}},
-        {0x16, {&Emu6502::op_asl_mem, ZEROPAGE_X, 2, 6, NOEC}},
-        {0x0e, {&Emu6502::op_asl_mem, ABSOLUTE, 3, 6, NOEC}},
-        {0x1e, {&Emu6502::op_asl_mem, ABSOLUTE_X, 3, 7, NOEC}},
+        {0x0a, {"ASL", &Emu6502::op_asl_acc, ACCUMULATOR, 1, 2, NOEC}},
+        {0x06, {"ASL", &Emu6502::op_asl_mem, ZEROPAGE, 2, 5, NOEC}},
+        {0x16, {"ASL", &Emu6502::op_asl_mem, ZEROPAGE_X, 2, 6, NOEC}},
+        {0x0e, {"ASL", &Emu6502::op_asl_mem, ABSOLUTE, 3, 6, NOEC}},
+        {0x1e, {"ASL", &Emu6502::op_asl_mem, ABSOLUTE_X, 3, 7, NOEC}},
     
         // ROL
-        {0x2a, {&Emu6502::op_rol_acc, ACCUMULATOR, 1, 2, NOEC}},
-        {0x26, {&Emu6502::op_rol_mem, ZEROPAGE, 2, 5, NOEC}},
-        {0x36, {&Emu6502::op_rol_mem, ZEROPAGE_X, 2, 6, NOEC}},
-        {0x2e, {&Emu6502::op_rol_mem, ABSOLUTE, 3, 6, NOEC}},
-        {0x3e, {&Emu6502::op_rol_mem, ABSOLUTE_X, 3, 7, NOEC}},
+        {0x2a, {"ROL", &Emu6502::op_rol_acc, ACCUMULATOR, 1, 2, NOEC}},
+        {0x26, {"ROL", &Emu6502::op_rol_mem, ZEROPAGE, 2, 5, NOEC}},
+        {0x36, {"ROL", &Emu6502::op_rol_mem, ZEROPAGE_X, 2, 6, NOEC}},
+        {0x2e, {"ROL", &Emu6502::op_rol_mem, ABSOLUTE, 3, 6, NOEC}},
+        {0x3e, {"ROL", &Emu6502::op_rol_mem, ABSOLUTE_X, 3, 7, NOEC}},
     
         // ROR
-        {0x6a, {&Emu6502::op_ror_acc, ACCUMULATOR, 1, 2, NOEC}},
-        {0x66, {&Emu6502::op_ror_mem, ZEROPAGE, 2, 5, NOEC}},
-        {0x76, {&Emu6502::op_ror_mem, ZEROPAGE_X, 2, 6, NOEC}},
-        {0x6e, {&Emu6502::op_ror_mem, ABSOLUTE, 3, 6, NOEC}},
-        {0x7e, {&Emu6502::op_ror_mem, ABSOLUTE_X, 3, 7, NOEC}},
+        {0x6a, {"ROR", &Emu6502::op_ror_acc, ACCUMULATOR, 1, 2, NOEC}},
+        {0x66, {"ROR", &Emu6502::op_ror_mem, ZEROPAGE, 2, 5, NOEC}},
+        {0x76, {"ROR", &Emu6502::op_ror_mem, ZEROPAGE_X, 2, 6, NOEC}},
+        {0x6e, {"ROR", &Emu6502::op_ror_mem, ABSOLUTE, 3, 6, NOEC}},
+        {0x7e, {"ROR", &Emu6502::op_ror_mem, ABSOLUTE_X, 3, 7, NOEC}},
     
         // LOADS
         // LDA
-        {0xa9, {&Emu6502::op_lda, IMMEDIATE, 2, 2, NOEC}},
-        {0xa5, {&Emu6502::op_lda, ZEROPAGE, 2, 3, NOEC}},
-        {0xb5, {&Emu6502::op_lda, ZEROPAGE_X, 2, 4, NOEC}},
-        {0xad, {&Emu6502::op_lda, ABSOLUTE, 3, 4, NOEC}},
-        {0xbd, {&Emu6502::op_lda, ABSOLUTE_X, 3, 4, YESEC}},
-        {0xb9, {&Emu6502::op_lda, ABSOLUTE_Y, 3, 4, YESEC}},
-        {0xa1, {&Emu6502::op_lda, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
-        {0xb1, {&Emu6502::op_lda, POST_INDEX_INDIRECT, 2, 5, YESEC}},
+        {0xa9, {"LDA", &Emu6502::op_lda, IMMEDIATE, 2, 2, NOEC}},
+        {0xa5, {"LDA", &Emu6502::op_lda, ZEROPAGE, 2, 3, NOEC}},
+        {0xb5, {"LDA", &Emu6502::op_lda, ZEROPAGE_X, 2, 4, NOEC}},
+        {0xad, {"LDA", &Emu6502::op_lda, ABSOLUTE, 3, 4, NOEC}},
+        {0xbd, {"LDA", &Emu6502::op_lda, ABSOLUTE_X, 3, 4, YESEC}},
+        {0xb9, {"LDA", &Emu6502::op_lda, ABSOLUTE_Y, 3, 4, YESEC}},
+        {0xa1, {"LDA", &Emu6502::op_lda, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
+        {0xb1, {"LDA", &Emu6502::op_lda, POST_INDEX_INDIRECT, 2, 5, YESEC}},
     
         // LDX
-        {0xa2, {&Emu6502::op_ldx, IMMEDIATE, 2, 2, NOEC}},
-        {0xa6, {&Emu6502::op_ldx, ZEROPAGE, 2, 3, NOEC}},
-        {0xb6, {&Emu6502::op_ldx, ZEROPAGE_Y, 2, 4, NOEC}},
-        {0xae, {&Emu6502::op_ldx, ABSOLUTE, 3, 4, NOEC}},
-        {0xbe, {&Emu6502::op_ldx, ABSOLUTE_Y, 3, 4, YESEC}},
+        {0xa2, {"LDX", &Emu6502::op_ldx, IMMEDIATE, 2, 2, NOEC}},
+        {0xa6, {"LDX", &Emu6502::op_ldx, ZEROPAGE, 2, 3, NOEC}},
+        {0xb6, {"LDX", &Emu6502::op_ldx, ZEROPAGE_Y, 2, 4, NOEC}},
+        {0xae, {"LDX", &Emu6502::op_ldx, ABSOLUTE, 3, 4, NOEC}},
+        {0xbe, {"LDX", &Emu6502::op_ldx, ABSOLUTE_Y, 3, 4, YESEC}},
     
         // LDY
-        {0xa0, {&Emu6502::op_ldy, IMMEDIATE, 2, 2, NOEC}},
-        {0xa4, {&Emu6502::op_ldy, ZEROPAGE, 2, 3, NOEC}},
-        {0xb4, {&Emu6502::op_ldy, ZEROPAGE_X, 2, 4, NOEC}},
-        {0xac, {&Emu6502::op_ldy, ABSOLUTE, 3, 4, NOEC}},
-        {0xbc, {&Emu6502::op_ldy, ABSOLUTE_X, 3, 4, YESEC}},
+        {0xa0, {"LDY", &Emu6502::op_ldy, IMMEDIATE, 2, 2, NOEC}},
+        {0xa4, {"LDY", &Emu6502::op_ldy, ZEROPAGE, 2, 3, NOEC}},
+        {0xb4, {"LDY", &Emu6502::op_ldy, ZEROPAGE_X, 2, 4, NOEC}},
+        {0xac, {"LDY", &Emu6502::op_ldy, ABSOLUTE, 3, 4, NOEC}},
+        {0xbc, {"LDY", &Emu6502::op_ldy, ABSOLUTE_X, 3, 4, YESEC}},
     
         // STORE
         // STA
-        {0x85, {&Emu6502::op_sta, ZEROPAGE, 2, 3, NOEC}},
-        {0x95, {&Emu6502::op_sta, ZEROPAGE_X, 2, 4, NOEC}},
-        {0x8d, {&Emu6502::op_sta, ABSOLUTE, 3, 4, NOEC}},
-        {0x9d, {&Emu6502::op_sta, ABSOLUTE_X, 3, 5, NOEC}},
-        {0x99, {&Emu6502::op_sta, ABSOLUTE_Y, 3, 5, NOEC}},
-        {0x81, {&Emu6502::op_sta, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
-        {0x91, {&Emu6502::op_sta, POST_INDEX_INDIRECT, 2, 6, NOEC}},
+        {0x85, {"STA", &Emu6502::op_sta, ZEROPAGE, 2, 3, NOEC}},
+        {0x95, {"STA", &Emu6502::op_sta, ZEROPAGE_X, 2, 4, NOEC}},
+        {0x8d, {"STA", &Emu6502::op_sta, ABSOLUTE, 3, 4, NOEC}},
+        {0x9d, {"STA", &Emu6502::op_sta, ABSOLUTE_X, 3, 5, NOEC}},
+        {0x99, {"STA", &Emu6502::op_sta, ABSOLUTE_Y, 3, 5, NOEC}},
+        {0x81, {"STA", &Emu6502::op_sta, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
+        {0x91, {"STA", &Emu6502::op_sta, POST_INDEX_INDIRECT, 2, 6, NOEC}},
     
         // STX
-        {0x86, {&Emu6502::op_stx, ZEROPAGE, 2, 3, NOEC}},
-        {0x96, {&Emu6502::op_stx, ZEROPAGE_Y, 2, 4, NOEC}},
-        {0x8e, {&Emu6502::op_stx, ABSOLUTE, 3, 4, NOEC}},
+        {0x86, {"STX", &Emu6502::op_stx, ZEROPAGE, 2, 3, NOEC}},
+        {0x96, {"STX", &Emu6502::op_stx, ZEROPAGE_Y, 2, 4, NOEC}},
+        {0x8e, {"STX", &Emu6502::op_stx, ABSOLUTE, 3, 4, NOEC}},
     
         // STY
-        {0x84, {&Emu6502::op_sty, ZEROPAGE, 2, 3, NOEC}},
-        {0x94, {&Emu6502::op_sty, ZEROPAGE_X, 2, 4, NOEC}},
-        {0x8c, {&Emu6502::op_sty, ABSOLUTE, 3, 4, NOEC}},
+        {0x84, {"STY", &Emu6502::op_sty, ZEROPAGE, 2, 3, NOEC}},
+        {0x94, {"STY", &Emu6502::op_sty, ZEROPAGE_X, 2, 4, NOEC}},
+        {0x8c, {"STY", &Emu6502::op_sty, ABSOLUTE, 3, 4, NOEC}},
     
         // TRANSFER
-        {0xaa, {&Emu6502::op_tax, IMPLICIT, 1, 2, NOEC}}, // TAX
-        {0xa8, {&Emu6502::op_tay, IMPLICIT, 1, 2, NOEC}}, // TAY
-        {0xba, {&Emu6502::op_tsx, IMPLICIT, 1, 2, NOEC}}, // TSX
-        {0x8a, {&Emu6502::op_txa, IMPLICIT, 1, 2, NOEC}}, // TXA
-        {0x9a, {&Emu6502::op_txs, IMPLICIT, 1, 2, NOEC}}, // TXS
-        {0x98, {&Emu6502::op_tya, IMPLICIT, 1, 2, NOEC}}, // TYA
+        {0xaa, {"TAX", &Emu6502::op_tax, IMPLICIT, 1, 2, NOEC}}, // TAX
+        {0xa8, {"TAY", &Emu6502::op_tay, IMPLICIT, 1, 2, NOEC}}, // TAY
+        {0xba, {"TSX", &Emu6502::op_tsx, IMPLICIT, 1, 2, NOEC}}, // TSX
+        {0x8a, {"TXA", &Emu6502::op_txa, IMPLICIT, 1, 2, NOEC}}, // TXA
+        {0x9a, {"TXS", &Emu6502::op_txs, IMPLICIT, 1, 2, NOEC}}, // TXS
+        {0x98, {"TYA", &Emu6502::op_tya, IMPLICIT, 1, 2, NOEC}}, // TYA
     
         // COMPARE
-        {0xc9, {&Emu6502::op_cpa, IMMEDIATE, 2, 2, NOEC}},
-        {0xc5, {&Emu6502::op_cpa, ZEROPAGE, 2, 3, NOEC}},
-        {0xd5, {&Emu6502::op_cpa, ZEROPAGE_X, 2, 4, NOEC}},
-        {0xcd, {&Emu6502::op_cpa, ABSOLUTE, 3, 4, NOEC}},
-        {0xdd, {&Emu6502::op_cpa, ABSOLUTE_X, 3, 4, YESEC}},
-        {0xd9, {&Emu6502::op_cpa, ABSOLUTE_Y, 3, 4, YESEC}},
-        {0xc1, {&Emu6502::op_cpa, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
-        {0xd1, {&Emu6502::op_cpa, POST_INDEX_INDIRECT, 2, 5, YESEC}},
-    
-        {0xe0, {&Emu6502::op_cpx, IMMEDIATE, 2, 2, NOEC}},
-        {0xe4, {&Emu6502::op_cpx, ZEROPAGE, 2, 3, NOEC}},
-        {0xec, {&Emu6502::op_cpx, ABSOLUTE, 3, 4, NOEC}},
-    
-        {0xc0, {&Emu6502::op_cpy, IMMEDIATE, 2, 2, NOEC}},
-        {0xc4, {&Emu6502::op_cpy, ZEROPAGE, 2, 3, NOEC}},
-        {0xcc, {&Emu6502::op_cpy, ABSOLUTE, 3, 4, NOEC}},
+        {0xc9, {"CMP", &Emu6502::op_cpa, IMMEDIATE, 2, 2, NOEC}},
+        {0xc5, {"CMP", &Emu6502::op_cpa, ZEROPAGE, 2, 3, NOEC}},
+        {0xd5, {"CMP", &Emu6502::op_cpa, ZEROPAGE_X, 2, 4, NOEC}},
+        {0xcd, {"CMP", &Emu6502::op_cpa, ABSOLUTE, 3, 4, NOEC}},
+        {0xdd, {"CMP", &Emu6502::op_cpa, ABSOLUTE_X, 3, 4, YESEC}},
+        {0xd9, {"CMP", &Emu6502::op_cpa, ABSOLUTE_Y, 3, 4, YESEC}},
+        {0xc1, {"CMP", &Emu6502::op_cpa, PRE_INDEX_INDIRECT, 2, 6, NOEC}},
+        {0xd1, {"CMP", &Emu6502::op_cpa, POST_INDEX_INDIRECT, 2, 5, YESEC}},
+    
+        {0xe0, {"CPX", &Emu6502::op_cpx, IMMEDIATE, 2, 2, NOEC}},
+        {0xe4, {"CPX", &Emu6502::op_cpx, ZEROPAGE, 2, 3, NOEC}},
+        {0xec, {"CPX", &Emu6502::op_cpx, ABSOLUTE, 3, 4, NOEC}},
+    
+        {0xc0, {"CPY", &Emu6502::op_cpy, IMMEDIATE, 2, 2, NOEC}},
+        {0xc4, {"CPY", &Emu6502::op_cpy, ZEROPAGE, 2, 3, NOEC}},
+        {0xcc, {"CPY", &Emu6502::op_cpy, ABSOLUTE, 3, 4, NOEC}},
     
         // STACK PUSH/PULL
-        {0x48, {&Emu6502::op_pha, IMPLICIT, 1, 3, NOEC}}, // PHA
-        {0x68, {&Emu6502::op_pla, IMPLICIT, 1, 4, NOEC}}, // PLA
-        {0x08, {&Emu6502::op_php, IMPLICIT, 1, 3, NOEC}}, // PHP
-        {0x28, {&Emu6502::op_plp, IMPLICIT, 1, 4, NOEC}}, // PLP
+        {0x48, {"PHA", &Emu6502::op_pha, IMPLICIT, 1, 3, NOEC}}, // PHA
+        {0x68, {"PLA", &Emu6502::op_pla, IMPLICIT, 1, 4, NOEC}}, // PLA
+        {0x08, {"PHP", &Emu6502::op_php, IMPLICIT, 1, 3, NOEC}}, // PHP
+        {0x28, {"PLP", &Emu6502::op_plp, IMPLICIT, 1, 4, NOEC}}, // PLP
     
         // INCREASE / DECREASE
-        {0xca, {&Emu6502::op_dex, IMPLICIT, 1, 2, NOEC}}, // DEX
-        {0x88, {&Emu6502::op_dey, IMPLICIT, 1, 2, NOEC}}, // DEY
+        {0xca, {"DEX", &Emu6502::op_dex, IMPLICIT, 1, 2, NOEC}}, // DEX
+        {0x88, {"DEY", &Emu6502::op_dey, IMPLICIT, 1, 2, NOEC}}, // DEY
     
-        {0xe8, {&Emu6502::op_inx, IMPLICIT, 1, 2, NOEC}}, // INX
-        {0xc8, {&Emu6502::op_iny, IMPLICIT, 1, 2, NOEC}}, // INY
+        {0xe8, {"INX", &Emu6502::op_inx, IMPLICIT, 1, 2, NOEC}}, // INX
+        {0xc8, {"INY", &Emu6502::op_iny, IMPLICIT, 1, 2, NOEC}}, // INY
     
-        {0xc6, {&Emu6502::op_dec, ZEROPAGE, 2, 5, NOEC}}, // DEC
-        {0xd6, {&Emu6502::op_dec, ZEROPAGE_X, 2, 6, NOEC}}, // DEC
-        {0xce, {&Emu6502::op_dec, ABSOLUTE, 3, 6, NOEC}}, // DEC
-        {0xde, {&Emu6502::op_dec, ABSOLUTE_X, 3, 7, NOEC}}, // DEC
+        {0xc6, {"DEC", &Emu6502::op_dec, ZEROPAGE, 2, 5, NOEC}}, // DEC
+        {0xd6, {"DEC", &Emu6502::op_dec, ZEROPAGE_X, 2, 6, NOEC}}, // DEC
+        {0xce, {"DEC", &Emu6502::op_dec, ABSOLUTE, 3, 6, NOEC}}, // DEC
+        {0xde, {"DEC", &Emu6502::op_dec, ABSOLUTE_X, 3, 7, NOEC}}, // DEC
     
-        {0xe6, {&Emu6502::op_inc, ZEROPAGE, 2, 5, NOEC}}, // INC
-        {0xf6, {&Emu6502::op_inc, ZEROPAGE_X, 2, 6, NOEC}}, // INC
-        {0xee, {&Emu6502::op_inc, ABSOLUTE, 3, 6, NOEC}}, // INC
-        {0xfe, {&Emu6502::op_inc, ABSOLUTE_X, 3, 7, NOEC}}, // INC
+        {0xe6, {"INC", &Emu6502::op_inc, ZEROPAGE, 2, 5, NOEC}}, // INC
+        {0xf6, {"INC", &Emu6502::op_inc, ZEROPAGE_X, 2, 6, NOEC}}, // INC
+        {0xee, {"INC", &Emu6502::op_inc, ABSOLUTE, 3, 6, NOEC}}, // INC
+        {0xfe, {"INC", &Emu6502::op_inc, ABSOLUTE_X, 3, 7, NOEC}}, // INC
     
         // BRANCH
-        {0xd0, {&Emu6502::op_bne, IMPLICIT, 2, 2, BRANCHEC}}, // BNE
-        {0xf0, {&Emu6502::op_beq, IMPLICIT, 2, 2, BRANCHEC}}, // BEQ
-        {0x90, {&Emu6502::op_bcc, IMPLICIT, 2, 2, BRANCHEC}}, // BCC
-        {0xb0, {&Emu6502::op_bcs, IMPLICIT, 2, 2, BRANCHEC}}, // BCS
-        {0x30, {&Emu6502::op_bmi, IMPLICIT, 2, 2, BRANCHEC}}, // BMI
-        {0x10, {&Emu6502::op_bpl, IMPLICIT, 2, 2, BRANCHEC}}, // BPL
-        {0x50, {&Emu6502::op_bvc, IMPLICIT, 2, 2, BRANCHEC}}, // BVC
-        {0x70, {&Emu6502::op_bvs, IMPLICIT, 2, 2, BRANCHEC}}, // BVS
+        {0xd0, {"BNE", &Emu6502::op_bne, IMPLICIT, 2, 2, BRANCHEC}}, // BNE
+        {0xf0, {"BEQ", &Emu6502::op_beq, IMPLICIT, 2, 2, BRANCHEC}}, // BEQ
+        {0x90, {"BCC", &Emu6502::op_bcc, IMPLICIT, 2, 2, BRANCHEC}}, // BCC
+        {0xb0, {"BCS", &Emu6502::op_bcs, IMPLICIT, 2, 2, BRANCHEC}}, // BCS
+        {0x30, {"BMI", &Emu6502::op_bmi, IMPLICIT, 2, 2, BRANCHEC}}, // BMI
+        {0x10, {"BPL", &Emu6502::op_bpl, IMPLICIT, 2, 2, BRANCHEC}}, // BPL
+        {0x50, {"BVC", &Emu6502::op_bvc, IMPLICIT, 2, 2, BRANCHEC}}, // BVC
+        {0x70, {"BVS", &Emu6502::op_bvs, IMPLICIT, 2, 2, BRANCHEC}}, // BVS
     
         // JUMP
-        {0x4c, {&Emu6502::op_jmp, ABSOLUTE, 0, 3, NOEC}}, // JMP
-        {0x6c, {&Emu6502::op_jmp, INDIRECT, 0, 5, NOEC}}, // JMP
-        {0x20, {&Emu6502::op_jsr, ABSOLUTE, 0, 6, NOEC}}, // JSR
-        {0x60, {&Emu6502::op_rts, IMPLICIT, 0, 6, NOEC}}, // RTS
+        {0x4c, {"JMP", &Emu6502::op_jmp, ABSOLUTE, 0, 3, NOEC}}, // JMP
+        {0x6c, {"JMP", &Emu6502::op_jmp, INDIRECT, 0, 5, NOEC}}, // JMP
+        {0x20, {"JSR", &Emu6502::op_jsr, ABSOLUTE, 0, 6, NOEC}}, // JSR
+        {0x60, {"RTS", &Emu6502::op_rts, IMPLICIT, 0, 6, NOEC}}, // RTS
     };
 };
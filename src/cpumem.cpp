@@ -7,9 +7,12 @@ Memory map is a list of tuples
 (startaddr, device)
 From lowest startaddr to greatest
 
-TODO : investigate the extent of this interface being the source of inefficiency
+The map is resolved once into a table of 256 pages of 256 bytes.
+RAM and ROM pages are accessed through a direct pointer, the others call
+the device get/set. Pages shared by several devices fall back to the
+search in the memory map.
 */
-Memory::Memory(const std::vector<std::pair<uint16_t, Device *>>& memory_map) {
+Memory::Memory(const std::vector<std::pair<uint16_t, Device *>>& memory_map) : split_page_device(this) {
     for (const auto& pair : memory_map) {
         mmap.push_back(pair);
     }
@@ -17,23 +20,66 @@ Memory::Memory(const std::vector<std::pair<uint16_t, Device *>>& memory_map) {
     // search from the biggest addr and stop at the
     // first one lowest than the addr were looking for
     std::reverse(mmap.begin(), mmap.end());
+
+    for (int page_no = 0; page_no < 256; page_no++) {
+        reset_page_device(page_no);
+    }
 }
 
-uint8_t Memory::get(uint16_t index) {
+Device * Memory::find_device(uint16_t index) {
     for (auto& pair : mmap) {
         if (index >= pair.first) {
-            return pair.second->get(index);
+            return pair.second;
         }
     }
     throw std::runtime_error("Bad memory map");
 }
 
-void Memory::set(uint16_t index, uint8_t value) {
+Device * Memory::get_page_device(uint8_t page_no) {
+    return pages[page_no].device;
+}
+
+void Memory::set_page_device(uint8_t page_no, Device * device) {
+    pages[page_no] = {device, nullptr, nullptr};
+    page_generation[page_no]++;
+}
+
+void Memory::remap_page(uint8_t page_no) {
+    if (pages[page_no].device == find_device(static_cast<uint16_t>(page_no) << 8)) {
+        reset_page_device(page_no);
+    } else {
+        page_generation[page_no]++;
+    }
+}
+
+uint32_t Memory::get_page_generation(uint8_t page_no) {
+    return page_generation[page_no];
+}
+
+uint8_t Memory::peek(uint16_t index) {
+    const Page& page = pages[index >> 8];
+    if (page.read_ptr != nullptr) {
+        return page.read_ptr[index & 0xff];
+    }
+    return page.device->peek(index);
+}
+
+void Memory::reset_page_device(uint8_t page_no) {
+    uint16_t page_start = static_cast<uint16_t>(page_no) << 8;
+    uint16_t page_end = page_start + 0xff;
+    page_generation[page_no]++;
+
+    bool split = false;
     for (auto& pair : mmap) {
-        if (index >= pair.first) {
-            pair.second->set(index, value);
-            return;
+        if (pair.first > page_start && pair.first <= page_end) {
+            split = true;
         }
     }
-    throw std::runtime_error("Bad memory map");
+    if (split) {
+        pages[page_no] = {&split_page_device, nullptr, nullptr};
+        return;
+    }
+
+    Device * device = find_device(page_start);
+    pages[page_no] = {device, device->direct_ptr(page_start, false), device->direct_ptr(page_start, true)};
 }
@@ -9,9 +9,69 @@ class Memory {
  public:
     Memory(const std::vector<std::pair<uint16_t, Device*>>& memory_map);
 
-    uint8_t get(uint16_t index);
-    void set(uint16_t index, uint8_t value);
+    // hot path : one table lookup, then either a direct access
+    // to the device memory or a call to the page device
+    uint8_t get(uint16_t index) {
+        const Page& page = pages[index >> 8];
+        if (page.read_ptr != nullptr) {
+            return page.read_ptr[index & 0xff];
+        }
+        return page.device->get(index);
+    }
+
+    void set(uint16_t index, uint8_t value) {
+        const Page& page = pages[index >> 8];
+        if (page.write_ptr != nullptr) {
+            page.write_ptr[index & 0xff] = value;
+            return;
+        }
+        page.device->set(index, value);
+    }
+
+    /*
+    Page overlays (cheats, watchpoints, loggers...)
+    set_page_device redirects all the accesses of a single 256 bytes page
+    to device, the other pages keep their direct pointers.
+    An overlay usually wraps the device returned by get_page_device
+    and puts it back when removed.
+    */
+    Device * get_page_device(uint8_t page_no);
+    void set_page_device(uint8_t page_no, Device * device);
+    // back to the device of the memory map
+    void reset_page_device(uint8_t page_no);
+    // the memory map device changed the memory behind the page (bank switch)
+    // the overlays, which go through the device, are kept
+    void remap_page(uint8_t page_no);
+    // incremented each time the page is remapped (overlay, bank switch)
+    uint32_t get_page_generation(uint8_t page_no);
+
+    // read as the cpu would, without side effects (Device::peek) : the
+    // overlays forward it, the cheats show, the hooks and loggers don't see it
+    uint8_t peek(uint16_t index);
 
  private:
+    struct Page {
+        Device * device;
+        uint8_t * read_ptr;
+        uint8_t * write_ptr;
+    };
+
+    // serves the pages shared by several devices of the memory map
+    // (e.g. 0x4000-0x40ff : APU then PPU/controllers)
+    class SplitPageDevice : public Device {
+     public:
+        SplitPageDevice(Memory * mem) : m_mem(mem) {}
+        uint8_t get(uint16_t addr) { return m_mem->find_device(addr)->get(addr); }
+        uint8_t peek(uint16_t addr) { return m_mem->find_device(addr)->peek(addr); }
+        void set(uint16_t addr, uint8_t val) { m_mem->find_device(addr)->set(addr, val); }
+     private:
+        Memory * m_mem;
+    };
+
+    Device * find_device(uint16_t index);
+
     std::vector<std::pair<uint16_t, Device*>> mmap;
+    SplitPageDevice split_page_device;
+    Page pages[256];
+    uint32_t page_generation[256] = {0};
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <stdexcept>
 
 enum {
@@ -18,6 +19,16 @@ class Device {
 public:
     virtual uint8_t get(uint16_t addr) = 0;
     virtual void set(uint16_t addr, uint8_t val) = 0;
+    // get without side effects, for the debugger views. The devices whose
+    // reads change their state (registers) must override it
+    virtual uint8_t peek(uint16_t addr) {
+        return get(addr);
+    }
+    // pointer to the 256 bytes backing the page starting at page_addr,
+    // used by Memory to bypass get/set. nullptr if the device has side effects
+    virtual uint8_t * direct_ptr(uint16_t page_addr, bool write) {
+        return nullptr;
+    }
 };
 
 class CartridgeRomDevice : public Device {
@@ -39,15 +50,28 @@ class CartridgeRomDevice : public Device {
     void set(uint16_t addr, uint8_t val) {
         throw std::runtime_error("Rom don't support assignment");
     }
+
+    uint8_t * direct_ptr(uint16_t page_addr, bool write) {
+        // writes must go through set to raise
+        if (write) {
+            return nullptr;
+        }
+        return &mem[page_addr - m_base_addr];
+    }
 };
 
 
 class RamDevice : public Device {
  private:
-    uint8_t mem[0x8000];
+    // zeroed at power on, so that two consoles start identical (netplay)
+    uint8_t mem[0x8000] = {0};
     uint16_t m_base_addr;
 
  public:
+    struct State {
+        uint8_t mem[0x8000];
+    };
+
     RamDevice(uint16_t base_addr) : m_base_addr(base_addr) {
     }
 
@@ -58,4 +82,16 @@ class RamDevice : public Device {
     void set(uint16_t addr, uint8_t val) {
         mem[addr - m_base_addr] = val;
     }
+
+    uint8_t * direct_ptr(uint16_t page_addr, bool write) {
+        return &mem[page_addr - m_base_addr];
+    }
+
+    void get_state(State * state) {
+        std::memcpy(state->mem, mem, sizeof(mem));
+    }
+
+    void set_state(const State& state) {
+        std::memcpy(mem, state.mem, sizeof(mem));
+    }
 };
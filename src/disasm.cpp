@@ -0,0 +1,108 @@
+#include "disasm.hpp"
+#include "cpu.hpp"
+#include "utils.hpp"
+
+Disassembler::Disassembler(Memory * mem, const Emu6502 * cpu, const LstDebuggerAsm6 * lst)
+    : m_mem(mem), m_cpu(cpu), m_lst(lst) {
+}
+
+void Disassembler::invalidate() {
+    m_cache.clear();
+}
+
+std::string Disassembler::format_addr(uint16_t addr) {
+    if (m_lst != nullptr) {
+        std::string label = m_lst->getLabel(addr);
+        if (!label.empty()) {
+            return label;
+        }
+    }
+    return "$" + hexstr(addr);
+}
+
+bool Disassembler::is_valid(const Entry& entry, uint16_t addr) {
+    if (entry.generation != m_mem->get_page_generation(addr >> 8)) {
+        return false;
+    }
+    for (uint8_t i = 0; i < entry.length; i++) {
+        if (m_mem->peek(addr + i) != entry.bytes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const Disassembler::Entry& Disassembler::decode(uint16_t addr) {
+    auto it = m_cache.find(addr);
+    if (it != m_cache.end() && is_valid(it->second, addr)) {
+        return it->second;
+    }
+
+    Entry entry;
+    entry.generation = m_mem->get_page_generation(addr >> 8);
+    entry.bytes[0] = m_mem->peek(addr);
+
+    const Emu6502::Opcode * op = m_cpu->find_opcode(entry.bytes[0]);
+    if (op == nullptr) {
+        entry.length = 1;
+        entry.text = ".db $" + hexstr(entry.bytes[0]);
+        return m_cache[addr] = entry;
+    }
+
+    entry.length = m_cpu->op_length(*op);
+    for (uint8_t i = 1; i < entry.length; i++) {
+        entry.bytes[i] = m_mem->peek(addr + i);
+    }
+    uint8_t zp = entry.bytes[1];
+    uint16_t abs = entry.bytes[1] + (entry.bytes[2] << 8);
+
+    std::string operand = "";
+    if (op->extra_cycle_type == BRANCHEC) {
+        // relative to the next instruction
+        operand = format_addr(addr + 2 + static_cast<int8_t>(entry.bytes[1]));
+    } else {
+        switch (op->addr_mode) {
+        case IMMEDIATE:           operand = "#$" + hexstr(zp); break;
+        case ZEROPAGE:            operand = "$" + hexstr(zp); break;
+        case ZEROPAGE_X:          operand = "$" + hexstr(zp) + ",X"; break;
+        case ZEROPAGE_Y:          operand = "$" + hexstr(zp) + ",Y"; break;
+        case ABSOLUTE:            operand = format_addr(abs); break;
+        case ABSOLUTE_X:          operand = format_addr(abs) + ",X"; break;
+        case ABSOLUTE_Y:          operand = format_addr(abs) + ",Y"; break;
+        case INDIRECT:            operand = "(" + format_addr(abs) + ")"; break;
+        case PRE_INDEX_INDIRECT:  operand = "($" + hexstr(zp) + ",X)"; break;
+        case POST_INDEX_INDIRECT: operand = "($" + hexstr(zp) + "),Y"; break;
+        case ACCUMULATOR:         operand = "A"; break;
+        default:                  break;
+        }
+    }
+    entry.text = op->mnemonic;
+    if (!operand.empty()) {
+        entry.text += " " + operand;
+    }
+    return m_cache[addr] = entry;
+}
+
+const std::string& Disassembler::get_inst(uint16_t addr) {
+    return decode(addr).text;
+}
+
+uint8_t Disassembler::get_length(uint16_t addr) {
+    return decode(addr).length;
+}
+
+std::string Disassembler::get_line(uint16_t addr) {
+    const Entry& entry = decode(addr);
+    std::string line = "";
+    if (m_lst != nullptr) {
+        std::string label = m_lst->getLabel(addr);
+        if (!label.empty()) {
+            line += label + ":\n";
+        }
+    }
+    line += hexstr(addr) + "  ";
+    for (uint8_t i = 0; i < 3; i++) {
+        line += (i < entry.length) ? hexstr(entry.bytes[i]) + " " : "   ";
+    }
+    return line + " " + entry.text;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+
+#include "cpumem.hpp"
+#include "lstdebugger.hpp"
+
+class Emu6502;
+
+/*
+Disassembler driven by the opcode table of Emu6502.
+Decoded instructions are cached per address. An entry is reused as long as
+its memory page was not remapped (bank switch, overlay) and its bytes are
+unchanged (code in RAM), so the debugger and the traces can format the
+same instructions over and over without decoding them again.
+Labels are taken from the assembler listing when one is given.
+*/
+class Disassembler {
+ public:
+    Disassembler(Memory * mem, const Emu6502 * cpu, const LstDebuggerAsm6 * lst = nullptr);
+
+    // e.g. "LDA $0200,X" or "JSR InitPPU"
+    const std::string& get_inst(uint16_t addr);
+    // instruction size in bytes
+    uint8_t get_length(uint16_t addr);
+    // trace line : "c000  ad 00 02  LDA $0200", prefixed by the label if any
+    std::string get_line(uint16_t addr);
+
+    void invalidate();
+
+ private:
+    struct Entry {
+        uint32_t generation;
+        uint8_t bytes[3];
+        uint8_t length;
+        std::string text;
+    };
+
+    const Entry& decode(uint16_t addr);
+    bool is_valid(const Entry& entry, uint16_t addr);
+    std::string format_addr(uint16_t addr);
+
+    Memory * m_mem;
+    const Emu6502 * m_cpu;
+    const LstDebuggerAsm6 * m_lst;
+    std::unordered_map<uint16_t, Entry> m_cache;
+};
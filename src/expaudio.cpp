@@ -0,0 +1,373 @@
+#include <cmath>
+#include <algorithm>
+#include <immintrin.h>
+
+#include "expaudio.hpp"
+
+// output of each chip at full volume, relative to an APU pulse
+static const float VRC6_LEVEL = static_cast<float>(MAX_AMPLITUDE) / 15;
+static const float SUNSOFT5B_LEVEL = static_cast<float>(MAX_AMPLITUDE);
+static const float N163_LEVEL = static_cast<float>(MAX_AMPLITUDE) / 60;
+
+/*
+Advance a divider by some cycles, returns the number of times it expired
+The dividers are batched over the cycles of a whole sample : one division
+instead of a step per expiry.
+*/
+static int divider_advance(float * divider, float cycles, float period) {
+    *divider -= cycles;
+    if (*divider > 0) {
+        return 0;
+    }
+    int nsteps = static_cast<int>(-*divider / period) + 1;
+    *divider += nsteps * period;
+    return nsteps;
+}
+
+void Vrc6Audio::write(uint16_t addr, uint8_t val) {
+    vrc6Pulse * pulse = &m_state.pulse[addr < 0xa000 ? 0 : 1];
+    switch (addr) {
+    case KEY_VRC6_PULSE1_CONTROL:
+    case KEY_VRC6_PULSE2_CONTROL:
+        pulse->ignore_duty = (val & BIT7) != 0;
+        pulse->duty = (val >> 4) & 0b111;
+        pulse->volume = val & 0xf;
+        break;
+    case KEY_VRC6_PULSE1_PERIOD_LOW:
+    case KEY_VRC6_PULSE2_PERIOD_LOW:
+        pulse->period = (pulse->period & 0xf00) | val;
+        break;
+    case KEY_VRC6_PULSE1_PERIOD_HIGH:
+    case KEY_VRC6_PULSE2_PERIOD_HIGH:
+        pulse->period = (pulse->period & 0xff) | ((val & 0xf) << 8);
+        pulse->enable = (val & BIT7) != 0;
+        if (!pulse->enable) {
+            // the duty sequence restarts
+            pulse->step = 15;
+        }
+        break;
+    case KEY_VRC6_FREQ_CONTROL:
+        m_state.halt = (val & BIT0) != 0;
+        m_state.shift = (val & BIT2) ? 8 : (val & BIT1) ? 4 : 0;
+        break;
+    case KEY_VRC6_SAW_RATE:
+        m_state.saw.rate = val & 0x3f;
+        break;
+    case KEY_VRC6_SAW_PERIOD_LOW:
+        m_state.saw.period = (m_state.saw.period & 0xf00) | val;
+        break;
+    case KEY_VRC6_SAW_PERIOD_HIGH:
+        m_state.saw.period = (m_state.saw.period & 0xff) | ((val & 0xf) << 8);
+        m_state.saw.enable = (val & BIT7) != 0;
+        if (!m_state.saw.enable) {
+            m_state.saw.step = 0;
+            m_state.saw.accumulator = 0;
+        }
+        break;
+    }
+}
+
+float Vrc6Audio::pulse_period(const vrc6Pulse& pulse) const {
+    return (pulse.period >> m_state.shift) + 1;
+}
+
+float Vrc6Audio::saw_period() const {
+    return (m_state.saw.period >> m_state.shift) + 1;
+}
+
+void Vrc6Audio::render(float * mix, int nsamples, float cycles_per_sample) {
+    vrc6Saw * saw = &m_state.saw;
+    for (int i = 0; i < nsamples; i++) {
+        int level = 0;
+        for (int chan_no = 0; chan_no < 2; chan_no++) {
+            vrc6Pulse * pulse = &m_state.pulse[chan_no];
+            if (!pulse->enable) {
+                continue;
+            }
+            if (!m_state.halt) {
+                // the duty sequence counts down
+                int nsteps = divider_advance(&pulse->divider, cycles_per_sample, pulse_period(*pulse));
+                pulse->step = (pulse->step - nsteps) & 0xf;
+            }
+            if (pulse->ignore_duty || pulse->step <= pulse->duty) {
+                level += pulse->volume;
+            }
+        }
+        if (saw->enable) {
+            if (!m_state.halt) {
+                /*
+                The rate is added at every other clock, and the accumulator
+                is reset after 7 additions (14 clocks)
+                */
+                int nsteps = divider_advance(&saw->divider, cycles_per_sample, saw_period());
+                int step = saw->step + nsteps;
+                if (step >= 14) {
+                    step %= 14;
+                    saw->accumulator = saw->rate * (step / 2);
+                } else {
+                    saw->accumulator += saw->rate * (step / 2 - saw->step / 2);
+                }
+                saw->step = step;
+            }
+            level += saw->accumulator >> 3;
+        }
+        mix[i] += level * VRC6_LEVEL;
+    }
+}
+
+Sunsoft5bAudio::Sunsoft5bAudio() {
+    // 1.5 dB per level, 0 is silent
+    m_levels[0] = 0;
+    for (int level = 1; level < 32; level++) {
+        m_levels[level] = std::pow(10.0f, -(31 - level) * 1.5f / 20);
+    }
+    m_state.lfsr = 1;
+}
+
+void Sunsoft5bAudio::select(uint8_t val) {
+    m_state.reg_select = val & 0xf;
+}
+
+void Sunsoft5bAudio::write(uint8_t val) {
+    uint8_t reg = m_state.reg_select;
+    if (reg < AY_REG_NOISE_PERIOD) {
+        // tone periods, fine then coarse
+        ayTone * tone = &m_state.tone[reg / 2];
+        if (reg % 2 == 0) {
+            tone->period = (tone->period & 0xf00) | val;
+        } else {
+            tone->period = (tone->period & 0xff) | ((val & 0xf) << 8);
+        }
+        return;
+    }
+    switch (reg) {
+    case AY_REG_NOISE_PERIOD:
+        m_state.noise_period = val & 0x1f;
+        break;
+    case AY_REG_MIXER:
+        for (int chan_no = 0; chan_no < 3; chan_no++) {
+            m_state.tone[chan_no].tone_disable = (val >> chan_no) & 1;
+            m_state.tone[chan_no].noise_disable = (val >> (chan_no + 3)) & 1;
+        }
+        break;
+    case AY_REG_VOLUME_A:
+    case AY_REG_VOLUME_A + 1:
+    case AY_REG_VOLUME_A + 2: {
+        ayTone * tone = &m_state.tone[reg - AY_REG_VOLUME_A];
+        tone->volume = val & 0xf;
+        tone->use_envelope = (val & BIT4) != 0;
+        break;
+    }
+    case AY_REG_ENVELOPE_LOW:
+        m_state.envelope_period = (m_state.envelope_period & 0xff00) | val;
+        break;
+    case AY_REG_ENVELOPE_HIGH:
+        m_state.envelope_period = (m_state.envelope_period & 0xff) | (val << 8);
+        break;
+    case AY_REG_ENVELOPE_SHAPE:
+        m_state.envelope_shape = val & 0xf;
+        m_state.envelope_step = 0;
+        m_state.envelope_attack = (val & AY_ENVELOPE_ATTACK) != 0;
+        m_state.envelope_holding = false;
+        m_state.envelope_divider = 0;
+        break;
+    }
+}
+
+void Sunsoft5bAudio::envelope_tick() {
+    if (m_state.envelope_holding) {
+        return;
+    }
+    if (m_state.envelope_step < 31) {
+        m_state.envelope_step++;
+        return;
+    }
+    uint8_t shape = m_state.envelope_shape;
+    if ((shape & AY_ENVELOPE_CONTINUE) == 0) {
+        // back to silence
+        m_state.envelope_holding = true;
+        m_state.envelope_attack = false;
+    } else if (shape & AY_ENVELOPE_HOLD) {
+        m_state.envelope_holding = true;
+        if (shape & AY_ENVELOPE_ALTERNATE) {
+            m_state.envelope_attack = !m_state.envelope_attack;
+        }
+    } else {
+        if (shape & AY_ENVELOPE_ALTERNATE) {
+            m_state.envelope_attack = !m_state.envelope_attack;
+        }
+        m_state.envelope_step = 0;
+    }
+}
+
+uint8_t Sunsoft5bAudio::envelope_level() const {
+    return m_state.envelope_attack ? m_state.envelope_step : 31 - m_state.envelope_step;
+}
+
+void Sunsoft5bAudio::render(float * mix, int nsamples, float cycles_per_sample) {
+    /*
+    The tones toggle every 16 * period cycles, the noise shifts every
+    32 * period cycles and the envelope has 32 steps of 8 * period cycles
+    */
+    for (int i = 0; i < nsamples; i++) {
+        for (int chan_no = 0; chan_no < 3; chan_no++) {
+            ayTone * tone = &m_state.tone[chan_no];
+            float period = 16 * std::max<uint16_t>(tone->period, 1);
+            if (divider_advance(&tone->divider, cycles_per_sample, period) & 1) {
+                tone->output = !tone->output;
+            }
+        }
+        float noise_period = 32 * std::max<uint8_t>(m_state.noise_period, 1);
+        for (int n = divider_advance(&m_state.noise_divider, cycles_per_sample, noise_period); n > 0; n--) {
+            uint32_t bit = (m_state.lfsr ^ (m_state.lfsr >> 3)) & 1;
+            m_state.lfsr = (m_state.lfsr >> 1) | (bit << 16);
+        }
+        float envelope_period = 8 * std::max<uint16_t>(m_state.envelope_period, 1);
+        for (int n = divider_advance(&m_state.envelope_divider, cycles_per_sample, envelope_period); n > 0; n--) {
+            envelope_tick();
+        }
+
+        bool noise = m_state.lfsr & 1;
+        float out = 0;
+        for (int chan_no = 0; chan_no < 3; chan_no++) {
+            ayTone * tone = &m_state.tone[chan_no];
+            if ((tone->output || tone->tone_disable) && (noise || tone->noise_disable)) {
+                // the 4 bit volumes are the odd envelope levels
+                uint8_t level = tone->use_envelope ? envelope_level() : (tone->volume ? tone->volume * 2 + 1 : 0);
+                out += m_levels[level];
+            }
+        }
+        mix[i] += out * SUNSOFT5B_LEVEL;
+    }
+}
+
+Namco163Audio::Namco163Audio() {
+    m_state.enabled = true;
+}
+
+void Namco163Audio::set_address(uint8_t val) {
+    m_state.addr = val;
+}
+
+uint8_t Namco163Audio::read() {
+    uint8_t val = m_state.ram[m_state.addr & 0x7f];
+    if (m_state.addr & BIT7) {
+        m_state.addr = ((m_state.addr + 1) & 0x7f) | BIT7;
+    }
+    return val;
+}
+
+void Namco163Audio::write(uint8_t val) {
+    m_state.ram[m_state.addr & 0x7f] = val;
+    m_dirty = true;
+    if (m_state.addr & BIT7) {
+        m_state.addr = ((m_state.addr + 1) & 0x7f) | BIT7;
+    }
+}
+
+void Namco163Audio::set_enabled(bool enabled) {
+    m_state.enabled = enabled;
+}
+
+void Namco163Audio::load_lanes() {
+    /*
+    Channel registers, 8 bytes from 0x40 + 8 * lane :
+    freq low, phase low, freq mid, phase mid, freq high (bits 0-1) and
+    256 - length (bits 2-7), phase high, wave offset, volume (bits 0-3)
+    The N enabled channels are the last ones.
+    */
+    for (int addr = 0; addr < N163_RAM_SIZE; addr++) {
+        m_wave[2 * addr] = m_state.ram[addr] & 0xf;
+        m_wave[2 * addr + 1] = m_state.ram[addr] >> 4;
+    }
+    int first_lane = N163_MAX_CHANNELS - channel_count();
+    for (int lane = 0; lane < N163_MAX_CHANNELS; lane++) {
+        const uint8_t * regs = &m_state.ram[N163_CHANNEL_REGS + 8 * lane];
+        bool active = lane >= first_lane;
+        m_lanes.length[lane] = (256 - (regs[4] & 0xfc)) << 16;
+        m_lanes.phase[lane] = (regs[1] | (regs[3] << 8) | (regs[5] << 16)) % m_lanes.length[lane];
+        m_lanes.freq[lane] = active ? regs[0] | (regs[2] << 8) | ((regs[4] & 0b11) << 16) : 0;
+        m_lanes.offset[lane] = regs[6];
+        m_lanes.volume[lane] = active ? regs[7] & 0xf : 0;
+    }
+}
+
+void Namco163Audio::store_phases() {
+    // so that the CPU reads the running phases
+    int first_lane = N163_MAX_CHANNELS - channel_count();
+    for (int lane = first_lane; lane < N163_MAX_CHANNELS; lane++) {
+        uint8_t * regs = &m_state.ram[N163_CHANNEL_REGS + 8 * lane];
+        regs[1] = m_lanes.phase[lane] & 0xff;
+        regs[3] = (m_lanes.phase[lane] >> 8) & 0xff;
+        regs[5] = (m_lanes.phase[lane] >> 16) & 0xff;
+    }
+}
+
+/*
+One round : every lane steps its phase and outputs its sample
+The frequency is below 4 << 16, the shortest wave length, so a single
+subtraction wraps the phase.
+*/
+static int32_t n163_round(uint32_t * phase, const uint32_t * freq, const uint32_t * length, const int32_t * offset, const int32_t * volume, const int32_t * wave) {
+    int32_t out = 0;
+    for (int lane = 0; lane < N163_MAX_CHANNELS; lane++) {
+        uint32_t p = phase[lane] + freq[lane];
+        if (p >= length[lane]) {
+            p -= length[lane];
+        }
+        phase[lane] = p;
+        out += (wave[((p >> 16) + offset[lane]) & 0xff] - 8) * volume[lane];
+    }
+    return out;
+}
+
+__attribute__((target("avx2")))
+static int32_t n163_round_avx2(uint32_t * phase, const uint32_t * freq, const uint32_t * length, const int32_t * offset, const int32_t * volume, const int32_t * wave) {
+    // the phases stay below 1 << 24, the signed compare is safe
+    __m256i len = _mm256_loadu_si256((const __m256i *)length);
+    __m256i p = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)phase), _mm256_loadu_si256((const __m256i *)freq));
+    __m256i wrap = _mm256_andnot_si256(_mm256_cmpgt_epi32(len, p), len);
+    p = _mm256_sub_epi32(p, wrap);
+    _mm256_storeu_si256((__m256i *)phase, p);
+
+    __m256i index = _mm256_add_epi32(_mm256_srli_epi32(p, 16), _mm256_loadu_si256((const __m256i *)offset));
+    index = _mm256_and_si256(index, _mm256_set1_epi32(0xff));
+    __m256i sample = _mm256_sub_epi32(_mm256_i32gather_epi32(wave, index, 4), _mm256_set1_epi32(8));
+    __m256i out = _mm256_mullo_epi32(sample, _mm256_loadu_si256((const __m256i *)volume));
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(out), _mm256_extracti128_si256(out, 1));
+    sum = _mm_hadd_epi32(sum, sum);
+    sum = _mm_hadd_epi32(sum, sum);
+    return _mm_cvtsi128_si32(sum);
+}
+
+void Namco163Audio::render(float * mix, int nsamples, float cycles_per_sample) {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    auto round = has_avx2 ? n163_round_avx2 : n163_round;
+    if (m_dirty) {
+        load_lanes();
+        m_dirty = false;
+    }
+    if (!m_state.enabled) {
+        return;
+    }
+    int nchannels = channel_count();
+    float period = 15.0f * nchannels;
+    float scale = N163_LEVEL / nchannels;
+    for (int i = 0; i < nsamples; i++) {
+        for (int n = divider_advance(&m_state.divider, cycles_per_sample, period); n > 0; n--) {
+            m_output = round(m_lanes.phase, m_lanes.freq, m_lanes.length, m_lanes.offset, m_lanes.volume, m_wave);
+        }
+        mix[i] += m_output * scale;
+    }
+    store_phases();
+}
+
+void Namco163Audio::get_state(State * state) {
+    *state = m_state;
+}
+
+void Namco163Audio::set_state(const State& state) {
+    m_state = state;
+    m_dirty = true;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+
+#include "audio.hpp"
+#include "apu.hpp"
+
+/*
+Cartridge sound chips
+They only change on register writes, which the mappers make after syncing
+the APU : render() then synthesises a whole block with constant registers.
+The chip states are plain structs, saved with the mapper registers.
+*/
+
+enum {
+    KEY_VRC6_PULSE1_CONTROL = 0x9000,
+    KEY_VRC6_PULSE1_PERIOD_LOW = 0x9001,
+    KEY_VRC6_PULSE1_PERIOD_HIGH = 0x9002,
+    KEY_VRC6_FREQ_CONTROL = 0x9003,
+    KEY_VRC6_PULSE2_CONTROL = 0xa000,
+    KEY_VRC6_PULSE2_PERIOD_LOW = 0xa001,
+    KEY_VRC6_PULSE2_PERIOD_HIGH = 0xa002,
+    KEY_VRC6_SAW_RATE = 0xb000,
+    KEY_VRC6_SAW_PERIOD_LOW = 0xb001,
+    KEY_VRC6_SAW_PERIOD_HIGH = 0xb002,
+};
+
+// https://www.nesdev.org/wiki/VRC6_audio
+class Vrc6Audio : public ExpansionAudio {
+ public:
+    struct State {
+        vrc6Pulse pulse[2];
+        vrc6Saw saw;
+        bool halt;
+        uint8_t shift; // the period is divided by 16 or 256
+    };
+
+    void write(uint16_t addr, uint8_t val);
+    void render(float * mix, int nsamples, float cycles_per_sample);
+
+    void get_state(State * state) { *state = m_state; }
+    void set_state(const State& state) { m_state = state; }
+
+ private:
+    float pulse_period(const vrc6Pulse& pulse) const;
+    float saw_period() const;
+
+    State m_state = {};
+};
+
+enum {
+    AY_REG_NOISE_PERIOD = 6,
+    AY_REG_MIXER = 7,
+    AY_REG_VOLUME_A = 8,
+    AY_REG_ENVELOPE_LOW = 11,
+    AY_REG_ENVELOPE_HIGH = 12,
+    AY_REG_ENVELOPE_SHAPE = 13,
+
+    AY_ENVELOPE_HOLD = 0b0001,
+    AY_ENVELOPE_ALTERNATE = 0b0010,
+    AY_ENVELOPE_ATTACK = 0b0100,
+    AY_ENVELOPE_CONTINUE = 0b1000,
+};
+
+/*
+Sunsoft 5B (FME-7 with the audio, a YM2149F) : three square tones, a
+noise generator and an envelope shared by the channels
+https://www.nesdev.org/wiki/Sunsoft_5B_audio
+*/
+class Sunsoft5bAudio : public ExpansionAudio {
+ public:
+    struct State {
+        ayTone tone[3];
+        uint8_t reg_select;
+        uint8_t noise_period;
+        uint32_t lfsr;
+        float noise_divider;
+        uint16_t envelope_period;
+        uint8_t envelope_shape;
+        uint8_t envelope_step; // 0-31
+        bool envelope_attack;
+        bool envelope_holding;
+        float envelope_divider;
+    };
+
+    Sunsoft5bAudio();
+    void select(uint8_t val);
+    void write(uint8_t val);
+    void render(float * mix, int nsamples, float cycles_per_sample);
+
+    void get_state(State * state) { *state = m_state; }
+    void set_state(const State& state) { m_state = state; }
+
+ private:
+    void envelope_tick();
+    uint8_t envelope_level() const;
+
+    State m_state = {};
+    float m_levels[32]; // 5 bit volume to amplitude
+};
+
+enum {
+    KEY_N163_DATA = 0x4800,
+    N163_RAM_SIZE = 0x80,
+    N163_MAX_CHANNELS = 8,
+    N163_CHANNEL_REGS = 0x40, // the channel registers fill the end of the RAM
+};
+
+/*
+Namco 163 : up to 8 wavetable channels, their registers and the 4 bit
+samples share 128 bytes of RAM
+https://www.nesdev.org/wiki/Namco_163_audio
+
+The chip updates one channel every 15 cycles, so each of the N enabled
+channels every 15 * N cycles, and outputs them in turn : the average of
+the channels is mixed. The channels are kept lane-wise (one array per
+field) so that a whole round is a few vector operations, the samples being
+fetched with an AVX2 gather when the CPU has it.
+*/
+class Namco163Audio : public ExpansionAudio {
+ public:
+    struct State {
+        uint8_t ram[N163_RAM_SIZE];
+        uint8_t addr; // bit 7 : auto-increment
+        bool enabled;
+        float divider;
+    };
+
+    Namco163Audio();
+    // the address port, at 0xf800
+    void set_address(uint8_t val);
+    uint8_t read();
+    // read without the auto-increment
+    uint8_t peek() const { return m_state.ram[m_state.addr & 0x7f]; }
+    void write(uint8_t val);
+    void set_enabled(bool enabled);
+    void render(float * mix, int nsamples, float cycles_per_sample);
+
+    void get_state(State * state);
+    void set_state(const State& state);
+
+ private:
+    struct Lanes {
+        uint32_t phase[N163_MAX_CHANNELS];
+        uint32_t freq[N163_MAX_CHANNELS];
+        uint32_t length[N163_MAX_CHANNELS]; // << 16, as the phase
+        int32_t offset[N163_MAX_CHANNELS];
+        int32_t volume[N163_MAX_CHANNELS]; // 0 for the disabled channels
+    };
+
+    int channel_count() const { return ((m_state.ram[0x7f] >> 4) & 0b111) + 1; }
+    void load_lanes();
+    void store_phases();
+
+    State m_state = {};
+    bool m_dirty = true; // the lanes must be reloaded from the RAM
+    Lanes m_lanes = {};
+    int32_t m_wave[N163_RAM_SIZE * 2]; // the RAM nibbles
+    int32_t m_output = 0; // sum of the channel outputs, last round
+};
@@ -0,0 +1,108 @@
+#include "fme7.hpp"
+
+Fme7Device::Fme7Device(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler, ApuDevice * apu)
+    : MapperDevice(prg, chr, ppu, scheduler), m_apu(apu) {
+    update_banks();
+    m_apu->set_expansion_audio(&m_audio);
+}
+
+Fme7Device::~Fme7Device() {
+    m_apu->set_expansion_audio(nullptr);
+}
+
+void Fme7Device::write_register(uint16_t addr, uint8_t val) {
+    switch (addr & 0xe000) {
+    case KEY_FME7_COMMAND:
+        m_regs.command = val & 0xf;
+        break;
+    case KEY_FME7_PARAMETER:
+        if (m_regs.command < FME7_CMD_PRG_6000) {
+            m_regs.chr[m_regs.command] = val;
+            update_banks();
+        } else if (m_regs.command == FME7_CMD_PRG_6000) {
+            m_regs.prg_6000 = val;
+            update_banks();
+        } else if (m_regs.command < FME7_CMD_MIRRORING) {
+            m_regs.prg[m_regs.command - FME7_CMD_PRG_8000] = val;
+            update_banks();
+        } else if (m_regs.command == FME7_CMD_MIRRORING) {
+            m_regs.mirroring = val & 0b11;
+        } else {
+            // the IRQ registers, any write acknowledges
+            sync();
+            if (m_regs.command == FME7_CMD_IRQ_CONTROL) {
+                m_regs.irq_control = val;
+            } else if (m_regs.command == FME7_CMD_IRQ_COUNTER_LOW) {
+                m_regs.irq_counter = (m_regs.irq_counter & 0xff00) | val;
+            } else {
+                m_regs.irq_counter = (m_regs.irq_counter & 0xff) | (val << 8);
+            }
+            m_cpu->set_irq_line(IRQ_SOURCE_MAPPER, false);
+            schedule_irq();
+        }
+        break;
+    case KEY_FME7_AUDIO_SELECT:
+        m_audio.select(val);
+        break;
+    case KEY_FME7_AUDIO_DATA:
+        m_apu->sync();
+        m_audio.write(val);
+        break;
+    }
+}
+
+void Fme7Device::update_banks() {
+    // 0x6000 : bit 6 selects the RAM, bit 7 enables it
+    set_prg_ram_access((m_regs.prg_6000 & BIT7) != 0);
+    if (m_regs.prg_6000 & BIT6) {
+        set_prg_6000_bank(-1);
+    } else {
+        set_prg_6000_bank(m_regs.prg_6000 & 0x3f);
+    }
+    for (int slot = 0; slot < 3; slot++) {
+        set_prg_bank(slot, m_regs.prg[slot] & 0x3f);
+    }
+    set_prg_bank(3, get_prg_bank_count() - 1);
+    for (int slot = 0; slot < 8; slot++) {
+        set_chr_bank(slot, m_regs.chr[slot]);
+    }
+}
+
+void Fme7Device::sync() {
+    uint64_t now = m_scheduler->now();
+    uint64_t elapsed = now - m_regs.sync_cycle;
+    m_regs.sync_cycle = now;
+    if ((m_regs.irq_control & FME7_IRQ_COUNTER_ENABLE) == 0) {
+        return;
+    }
+    if (elapsed > m_regs.irq_counter && (m_regs.irq_control & FME7_IRQ_ENABLE)) {
+        m_cpu->set_irq_line(IRQ_SOURCE_MAPPER, true);
+    }
+    m_regs.irq_counter -= elapsed;
+}
+
+void Fme7Device::schedule_irq() {
+    // must follow a sync
+    if ((m_regs.irq_control & (FME7_IRQ_COUNTER_ENABLE | FME7_IRQ_ENABLE)) != (FME7_IRQ_COUNTER_ENABLE | FME7_IRQ_ENABLE)) {
+        m_scheduler->cancel(EVENT_MAPPER_IRQ);
+        return;
+    }
+    // wraps at the decrement after 0
+    m_scheduler->schedule(EVENT_MAPPER_IRQ, m_regs.sync_cycle + m_regs.irq_counter + 1);
+}
+
+void Fme7Device::irq_event(uint64_t cycle) {
+    sync();
+    schedule_irq();
+}
+
+void Fme7Device::save_regs(uint8_t * regs) {
+    m_audio.get_state(&m_regs.audio);
+    std::memcpy(regs, &m_regs, sizeof(m_regs));
+}
+
+void Fme7Device::load_regs(const uint8_t * regs) {
+    std::memcpy(&m_regs, regs, sizeof(m_regs));
+    m_audio.set_state(m_regs.audio);
+    update_banks();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "mapper.hpp"
+#include "expaudio.hpp"
+
+enum {
+    KEY_FME7_COMMAND = 0x8000,
+    KEY_FME7_PARAMETER = 0xa000,
+    KEY_FME7_AUDIO_SELECT = 0xc000,
+    KEY_FME7_AUDIO_DATA = 0xe000,
+
+    FME7_CMD_PRG_6000 = 0x8,
+    FME7_CMD_PRG_8000 = 0x9,
+    FME7_CMD_MIRRORING = 0xc,
+    FME7_CMD_IRQ_CONTROL = 0xd,
+    FME7_CMD_IRQ_COUNTER_LOW = 0xe,
+    FME7_CMD_IRQ_COUNTER_HIGH = 0xf,
+
+    FME7_IRQ_ENABLE = BIT0,
+    FME7_IRQ_COUNTER_ENABLE = BIT7,
+};
+
+/*
+Sunsoft FME-7 (iNES mapper 69) : PRG/CHR banking through a command
+register, a 16 bit cpu cycle IRQ counter and the 5B audio
+https://www.nesdev.org/wiki/Sunsoft_FME-7
+
+The counter decrements at each cycle and raises the IRQ when it wraps : the
+wrap is scheduled rather than counted.
+*/
+class Fme7Device : public MapperDevice {
+ public:
+    Fme7Device(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler, ApuDevice * apu);
+    ~Fme7Device();
+
+    void irq_event(uint64_t cycle);
+
+ protected:
+    void write_register(uint16_t addr, uint8_t val);
+    void save_regs(uint8_t * regs);
+    void load_regs(const uint8_t * regs);
+
+ private:
+    void update_banks();
+    void sync();
+    void schedule_irq();
+
+    struct Regs {
+        uint8_t command;
+        uint8_t chr[8];
+        uint8_t prg_6000;
+        uint8_t prg[3];
+        // TODO : the PPU has no nametable mirroring yet
+        uint8_t mirroring;
+        uint8_t irq_control;
+        uint16_t irq_counter;
+        uint64_t sync_cycle;
+        Sunsoft5bAudio::State audio;
+    };
+    static_assert(sizeof(Regs) <= MAPPER_REGS_SIZE, "FME-7 registers don't fit in the mapper state");
+
+    ApuDevice * m_apu;
+    Sunsoft5bAudio m_audio;
+    Regs m_regs = {};
+};
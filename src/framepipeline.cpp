@@ -0,0 +1,146 @@
+#include <cstring>
+
+#include "framepipeline.hpp"
+#include "ppu.hpp"
+#include "shmexport.hpp"
+
+FramePipeline::FramePipeline() {
+    for (int i = 0; i < NFRAMES; i++) {
+        m_frames[i].indices = cv::Mat(30*8, 32*8, CV_8UC1, cv::Scalar(0x0f));
+        m_frames[i].rgb = cv::Mat(30*8, 32*8, CV_8UC3);
+        m_free.push(&m_frames[i]);
+    }
+}
+
+FramePipeline::~FramePipeline() {
+    stop();
+}
+
+void FramePipeline::start() {
+    if (m_thread.joinable()) {
+        return;
+    }
+    m_done = false;
+    m_thread = std::thread(&FramePipeline::run, this);
+}
+
+void FramePipeline::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    m_done = true;
+    m_thread.join();
+}
+
+FramePipeline::Frame * FramePipeline::start_hand_over(long frame_no, int first_row, int end_row) {
+    // a free buffer, nullptr if all are in flight
+    Clock::time_point now = Clock::now();
+    Clock::time_point started = m_last_hand_over;
+    if (m_last_hand_over != Clock::time_point()) {
+        m_emulate_stats.add(m_last_hand_over, now);
+    } else {
+        started = now;
+    }
+    m_last_hand_over = now;
+
+    Frame * free;
+    if (!m_free.pop(&free)) {
+        m_dropped++;
+        return nullptr;
+    }
+    free->frame_no = frame_no;
+    free->first_row = first_row;
+    free->end_row = end_row;
+    free->started = started;
+    free->emulated = now;
+    return free;
+}
+
+void FramePipeline::push_emulated(cv::Mat * frame, long frame_no) {
+    Frame * free = start_hand_over(frame_no, 0, frame->rows);
+    if (free == nullptr) {
+        return;
+    }
+    cv::swap(free->indices, *frame);
+    // as many slots as frames, never full
+    m_emulated.push(free);
+}
+
+void FramePipeline::push_slice(const cv::Mat& frame, int first_row, int end_row, long frame_no) {
+    Frame * free = start_hand_over(frame_no, first_row, end_row);
+    if (free == nullptr) {
+        return;
+    }
+    std::memcpy(free->indices.ptr<uint8_t>(first_row), frame.ptr<uint8_t>(first_row), (end_row - first_row) * frame.step1());
+    m_emulated.push(free);
+}
+
+void FramePipeline::run() {
+    while (!m_done) {
+        Frame * frame;
+        if (!m_emulated.pop(&frame)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        post_process(frame);
+        if (m_exporter != nullptr) {
+            m_exporter->write_rows(frame->rgb, frame->first_row, frame->end_row, frame->frame_no);
+        }
+        frame->processed = Clock::now();
+        m_process_stats.add(frame->emulated, frame->processed);
+        m_processed.push(frame);
+    }
+}
+
+void FramePipeline::post_process(Frame * frame) {
+    // palette conversion
+    for (int y = frame->first_row; y < frame->end_row; y++) {
+        const uint8_t * indices = frame->indices.ptr<uint8_t>(y);
+        uint8_t * rgb = frame->rgb.ptr<uint8_t>(y);
+        for (int x = 0; x < frame->indices.cols; x++) {
+            const uint8_t * color = NES_COLORS[indices[x] & 0x3f];
+            rgb[3*x] = color[0];
+            rgb[3*x + 1] = color[1];
+            rgb[3*x + 2] = color[2];
+        }
+    }
+}
+
+FramePipeline::Frame * FramePipeline::acquire() {
+    Frame * frame;
+    if (!m_processed.pop(&frame)) {
+        return nullptr;
+    }
+    return frame;
+}
+
+void FramePipeline::release(Frame * frame) {
+    Clock::time_point now = Clock::now();
+    m_present_stats.add(frame->processed, now);
+    m_total_stats.add(frame->emulated, now);
+    m_row_stats.add(frame->started, now);
+    m_free.push(frame);
+}
+
+void FramePipeline::StageStats::add(Clock::time_point start, Clock::time_point end) {
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    count++;
+    total_ms += ms;
+    if (ms > max_ms) {
+        max_ms = ms;
+    }
+}
+
+void FramePipeline::StageStats::print(std::ostream& out, const char * name) {
+    out << "  " << name << ": " << (count > 0 ? total_ms / count : 0) << " ms avg, " << max_ms << " ms max, " << count << " frames" << std::endl;
+}
+
+void FramePipeline::print_stats(std::ostream& out) {
+    out << "frame pipeline latencies" << std::endl;
+    m_emulate_stats.print(out, "emulate (between hand overs)");
+    m_process_stats.print(out, "post-process (handed over to converted)");
+    m_present_stats.print(out, "present (converted to presented)");
+    m_total_stats.print(out, "total (handed over to presented)");
+    m_row_stats.print(out, "oldest row (drawn to presented)");
+    out << "  " << m_dropped << " dropped" << std::endl;
+}
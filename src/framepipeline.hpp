@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <thread>
+#include <opencv2/opencv.hpp>
+
+#include "spscring.hpp"
+
+class ShmExporter;
+
+/*
+Frame pipeline : emulate, post-process, present
+The PPU hands each finished frame (NES color indices) over at vblank,
+swapped with a recycled buffer so that it never copies nor waits. A worker
+converts it to RGB while the next frame emulates, the UI thread uploads the
+converted ones and presents. The stages overlap, so the throughput is the one of
+the slowest and not of their sum. When all the buffers are in flight the
+PPU keeps drawing over its frame : the frame is dropped, not the emulation
+slowed down.
+Beam racing : the PPU hands slices of rows over as they are drawn (copied,
+it goes on drawing the frame), the UI uploads and presents each at once.
+The oldest row of a slice waits a slice instead of a whole frame.
+*/
+class FramePipeline {
+ public:
+    typedef std::chrono::steady_clock Clock;
+
+    // a whole frame or a slice, only its rows are valid
+    struct Frame {
+        cv::Mat indices; // NES color per pixel, drawn by the PPU
+        cv::Mat rgb;     // for the texture
+        long frame_no;
+        int first_row;
+        int end_row;
+        Clock::time_point started; // first row drawn, at the previous hand over
+        Clock::time_point emulated;
+        Clock::time_point processed;
+    };
+
+    FramePipeline();
+    ~FramePipeline();
+
+    void start();
+    void stop();
+    // optional, gets the converted frames and slices, set before start
+    void set_exporter(ShmExporter * exporter) { m_exporter = exporter; }
+
+    // emulation stage, at vblank : frame is swapped with a free buffer
+    void push_emulated(cv::Mat * frame, long frame_no);
+    // emulation stage, beam racing : rows first_row to end_row - 1 of frame are final
+    void push_slice(const cv::Mat& frame, int first_row, int end_row, long frame_no);
+    // presentation stage : the post-processed frames and slices in order,
+    // nullptr if none, to release once presented
+    Frame * acquire();
+    void release(Frame * frame);
+
+    // the latencies of the stages, once stopped
+    void print_stats(std::ostream& out);
+
+ private:
+    struct StageStats {
+        long count = 0;
+        double total_ms = 0;
+        double max_ms = 0;
+
+        void add(Clock::time_point start, Clock::time_point end);
+        void print(std::ostream& out, const char * name);
+    };
+
+    static const int NFRAMES = 8; // a few frames, or slices
+
+    void run();
+    Frame * start_hand_over(long frame_no, int first_row, int end_row);
+    void post_process(Frame * frame);
+
+    Frame m_frames[NFRAMES];
+    SpscRing<Frame*, NFRAMES> m_free;      // present -> emulate
+    SpscRing<Frame*, NFRAMES> m_emulated;  // emulate -> post-process
+    SpscRing<Frame*, NFRAMES> m_processed; // post-process -> present
+    ShmExporter * m_exporter = nullptr;
+    std::thread m_thread;
+    std::atomic<bool> m_done {false};
+
+    // each written by the thread of its stage only
+    StageStats m_emulate_stats;  // between two hand overs
+    StageStats m_process_stats;  // handed over to converted, with the queueing
+    StageStats m_present_stats;  // converted to presented, with the queueing
+    StageStats m_total_stats;    // handed over to presented
+    StageStats m_row_stats;      // oldest row drawn to presented
+    Clock::time_point m_last_hand_over;
+    long m_dropped = 0; // no free buffer at the hand over
+};
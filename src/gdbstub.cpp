@@ -0,0 +1,494 @@
+#include <stdexcept>
+#include <chrono>
+#include <thread>
+#include <cctype>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "gdbstub.hpp"
+#include "utils.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+// instructions run between two checks for a ctrl-c from gdb
+static const long GDB_POLL_INSTRUCTIONS = 10000;
+
+// indexed by GDB_WATCH_*
+static const char * GDB_WATCH_NAMES[] = {"", "", "watch", "rwatch", "awatch"};
+
+uint8_t GdbStub::WatchPageDevice::get(uint16_t addr) {
+    auto it = m_stub->m_watchpoints.find(addr);
+    // exec_inst reads the opcode and operands through here too, they aren't data reads
+    if (it != m_stub->m_watchpoints.end() && it->second != GDB_WATCH_WRITE && !m_stub->m_nes->cpu.is_fetch(addr)) {
+        m_stub->m_watch_hit_type = it->second;
+        m_stub->m_watch_hit_addr = addr;
+    }
+    return m_inner->get(addr);
+}
+
+void GdbStub::WatchPageDevice::set(uint16_t addr, uint8_t val) {
+    auto it = m_stub->m_watchpoints.find(addr);
+    if (it != m_stub->m_watchpoints.end() && it->second != GDB_WATCH_READ) {
+        m_stub->m_watch_hit_type = it->second;
+        m_stub->m_watch_hit_addr = addr;
+    }
+    m_inner->set(addr, val);
+}
+
+GdbStub::GdbStub(Nes * nes) : m_nes(nes), m_breakpoints(0x10000, false) {
+}
+
+GdbStub::~GdbStub() {
+    if (m_fd >= 0) {
+        end_session();
+    }
+    if (m_listen_fd >= 0) {
+        close(m_listen_fd);
+    }
+    if (!m_unix_path.empty()) {
+        unlink(m_unix_path.c_str());
+    }
+}
+
+void GdbStub::listen(const std::string& where) {
+    bool is_port = !where.empty();
+    for (char c : where) {
+        is_port = is_port && std::isdigit(c);
+    }
+
+    if (is_port) {
+        m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(std::stoi(where));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(m_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("Unable to bind gdb socket");
+        }
+    } else {
+        m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (where.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("gdb socket path too long");
+        }
+        where.copy(addr.sun_path, where.size());
+        unlink(where.c_str());
+        if (bind(m_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("Unable to bind gdb socket");
+        }
+        m_unix_path = where;
+    }
+
+    if (::listen(m_listen_fd, 1) != 0) {
+        throw std::runtime_error("Unable to listen on gdb socket");
+    }
+    fcntl(m_listen_fd, F_SETFL, fcntl(m_listen_fd, F_GETFL) | O_NONBLOCK);
+}
+
+void GdbStub::set_time_travel(TimeTravel * time_travel) {
+    m_time_travel = time_travel;
+}
+
+bool GdbStub::poll_attach() {
+    if (m_listen_fd < 0 || m_fd >= 0) {
+        return false;
+    }
+    m_fd = accept(m_listen_fd, nullptr, nullptr);
+    if (m_fd < 0) {
+        return false;
+    }
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_NONBLOCK);
+    if (m_unix_path.empty()) {
+        int yes = 1;
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    return true;
+}
+
+int GdbStub::read_byte(int timeout_ms) {
+    /*
+    -1 : connection closed
+    -2 : timeout
+    */
+    if (m_rx.empty()) {
+        pollfd pfd = {m_fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return -2;
+        }
+        char buf[1024];
+        ssize_t n = recv(m_fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return -1;
+        }
+        m_rx.append(buf, n);
+    }
+    uint8_t c = m_rx[0];
+    m_rx.erase(0, 1);
+    return c;
+}
+
+bool GdbStub::read_packet(std::string * packet, bool * thread_done) {
+    while (true) {
+        int c = read_byte(100);
+        if (c == -1) {
+            return false;
+        }
+        if (c == -2) {
+            if (*thread_done) {
+                return false;
+            }
+            continue;
+        }
+        if (c == 0x03) {
+            *packet = "\x03";
+            return true;
+        }
+        if (c != '$') {
+            // acks
+            continue;
+        }
+
+        packet->clear();
+        uint8_t checksum = 0;
+        while ((c = read_byte(1000)) >= 0 && c != '#') {
+            packet->push_back(c);
+            checksum += c;
+        }
+        std::string received = "";
+        while (c >= 0 && received.size() < 2 && (c = read_byte(1000)) >= 0) {
+            received.push_back(c);
+        }
+        if (c < 0) {
+            return false;
+        }
+        for (auto& r : received) {
+            r = std::tolower(r);
+        }
+        if (received != hexstr(checksum)) {
+            send(m_fd, "-", 1, MSG_NOSIGNAL);
+            continue;
+        }
+        send(m_fd, "+", 1, MSG_NOSIGNAL);
+        return true;
+    }
+}
+
+void GdbStub::send_packet(const std::string& data) {
+    uint8_t checksum = 0;
+    for (char c : data) {
+        checksum += c;
+    }
+    std::string packet = "$" + data + "#" + hexstr(checksum);
+    send(m_fd, packet.data(), packet.size(), MSG_NOSIGNAL);
+}
+
+bool GdbStub::interrupted() {
+    int c;
+    while ((c = read_byte(0)) >= 0) {
+        if (c == 0x03) {
+            return true;
+        }
+    }
+    // a closed connection stops the target too
+    return c == -1;
+}
+
+std::string GdbStub::read_registers() {
+    Emu6502& cpu = m_nes->cpu;
+    uint16_t pc = cpu.get_prgm_ctr();
+    return hexstr(cpu.get_reg(REG_A)) + hexstr(cpu.get_reg(REG_X)) + hexstr(cpu.get_reg(REG_Y))
+        + hexstr(cpu.get_reg(REG_S)) + hexstr(cpu.get_stack_ptr())
+        + hexstr(low_byte(pc)) + hexstr(high_byte(pc));
+}
+
+void GdbStub::write_registers(const std::string& hex) {
+    if (hex.size() < 14) {
+        throw std::runtime_error("Bad gdb register packet");
+    }
+    uint8_t vals[7];
+    for (int i = 0; i < 7; i++) {
+        vals[i] = std::stoul(hex.substr(2 * i, 2), nullptr, 16);
+    }
+    Emu6502& cpu = m_nes->cpu;
+    cpu.set_reg(REG_A, vals[0]);
+    cpu.set_reg(REG_X, vals[1]);
+    cpu.set_reg(REG_Y, vals[2]);
+    cpu.set_reg(REG_S, vals[3]);
+    cpu.set_stack_ptr(vals[4]);
+    cpu.set_prgm_ctr(vals[5] + (vals[6] << 8));
+}
+
+void GdbStub::install_watchpoints() {
+    for (const auto& pair : m_watchpoints) {
+        uint8_t page_no = pair.first >> 8;
+        if (m_watch_pages.find(page_no) == m_watch_pages.end()) {
+            m_watch_pages[page_no] = std::make_unique<WatchPageDevice>(this, m_nes->mem.get_page_device(page_no));
+            m_nes->mem.set_page_device(page_no, m_watch_pages[page_no].get());
+        }
+    }
+}
+
+void GdbStub::uninstall_watchpoints() {
+    for (auto& pair : m_watch_pages) {
+        Device * inner = pair.second->get_inner();
+        m_nes->mem.reset_page_device(pair.first);
+        if (m_nes->mem.get_page_device(pair.first) != inner) {
+            m_nes->mem.set_page_device(pair.first, inner);
+        }
+    }
+    m_watch_pages.clear();
+}
+
+std::string GdbStub::set_point(const std::string& packet, bool insert) {
+    // Ztype,addr,kind
+    int type = packet[1] - '0';
+    size_t sep = packet.find(',', 3);
+    uint16_t addr = std::stoul(packet.substr(3, sep - 3), nullptr, 16);
+    int length = std::stoi(packet.substr(sep + 1), nullptr, 16);
+
+    if (type == GDB_BREAKPOINT_SW || type == GDB_BREAKPOINT_HW) {
+        m_breakpoints[addr] = insert;
+        return "OK";
+    }
+    if (type < GDB_WATCH_WRITE || type > GDB_WATCH_ACCESS) {
+        return "";
+    }
+    uninstall_watchpoints();
+    for (int i = 0; i < length; i++) {
+        if (insert) {
+            m_watchpoints[addr + i] = type;
+        } else {
+            m_watchpoints.erase(addr + i);
+        }
+    }
+    install_watchpoints();
+    return "OK";
+}
+
+std::string GdbStub::resume(bool step, bool * thread_done) {
+    m_watch_hit_type = 0;
+    uint64_t start_cycles = m_nes->get_cycles();
+    auto start_t = Clock::now();
+
+    for (long n = 1; ; n++) {
+        m_nes->step_instruction();
+        if (m_time_travel != nullptr) {
+            m_time_travel->record();
+        }
+
+        if (m_watch_hit_type != 0) {
+            return std::string("T05") + GDB_WATCH_NAMES[m_watch_hit_type] + ":" + hexstr(m_watch_hit_addr) + ";";
+        }
+        if (step || m_breakpoints[m_nes->cpu.get_prgm_ctr()]) {
+            return "S05";
+        }
+
+        if (n % GDB_POLL_INSTRUCTIONS == 0) {
+            if (*thread_done || interrupted()) {
+                return "S02";
+            }
+            // keep the game running at its real speed
+            long expected_us = (m_nes->get_cycles() - start_cycles) * 1000000 / CLOCK_FREQUENCY;
+            long elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start_t).count();
+            if (expected_us > elapsed_us) {
+                std::this_thread::sleep_for(std::chrono::microseconds(expected_us - elapsed_us));
+            }
+        }
+    }
+}
+
+std::string GdbStub::reverse(bool step) {
+    if (m_time_travel == nullptr) {
+        return "";
+    }
+    bool ok;
+    if (step) {
+        ok = m_time_travel->reverse_step();
+    } else {
+        ok = m_time_travel->reverse_continue(m_breakpoints);
+    }
+    // the replay went through the watched pages again
+    m_watch_hit_type = 0;
+    if (!ok) {
+        return "T05replaylog:begin;";
+    }
+    return "S05";
+}
+
+std::string GdbStub::handle(const std::string& packet, bool * resume, bool * step, bool * detach) {
+    Emu6502& cpu = m_nes->cpu;
+    size_t comma = packet.find(',');
+    size_t colon = packet.find(':');
+    size_t equal = packet.find('=');
+
+    switch (packet[0]) {
+    case '?':
+        return "S05";
+
+    case 'g':
+        return read_registers();
+
+    case 'G':
+        write_registers(packet.substr(1));
+        if (m_time_travel != nullptr) {
+            m_time_travel->truncate();
+        }
+        return "OK";
+
+    case 'p': {
+        int reg = std::stoi(packet.substr(1), nullptr, 16);
+        if (reg < 4) {
+            return hexstr(cpu.get_reg(reg));
+        } else if (reg == 4) {
+            return hexstr(cpu.get_stack_ptr());
+        } else if (reg == 5) {
+            return hexstr(low_byte(cpu.get_prgm_ctr())) + hexstr(high_byte(cpu.get_prgm_ctr()));
+        }
+        return "E01";
+    }
+
+    case 'P': {
+        int reg = std::stoi(packet.substr(1, equal - 1), nullptr, 16);
+        uint8_t low = std::stoul(packet.substr(equal + 1, 2), nullptr, 16);
+        if (reg < 4) {
+            cpu.set_reg(reg, low);
+        } else if (reg == 4) {
+            cpu.set_stack_ptr(low);
+        } else if (reg == 5) {
+            cpu.set_prgm_ctr(low + (std::stoul(packet.substr(equal + 3, 2), nullptr, 16) << 8));
+        } else {
+            return "E01";
+        }
+        if (m_time_travel != nullptr) {
+            m_time_travel->truncate();
+        }
+        return "OK";
+    }
+
+    case 'm': {
+        uint16_t addr = std::stoul(packet.substr(1, comma - 1), nullptr, 16);
+        int length = std::stoi(packet.substr(comma + 1), nullptr, 16);
+        std::string reply = "";
+        for (int i = 0; i < length; i++) {
+            reply += hexstr(m_nes->mem.peek(addr + i));
+        }
+        return reply;
+    }
+
+    case 'M': {
+        uint16_t addr = std::stoul(packet.substr(1, comma - 1), nullptr, 16);
+        int length = std::stoi(packet.substr(comma + 1, colon - comma - 1), nullptr, 16);
+        try {
+            for (int i = 0; i < length; i++) {
+                m_nes->mem.set(addr + i, std::stoul(packet.substr(colon + 1 + 2 * i, 2), nullptr, 16));
+            }
+        } catch (const std::runtime_error& ex) {
+            // e.g. ROM
+            return "E01";
+        }
+        m_watch_hit_type = 0;
+        if (m_time_travel != nullptr) {
+            m_time_travel->truncate();
+        }
+        return "OK";
+    }
+
+    case 'c':
+    case 's':
+        if (packet.size() > 1) {
+            cpu.set_prgm_ctr(std::stoul(packet.substr(1), nullptr, 16));
+        }
+        *resume = true;
+        *step = (packet[0] == 's');
+        return "";
+
+    case 'b':
+        if (packet == "bs" || packet == "bc") {
+            return reverse(packet == "bs");
+        }
+        return "";
+
+    case 'Z':
+    case 'z':
+        return set_point(packet, packet[0] == 'Z');
+
+    case 'D':
+    case 'k':
+        *detach = true;
+        return "OK";
+
+    case 'H':
+    case 'T':
+        return "OK";
+
+    case 'q':
+        if (packet.rfind("qSupported", 0) == 0) {
+            if (m_time_travel != nullptr) {
+                return "PacketSize=4000;ReverseStep+;ReverseContinue+";
+            }
+            return "PacketSize=4000";
+        } else if (packet == "qAttached") {
+            return "1";
+        } else if (packet == "qC") {
+            return "QC1";
+        } else if (packet == "qfThreadInfo") {
+            return "m1";
+        } else if (packet == "qsThreadInfo") {
+            return "l";
+        }
+        return "";
+
+    default:
+        // unsupported packet
+        return "";
+    }
+}
+
+void GdbStub::end_session() {
+    uninstall_watchpoints();
+    m_watchpoints.clear();
+    m_breakpoints.assign(0x10000, false);
+    close(m_fd);
+    m_fd = -1;
+    m_rx.clear();
+}
+
+void GdbStub::serve(bool * thread_done) {
+    std::string packet;
+    while (read_packet(&packet, thread_done)) {
+        if (packet == "\x03") {
+            // already stopped
+            continue;
+        }
+        bool resume = false;
+        bool step = false;
+        bool detach = false;
+        std::string reply;
+        try {
+            reply = handle(packet, &resume, &step, &detach);
+        } catch (const std::exception& ex) {
+            // malformed packet
+            reply = "E02";
+        }
+        if (resume) {
+            reply = this->resume(step, thread_done);
+        }
+        if (packet[0] != 'k') {
+            send_packet(reply);
+        }
+        if (detach) {
+            break;
+        }
+    }
+    end_session();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "device.hpp"
+#include "nes.hpp"
+#include "timetravel.hpp"
+
+// gdb Z/z packet types
+enum {
+    GDB_BREAKPOINT_SW = 0,
+    GDB_BREAKPOINT_HW = 1,
+    GDB_WATCH_WRITE = 2,
+    GDB_WATCH_READ = 3,
+    GDB_WATCH_ACCESS = 4,
+};
+
+/*
+GDB remote serial protocol stub
+https://sourceware.org/gdb/current/onlinedocs/gdb.html/Remote-Protocol.html
+
+The run loop only polls for a connection in its pacing block, so an idle
+stub costs nothing per cycle. Once attached, the session is served on the
+emulation thread which then steps instruction by instruction, checking
+breakpoints and watchpoints, until the debugger detaches.
+
+With a TimeTravel, the stub also records checkpoints while running and
+answers the reverse execution packets.
+
+Registers (g/G/p/P), in order : A, X, Y, P (status), SP (8 bits), PC (16 bits, little endian)
+*/
+class GdbStub {
+ public:
+    GdbStub(Nes * nes);
+    ~GdbStub();
+
+    // "1234" : TCP on 127.0.0.1:1234, anything else : unix socket path
+    void listen(const std::string& where);
+    // non blocking, true when a debugger just connected
+    bool poll_attach();
+    // serve the session until the debugger detaches or *thread_done
+    void serve(bool * thread_done);
+    // enables reverse-step / reverse-continue (bs / bc packets)
+    void set_time_travel(TimeTravel * time_travel);
+
+ private:
+    class WatchPageDevice : public Device {
+     public:
+        WatchPageDevice(GdbStub * stub, Device * inner) : m_stub(stub), m_inner(inner) {}
+        uint8_t get(uint16_t addr);
+        // not a hit, the gdb m packets read through peek
+        uint8_t peek(uint16_t addr) { return m_inner->peek(addr); }
+        void set(uint16_t addr, uint8_t val);
+        Device * get_inner() { return m_inner; }
+     private:
+        GdbStub * m_stub;
+        Device * m_inner;
+    };
+
+    bool read_packet(std::string * packet, bool * thread_done);
+    void send_packet(const std::string& data);
+    bool interrupted();
+    int read_byte(int timeout_ms);
+
+    std::string handle(const std::string& packet, bool * resume, bool * step, bool * detach);
+    std::string resume(bool step, bool * thread_done);
+    std::string reverse(bool step);
+    std::string read_registers();
+    void write_registers(const std::string& hex);
+    std::string set_point(const std::string& packet, bool insert);
+
+    void install_watchpoints();
+    void uninstall_watchpoints();
+    void end_session();
+
+    Nes * m_nes;
+    TimeTravel * m_time_travel = nullptr;
+    int m_listen_fd = -1;
+    int m_fd = -1;
+    std::string m_unix_path;
+    std::string m_rx;
+
+    std::vector<bool> m_breakpoints;
+    std::map<uint16_t, int> m_watchpoints; // addr -> GDB_WATCH_*
+    std::map<uint8_t, std::unique_ptr<WatchPageDevice>> m_watch_pages;
+    int m_watch_hit_type = 0;
+    uint16_t m_watch_hit_addr = 0;
+};
@@ -44,6 +44,16 @@ LstDebuggerAsm6::LstDebuggerAsm6(const std::string& lstfile, bool asm6) {
         inst.erase(inst.find_last_not_of(" \n\r\t") + 1); // rstrip
         inst.erase(0, inst.find_first_not_of(" \n\r\t")); // lstrip
 
+        // label lines look like "Reset:" or "Reset:  sei"
+        std::string token = inst.substr(0, inst.find_first_of(" \t"));
+        if (token.size() > 1 && token.back() == ':' && !std::isdigit(token[0])) {
+            if (labelMap.find(addr) == labelMap.end()) {
+                labelMap[addr] = token.substr(0, token.size() - 1);
+            }
+            inst.erase(0, token.size());
+            inst.erase(0, inst.find_first_not_of(" \n\r\t"));
+        }
+
         if (!inst.empty()) {
             instMap[addr] = inst;
         }
@@ -57,3 +67,11 @@ std::string LstDebuggerAsm6::getInst(uint16_t addr) const {
     }
     return "NOP";
 }
+
+std::string LstDebuggerAsm6::getLabel(uint16_t addr) const {
+    auto it = labelMap.find(addr);
+    if (it != labelMap.end()) {
+        return it->second;
+    }
+    return "";
+}
@@ -13,7 +13,10 @@ public:
     LstDebuggerAsm6(const std::string& lstfile, bool asm6);
 
     std::string getInst(uint16_t addr) const;
+    // empty if no label is defined at addr
+    std::string getLabel(uint16_t addr) const;
 
 private:
     std::unordered_map<uint16_t, std::string> instMap;
+    std::unordered_map<uint16_t, std::string> labelMap;
 };
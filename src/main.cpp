@@ -9,6 +9,24 @@
 #include "device.hpp"
 #include "ppu.hpp"
 #include "apu.hpp"
+#include "ramsearch.hpp"
+#include "ramexpr.hpp"
+#include "consolesnapshot.hpp"
+#include "shmexport.hpp"
+#include "netplay.hpp"
+#include "cheat.hpp"
+#include "plugin.hpp"
+#include "cdl.hpp"
+#include "disasm.hpp"
+#include "nes.hpp"
+#include "gdbstub.hpp"
+#include "checkpoint.hpp"
+#include "romindex.hpp"
+#include "timetravel.hpp"
+#include "ppuviewer.hpp"
+#include "pputhread.hpp"
+#include "framepipeline.hpp"
+#include "mosaic.hpp"
 
 #include <opencv2/opencv.hpp>
 #include <SDL.h>
@@ -17,7 +35,10 @@
 #include <thread>
 
 #include <signal.h>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <vector>
 
 typedef std::chrono::high_resolution_clock Clock;
 
@@ -34,8 +55,49 @@ void turn_bit_on(uint8_t * value, uint8_t bit) {
     *value |= (1 << bit);
 }
 
+// F1 : restart the search, F2..F5 : filter, F6 : print the candidates
+// 0..9 : type the value N (decimal, backspace clears it), F7 : == N, F8 : != N
+std::map<SDL_Keycode,int> RAMSEARCH_MAPPING = {{SDLK_F2, RAMSEARCH_CHANGED}, {SDLK_F3, RAMSEARCH_UNCHANGED}, {SDLK_F4, RAMSEARCH_INCREASED}, {SDLK_F5, RAMSEARCH_DECREASED},
+                                               {SDLK_F7, RAMSEARCH_EQUAL}, {SDLK_F8, RAMSEARCH_NOT_EQUAL}};
+
+void ram_search_key(RamSearch * search, SnapshotRamDevice * search_ram, int * value, SDL_Keycode key) {
+    if (key >= SDLK_0 && key <= SDLK_9) {
+        *value = *value * 10 + (key - SDLK_0);
+        if (*value > 0xff) {
+            // start over rather than wrap to a surprising value
+            *value = key - SDLK_0;
+        }
+        std::cout << "ram search: N=" << *value << std::endl;
+        return;
+    } else if (key == SDLK_BACKSPACE) {
+        *value = 0;
+        std::cout << "ram search: N=0" << std::endl;
+        return;
+    }
+    // the RAM as of the last vblank, not racing with the emulation
+    search_ram->refresh();
+    if (key == SDLK_F1) {
+        search->reset();
+    } else if (RAMSEARCH_MAPPING.find(key) != RAMSEARCH_MAPPING.end()) {
+        search->filter(RAMSEARCH_MAPPING[key], *value);
+    } else if (key == SDLK_F6) {
+        int nprint = 0;
+        for (uint16_t addr : search->candidates()) {
+            std::cout << hexstr(addr) << "=" << hexstr(search->get_value(addr)) << " ";
+            if (++nprint == 64) {
+                std::cout << "...";
+                break;
+            }
+        }
+        std::cout << std::endl;
+    } else {
+        return;
+    }
+    std::cout << "ram search: " << search->count() << " candidates" << std::endl;
+}
 
-void ui(PpuDevice * ppu, ApuDevice * apu) {
+
+void ui(PpuDevice * ppu, ApuDevice * apu, RamSearch * search, SnapshotRamDevice * search_ram, FramePipeline * pipeline, std::atomic<uint8_t> * pad) {
     
     // init SDL
     struct sigaction action;
@@ -81,11 +143,12 @@ void ui(PpuDevice * ppu, ApuDevice * apu) {
         return;
     }
 
-    cv::Mat * frame = ppu->getFrame();
-    
     bool thread_done = false;
 
     uint8_t kb_state = 0;
+    // the N of the equal / not equal RAM search filters
+    int search_value = 0;
+    std::vector<FramePipeline::Frame *> uploaded;
 
     while(!thread_done) {
         SDL_Event e;
@@ -95,6 +158,9 @@ void ui(PpuDevice * ppu, ApuDevice * apu) {
             if (e.type == SDL_QUIT) {
                 thread_done = true;
             }
+            if (e.type == SDL_KEYDOWN) {
+                ram_search_key(search, search_ram, &search_value, e.key.keysym.sym);
+            }
             if (e.type == SDL_KEYDOWN | e.type == SDL_KEYUP) {
                 uint8_t keycode = 0;
                 try {
@@ -110,14 +176,32 @@ void ui(PpuDevice * ppu, ApuDevice * apu) {
             }
         }
 
-        ppu->set_kb_state(kb_state);
-        ppu->render();
+        if (pad != nullptr) {
+            // netplay : the session sets the controllers of both players at each frame
+            pad->store(kb_state, std::memory_order_relaxed);
+        } else {
+            ppu->set_kb_state(kb_state);
+        }
 
-        SDL_UpdateTexture(texture, nullptr, frame->data, frame->step1());
+        // the frames are emulated and converted meanwhile on the other
+        // threads, only the rows of the slices are uploaded when beam racing
+        FramePipeline::Frame * frame;
+        while ((frame = pipeline->acquire()) != nullptr) {
+            SDL_Rect rows = {0, frame->first_row, frame->rgb.cols, frame->end_row - frame->first_row};
+            SDL_UpdateTexture(texture, &rows, frame->rgb.ptr<uint8_t>(frame->first_row), frame->rgb.step1());
+            uploaded.push_back(frame);
+        }
+        if (uploaded.empty()) {
+            SDL_Delay(1);
+            continue;
+        }
         SDL_RenderClear(renderer);
         SDL_RenderCopy(renderer, texture, nullptr, nullptr);
         SDL_RenderPresent(renderer);
-        SDL_Delay(40);
+        for (FramePipeline::Frame * presented : uploaded) {
+            pipeline->release(presented);
+        }
+        uploaded.clear();
     }
 
     SDL_DestroyTexture(texture);
@@ -126,27 +210,264 @@ void ui(PpuDevice * ppu, ApuDevice * apu) {
     SDL_Quit();
 }
 
-void run(Emu6502 * cpu, PpuDevice * ppu, ApuDevice * apu, bool * thread_done) {
-    unsigned long long loopCount = 0;
-    auto last_t = Clock::now();
-    while (!(*thread_done)) {
-        cpu->tick();
+void mosaic_ui(Mosaic * mosaic) {
+    // the whole grid in one streaming texture, only the cells drawn since are uploaded
+    struct sigaction action;
+    sigaction(SIGINT, NULL, &action);
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
+        return;
+    }
+    sigaction(SIGINT, &action, NULL);
+
+    const cv::Mat& canvas = mosaic->get_canvas();
+    SDL_Window* window = SDL_CreateWindow("Mosaic", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, canvas.cols, canvas.rows, SDL_WINDOW_SHOWN | SDL_WINDOW_ALLOW_HIGHDPI);
+    if (window == nullptr) {
+        std::cerr << "SDL_CreateWindow Error: " << SDL_GetError() << std::endl;
+        SDL_Quit();
+        return;
+    }
+
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, 0);
+    if (renderer == nullptr) {
+        std::cerr << "SDL_CreateRenderer Error: " << SDL_GetError() << std::endl;
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return;
+    }
+
+    // R, G, B, X in memory, as the canvas
+    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, canvas.cols, canvas.rows);
+    if (texture == nullptr) {
+        std::cerr << "SDL_CreateTexture Error: " << SDL_GetError() << std::endl;
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return;
+    }
+
+    bool thread_done = false;
+    std::vector<uint32_t> uploaded(mosaic->get_instance_count(), 0);
+
+    while (!thread_done) {
+        SDL_Event e;
+        while (SDL_PollEvent(&e)) {
+            if (e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE)) {
+                thread_done = true;
+            }
+        }
+
+        bool changed = false;
+        for (int i = 0; i < mosaic->get_instance_count(); i++) {
+            uint32_t seq = mosaic->get_cell_sequence(i);
+            if ((seq & 1) || seq == uploaded[i]) {
+                continue;
+            }
+            cv::Rect cell = mosaic->get_cell(i);
+            SDL_Rect rect = {cell.x, cell.y, cell.width, cell.height};
+            SDL_UpdateTexture(texture, &rect, canvas.ptr<uint8_t>(cell.y, cell.x), canvas.step1());
+            // torn : uploaded again once the worker is done with it
+            if (mosaic->is_cell_unchanged(i, seq)) {
+                uploaded[i] = seq;
+            }
+            changed = true;
+        }
+        if (!changed) {
+            SDL_Delay(1);
+            continue;
+        }
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+    }
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+void bench_mosaic(Mosaic * mosaic, int seconds) {
+    // headless, the instances as the mosaic would run them without a window
+    mosaic->start();
+    for (int i = 0; i < seconds; i++) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        mosaic->print_stats(std::cout);
+    }
+    mosaic->stop();
+}
+
+void bench_ppu(Nes * nes, long nframes) {
+    // headless, the whole console with each renderer from the same state
+    Nes::State start;
+    nes->get_state(&start);
+    double realtime_fps = 3.0 * CLOCK_FREQUENCY / PPU_FRAME_TICKS;
+    PpuRenderThread render_thread(&nes->ppu);
+    const char * names[] = {"frame", "dot", "threaded dot"};
+    for (int renderer = 0; renderer < 3; renderer++) {
+        nes->set_state(start);
+        nes->ppu.set_dot_renderer(renderer == 1);
+        if (renderer == 2) {
+            render_thread.start();
+        }
+        auto start_t = Clock::now();
+        for (long frame_no = 0; frame_no < nframes; frame_no++) {
+            for (long cycle = 0; cycle < PPU_FRAME_TICKS / 3; cycle++) {
+                nes->cpu_cycle();
+            }
+            nes->ppu.render();
+        }
+        if (renderer == 2) {
+            // until the last frame is drawn
+            render_thread.sync(nes->ppu.get_tick());
+            render_thread.stop();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start_t).count();
+        std::cout << names[renderer] << " renderer: " << nframes / seconds << " frames/s ("
+                  << nframes / seconds / realtime_fps << "x realtime), "
+                  << nes->ppu.get_lag_frame_count() - start.ppu.lag_frame_count << " lag frames" << std::endl;
+    }
+}
+
+void bench_audio(long seconds) {
+    // headless, the three channels on, rendered by frame sequencer blocks as the APU does
+    const int block = SAMPLE_RATE / 240;
+    std::vector<Sint16> out(block);
+    for (int filter = 0; filter < 2; filter++) {
+        SoundEngine engine;
+        engine.setFilterEnable(filter == 1);
+        for (int channel = 0; channel < 3; channel++) {
+            engine.setFrequency(channel, 220.0f * (channel + 1));
+            engine.setAmplitude(channel, MAX_AMPLITUDE);
+            engine.setDutyCycle(channel, DUTY_CYCLE_VALUES[channel]);
+            engine.setChannelEnable(channel, true);
+        }
+        long nsamples = seconds * SAMPLE_RATE;
+        auto start_t = Clock::now();
+        for (long n = 0; n < nsamples; n += block) {
+            engine.render(block);
+            engine.playSamples(out.data(), block);
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - start_t).count();
+        std::cout << "render, filter " << (filter ? "on" : "off") << ": " << 1e9 * elapsed / nsamples << " ns/sample, "
+                  << 1e3 * elapsed / seconds << " ms per second of audio" << std::endl;
+    }
+
+    // the filter chain alone, on a square wave
+    OutputFilter filter(SAMPLE_RATE);
+    std::vector<float> samples(block);
+    long nsamples = seconds * SAMPLE_RATE;
+    double elapsed = 0;
+    for (long n = 0; n < nsamples; n += block) {
+        for (int i = 0; i < block; i++) {
+            samples[i] = ((n + i) / 100) & 1 ? MAX_AMPLITUDE : -MAX_AMPLITUDE;
+        }
+        auto start_t = Clock::now();
+        filter.process(samples.data(), block);
+        elapsed += std::chrono::duration<double>(Clock::now() - start_t).count();
+    }
+    std::cout << "output filter: " << 1e9 * elapsed / nsamples << " ns/sample" << std::endl;
+}
 
-        ppu->tick();
-        ppu->tick();
-        ppu->tick();
+static uint8_t bench_input(int player, long frame) {
+    // held for 8 frames, as a player would
+    uint32_t hash = (frame / 8 + 1) * 2654435761u ^ (player + 1) * 40503u;
+    return (hash >> 13) & 0xff;
+}
 
-        cpu->tick();
+void bench_netplay(const InesRom& cart, long nframes) {
+    // headless, two consoles through a lossy loopback link against one without netplay
+    struct Link {
+        int latency;
+        int jitter;
+        double loss;
+        int input_delay;
+    };
+    const Link links[] = {{0, 0, 0, 0}, {2, 1, 0.05, 0}, {4, 2, 0.2, 1}, {6, 3, 0.3, 2}};
+    for (const Link& link : links) {
+        std::cout << "link: " << link.latency << "+" << link.jitter << " frames, " << link.loss * 100 << "% loss, input delay " << link.input_delay << std::endl;
+        // no input during the delay
+        std::vector<uint32_t> reference;
+        auto ref = std::make_unique<Nes>(cart);
+        for (long frame = 0; frame <= nframes; frame++) {
+            Nes::State state;
+            ref->get_state(&state);
+            reference.push_back(RollbackSession::state_checksum(state));
+            for (int player = 0; player < 2; player++) {
+                ref->ppu.set_kb_state(frame < link.input_delay ? 0 : bench_input(player, frame), player);
+            }
+            ref->run_frame();
+        }
+        LoopbackLink loopback(link.latency, link.jitter, link.loss, 1234);
+        std::unique_ptr<Nes> nes[2];
+        std::unique_ptr<RollbackSession> sessions[2];
+        for (int player = 0; player < 2; player++) {
+            nes[player] = std::make_unique<Nes>(cart);
+            sessions[player] = std::make_unique<RollbackSession>(nes[player].get(), loopback.get_end(player), player, link.input_delay);
+        }
+        long host_frames = 0;
+        while ((sessions[0]->get_frame() < nframes || sessions[1]->get_frame() < nframes) && host_frames < 4 * nframes) {
+            for (int player = 0; player < 2; player++) {
+                RollbackSession * session = sessions[player].get();
+                long frame = session->get_frame() + session->get_input_delay();
+                session->advance_frame(frame < session->get_input_delay() ? 0 : bench_input(player, frame));
+            }
+            loopback.tick();
+            host_frames++;
+        }
+        for (int player = 0; player < 2; player++) {
+            sessions[player]->print_stats(std::cout);
+            uint32_t checksum;
+            long frame = sessions[player]->get_confirmed_checksum(&checksum);
+            bool same = frame >= 0 && frame < static_cast<long>(reference.size()) && reference[frame] == checksum;
+            std::cout << "  confirmed frame " << frame << (same ? " matches" : " DIFFERS from") << " the reference" << std::endl;
+        }
+        std::cout << "  " << host_frames << " host frames" << std::endl;
+    }
+}
 
-        ppu->tick();
-        ppu->tick();
-        ppu->tick();
+void run_netplay(Nes * nes, RollbackSession * session, std::atomic<uint8_t> * pad, bool * thread_done) {
+    // paced per frame, the session waits for the peer or rolls back within it
+    auto frame_time = std::chrono::microseconds(static_cast<long>(1e6 * PPU_FRAME_TICKS / (3.0 * CLOCK_FREQUENCY)));
+    auto deadline = Clock::now();
+    while (!(*thread_done)) {
+        session->advance_frame(pad->load(std::memory_order_relaxed));
+        if (!session->get_error().empty()) {
+            std::cerr << "Netplay session refused: " << session->get_error() << std::endl;
+            break;
+        }
+        deadline += frame_time;
+        auto now = Clock::now();
+        if (now < deadline) {
+            std::this_thread::sleep_until(deadline);
+        } else if (now - deadline > std::chrono::milliseconds(100)) {
+            deadline = now;
+        }
+    }
+    session->print_stats(std::cout);
+}
 
-        apu->tick();
+void run(Nes * nes, GdbStub * gdb, TimeTravel * time_travel, CheckpointWriter * checkpoints, bool * thread_done) {
+    unsigned long long loopCount = 0;
+    auto last_t = Clock::now();
+    while (!(*thread_done)) {
+        nes->tick();
     
         loopCount++;
 
         if (loopCount % NSTEPS_PAUSE == 0) {
+            // the debugger is only looked for here, the loop above
+            // doesn't pay anything for it
+            if (gdb != nullptr && gdb->poll_attach()) {
+                gdb->serve(thread_done);
+            }
+            // as often as the pacing allows, at worst every NSTEPS_PAUSE iterations
+            if (time_travel != nullptr) {
+                time_travel->record();
+            }
+            if (checkpoints != nullptr) {
+                checkpoints->poll();
+            }
             auto now = Clock::now();
             // slow down !
             loopCount = 0;
@@ -161,39 +482,399 @@ void run(Emu6502 * cpu, PpuDevice * ppu, ApuDevice * apu, bool * thread_done) {
     }
 }
 
-int main() {
-    uint8_t prg[0x8000] = {0};
-    uint8_t chr[0x4000] = {0}; // TODO : check sizes
+void run_beam_raced(Nes * nes, GdbStub * gdb, TimeTravel * time_travel, CheckpointWriter * checkpoints, bool * thread_done) {
+    /*
+    Paced per slice instead of per NSTEPS_PAUSE : each slice is emulated
+    just before its wall clock time (the PPU ticks at their real rate from
+    the start) and presented at once, as the display scans it
+    */
+    double ticks_per_us = 3.0 * CLOCK_FREQUENCY / 1e6;
+    int64_t start_tick = nes->ppu.get_tick();
+    auto start_t = Clock::now();
+    while (!(*thread_done)) {
+        int64_t slice_tick = nes->ppu.next_slice_tick();
+        while (nes->ppu.get_tick() < slice_tick) {
+            nes->tick();
+        }
+        if (gdb != nullptr && gdb->poll_attach()) {
+            gdb->serve(thread_done);
+        }
+        if (time_travel != nullptr) {
+            time_travel->record();
+        }
+        if (checkpoints != nullptr) {
+            checkpoints->poll();
+        }
+        auto deadline = start_t + std::chrono::microseconds(static_cast<long>((slice_tick - start_tick) / ticks_per_us));
+        auto now = Clock::now();
+        if (now < deadline) {
+            std::this_thread::sleep_until(deadline);
+        } else if (now - deadline > std::chrono::milliseconds(100)) {
+            // far behind (debugger, slow host) : no catching up, restart the schedule
+            start_tick = slice_tick;
+            start_t = now;
+        }
+    }
+}
+
+int main(int argc, char ** argv) {
+    // the game is needed before the console is built, the other options after
+    std::string rom = "";
+    std::string rom_index_file = "";
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--rom") {
+            rom = argv[i + 1];
+        } else if (std::string(argv[i]) == "--rom-index") {
+            rom_index_file = argv[i + 1];
+        }
+    }
+
+    InesRom cart;
+    // the listing is of the default game only
+    std::unique_ptr<LstDebuggerAsm6> lst;
+    RomIndex rom_index;
+    if (rom.empty()) {
+        loadInes("../rom/Donkey-Kong-NES-Disassembly/dk.nes", &cart);
+        lst = std::make_unique<LstDebuggerAsm6>("../rom/Donkey-Kong-NES-Disassembly/dk.lst", true);
+    } else if (!rom_index_file.empty()) {
+        rom_index.open(rom_index_file);
+        rom_index.load(rom, &cart);
+    } else {
+        loadInes(rom, &cart);
+    }
+
+    Nes nes(cart, lst.get());
+
+    // published at each vblank, for the readers of the other threads
+    ConsoleSnapshotPublisher snapshots(&nes);
+    SnapshotRamDevice search_ram(&snapshots);
+    RamSearch search(&search_ram);
+    if (nes.mapper) {
+        search.add_region(&search_ram, 0x6000, 0x2000);
+    }
+
+    CheatEngine cheats(&nes.mem);
+    PluginHost plugins(&nes);
+    std::vector<std::string> expressions;
+    std::string cdl_file = "";
+    std::string gdb_addr = "";
+    std::string shm_name = "";
+    std::string netplay = "";
+    int input_delay = 0;
+    long bench_netplay_frames = 0;
+    uint64_t checkpoint_interval = TIMETRAVEL_DEFAULT_INTERVAL;
+    std::string checkpoint_dir = "";
+    long checkpoint_every = CHECKPOINT_DEFAULT_INTERVAL;
+    std::string resume_dir = "";
+    std::string index_dir = "";
+    bool ppu_viewer = false;
+    bool ppu_thread = false;
+    bool skip_lag = false;
+    int beam_slices = 0;
+    long bench_frames = 0;
+    long bench_audio_seconds = 0;
+    int mosaic_count = 0;
+    int mosaic_workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    std::vector<std::string> mosaic_roms;
+    bool bench_mosaic_run = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--ppu-viewer") {
+            ppu_viewer = true;
+            continue;
+        }
+        if (arg == "--ppu-dots") {
+            // dot accurate PPU, slower
+            nes.ppu.set_dot_renderer(true);
+            continue;
+        }
+        if (arg == "--ppu-thread") {
+            // dot accurate PPU, drawn on a second core
+            ppu_thread = true;
+            continue;
+        }
+        if (arg == "--skip-lag") {
+            // no telemetry nor mosaic drawing on the lag frames, the input of which is ignored
+            skip_lag = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+        std::string val = argv[++i];
+        if (arg == "--rom" || arg == "--rom-index") {
+            // --rom PATH (.nes, .nes.gz, .zip) or, with --rom-index FILE, --rom HASH (CRC32 or SHA-1), read above
+            continue;
+        }
+        if (arg == "--genie") {
+            cheats.add_game_genie(val);
+        } else if (arg == "--freeze") {
+            // --freeze ADDR:VALUE, both in hex
+            size_t sep = val.find(':');
+            if (sep == std::string::npos) {
+                std::cerr << "--freeze expects ADDR:VALUE" << std::endl;
+                return 1;
+            }
+            cheats.add_freeze(std::stoul(val.substr(0, sep), nullptr, 16), std::stoul(val.substr(sep + 1), nullptr, 16));
+        } else if (arg == "--watch") {
+            // --watch ADDR, in hex : prints the writes changing it, with their frame
+            uint16_t addr = std::stoul(val, nullptr, 16);
+            // any address, through the memory map without side effects
+            plugins.on_write(addr, [&nes, last = nes.mem.peek(addr)](uint16_t addr, uint8_t value) mutable {
+                if (value != last) {
+                    std::cout << "frame " << nes.ppu.get_frame_no() << ": " << hexstr(addr) << "=" << hexstr(value) << std::endl;
+                    last = value;
+                }
+            });
+        } else if (arg == "--expr") {
+            // --expr EXPR, repeated : prints the values of the RAM expressions when they change, see RamExpression
+            // e.g. --expr "bcd(ram[0x25], ram[0x26]) - prev(bcd(ram[0x25], ram[0x26]))" : the score gained each frame
+            expressions.push_back(val);
+        } else if (arg == "--cdl") {
+            cdl_file = val;
+        } else if (arg == "--gdb") {
+            // --gdb PORT (localhost) or --gdb /path/to/unix/socket
+            gdb_addr = val;
+        } else if (arg == "--shm-export") {
+            // --shm-export NAME : frames, audio and RAM to the shared memory NAME, see nesshm.h
+            shm_name = val;
+        } else if (arg == "--netplay") {
+            // --netplay PLAYER:LOCALPORT:HOST:PORT, PLAYER 1 or 2
+            netplay = val;
+        } else if (arg == "--input-delay") {
+            // netplay frames of input delay, fewer rollbacks
+            input_delay = std::stoi(val);
+        } else if (arg == "--bench-netplay") {
+            // --bench-netplay FRAMES : rollback netplay over a simulated link and exit
+            bench_netplay_frames = std::stol(val);
+        } else if (arg == "--checkpoint-interval") {
+            // cpu cycles between two time travel checkpoints
+            checkpoint_interval = std::stoul(val);
+        } else if (arg == "--checkpoint-dir") {
+            // --checkpoint-dir DIR : checkpoints to disk in the background, see CheckpointWriter
+            checkpoint_dir = val;
+        } else if (arg == "--checkpoint-every") {
+            // frames between two disk checkpoints
+            checkpoint_every = std::stol(val);
+            if (checkpoint_every <= 0) {
+                std::cerr << "--checkpoint-every must be at least 1" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--resume") {
+            // --resume DIR : start from the newest valid checkpoint of DIR
+            resume_dir = val;
+        } else if (arg == "--beam-racing") {
+            // --beam-racing SLICES : present the dot renderer frames by slices of rows
+            beam_slices = std::stoi(val);
+        } else if (arg == "--mosaic") {
+            // --mosaic COUNT : COUNT games at once in a grid, see Mosaic
+            mosaic_count = std::stoi(val);
+        } else if (arg == "--mosaic-workers") {
+            // threads the mosaic instances share, default all the cores but one
+            mosaic_workers = std::stoi(val);
+        } else if (arg == "--mosaic-rom") {
+            // --mosaic-rom PATH, repeated : the games of the mosaic in turn, default the loaded one
+            mosaic_roms.push_back(val);
+        } else if (arg == "--bench-mosaic") {
+            // --bench-mosaic COUNT : COUNT instances headless for 5 s and exit
+            mosaic_count = std::stoi(val);
+            bench_mosaic_run = true;
+        } else if (arg == "--index-roms") {
+            // --index-roms DIR : index the ROMs of DIR and its subdirectories into the --rom-index FILE and exit
+            index_dir = val;
+        } else if (arg == "--bench-ppu") {
+            // --bench-ppu FRAMES : compare the renderers and exit
+            bench_frames = std::stol(val);
+        } else if (arg == "--bench-audio") {
+            // --bench-audio SECONDS : render SECONDS of audio with and without the output filter and exit
+            bench_audio_seconds = std::stol(val);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (!index_dir.empty()) {
+        if (rom_index_file.empty()) {
+            std::cerr << "--index-roms needs --rom-index FILE" << std::endl;
+            return 1;
+        }
+        int nthreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        RomIndex::BuildStats stats = RomIndex::build(index_dir, rom_index_file, nthreads, std::cerr);
+        std::cout << stats.roms << " ROMs indexed of " << stats.files << " files (" << stats.failed << " failed), "
+            << stats.bytes / 1e6 << " MB hashed in " << stats.seconds << " s" << std::endl;
+        return 0;
+    }
+    if (bench_frames > 0) {
+        bench_ppu(&nes, bench_frames);
+        return 0;
+    }
+    if (bench_audio_seconds > 0) {
+        bench_audio(bench_audio_seconds);
+        return 0;
+    }
+    if (bench_netplay_frames > 0) {
+        bench_netplay(cart, bench_netplay_frames);
+        return 0;
+    }
+    if (mosaic_count > 0) {
+        std::vector<InesRom> carts;
+        for (const std::string& path : mosaic_roms) {
+            carts.emplace_back();
+            loadInes(path, &carts.back());
+        }
+        if (carts.empty()) {
+            carts.push_back(cart);
+        }
+        Mosaic mosaic(carts, mosaic_count, mosaic_workers);
+        mosaic.set_skip_lag_frames(skip_lag);
+        if (bench_mosaic_run) {
+            bench_mosaic(&mosaic, 5);
+            return 0;
+        }
+        mosaic.start();
+        mosaic_ui(&mosaic);
+        mosaic.stop();
+        mosaic.print_stats(std::cout);
+        return 0;
+    }
+    if (!netplay.empty() && (ppu_thread || !gdb_addr.empty())) {
+        // both replace the state under them
+        std::cerr << "--netplay can't be used with --ppu-thread nor --gdb" << std::endl;
+        return 1;
+    }
+    if (!netplay.empty() && (!checkpoint_dir.empty() || !resume_dir.empty())) {
+        // the session's frames are agreed with the peer from power on
+        std::cerr << "--netplay can't be used with --checkpoint-dir nor --resume" << std::endl;
+        return 1;
+    }
+    if (!resume_dir.empty()) {
+        auto state = std::make_unique<Nes::State>();
+        std::string path;
+        if (!CheckpointWriter::load_latest(resume_dir, rom_crc32(cart), state.get(), &path)) {
+            std::cerr << "No valid checkpoint of this game in " << resume_dir << std::endl;
+            return 1;
+        }
+        nes.set_state(*state);
+        std::cout << "resumed from " << path << std::endl;
+    }
 
-    parseInes("../rom/Donkey-Kong-NES-Disassembly/dk.nes", prg, chr);
-    LstDebuggerAsm6 lst("../rom/Donkey-Kong-NES-Disassembly/dk.lst", true);
+    std::unique_ptr<RamExpressionBatch> telemetry;
+    std::vector<int64_t> telemetry_values[2]; // this frame, last printed
+    if (!expressions.empty()) {
+        telemetry = std::make_unique<RamExpressionBatch>(expressions, 1);
+        telemetry_values[0].assign(expressions.size(), 0);
+        telemetry_values[1].assign(expressions.size(), 0);
+        plugins.on_frame_end([&](long frame_no) {
+            if (skip_lag && nes.ppu.is_lag_frame()) {
+                return;
+            }
+            const uint8_t * ram = nes.ram.direct_ptr(0x0000, false);
+            telemetry->evaluate(&ram, telemetry_values[0].data());
+            if (telemetry_values[0] != telemetry_values[1]) {
+                std::cout << "frame " << frame_no << ":";
+                for (int64_t value : telemetry_values[0]) {
+                    std::cout << " " << value;
+                }
+                std::cout << std::endl;
+                telemetry_values[1] = telemetry_values[0];
+            }
+        });
+    }
 
-    CartridgeRomDevice rom(prg, 0xc000);
-    RamDevice ram(0x0000);
-    ApuDevice apu;
-    PpuDevice ppu(chr, &ram, &apu);
+    // after the cheats, the hooks see the frozen values
+    plugins.install();
 
-    Memory mem({
-        {0x0000, &ram},
-        {0x2000, &ppu},
-        {0x4000, &apu},
-        {0x4014, &ppu},
-        {0xc000, &rom},
-    });
+    Disassembler disasm(&nes.mem, &nes.cpu, lst.get());
+    nes.cpu.set_disassembler(&disasm);
 
-    Emu6502 cpu(&mem, false, &lst);
-    ppu.set_cpu(&cpu); // urgh
-    apu.set_cpu(&cpu); // urgh
+    CodeDataLogger cdl(&nes.mem, nes.mapper.get(), cart.prg.size(), cart.chr.size());
+    if (!cdl_file.empty()) {
+        cdl.start();
+        nes.cpu.set_cdl(&cdl);
+        nes.ppu.set_cdl(&cdl);
+    }
 
+    GdbStub gdb(&nes);
+    std::unique_ptr<TimeTravel> time_travel;
+    if (!gdb_addr.empty()) {
+        gdb.listen(gdb_addr);
+        time_travel = std::make_unique<TimeTravel>(&nes, checkpoint_interval);
+        gdb.set_time_travel(time_travel.get());
+    }
+
+    PpuViewer viewer(&nes.ppu);
+    if (ppu_viewer) {
+        viewer.start();
+    }
+
+    FramePipeline pipeline;
+    nes.ppu.set_frame_pipeline(&pipeline);
+    if (beam_slices > 0) {
+        nes.ppu.set_dot_renderer(true);
+        nes.ppu.set_beam_slices(beam_slices);
+    }
+    ShmExporter shm_export(&snapshots);
+    if (!shm_name.empty()) {
+        shm_export.open(shm_name);
+        pipeline.set_exporter(&shm_export);
+        nes.apu.set_audio_export(&shm_export);
+    }
+    pipeline.start();
+
+    PpuRenderThread render_thread(&nes.ppu);
+    if (ppu_thread) {
+        render_thread.start();
+    }
+
+    std::unique_ptr<UdpTransport> transport;
+    std::unique_ptr<RollbackSession> session;
+    std::atomic<uint8_t> pad {0};
+    if (!netplay.empty()) {
+        size_t sep1 = netplay.find(':');
+        size_t sep2 = netplay.find(':', sep1 + 1);
+        size_t sep3 = netplay.rfind(':');
+        if (sep1 == std::string::npos || sep2 == std::string::npos || sep3 == sep2) {
+            std::cerr << "Bad --netplay, expected PLAYER:LOCALPORT:HOST:PORT" << std::endl;
+            return 1;
+        }
+        transport = std::make_unique<UdpTransport>(std::stoi(netplay.substr(sep1 + 1, sep2 - sep1 - 1)), netplay.substr(sep2 + 1, sep3 - sep2 - 1), std::stoi(netplay.substr(sep3 + 1)));
+        session = std::make_unique<RollbackSession>(&nes, transport.get(), std::stoi(netplay.substr(0, sep1)) - 1, input_delay);
+    }
+
+    std::unique_ptr<CheckpointWriter> checkpoints;
+    if (!checkpoint_dir.empty()) {
+        checkpoints = std::make_unique<CheckpointWriter>(&nes, rom_crc32(cart), checkpoint_dir, checkpoint_every);
+        checkpoints->start();
+    }
 
     bool kill = false;
-    std::thread t1(run, &cpu, &ppu, &apu, &kill); 
+    std::thread t1;
+    if (session) {
+        t1 = std::thread(run_netplay, &nes, session.get(), &pad, &kill);
+    } else {
+        t1 = std::thread(beam_slices > 0 ? run_beam_raced : run, &nes, gdb_addr.empty() ? nullptr : &gdb, time_travel.get(), checkpoints.get(), &kill);
+    }
 
-    ui(&ppu, &apu);
+    ui(&nes.ppu, &nes.apu, &search, &search_ram, &pipeline, session ? &pad : nullptr);
 
     kill = true;
 
     t1.join();
+    render_thread.stop();
+    pipeline.stop();
+    pipeline.print_stats(std::cout);
+    std::cout << "lag frames: " << nes.ppu.get_lag_frame_count() << " of " << nes.ppu.get_frame_no() << std::endl;
+    if (checkpoints) {
+        checkpoints->stop();
+        checkpoints->print_stats(std::cout);
+    }
+    viewer.stop();
+
+    if (!cdl_file.empty()) {
+        cdl.save(cdl_file);
+    }
     
     return 0;
 }
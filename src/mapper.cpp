@@ -0,0 +1,176 @@
+#include <string>
+
+#include "mapper.hpp"
+#include "mmc3.hpp"
+#include "vrc6.hpp"
+#include "fme7.hpp"
+#include "namco163.hpp"
+
+std::unique_ptr<MapperDevice> MapperDevice::create(const InesRom& cart, PpuDevice * ppu, ApuDevice * apu, Scheduler * scheduler) {
+    switch (cart.mapper) {
+    case 0:
+        return nullptr;
+    case 4:
+        return std::make_unique<Mmc3Device>(cart.prg, cart.chr, ppu, scheduler);
+    case 19:
+        return std::make_unique<Namco163Device>(cart.prg, cart.chr, ppu, scheduler, apu);
+    case 24:
+        return std::make_unique<Vrc6Device>(cart.prg, cart.chr, ppu, scheduler, apu, false);
+    case 26:
+        return std::make_unique<Vrc6Device>(cart.prg, cart.chr, ppu, scheduler, apu, true);
+    case 69:
+        return std::make_unique<Fme7Device>(cart.prg, cart.chr, ppu, scheduler, apu);
+    default:
+        throw std::runtime_error("Unsupported mapper " + std::to_string(cart.mapper));
+    }
+}
+
+MapperDevice::MapperDevice(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler)
+    : m_ppu(ppu), m_scheduler(scheduler), m_prg(prg), m_chr(chr) {
+    if (m_prg.size() < 0x4000 || m_prg.size() % 0x2000 != 0) {
+        throw std::runtime_error("Bad PRG size");
+    }
+    if (m_chr.empty()) {
+        // CHR RAM
+        m_chr.resize(0x2000, 0);
+    }
+    // power up : last banks everywhere, the mappers set theirs in their constructor
+    for (int slot = 0; slot < 4; slot++) {
+        set_prg_bank(slot, get_prg_bank_count() - 4 + slot);
+    }
+    for (int slot = 0; slot < 8; slot++) {
+        set_chr_bank(slot, slot);
+    }
+}
+
+void MapperDevice::set_cpu(Emu6502 * cpu) {
+    m_cpu = cpu;
+}
+
+void MapperDevice::set_memory(Memory * mem) {
+    m_mem = mem;
+}
+
+uint8_t MapperDevice::get(uint16_t addr) {
+    if (addr < 0x6000) {
+        return read_register(addr);
+    }
+    if (addr < 0x8000) {
+        if (m_prg_6000 == m_prg_ram && !m_prg_ram_enabled) {
+            return 0;
+        }
+        return m_prg_6000[addr - 0x6000];
+    }
+    return m_prg_banks[(addr - 0x8000) >> 13][addr & 0x1fff];
+}
+
+uint8_t MapperDevice::peek(uint16_t addr) {
+    if (addr < 0x6000) {
+        return peek_register(addr);
+    }
+    return get(addr);
+}
+
+void MapperDevice::set(uint16_t addr, uint8_t val) {
+    if (addr >= 0x6000 && addr < 0x8000) {
+        // ROM mapped at 0x6000 ignores the writes, so does protected RAM
+        if (m_prg_6000 == m_prg_ram && m_prg_ram_enabled && (m_prg_ram_write_mask & (1 << ((addr - 0x6000) >> 11)))) {
+            m_prg_ram[addr - 0x6000] = val;
+        }
+        return;
+    }
+    write_register(addr, val);
+}
+
+uint8_t * MapperDevice::direct_ptr(uint16_t page_addr, bool write) {
+    if (page_addr < 0x6000) {
+        return nullptr;
+    }
+    if (page_addr < 0x8000) {
+        if (m_prg_6000 == m_prg_ram && !m_prg_ram_enabled) {
+            return nullptr;
+        }
+        if (write && (m_prg_6000 != m_prg_ram || !(m_prg_ram_write_mask & (1 << ((page_addr - 0x6000) >> 11))))) {
+            return nullptr;
+        }
+        return &m_prg_6000[page_addr - 0x6000];
+    }
+    // writes are register accesses
+    if (write) {
+        return nullptr;
+    }
+    return &m_prg_banks[(page_addr - 0x8000) >> 13][page_addr & 0x1fff];
+}
+
+void MapperDevice::remap(uint8_t first_page, int npages) {
+    if (m_mem == nullptr) {
+        return;
+    }
+    for (int page = 0; page < npages; page++) {
+        m_mem->remap_page(first_page + page);
+    }
+}
+
+void MapperDevice::set_prg_bank(int slot, int bank) {
+    int nbanks = get_prg_bank_count();
+    uint8_t * ptr = &m_prg[(((bank % nbanks) + nbanks) % nbanks) * 0x2000];
+    if (ptr != m_prg_banks[slot]) {
+        m_prg_banks[slot] = ptr;
+        remap(0x80 + slot * 0x20, 0x20);
+    }
+}
+
+void MapperDevice::set_prg_6000_bank(int bank) {
+    uint8_t * ptr = m_prg_ram;
+    if (bank >= 0) {
+        ptr = &m_prg[(bank % get_prg_bank_count()) * 0x2000];
+    }
+    if (ptr != m_prg_6000) {
+        m_prg_6000 = ptr;
+        remap(0x60, 0x20);
+    }
+}
+
+void MapperDevice::set_prg_ram_access(bool enabled, uint8_t write_mask) {
+    write_mask &= 0b1111;
+    if (enabled != m_prg_ram_enabled || write_mask != m_prg_ram_write_mask) {
+        m_prg_ram_enabled = enabled;
+        m_prg_ram_write_mask = write_mask;
+        remap(0x60, 0x20);
+    }
+}
+
+void MapperDevice::set_chr_bank(int slot, int bank) {
+    int nbanks = m_chr.size() / 0x400;
+    m_ppu->set_chr_bank(slot, &m_chr[(bank % nbanks) * 0x400]);
+}
+
+long MapperDevice::prg_offset(uint16_t addr) const {
+    if (addr >= 0x8000) {
+        return (m_prg_banks[(addr - 0x8000) >> 13] - m_prg.data()) + (addr & 0x1fff);
+    }
+    if (addr >= 0x6000 && m_prg_6000 != m_prg_ram) {
+        return (m_prg_6000 - m_prg.data()) + (addr - 0x6000);
+    }
+    return -1;
+}
+
+long MapperDevice::chr_offset(uint16_t addr) const {
+    // the PPU may also map other memory than the CHR (nametable RAM)
+    uintptr_t bank = reinterpret_cast<uintptr_t>(m_ppu->get_chr_bank((addr >> 10) & 0b111));
+    uintptr_t chr = reinterpret_cast<uintptr_t>(m_chr.data());
+    if (bank < chr || bank >= chr + m_chr.size()) {
+        return -1;
+    }
+    return (bank - chr) + (addr & 0x3ff);
+}
+
+void MapperDevice::get_state(State * state) {
+    std::memcpy(state->prg_ram, m_prg_ram, sizeof(m_prg_ram));
+    save_regs(state->regs);
+}
+
+void MapperDevice::set_state(const State& state) {
+    std::memcpy(m_prg_ram, state.prg_ram, sizeof(m_prg_ram));
+    load_regs(state.regs);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "device.hpp"
+#include "cpumem.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "apu.hpp"
+#include "scheduler.hpp"
+#include "utils.hpp"
+
+static const size_t MAPPER_REGS_SIZE = 256;
+
+/*
+Base of the bank switching cartridges
+PRG : four 8 KB slots from 0x8000, and 8 KB at 0x6000 (RAM unless a bank
+is mapped there), CHR : eight 1 KB slots handed to the PPU.
+The derived mappers decode their registers in write_register and pick the
+banks with set_prg_bank / set_chr_bank. Their registers are saved as a
+blob (save_regs / load_regs) so that the console state stays a plain struct.
+*/
+class MapperDevice : public Device {
+ public:
+    struct State {
+        uint8_t prg_ram[0x2000];
+        uint8_t regs[MAPPER_REGS_SIZE];
+    };
+
+    // nullptr for mapper 0 (no banking), throws for the unsupported ones
+    static std::unique_ptr<MapperDevice> create(const InesRom& cart, PpuDevice * ppu, ApuDevice * apu, Scheduler * scheduler);
+
+    MapperDevice(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler);
+    virtual ~MapperDevice() {}
+    void set_cpu(Emu6502 * cpu);
+    void set_memory(Memory * mem);
+    // first address decoded by the mapper
+    virtual uint16_t get_base_addr() { return 0x6000; }
+
+    uint8_t get(uint16_t addr);
+    uint8_t peek(uint16_t addr);
+    void set(uint16_t addr, uint8_t val);
+    uint8_t * direct_ptr(uint16_t page_addr, bool write);
+
+    // EVENT_MAPPER_IRQ handler
+    virtual void irq_event(uint64_t cycle) {}
+
+    void get_state(State * state);
+    void set_state(const State& state);
+
+    // the offsets in the PRG and CHR ROMs of what addr maps now (CHR : PPU
+    // address below 0x2000), -1 if it isn't ROM (PRG RAM, registers, CHR RAM)
+    long prg_offset(uint16_t addr) const;
+    long chr_offset(uint16_t addr) const;
+    // 8 KB, even while a ROM bank is mapped at 0x6000
+    const uint8_t * get_prg_ram() const { return m_prg_ram; }
+
+ protected:
+    // writes from 0x8000, and all the accesses below 0x6000
+    virtual void write_register(uint16_t addr, uint8_t val) = 0;
+    virtual uint8_t read_register(uint16_t addr) { return 0; }
+    // read_register without side effects, for the debugger views
+    virtual uint8_t peek_register(uint16_t addr) { return read_register(addr); }
+    // load_regs must also restore the banks
+    virtual void save_regs(uint8_t * regs) = 0;
+    virtual void load_regs(const uint8_t * regs) = 0;
+
+    // bank numbers wrap around the ROM size
+    void set_prg_bank(int slot, int bank);
+    // -1 : PRG RAM
+    void set_prg_6000_bank(int bank);
+    // disabled PRG RAM reads 0 (open bus), bit n of write_mask : the 2 KB
+    // from 0x6000 + 0x800 * n can be written
+    void set_prg_ram_access(bool enabled, uint8_t write_mask = 0b1111);
+    void set_chr_bank(int slot, int bank);
+    int get_prg_bank_count() const { return m_prg.size() / 0x2000; }
+
+    PpuDevice * m_ppu;
+    Scheduler * m_scheduler;
+    Emu6502 * m_cpu = nullptr;
+
+ private:
+    void remap(uint8_t first_page, int npages);
+
+    Memory * m_mem = nullptr;
+    std::vector<uint8_t> m_prg;
+    std::vector<uint8_t> m_chr;
+    uint8_t m_prg_ram[0x2000] = {0};
+    uint8_t * m_prg_banks[4] = {nullptr}; // 8 KB each, from 0x8000
+    uint8_t * m_prg_6000 = m_prg_ram;
+    bool m_prg_ram_enabled = true;
+    uint8_t m_prg_ram_write_mask = 0b1111;
+};
@@ -0,0 +1,194 @@
+#include "mmc3.hpp"
+
+Mmc3Device::Mmc3Device(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler)
+    : MapperDevice(prg, chr, ppu, scheduler) {
+    update_banks();
+    m_ppu->set_setup_observer(this);
+}
+
+void Mmc3Device::write_register(uint16_t addr, uint8_t val) {
+    if (addr < 0x8000) {
+        return;
+    }
+    // the registers are mirrored, only A0 and the 8 KB range matter
+    switch (addr & 0xe001) {
+    case KEY_MMC3_BANK_SELECT:
+        m_regs.bank_select = val;
+        update_banks();
+        break;
+    case KEY_MMC3_BANK_DATA:
+        m_regs.bank_regs[m_regs.bank_select & 0b111] = val;
+        update_banks();
+        break;
+    case KEY_MMC3_MIRRORING:
+        m_regs.mirroring = val & 1;
+        break;
+    case KEY_MMC3_PRG_RAM_PROTECT:
+        m_regs.prg_ram_protect = val;
+        break;
+    case KEY_MMC3_IRQ_LATCH:
+        sync();
+        m_regs.irq_latch = val;
+        schedule_irq();
+        break;
+    case KEY_MMC3_IRQ_RELOAD:
+        sync();
+        m_regs.irq_counter = 0;
+        m_regs.irq_reload = true;
+        schedule_irq();
+        break;
+    case KEY_MMC3_IRQ_DISABLE:
+        // also acknowledges the pending IRQ
+        sync();
+        m_regs.irq_enabled = false;
+        m_cpu->set_irq_line(IRQ_SOURCE_MAPPER, false);
+        schedule_irq();
+        break;
+    case KEY_MMC3_IRQ_ENABLE:
+        sync();
+        m_regs.irq_enabled = true;
+        schedule_irq();
+        break;
+    }
+}
+
+void Mmc3Device::update_banks() {
+    /*
+    PRG : 0x8000 and 0xc000 swap with bit 6 of bank select, 0xa000 is R7
+    and 0xe000 is fixed to the last bank
+    CHR : two 2 KB banks (R0, R1) and four 1 KB banks (R2-R5), the halves
+    of the pattern tables swap with bit 7 of bank select
+    */
+    int nprg = get_prg_bank_count();
+    if ((m_regs.bank_select & BIT6) == 0) {
+        set_prg_bank(0, m_regs.bank_regs[6]);
+        set_prg_bank(2, nprg - 2);
+    } else {
+        set_prg_bank(0, nprg - 2);
+        set_prg_bank(2, m_regs.bank_regs[6]);
+    }
+    set_prg_bank(1, m_regs.bank_regs[7]);
+    set_prg_bank(3, nprg - 1);
+
+    int chr_banks[8] = {
+        m_regs.bank_regs[0] & 0xfe, m_regs.bank_regs[0] | 1, m_regs.bank_regs[1] & 0xfe, m_regs.bank_regs[1] | 1,
+        m_regs.bank_regs[2], m_regs.bank_regs[3], m_regs.bank_regs[4], m_regs.bank_regs[5],
+    };
+    for (int slot = 0; slot < 8; slot++) {
+        int ppu_slot = (m_regs.bank_select & BIT7) ? slot ^ 4 : slot;
+        set_chr_bank(ppu_slot, chr_banks[slot]);
+    }
+}
+
+long Mmc3Device::a12_rise_dot() {
+    /*
+    Dot of each rendered scanline at which A12 rises, -1 if it doesn't
+    BG at 0x0000 : when the sprite fetches start (8x16 sprites are assumed
+    to be at 0x1000, as games using the counter do)
+    BG at 0x1000 : when the fetches of the next line tiles start
+    TODO : BG and sprites both at 0x1000 clock at every fetch on the hardware
+    */
+    uint8_t ppumask = m_ppu->get_ppumask();
+    uint8_t ppuctrl = m_ppu->get_ppuctrl();
+    if ((ppumask & (PPUMASK_SHOWBG | PPUMASK_SHOWSPRITES)) == 0) {
+        return -1;
+    }
+    if ((ppuctrl & PPUCTRL_BGPATTTABLE) == 0) {
+        if ((ppuctrl & (PPUCTRL_OAMPATTTABLE | PPUCTRL_SPRITESIZE)) == 0) {
+            return -1;
+        }
+        return 260;
+    }
+    return 324;
+}
+
+int64_t Mmc3Device::next_clock_tick(int64_t tick, long dot) {
+    /*
+    First clock strictly after tick
+    Frame ticks start at scanline 241, so the pre-render line (261) is the
+    line 20 of the frame and the visible lines 0-239 are the lines 21-260
+    */
+    int64_t origin = 3 * static_cast<int64_t>(m_scheduler->now()) - m_ppu->get_frame_tick();
+    int64_t frame_pos = (tick - origin) % PPU_FRAME_TICKS;
+    if (frame_pos < 0) {
+        frame_pos += PPU_FRAME_TICKS;
+    }
+    int64_t frame_start = tick - frame_pos;
+    int64_t line = 0;
+    if (frame_pos >= dot - 1) {
+        line = (frame_pos - (dot - 1)) / PPU_SCANLINE_TICKS + 1;
+    }
+    if (line < 20) {
+        line = 20;
+    }
+    if (line > 260) {
+        frame_start += PPU_FRAME_TICKS;
+        line = 20;
+    }
+    return frame_start + line * PPU_SCANLINE_TICKS + dot - 1;
+}
+
+void Mmc3Device::clock_counter() {
+    if (m_regs.irq_counter == 0 || m_regs.irq_reload) {
+        m_regs.irq_counter = m_regs.irq_latch;
+        m_regs.irq_reload = false;
+    } else {
+        m_regs.irq_counter--;
+    }
+    if (m_regs.irq_counter == 0 && m_regs.irq_enabled) {
+        m_cpu->set_irq_line(IRQ_SOURCE_MAPPER, true);
+    }
+}
+
+void Mmc3Device::sync() {
+    // apply the clocks since the last sync, with the current PPU setup
+    int64_t now_tick = 3 * static_cast<int64_t>(m_scheduler->now());
+    long dot = a12_rise_dot();
+    if (dot >= 0) {
+        for (int64_t tick = next_clock_tick(m_regs.sync_tick, dot); tick <= now_tick; tick = next_clock_tick(tick, dot)) {
+            clock_counter();
+        }
+    }
+    m_regs.sync_tick = now_tick;
+}
+
+void Mmc3Device::schedule_irq() {
+    // must follow a sync
+    long dot = a12_rise_dot();
+    if (!m_regs.irq_enabled || dot < 0) {
+        m_scheduler->cancel(EVENT_MAPPER_IRQ);
+        return;
+    }
+    int nclocks = m_regs.irq_counter;
+    if (m_regs.irq_counter == 0 || m_regs.irq_reload) {
+        nclocks = 1 + m_regs.irq_latch;
+    }
+    int64_t tick = m_regs.sync_tick;
+    for (int i = 0; i < nclocks; i++) {
+        tick = next_clock_tick(tick, dot);
+    }
+    // first cpu cycle at which the PPU passed the clock
+    m_scheduler->schedule(EVENT_MAPPER_IRQ, (tick + 2) / 3);
+}
+
+void Mmc3Device::irq_event(uint64_t cycle) {
+    sync();
+    schedule_irq();
+}
+
+void Mmc3Device::ppu_setup_changing() {
+    sync();
+}
+
+void Mmc3Device::ppu_setup_changed() {
+    schedule_irq();
+}
+
+void Mmc3Device::save_regs(uint8_t * regs) {
+    std::memcpy(regs, &m_regs, sizeof(m_regs));
+}
+
+void Mmc3Device::load_regs(const uint8_t * regs) {
+    std::memcpy(&m_regs, regs, sizeof(m_regs));
+    update_banks();
+}
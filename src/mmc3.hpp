@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "mapper.hpp"
+
+enum {
+    KEY_MMC3_BANK_SELECT = 0x8000,
+    KEY_MMC3_BANK_DATA = 0x8001,
+    KEY_MMC3_MIRRORING = 0xa000,
+    KEY_MMC3_PRG_RAM_PROTECT = 0xa001,
+    KEY_MMC3_IRQ_LATCH = 0xc000,
+    KEY_MMC3_IRQ_RELOAD = 0xc001,
+    KEY_MMC3_IRQ_DISABLE = 0xe000,
+    KEY_MMC3_IRQ_ENABLE = 0xe001,
+};
+
+/*
+MMC3 (iNES mapper 4) : PRG/CHR banking, PRG RAM at 0x6000 and the
+scanline IRQ counter
+https://www.nesdev.org/wiki/MMC3
+
+The counter is clocked by the rising edges of the PPU A12 line, once per
+rendered scanline with the usual pattern table setups. Rather than watching
+A12 at each PPU dot, the clocks are derived from the frame position : the
+counter is brought up to date (sync) when the CPU or the PPU setup touches
+it, and the cycle at which it will reach zero is scheduled as an event.
+*/
+class Mmc3Device : public MapperDevice, public PpuSetupObserver {
+ public:
+    Mmc3Device(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler);
+
+    void ppu_setup_changing();
+    void ppu_setup_changed();
+    void irq_event(uint64_t cycle);
+
+ protected:
+    void write_register(uint16_t addr, uint8_t val);
+    void save_regs(uint8_t * regs);
+    void load_regs(const uint8_t * regs);
+
+ private:
+    void update_banks();
+    void sync();
+    void schedule_irq();
+    void clock_counter();
+    long a12_rise_dot();
+    int64_t next_clock_tick(int64_t tick, long dot);
+
+    struct Regs {
+        uint8_t bank_select;
+        uint8_t bank_regs[8];
+        // TODO : the PPU has no nametable mirroring yet
+        uint8_t mirroring;
+        // TODO : not enforced
+        uint8_t prg_ram_protect;
+        uint8_t irq_latch;
+        uint8_t irq_counter;
+        bool irq_reload;
+        bool irq_enabled;
+        // PPU ticks (3 per cpu cycle) up to which the counter was clocked
+        int64_t sync_tick;
+    };
+    static_assert(sizeof(Regs) <= MAPPER_REGS_SIZE, "MMC3 registers don't fit in the mapper state");
+
+    Regs m_regs = {};
+};
@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MOSAIC_HAS_AVX2_PATH
+#endif
+
+#include "mosaic.hpp"
+
+/*
+Downscaling : the indices are converted to RGBX (R, G, B, 0 in memory,
+a uint32_t per pixel) then halved once or twice, each halving a rounded
+up average of the 2 rows then of the 2 columns, as _mm256_avg_epu8. The
+scalar path does the same roundings, both give the same bytes.
+*/
+
+struct RgbxPalette {
+    uint32_t colors[64];
+
+    RgbxPalette() {
+        for (int i = 0; i < 64; i++) {
+            colors[i] = NES_COLORS[i][0] | (NES_COLORS[i][1] << 8) | (NES_COLORS[i][2] << 16);
+        }
+    }
+};
+static const RgbxPalette RGBX_PALETTE;
+
+static inline uint32_t avg_rgbx(uint32_t a, uint32_t b) {
+    // (a + b + 1) >> 1 per byte, without carries between them
+    return (a | b) - (((a ^ b) >> 1) & 0x7f7f7f7f);
+}
+
+static void palette_row_scalar(const uint8_t * indices, uint32_t * dst, int width) {
+    for (int x = 0; x < width; x++) {
+        dst[x] = RGBX_PALETTE.colors[indices[x] & 0x3f];
+    }
+}
+
+// width : of dst, row0 and row1 are twice as wide
+static void halve_row_scalar(const uint32_t * row0, const uint32_t * row1, uint32_t * dst, int width) {
+    for (int x = 0; x < width; x++) {
+        dst[x] = avg_rgbx(avg_rgbx(row0[2*x], row1[2*x]), avg_rgbx(row0[2*x + 1], row1[2*x + 1]));
+    }
+}
+
+#ifdef MOSAIC_HAS_AVX2_PATH
+__attribute__((target("avx2")))
+static void palette_row_avx2(const uint8_t * indices, uint32_t * dst, int width) {
+    const __m256i mask = _mm256_set1_epi32(0x3f);
+    const int * colors = reinterpret_cast<const int*>(RGBX_PALETTE.colors);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i index = _mm256_and_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + x))), mask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_i32gather_epi32(colors, index, 4));
+    }
+    palette_row_scalar(indices + x, dst + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void halve_row_avx2(const uint32_t * row0, const uint32_t * row1, uint32_t * dst, int width) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i v0 = _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 2*x)),
+                                     _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 2*x)));
+        __m256i v1 = _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 2*x + 8)),
+                                     _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 2*x + 8)));
+        // even and odd pixels, per 128 bits lane : v0 0 2 v1 0 2 | v0 4 6 v1 4 6
+        __m256 even = _mm256_shuffle_ps(_mm256_castsi256_ps(v0), _mm256_castsi256_ps(v1), _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 odd = _mm256_shuffle_ps(_mm256_castsi256_ps(v0), _mm256_castsi256_ps(v1), _MM_SHUFFLE(3, 1, 3, 1));
+        __m256i h = _mm256_avg_epu8(_mm256_castps_si256(even), _mm256_castps_si256(odd));
+        // pixels 0 1 4 5 2 3 6 7 back in order
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_permute4x64_epi64(h, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    halve_row_scalar(row0 + 2*x, row1 + 2*x, dst + x, width - x);
+}
+#endif
+
+static void palette_row(const uint8_t * indices, uint32_t * dst, int width) {
+#ifdef MOSAIC_HAS_AVX2_PATH
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2) {
+        palette_row_avx2(indices, dst, width);
+    } else {
+        palette_row_scalar(indices, dst, width);
+    }
+#else
+    palette_row_scalar(indices, dst, width);
+#endif
+}
+
+static void halve_row(const uint32_t * row0, const uint32_t * row1, uint32_t * dst, int width) {
+#ifdef MOSAIC_HAS_AVX2_PATH
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2) {
+        halve_row_avx2(row0, row1, dst, width);
+    } else {
+        halve_row_scalar(row0, row1, dst, width);
+    }
+#else
+    halve_row_scalar(row0, row1, dst, width);
+#endif
+}
+
+// src rows 0 to 2*height - 1 into dst rows 0 to height - 1, may be src : a row is written after reading it
+static void halve(const cv::Mat& src, cv::Mat * dst, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        halve_row(src.ptr<uint32_t>(2*y), src.ptr<uint32_t>(2*y + 1), dst->ptr<uint32_t>(y), width);
+    }
+}
+
+void Mosaic::downscale(const cv::Mat& indices, int factor, cv::Mat * dst, cv::Mat * scratch) {
+    int width = indices.cols / factor;
+    int height = indices.rows / factor;
+    if (factor == 1) {
+        for (int y = 0; y < height; y++) {
+            palette_row(indices.ptr<uint8_t>(y), dst->ptr<uint32_t>(y), width);
+        }
+        return;
+    }
+    if (factor != 2 && factor != 4) {
+        throw std::runtime_error("Invalid mosaic scale");
+    }
+    scratch->create(indices.rows, indices.cols, CV_8UC4);
+    for (int y = 0; y < indices.rows; y++) {
+        palette_row(indices.ptr<uint8_t>(y), scratch->ptr<uint32_t>(y), indices.cols);
+    }
+    if (factor == 4) {
+        halve(*scratch, scratch, indices.cols / 2, indices.rows / 2);
+    }
+    halve(*scratch, dst, width, height);
+}
+
+Mosaic::Mosaic(const std::vector<InesRom>& carts, int ninstances, int nworkers, int scale) : m_nworkers(nworkers), m_scale(scale) {
+    if (carts.empty() || ninstances <= 0 || nworkers <= 0) {
+        throw std::runtime_error("A mosaic needs games, instances and workers");
+    }
+    int cols = std::ceil(std::sqrt(static_cast<double>(ninstances)));
+    int rows = (ninstances + cols - 1) / cols;
+    if (m_scale == 0) {
+        // about 1024 pixels wide at most
+        m_scale = cols <= 4 ? 1 : (cols <= 8 ? 2 : 4);
+    }
+    if (m_scale != 1 && m_scale != 2 && m_scale != 4) {
+        throw std::runtime_error("Invalid mosaic scale");
+    }
+    int cell_width = 256 / m_scale;
+    int cell_height = 240 / m_scale;
+    m_canvas = cv::Mat::zeros(rows * cell_height, cols * cell_width, CV_8UC4);
+    m_period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(PPU_FRAME_TICKS / (3.0 * CLOCK_FREQUENCY)));
+    for (int i = 0; i < ninstances; i++) {
+        auto instance = std::make_unique<Instance>();
+        instance->nes = std::make_unique<Nes>(carts[i % carts.size()]);
+        // still emulated, not played
+        instance->nes->apu.set_audio_muted(true);
+        instance->cell = cv::Rect((i % cols) * cell_width, (i / cols) * cell_height, cell_width, cell_height);
+        m_instances.push_back(std::move(instance));
+    }
+}
+
+Mosaic::~Mosaic() {
+    stop();
+}
+
+void Mosaic::start() {
+    if (!m_workers.empty()) {
+        return;
+    }
+    m_done = false;
+    m_started = Clock::now();
+    // spread over a frame, not all due at once
+    for (size_t i = 0; i < m_instances.size(); i++) {
+        m_instances[i]->due = m_started + m_period * i / m_instances.size();
+    }
+    for (int i = 0; i < m_nworkers; i++) {
+        m_workers.emplace_back(&Mosaic::run_worker, this);
+    }
+}
+
+void Mosaic::stop() {
+    if (m_workers.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_wakeup.notify_all();
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+    m_workers.clear();
+    m_stopped = Clock::now();
+}
+
+cv::Rect Mosaic::get_cell(int instance) const {
+    return m_instances[instance]->cell;
+}
+
+uint32_t Mosaic::get_cell_sequence(int instance) const {
+    return m_instances[instance]->seq.load(std::memory_order_acquire);
+}
+
+bool Mosaic::is_cell_unchanged(int instance, uint32_t seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return m_instances[instance]->seq.load(std::memory_order_relaxed) == seq;
+}
+
+void Mosaic::run_worker() {
+    // per worker, reused by all the instances it runs
+    cv::Mat scratch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Instance * instance;
+    while ((instance = next_instance(lock)) != nullptr) {
+        lock.unlock();
+        auto start = Clock::now();
+        run_slice(instance, &scratch);
+        long cost_us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        m_busy_us += cost_us;
+        lock.lock();
+        instance->frame_cost_us = instance->frames == 0 ? cost_us : 0.9 * instance->frame_cost_us + 0.1 * cost_us;
+        instance->frames++;
+        instance->due += m_period * instance->divider;
+        instance->busy = false;
+        m_wakeup.notify_one();
+    }
+}
+
+Mosaic::Instance * Mosaic::next_instance(std::unique_lock<std::mutex>& lock) {
+    for (;;) {
+        if (m_done) {
+            return nullptr;
+        }
+        // the most overdue one, and the share of the pool the instances need
+        Instance * next = nullptr;
+        double load = 0;
+        for (auto& instance : m_instances) {
+            load += instance->frame_cost_us / std::chrono::duration<double, std::micro>(m_period * instance->divider).count();
+            if (!instance->busy && (next == nullptr || instance->due < next->due)) {
+                next = instance.get();
+            }
+        }
+        load /= m_nworkers;
+        auto now = Clock::now();
+        if (next == nullptr) {
+            m_wakeup.wait(lock);
+            continue;
+        }
+        if (next->due > now) {
+            m_wakeup.wait_until(lock, next->due);
+            continue;
+        }
+        Clock::duration period = m_period * next->divider;
+        Clock::duration late = now - next->due;
+        if (late > period) {
+            // a whole frame behind : slower rather than catching up
+            if (next->divider < MOSAIC_MAX_DIVIDER) {
+                next->divider *= 2;
+                next->slowdowns++;
+            }
+            next->due = now;
+            next->on_time = 0;
+        } else if (late < period / 4) {
+            // back to twice the rate once it has kept up for 2 s and the pool
+            // has room for the frames it adds, as many as it runs now
+            double added = next->frame_cost_us / std::chrono::duration<double, std::micro>(period).count() / m_nworkers;
+            if (next->divider > 1 && ++next->on_time >= 120 / next->divider && load + added < 0.75) {
+                next->divider /= 2;
+                next->on_time = 0;
+            }
+        } else {
+            next->on_time = 0;
+        }
+        next->busy = true;
+        return next;
+    }
+}
+
+void Mosaic::run_slice(Instance * instance, cv::Mat * scratch) {
+    Nes * nes = instance->nes.get();
+    nes->run_frame();
+    if (nes->ppu.is_lag_frame()) {
+        instance->lag_frames++;
+        if (m_skip_lag_frames) {
+            return;
+        }
+    }
+    nes->ppu.render();
+    // odd while the cell is written
+    uint32_t seq = instance->seq.load(std::memory_order_relaxed);
+    instance->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    cv::Mat cell = m_canvas(instance->cell);
+    downscale(*nes->ppu.getFrame(), m_scale, &cell, scratch);
+    instance->seq.store(seq + 2, std::memory_order_release);
+}
+
+void Mosaic::print_stats(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Clock::time_point end = m_workers.empty() ? m_stopped : Clock::now();
+    double seconds = std::chrono::duration<double>(end - m_started).count();
+    if (seconds <= 0) {
+        return;
+    }
+    long frames = 0;
+    long slowdowns = 0;
+    long lag_frames = 0;
+    long min_frames = -1;
+    long max_frames = 0;
+    double cost_us = 0;
+    int dividers[MOSAIC_MAX_DIVIDER + 1] = {0};
+    for (auto& instance : m_instances) {
+        frames += instance->frames;
+        slowdowns += instance->slowdowns;
+        lag_frames += instance->lag_frames;
+        min_frames = min_frames < 0 ? instance->frames : std::min(min_frames, instance->frames);
+        max_frames = std::max(max_frames, instance->frames);
+        cost_us += instance->frame_cost_us;
+        dividers[instance->divider]++;
+    }
+    double realtime_fps = 3.0 * CLOCK_FREQUENCY / PPU_FRAME_TICKS;
+    out << "mosaic: " << m_instances.size() << " instances on " << m_nworkers << " workers, " << seconds << " s" << std::endl;
+    out << "  " << frames / seconds << " frames/s, per instance " << min_frames / seconds << " to " << max_frames / seconds
+        << " (" << realtime_fps << " realtime)" << std::endl;
+    out << "  frame cost " << cost_us / m_instances.size() << " us, workers busy "
+        << 100.0 * m_busy_us.load() / (seconds * 1e6 * m_nworkers) << "%" << std::endl;
+    out << "  rate dividers:";
+    for (int divider = 1; divider <= MOSAIC_MAX_DIVIDER; divider *= 2) {
+        out << " 1/" << divider << ": " << dividers[divider];
+    }
+    out << ", " << slowdowns << " slowdowns" << std::endl;
+    out << "  lag frames " << lag_frames << " (" << (frames == 0 ? 0 : 100.0 * lag_frames / frames) << "%)"
+        << (m_skip_lag_frames ? ", not drawn" : "") << std::endl;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "nes.hpp"
+#include "utils.hpp"
+
+// an instance runs at 1/MOSAIC_MAX_DIVIDER of its frame rate at worst
+static const int MOSAIC_MAX_DIVIDER = 8;
+
+/*
+Mosaic : many consoles in a grid, on a few cores
+The instances are time sliced over a pool of workers, a slice being one
+emulated frame : a worker takes the instance whose frame is the most
+overdue, runs it to its next vblank, draws it and downscales it into its
+cell of the shared canvas (RGBX, what the UI streams into a single
+texture).
+Each instance has a frame budget : one frame every divider frame
+periods. Under load, an instance more than its period late doubles its
+divider (its game runs slower instead of all of them stuttering), and
+halves it again once the pool has room for it, from the measured cost of
+its frames.
+*/
+class Mosaic {
+ public:
+    typedef std::chrono::steady_clock Clock;
+
+    // scale : 1/scale of a frame per cell, 1, 2 or 4, 0 for what fits a window
+    Mosaic(const std::vector<InesRom>& carts, int ninstances, int nworkers, int scale = 0);
+    ~Mosaic();
+
+    void start();
+    void stop();
+    // the cells keep the last frame which polled the controllers, lag frames aren't drawn
+    void set_skip_lag_frames(bool skip) { m_skip_lag_frames = skip; }
+
+    int get_instance_count() const { return m_instances.size(); }
+    const cv::Mat& get_canvas() const { return m_canvas; }
+    cv::Rect get_cell(int instance) const;
+
+    /*
+    The cells are sequence locked : odd while the cell is written. Read
+    a cell when its sequence is even, and keep what was read only when
+    is_cell_unchanged(seq) afterwards, else it may be torn
+    */
+    uint32_t get_cell_sequence(int instance) const;
+    bool is_cell_unchanged(int instance, uint32_t seq) const;
+
+    void print_stats(std::ostream& out);
+
+    // NES color indices to RGBX, 1/factor in both directions : factor 1, 2 or 4
+    static void downscale(const cv::Mat& indices, int factor, cv::Mat * dst, cv::Mat * scratch);
+
+ private:
+    struct Instance {
+        std::unique_ptr<Nes> nes;
+        cv::Rect cell;
+        int divider = 1;
+        Clock::time_point due;
+        bool busy = false;         // a worker runs it
+        int on_time = 0;           // frames in a row in time
+        double frame_cost_us = 0;  // moving average of a slice
+        long frames = 0;
+        long slowdowns = 0;
+        long lag_frames = 0;
+        std::atomic<uint32_t> seq {0};
+    };
+
+    void run_worker();
+    Instance * next_instance(std::unique_lock<std::mutex>& lock);
+    void run_slice(Instance * instance, cv::Mat * scratch);
+
+    std::vector<std::unique_ptr<Instance>> m_instances;
+    int m_nworkers;
+    int m_scale;
+    bool m_skip_lag_frames = false;
+    Clock::duration m_period;  // of a frame, at divider 1
+    cv::Mat m_canvas;
+    std::mutex m_mutex;        // the scheduling fields of the instances
+    std::condition_variable m_wakeup;
+    std::vector<std::thread> m_workers;
+    bool m_done = false;
+    Clock::time_point m_started;
+    Clock::time_point m_stopped;
+    // worker time spent running slices, us
+    std::atomic<long> m_busy_us {0};
+};
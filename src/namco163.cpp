@@ -0,0 +1,152 @@
+#include <algorithm>
+
+#include "namco163.hpp"
+
+Namco163Device::Namco163Device(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler, ApuDevice * apu)
+    : MapperDevice(prg, chr, ppu, scheduler), m_apu(apu) {
+    update_banks();
+    m_apu->set_expansion_audio(&m_audio);
+}
+
+Namco163Device::~Namco163Device() {
+    m_apu->set_expansion_audio(nullptr);
+}
+
+uint8_t Namco163Device::read_register(uint16_t addr) {
+    switch (addr & 0xf800) {
+    case KEY_N163_DATA:
+        // the phases are written back to the RAM as the audio is rendered
+        m_apu->sync();
+        return m_audio.read();
+    case KEY_N163_IRQ_LOW:
+        sync();
+        return m_regs.irq_counter & 0xff;
+    case KEY_N163_IRQ_HIGH:
+        sync();
+        return (m_regs.irq_counter >> 8) | (m_regs.irq_enabled ? N163_IRQ_ENABLE : 0);
+    }
+    return 0;
+}
+
+uint8_t Namco163Device::peek_register(uint16_t addr) {
+    // the phases as last rendered, and the counter as sync would bring it
+    uint16_t counter = m_regs.irq_counter;
+    if (m_regs.irq_enabled) {
+        uint64_t elapsed = m_scheduler->now() - m_regs.sync_cycle;
+        counter = std::min<uint64_t>(counter + elapsed, N163_IRQ_COUNTER_MAX);
+    }
+    switch (addr & 0xf800) {
+    case KEY_N163_DATA:
+        return m_audio.peek();
+    case KEY_N163_IRQ_LOW:
+        return counter & 0xff;
+    case KEY_N163_IRQ_HIGH:
+        return (counter >> 8) | (m_regs.irq_enabled ? N163_IRQ_ENABLE : 0);
+    }
+    return 0;
+}
+
+void Namco163Device::write_register(uint16_t addr, uint8_t val) {
+    addr &= 0xf800;
+    if (addr >= KEY_N163_CHR && addr < 0xc000) {
+        m_regs.chr[(addr - KEY_N163_CHR) >> 11] = val;
+        update_banks();
+        return;
+    }
+    switch (addr) {
+    case KEY_N163_DATA:
+        m_apu->sync();
+        m_audio.write(val);
+        break;
+    case KEY_N163_IRQ_LOW:
+    case KEY_N163_IRQ_HIGH:
+        // both acknowledge the IRQ
+        sync();
+        if (addr == KEY_N163_IRQ_LOW) {
+            m_regs.irq_counter = (m_regs.irq_counter & 0x7f00) | val;
+        } else {
+            m_regs.irq_counter = (m_regs.irq_counter & 0xff) | ((val & 0x7f) << 8);
+            m_regs.irq_enabled = (val & N163_IRQ_ENABLE) != 0;
+        }
+        m_cpu->set_irq_line(IRQ_SOURCE_MAPPER, false);
+        schedule_irq();
+        break;
+    case KEY_N163_PRG_8000:
+        m_apu->sync();
+        m_audio.set_enabled((val & N163_SOUND_DISABLE) == 0);
+        m_regs.prg[0] = val;
+        update_banks();
+        break;
+    case KEY_N163_PRG_A000:
+    case KEY_N163_PRG_C000:
+        m_regs.prg[(addr - KEY_N163_PRG_8000) >> 11] = val;
+        update_banks();
+        break;
+    case KEY_N163_ADDRESS:
+        m_audio.set_address(val);
+        m_regs.prg_ram_protect = val;
+        update_banks();
+        break;
+    }
+}
+
+void Namco163Device::update_banks() {
+    for (int slot = 0; slot < 3; slot++) {
+        set_prg_bank(slot, m_regs.prg[slot] & 0x3f);
+    }
+    set_prg_bank(3, get_prg_bank_count() - 1);
+    // the bits 0 - 3 protect 2 KB each, all of it without the key
+    uint8_t write_mask = 0;
+    if ((m_regs.prg_ram_protect & 0xf0) == N163_PRG_RAM_WRITE_KEY) {
+        write_mask = ~m_regs.prg_ram_protect;
+    }
+    set_prg_ram_access(true, write_mask);
+    for (int slot = 0; slot < 8; slot++) {
+        uint8_t disable = slot < 4 ? N163_NAMETABLE_CHR_DISABLE_LOW : N163_NAMETABLE_CHR_DISABLE_HIGH;
+        if (m_regs.chr[slot] >= 0xe0 && (m_regs.prg[1] & disable) == 0) {
+            m_ppu->set_chr_nametable(slot, m_regs.chr[slot] & 1);
+        } else {
+            set_chr_bank(slot, m_regs.chr[slot]);
+        }
+    }
+}
+
+void Namco163Device::sync() {
+    uint64_t now = m_scheduler->now();
+    uint64_t elapsed = now - m_regs.sync_cycle;
+    m_regs.sync_cycle = now;
+    if (!m_regs.irq_enabled || m_regs.irq_counter == N163_IRQ_COUNTER_MAX) {
+        return;
+    }
+    if (elapsed >= static_cast<uint64_t>(N163_IRQ_COUNTER_MAX - m_regs.irq_counter)) {
+        m_regs.irq_counter = N163_IRQ_COUNTER_MAX;
+        m_cpu->set_irq_line(IRQ_SOURCE_MAPPER, true);
+    } else {
+        m_regs.irq_counter += elapsed;
+    }
+}
+
+void Namco163Device::schedule_irq() {
+    // must follow a sync
+    if (!m_regs.irq_enabled || m_regs.irq_counter == N163_IRQ_COUNTER_MAX) {
+        m_scheduler->cancel(EVENT_MAPPER_IRQ);
+        return;
+    }
+    m_scheduler->schedule(EVENT_MAPPER_IRQ, m_regs.sync_cycle + N163_IRQ_COUNTER_MAX - m_regs.irq_counter);
+}
+
+void Namco163Device::irq_event(uint64_t cycle) {
+    sync();
+    schedule_irq();
+}
+
+void Namco163Device::save_regs(uint8_t * regs) {
+    m_audio.get_state(&m_regs.audio);
+    std::memcpy(regs, &m_regs, sizeof(m_regs));
+}
+
+void Namco163Device::load_regs(const uint8_t * regs) {
+    std::memcpy(&m_regs, regs, sizeof(m_regs));
+    m_audio.set_state(m_regs.audio);
+    update_banks();
+}
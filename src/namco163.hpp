@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "mapper.hpp"
+#include "expaudio.hpp"
+
+enum {
+    KEY_N163_IRQ_LOW = 0x5000,
+    KEY_N163_IRQ_HIGH = 0x5800,
+    KEY_N163_CHR = 0x8000, // up to 0xb800, one register per 0x800
+    KEY_N163_PRG_8000 = 0xe000,
+    KEY_N163_PRG_A000 = 0xe800,
+    KEY_N163_PRG_C000 = 0xf000,
+    KEY_N163_ADDRESS = 0xf800,
+
+    N163_IRQ_ENABLE = BIT7,
+    N163_SOUND_DISABLE = BIT6,
+    // 0xe800, the CHR values from 0xe0 select the nametable RAM unless set
+    N163_NAMETABLE_CHR_DISABLE_LOW = BIT6,  // 0x0000 - 0x0fff
+    N163_NAMETABLE_CHR_DISABLE_HIGH = BIT7, // 0x1000 - 0x1fff
+    // 0xf800, the high nibble must be this for the PRG RAM writes
+    N163_PRG_RAM_WRITE_KEY = 0x40,
+    N163_IRQ_COUNTER_MAX = 0x7fff,
+};
+
+/*
+Namco 163 (iNES mapper 19) : PRG/CHR banking, a 15 bit cpu cycle IRQ
+counter and the wavetable audio, whose RAM is accessed through 0x4800
+https://www.nesdev.org/wiki/INES_Mapper_019
+
+The counter counts up and stops at 0x7fff, raising the IRQ : that cycle
+is scheduled.
+TODO : the nametable registers (0xc000 - 0xd800), the PPU has no nametable
+mirroring yet
+*/
+class Namco163Device : public MapperDevice {
+ public:
+    Namco163Device(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler, ApuDevice * apu);
+    ~Namco163Device();
+    uint16_t get_base_addr() { return KEY_N163_DATA; }
+
+    void irq_event(uint64_t cycle);
+
+ protected:
+    void write_register(uint16_t addr, uint8_t val);
+    uint8_t read_register(uint16_t addr);
+    uint8_t peek_register(uint16_t addr);
+    void save_regs(uint8_t * regs);
+    void load_regs(const uint8_t * regs);
+
+ private:
+    void update_banks();
+    void sync();
+    void schedule_irq();
+
+    struct Regs {
+        uint8_t chr[8];
+        uint8_t prg[3];
+        uint8_t prg_ram_protect;
+        uint16_t irq_counter;
+        bool irq_enabled;
+        uint64_t sync_cycle;
+        Namco163Audio::State audio;
+    };
+    static_assert(sizeof(Regs) <= MAPPER_REGS_SIZE, "Namco 163 registers don't fit in the mapper state");
+
+    ApuDevice * m_apu;
+    Namco163Audio m_audio;
+    Regs m_regs = {};
+};
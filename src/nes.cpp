@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include "nes.hpp"
+
+Nes::Nes(const InesRom& cart, LstDebuggerAsm6 * lst)
+    : scheduler(&m_cycles), rom(padded(cart.prg, 0x8000).data(), 0xc000), ram(0x0000), apu(), ppu(padded(cart.chr, 0x4000).data(), &ram, &apu),
+      mapper(MapperDevice::create(cart, &ppu, &apu, &scheduler)),
+      mem(memory_map()),
+      cpu(&mem, false, lst) {
+    ppu.set_cpu(&cpu); // urgh
+    apu.set_cpu(&cpu); // urgh
+    apu.set_scheduler(&scheduler);
+    scheduler.set_handler(EVENT_APU_FRAME, [this](uint64_t cycle) { apu.frame_event(cycle); });
+    if (mapper) {
+        mapper->set_cpu(&cpu);
+        mapper->set_memory(&mem);
+        scheduler.set_handler(EVENT_MAPPER_IRQ, [this](uint64_t cycle) { mapper->irq_event(cycle); });
+    }
+}
+
+Nes::Nes(uint8_t * prg, uint8_t * chr, LstDebuggerAsm6 * lst)
+    : Nes(InesRom{std::vector<uint8_t>(prg, prg + 0x8000), std::vector<uint8_t>(chr, chr + 0x4000), 0}, lst) {
+}
+
+std::vector<uint8_t> Nes::padded(const std::vector<uint8_t>& data, size_t size) {
+    std::vector<uint8_t> out(data);
+    out.resize(std::max(size, data.size()), 0);
+    return out;
+}
+
+std::vector<std::pair<uint16_t, Device*>> Nes::memory_map() {
+    std::vector<std::pair<uint16_t, Device*>> mmap = {
+        {0x0000, &ram},
+        {0x2000, &ppu},
+        {0x4000, &apu},
+        {0x4014, &ppu},
+    };
+    if (mapper) {
+        mmap.push_back({mapper->get_base_addr(), mapper.get()});
+    } else {
+        mmap.push_back({0xc000, &rom});
+    }
+    return mmap;
+}
+
+void Nes::step_instruction() {
+    do {
+        cpu_cycle();
+    } while (!cpu.at_instruction_start());
+}
+
+void Nes::run_frame() {
+    long frame_no = ppu.get_frame_no();
+    while (ppu.get_frame_no() == frame_no) {
+        tick();
+    }
+}
+
+void Nes::get_state(State * state) {
+    cpu.get_state(&state->cpu);
+    ram.get_state(&state->ram);
+    ppu.get_state(&state->ppu);
+    apu.get_state(&state->apu);
+    if (mapper) {
+        mapper->get_state(&state->mapper);
+    }
+    scheduler.get_state(&state->scheduler);
+    state->cycles = m_cycles;
+}
+
+void Nes::set_state(const State& state) {
+    cpu.set_state(state.cpu);
+    ram.set_state(state.ram);
+    ppu.set_state(state.ppu);
+    apu.set_state(state.apu);
+    if (mapper) {
+        mapper->set_state(state.mapper);
+    }
+    scheduler.set_state(state.scheduler);
+    m_cycles = state.cycles;
+}
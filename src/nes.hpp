@@ -0,0 +1,81 @@
+#pragma once
+
+#include "device.hpp"
+#include "cpumem.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "apu.hpp"
+#include "mapper.hpp"
+#include "scheduler.hpp"
+#include "lstdebugger.hpp"
+#include "utils.hpp"
+
+#include <memory>
+#include <vector>
+
+/*
+One console : the devices, the memory map and the cpu, wired as in
+the original main(). Mapper 0 : PRG is mapped at 0xc000 (NROM-128),
+the others (see MapperDevice::create) from their base address, 0x6000
+(PRG RAM) for most.
+*/
+class Nes {
+ public:
+    struct State {
+        Emu6502::State cpu;
+        RamDevice::State ram;
+        PpuDevice::State ppu;
+        ApuDevice::State apu;
+        MapperDevice::State mapper; // unused for NROM
+        Scheduler::State scheduler;
+        uint64_t cycles;
+    };
+
+    Nes(const InesRom& cart, LstDebuggerAsm6 * lst = nullptr);
+    // NROM, prg : 0x8000 bytes, chr : 0x4000 bytes
+    Nes(uint8_t * prg, uint8_t * chr, LstDebuggerAsm6 * lst = nullptr);
+
+    // one cpu cycle : 3 ppu cycles, the APU only runs on its frame events
+    void cpu_cycle() {
+        if (m_cycles >= scheduler.next_cycle()) {
+            scheduler.run();
+        }
+        cpu.tick();
+        ppu.tick();
+        ppu.tick();
+        ppu.tick();
+        m_cycles++;
+    }
+
+    // one iteration of the run loop
+    void tick() {
+        cpu_cycle();
+        cpu_cycle();
+    }
+
+    // run until the cpu is about to start the next instruction
+    void step_instruction();
+    // run until the next vblank
+    void run_frame();
+
+    // cpu cycles since power on
+    uint64_t get_cycles() const { return m_cycles; }
+
+    void get_state(State * state);
+    void set_state(const State& state);
+
+    Scheduler scheduler;
+    CartridgeRomDevice rom;
+    RamDevice ram;
+    ApuDevice apu;
+    PpuDevice ppu;
+    std::unique_ptr<MapperDevice> mapper; // nullptr for NROM
+    Memory mem;
+    Emu6502 cpu;
+
+ private:
+    static std::vector<uint8_t> padded(const std::vector<uint8_t>& data, size_t size);
+    std::vector<std::pair<uint16_t, Device*>> memory_map();
+
+    uint64_t m_cycles = 0;
+};
@@ -0,0 +1,152 @@
+/*
+Shared memory export, for the local consumers of the emulator output
+(encoders, inference servers, overlays). C, header only, Linux, with
+the GNU extensions (gcc's default, else define _GNU_SOURCE for syscall).
+
+The emulator (--shm-export NAME) creates the POSIX shared memory NAME,
+a struct nes_shm, and keeps writing into it :
+- frames : a ring of NES_SHM_FRAME_SLOTS RGB frames, each with the last
+  RAM snapshot published when it was exported. frame_count is the number of frames published,
+  the last one is in slot (frame_count - 1) % NES_SHM_FRAME_SLOTS.
+  Each slot is a sequence lock : its seq is odd while it is written.
+  frame_count is also a futex word, woken at each published frame.
+- audio : a ring of mono samples at sample_rate, audio_write is the
+  number of samples written since the start.
+The emulator never waits for the consumers : a slow consumer sees the
+slots it was reading overwritten (seq changed) and the audio overrun.
+
+Reading a frame in place, with no copy :
+
+    struct nes_shm * shm = nes_shm_open("/nesquick");
+    uint32_t seen = 0;
+    for (;;) {
+        seen = nes_shm_wait_frame(shm, seen, 100);
+        const struct nes_shm_frame * frame = nes_shm_last_frame(shm, seen);
+        if (frame == NULL) continue;
+        uint32_t seq = nes_shm_frame_begin(frame);
+        if (seq & 1) continue;
+        ... use frame->rgb, frame->ram ...
+        if (!nes_shm_frame_end(frame, seq)) { ... overwritten meanwhile, discard ... }
+    }
+*/
+#ifndef NESSHM_H
+#define NESSHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define NES_SHM_MAGIC 0x4d48534e /* "NSHM" */
+#define NES_SHM_VERSION 1
+#define NES_SHM_WIDTH 256
+#define NES_SHM_HEIGHT 240
+#define NES_SHM_FRAME_SLOTS 4
+#define NES_SHM_RAM_SIZE 0x800
+#define NES_SHM_AUDIO_SAMPLES 16384 /* power of 2, ~370 ms */
+
+struct nes_shm_frame {
+    uint32_t seq;            /* odd while written */
+    uint32_t reserved;
+    int64_t frame_no;        /* PPU frame number */
+    int64_t ram_frame_no;    /* of the RAM snapshot, -1 if none */
+    uint64_t cycles;         /* cpu cycles at the RAM snapshot */
+    uint8_t ram[NES_SHM_RAM_SIZE];
+    uint8_t rgb[NES_SHM_HEIGHT][NES_SHM_WIDTH][3];
+};
+
+struct nes_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame_slots;
+    uint32_t audio_samples;
+    uint32_t sample_rate;
+    uint32_t frame_count;    /* frames published, futex word */
+    uint64_t audio_write;    /* samples written */
+    struct nes_shm_frame frames[NES_SHM_FRAME_SLOTS];
+    int16_t audio[NES_SHM_AUDIO_SAMPLES];
+};
+
+/* read only mapping of the export NAME, NULL if missing or incompatible */
+static inline struct nes_shm * nes_shm_open(const char * name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    void * addr = mmap(NULL, sizeof(struct nes_shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    struct nes_shm * shm = (struct nes_shm *)addr;
+    if (shm->magic != NES_SHM_MAGIC || shm->version != NES_SHM_VERSION) {
+        munmap(addr, sizeof(struct nes_shm));
+        return NULL;
+    }
+    return shm;
+}
+
+static inline void nes_shm_close(struct nes_shm * shm) {
+    munmap(shm, sizeof(struct nes_shm));
+}
+
+static inline uint32_t nes_shm_frame_count(const struct nes_shm * shm) {
+    return __atomic_load_n(&shm->frame_count, __ATOMIC_ACQUIRE);
+}
+
+/* waits until frame_count differs from seen or timeout_ms, returns it */
+static inline uint32_t nes_shm_wait_frame(const struct nes_shm * shm, uint32_t seen, int timeout_ms) {
+    uint32_t count = nes_shm_frame_count(shm);
+    if (count == seen) {
+        struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        syscall(SYS_futex, &shm->frame_count, FUTEX_WAIT, seen, &timeout, NULL, 0);
+        count = nes_shm_frame_count(shm);
+    }
+    return count;
+}
+
+/* the slot of the count-th frame, see nes_shm_frame_count,
+   NULL while no frame was published (count 0) */
+static inline const struct nes_shm_frame * nes_shm_last_frame(const struct nes_shm * shm, uint32_t count) {
+    if (count == 0) {
+        return NULL;
+    }
+    return &shm->frames[(count - 1) % NES_SHM_FRAME_SLOTS];
+}
+
+/* before using a slot in place, odd : being written, retry */
+static inline uint32_t nes_shm_frame_begin(const struct nes_shm_frame * frame) {
+    return __atomic_load_n(&frame->seq, __ATOMIC_ACQUIRE);
+}
+
+/* after, 0 if the slot was written meanwhile : what was read is torn */
+static inline int nes_shm_frame_end(const struct nes_shm_frame * frame, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&frame->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/*
+copies up to max samples from *pos, advances it, returns the count. A
+consumer more than half the ring behind skips ahead to half the ring
+*/
+static inline size_t nes_shm_read_audio(const struct nes_shm * shm, uint64_t * pos, int16_t * samples, size_t max) {
+    uint64_t write = __atomic_load_n(&shm->audio_write, __ATOMIC_ACQUIRE);
+    if (write - *pos > NES_SHM_AUDIO_SAMPLES / 2) {
+        /* half a ring of margin, the writer is filling the rest */
+        *pos = write - NES_SHM_AUDIO_SAMPLES / 2;
+    }
+    size_t n = 0;
+    for (; n < max && *pos < write; n++, (*pos)++) {
+        samples[n] = shm->audio[*pos & (NES_SHM_AUDIO_SAMPLES - 1)];
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "netplay.hpp"
+
+static const uint32_t NETPLAY_MAGIC = 0x594c504e; // "NPLY"
+// magic, frame, advantage, ack, checked frame, checksum, start, input delay, count
+static const size_t NETPLAY_HEADER_SIZE = 4 * 7 + 2;
+
+static void put32(std::vector<uint8_t> * out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out->push_back((value >> (8 * i)) & 0xff);
+    }
+}
+
+static uint32_t get32(const uint8_t * in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+UdpTransport::UdpTransport(uint16_t local_port, const std::string& remote_host, uint16_t remote_port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo * found;
+    if (getaddrinfo(remote_host.c_str(), nullptr, &hints, &found) != 0) {
+        throw std::runtime_error("Unknown netplay host " + remote_host);
+    }
+    m_remote = *reinterpret_cast<sockaddr_in*>(found->ai_addr);
+    m_remote.sin_port = htons(remote_port);
+    freeaddrinfo(found);
+
+    m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(local_port);
+    if (m_fd < 0 || bind(m_fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) < 0) {
+        throw std::runtime_error("Unable to bind netplay socket");
+    }
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+}
+
+UdpTransport::~UdpTransport() {
+    close(m_fd);
+}
+
+void UdpTransport::send(const std::vector<uint8_t>& datagram) {
+    // lost if the socket buffer is full, as on the wire
+    sendto(m_fd, datagram.data(), datagram.size(), 0, reinterpret_cast<const sockaddr*>(&m_remote), sizeof(m_remote));
+}
+
+bool UdpTransport::receive(std::vector<uint8_t> * datagram) {
+    uint8_t buffer[1500];
+    sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    while (true) {
+        ssize_t size = recvfrom(m_fd, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &from_len);
+        if (size < 0) {
+            return false;
+        }
+        // only from the peer
+        if (from.sin_addr.s_addr == m_remote.sin_addr.s_addr && from.sin_port == m_remote.sin_port) {
+            datagram->assign(buffer, buffer + size);
+            return true;
+        }
+    }
+}
+
+LoopbackLink::LoopbackLink(int latency, int jitter, double loss, uint32_t seed)
+    : m_latency(latency), m_jitter(jitter), m_loss(loss), m_rng(seed) {
+    for (int i = 0; i < 2; i++) {
+        m_ends[i].m_link = this;
+        m_ends[i].m_no = i;
+    }
+}
+
+void LoopbackLink::End::send(const std::vector<uint8_t>& datagram) {
+    LoopbackLink * link = m_link;
+    if (std::uniform_real_distribution<double>(0, 1)(link->m_rng) < link->m_loss) {
+        return;
+    }
+    long delay = link->m_latency + std::uniform_int_distribution<int>(0, link->m_jitter)(link->m_rng);
+    link->m_queues[1 - m_no].push_back({link->m_now + delay, datagram});
+}
+
+bool LoopbackLink::End::receive(std::vector<uint8_t> * datagram) {
+    std::vector<Datagram>& queue = m_link->m_queues[m_no];
+    for (size_t i = 0; i < queue.size(); i++) {
+        if (queue[i].deliver_at <= m_link->m_now) {
+            datagram->swap(queue[i].data);
+            queue.erase(queue.begin() + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+RollbackSession::RollbackSession(Nes * nes, NetTransport * transport, int local_player, int input_delay)
+    : m_nes(nes), m_transport(transport), m_local(local_player), m_remote(1 - local_player), m_input_delay(input_delay),
+      m_states(new Nes::State[NETPLAY_MAX_ROLLBACK + 1]) {
+    if (local_player != 0 && local_player != 1) {
+        throw std::runtime_error("Bad netplay player");
+    }
+    if (input_delay < 0 || input_delay > NETPLAY_MAX_ROLLBACK) {
+        throw std::runtime_error("Bad netplay input delay");
+    }
+    // no input on both sides for the frames of the delay
+    m_local_end = input_delay;
+    m_remote_end = input_delay;
+    m_remote_acked = input_delay;
+    m_rollback_to = 0;
+}
+
+uint32_t RollbackSession::state_checksum(const Nes::State& state) {
+    // FNV-1a of what the game logic depends on, the structs have padding
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](const uint8_t * data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ data[i]) * 16777619u;
+        }
+    };
+    add(state.ram.mem, 0x800);
+    add(state.cpu.regs, sizeof(state.cpu.regs));
+    add(&state.cpu.stack_ptr, 1);
+    uint8_t pc[2] = {static_cast<uint8_t>(state.cpu.prgm_ctr & 0xff), static_cast<uint8_t>(state.cpu.prgm_ctr >> 8)};
+    add(pc, 2);
+    add(state.ppu.ppuoam, sizeof(state.ppu.ppuoam));
+    add(state.ppu.vram + 0x2000, 0x1000);
+    add(state.ppu.vram + 0x3f00, 0x20);
+    return hash;
+}
+
+bool RollbackSession::advance_frame(uint8_t local_input) {
+    poll();
+    if (!m_error.empty()) {
+        return false;
+    }
+    if (m_rollback_to < m_frame) {
+        rollback();
+    }
+    record_checksums();
+
+    // too many frames predicted, or the local inputs would not fit the window
+    if (m_frame - m_remote_end >= NETPLAY_MAX_ROLLBACK || m_frame + m_input_delay + 1 - m_remote_acked > NETPLAY_WINDOW) {
+        m_stats.stalls++;
+        send();
+        return false;
+    }
+    // both see the same latency : half the difference of the advantages is
+    // how far this side is ahead, it gives a frame back now and then
+    long ahead = ((m_frame - m_remote_frame) - m_remote_advantage) / 2;
+    if (ahead >= 1 && m_frame - m_last_skip >= 10) {
+        m_last_skip = m_frame;
+        m_stats.time_sync_skips++;
+        send();
+        return false;
+    }
+
+    m_inputs[m_local][(m_frame + m_input_delay) % NETPLAY_WINDOW] = local_input;
+    m_local_end = m_frame + m_input_delay + 1;
+    m_nes->get_state(state_at(m_frame));
+    run_frame(m_frame);
+    m_frame++;
+    m_rollback_to = m_frame;
+    send();
+    return true;
+}
+
+void RollbackSession::run_frame(long frame) {
+    if (frame >= m_remote_end) {
+        m_inputs[m_remote][frame % NETPLAY_WINDOW] = m_last_remote;
+    }
+    m_nes->ppu.set_kb_state(m_inputs[0][frame % NETPLAY_WINDOW], 0);
+    m_nes->ppu.set_kb_state(m_inputs[1][frame % NETPLAY_WINDOW], 1);
+    m_nes->run_frame();
+}
+
+void RollbackSession::rollback() {
+    auto start = std::chrono::steady_clock::now();
+    int depth = m_frame - m_rollback_to;
+    m_nes->set_state(*state_at(m_rollback_to));
+    // already presented, played and observed once, not again
+    FramePipeline * pipeline = m_nes->ppu.get_frame_pipeline();
+    m_nes->ppu.set_frame_pipeline(nullptr);
+    PpuFrameObserver * observer = m_nes->ppu.get_frame_observer();
+    m_nes->ppu.set_frame_observer(nullptr);
+    m_nes->apu.set_audio_muted(true);
+    for (long frame = m_rollback_to; frame < m_frame; frame++) {
+        if (frame > m_rollback_to) {
+            m_nes->get_state(state_at(frame));
+        }
+        run_frame(frame);
+    }
+    m_nes->apu.set_audio_muted(false);
+    m_nes->ppu.set_frame_observer(observer);
+    m_nes->ppu.set_frame_pipeline(pipeline);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    m_stats.rollbacks++;
+    m_stats.resimulated += depth;
+    m_stats.max_depth = std::max(m_stats.max_depth, depth);
+    m_stats.max_rollback_ms = std::max(m_stats.max_rollback_ms, ms);
+    m_rollback_to = m_frame;
+}
+
+void RollbackSession::record_checksums() {
+    // the state at the start of a frame is final once the inputs before are
+    while (m_checked < m_frame && m_checked <= m_remote_end) {
+        m_checksums[m_checked % NETPLAY_WINDOW] = state_checksum(*state_at(m_checked));
+        m_checked++;
+    }
+}
+
+long RollbackSession::get_confirmed_checksum(uint32_t * checksum) const {
+    if (m_checked == 0) {
+        return -1;
+    }
+    *checksum = m_checksums[(m_checked - 1) % NETPLAY_WINDOW];
+    return m_checked - 1;
+}
+
+void RollbackSession::poll() {
+    std::vector<uint8_t> datagram;
+    while (m_transport->receive(&datagram)) {
+        if (datagram.size() < NETPLAY_HEADER_SIZE || get32(&datagram[0]) != NETPLAY_MAGIC) {
+            continue;
+        }
+        int count = datagram[NETPLAY_HEADER_SIZE - 1];
+        if (datagram.size() < NETPLAY_HEADER_SIZE + count) {
+            continue;
+        }
+        m_stats.received++;
+        // the frame an input applies to depends on the delay, both sides must agree
+        int remote_delay = datagram[NETPLAY_HEADER_SIZE - 2];
+        if (remote_delay != m_input_delay) {
+            m_error = "the peer uses an input delay of " + std::to_string(remote_delay) + ", this side " + std::to_string(m_input_delay);
+            return;
+        }
+        long frame = static_cast<int32_t>(get32(&datagram[4]));
+        // the latest datagram sent tells the latest frame
+        if (frame >= m_remote_frame) {
+            m_remote_frame = frame;
+            m_remote_advantage = static_cast<int32_t>(get32(&datagram[8]));
+        }
+        m_remote_acked = std::max(m_remote_acked, static_cast<long>(static_cast<int32_t>(get32(&datagram[12]))));
+        check_remote_checksum(static_cast<int32_t>(get32(&datagram[16])), get32(&datagram[20]));
+        long start = static_cast<int32_t>(get32(&datagram[24]));
+        for (int i = 0; i < count; i++) {
+            if (start + i == m_remote_end) {
+                confirm_remote(start + i, datagram[NETPLAY_HEADER_SIZE + i]);
+            }
+        }
+    }
+}
+
+void RollbackSession::confirm_remote(long frame, uint8_t input) {
+    uint8_t * used = &m_inputs[m_remote][frame % NETPLAY_WINDOW];
+    if (frame < m_frame && *used != input) {
+        m_rollback_to = std::min(m_rollback_to, frame);
+    }
+    *used = input;
+    m_last_remote = input;
+    m_remote_end = frame + 1;
+}
+
+void RollbackSession::check_remote_checksum(long frame, uint32_t checksum) {
+    if (frame < 0 || frame >= m_checked || frame < m_checked - NETPLAY_WINDOW) {
+        return;
+    }
+    if (m_checksums[frame % NETPLAY_WINDOW] != checksum) {
+        m_stats.desyncs++;
+    }
+}
+
+void RollbackSession::send() {
+    std::vector<uint8_t> datagram;
+    uint32_t checksum = 0;
+    long checked = get_confirmed_checksum(&checksum);
+    // the local inputs the peer did not acknowledge yet
+    long start = m_remote_acked;
+    int count = std::min<long>(m_local_end - start, 255);
+    put32(&datagram, NETPLAY_MAGIC);
+    put32(&datagram, m_frame);
+    put32(&datagram, m_frame - m_remote_frame);
+    put32(&datagram, m_remote_end);
+    put32(&datagram, checked);
+    put32(&datagram, checksum);
+    put32(&datagram, start);
+    datagram.push_back(m_input_delay);
+    datagram.push_back(count);
+    for (int i = 0; i < count; i++) {
+        datagram.push_back(m_inputs[m_local][(start + i) % NETPLAY_WINDOW]);
+    }
+    m_transport->send(datagram);
+    m_stats.sent++;
+}
+
+void RollbackSession::print_stats(std::ostream& out) {
+    out << "netplay player " << m_local + 1 << ": " << m_frame << " frames, "
+        << m_stats.rollbacks << " rollbacks (" << m_stats.resimulated << " frames re-simulated, "
+        << m_stats.max_depth << " deepest, " << m_stats.max_rollback_ms << " ms longest), "
+        << m_stats.stalls << " stalls, " << m_stats.time_sync_skips << " time sync skips, "
+        << m_stats.sent << " sent, " << m_stats.received << " received, "
+        << m_stats.desyncs << " desyncs" << std::endl;
+    if (!m_error.empty()) {
+        out << "  session refused: " << m_error << std::endl;
+    }
+}
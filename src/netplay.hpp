@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+
+#include "nes.hpp"
+
+// frames re-simulated at most in one host frame, the session waits beyond
+static const int NETPLAY_MAX_ROLLBACK = 8;
+// ring of the inputs and checksums, power of 2
+static const int NETPLAY_WINDOW = 64;
+
+// datagrams between the two peers, may be lost, late or reordered
+class NetTransport {
+ public:
+    virtual ~NetTransport() {}
+    virtual void send(const std::vector<uint8_t>& datagram) = 0;
+    // false if nothing was received
+    virtual bool receive(std::vector<uint8_t> * datagram) = 0;
+};
+
+class UdpTransport : public NetTransport {
+ public:
+    // binds local_port, sends to remote_host:remote_port
+    UdpTransport(uint16_t local_port, const std::string& remote_host, uint16_t remote_port);
+    ~UdpTransport();
+
+    void send(const std::vector<uint8_t>& datagram) override;
+    bool receive(std::vector<uint8_t> * datagram) override;
+
+ private:
+    int m_fd;
+    sockaddr_in m_remote;
+};
+
+/*
+Both ends of a link in the same process, for the headless tests : each
+datagram is lost with the probability loss, else delivered latency to
+latency + jitter host frames later, so possibly out of order. Seeded, a
+run is reproducible.
+*/
+class LoopbackLink {
+ public:
+    LoopbackLink(int latency, int jitter, double loss, uint32_t seed = 0);
+
+    NetTransport * get_end(int end_no) { return &m_ends[end_no]; }
+    // one host frame
+    void tick() { m_now++; }
+
+ private:
+    struct Datagram {
+        long deliver_at;
+        std::vector<uint8_t> data;
+    };
+
+    class End : public NetTransport {
+     public:
+        void send(const std::vector<uint8_t>& datagram) override;
+        bool receive(std::vector<uint8_t> * datagram) override;
+
+        LoopbackLink * m_link;
+        int m_no;
+    };
+
+    int m_latency;
+    int m_jitter;
+    double m_loss;
+    std::mt19937 m_rng;
+    long m_now = 0;
+    End m_ends[2];
+    std::vector<Datagram> m_queues[2]; // to each end
+};
+
+/*
+Rollback netplay, two players (as GGPO)
+Each peer runs the whole game with its local inputs at once, and for the
+remote player repeats its last confirmed input. The inputs of each frame
+go to the peer in every datagram until it acknowledged them, so that a
+lost one is covered by the next. When a confirmed remote input differs
+from the one predicted, the state saved at the start of that frame is
+restored and the frames since re-simulated with it, muted and without
+presenting them, all within the host frame.
+The session waits (advance_frame returns false) when NETPLAY_MAX_ROLLBACK
+frames are still predicted, and skips a frame now and then when it runs
+ahead of the peer, so that both sides roll back as little.
+The checksum of each confirmed frame is sent too, a differing one from
+the peer is counted as a desync. The input delay is sent too : both peers
+must use the same, else the session is refused (get_error) and stops.
+*/
+class RollbackSession {
+ public:
+    // local_player : 0 or 1, the controller port of this peer
+    RollbackSession(Nes * nes, NetTransport * transport, int local_player, int input_delay = 0);
+
+    // one host frame : false if it waited for the peer or the session was refused
+    bool advance_frame(uint8_t local_input);
+    // why the session was refused, empty while it runs
+    const std::string& get_error() const { return m_error; }
+    // frames emulated so far, the next one to run
+    long get_frame() const { return m_frame; }
+    int get_input_delay() const { return m_input_delay; }
+    // last frame whose state is final on both peers and its checksum, -1 if none
+    long get_confirmed_checksum(uint32_t * checksum) const;
+
+    void print_stats(std::ostream& out);
+
+    static uint32_t state_checksum(const Nes::State& state);
+
+ private:
+    struct Stats {
+        long rollbacks = 0;
+        long resimulated = 0;
+        int max_depth = 0;
+        double max_rollback_ms = 0;
+        long stalls = 0;
+        long time_sync_skips = 0;
+        long sent = 0;
+        long received = 0;
+        long desyncs = 0;
+    };
+
+    void poll();
+    void confirm_remote(long frame, uint8_t input);
+    void check_remote_checksum(long frame, uint32_t checksum);
+    void rollback();
+    void record_checksums();
+    void run_frame(long frame);
+    void send();
+    Nes::State * state_at(long frame) { return &m_states[frame % (NETPLAY_MAX_ROLLBACK + 1)]; }
+
+    Nes * m_nes;
+    NetTransport * m_transport;
+    int m_local;
+    int m_remote;
+    int m_input_delay;
+
+    long m_frame = 0;
+    // inputs used per frame and player, confirmed or predicted
+    uint8_t m_inputs[2][NETPLAY_WINDOW] = {{0}};
+    long m_local_end;       // local inputs known up to there
+    long m_remote_end;      // remote inputs confirmed up to there
+    long m_remote_acked;    // local inputs the peer has
+    uint8_t m_last_remote = 0;
+    long m_rollback_to;     // first mispredicted frame, m_frame if none
+    long m_remote_frame = 0;
+    long m_remote_advantage = 0;
+    long m_last_skip = 0;
+    // state at the start of the last frames
+    std::unique_ptr<Nes::State[]> m_states;
+    // checksums of the frames whose state is final
+    uint32_t m_checksums[NETPLAY_WINDOW] = {0};
+    long m_checked = 0;     // checksummed up to there
+    std::string m_error;
+    Stats m_stats;
+};
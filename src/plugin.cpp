@@ -0,0 +1,139 @@
+#include <stdexcept>
+
+#include "plugin.hpp"
+#include "nes.hpp"
+
+uint8_t HookPageDevice::get(uint16_t addr) {
+    uint8_t value = m_inner->get(addr);
+    if (!m_read_hooked[addr & 0xff]) {
+        return value;
+    }
+    for (const auto& hook : m_read_hooks) {
+        if (hook.first == addr) {
+            value = hook.second(addr, value);
+        }
+    }
+    return value;
+}
+
+void HookPageDevice::set(uint16_t addr, uint8_t val) {
+    m_inner->set(addr, val);
+    if (!m_write_hooked[addr & 0xff]) {
+        return;
+    }
+    for (const auto& hook : m_write_hooks) {
+        if (hook.first == addr) {
+            hook.second(addr, val);
+        }
+    }
+}
+
+void HookPageDevice::add_read_hook(uint16_t addr, const ReadHook& hook) {
+    m_read_hooks.push_back({addr, hook});
+    m_read_hooked[addr & 0xff] = true;
+}
+
+void HookPageDevice::add_write_hook(uint16_t addr, const WriteHook& hook) {
+    m_write_hooks.push_back({addr, hook});
+    m_write_hooked[addr & 0xff] = true;
+}
+
+PluginHost::PluginHost(Nes * nes) : m_nes(nes) {
+}
+
+PluginHost::~PluginHost() {
+    uninstall();
+}
+
+void PluginHost::add(Plugin * plugin) {
+    plugin->setup(this);
+}
+
+void PluginHost::on_frame_end(const FrameEndHook& hook) {
+    if (m_installed) {
+        throw std::runtime_error("Plugin hooks are registered before install");
+    }
+    m_frame_hooks.push_back(hook);
+}
+
+void PluginHost::on_read(uint16_t addr, const ReadHook& hook) {
+    if (m_installed) {
+        throw std::runtime_error("Plugin hooks are registered before install");
+    }
+    m_read_hooks.push_back({addr, hook});
+}
+
+void PluginHost::on_write(uint16_t addr, const WriteHook& hook) {
+    if (m_installed) {
+        throw std::runtime_error("Plugin hooks are registered before install");
+    }
+    m_write_hooks.push_back({addr, hook});
+}
+
+void PluginHost::on_controller_read(const ControllerReadHook& hook) {
+    for (int port = 0; port < 2; port++) {
+        on_read(KEY_CTRL1 + port, [hook, port](uint16_t addr, uint8_t value) {
+            // bit 0 is the button, the others as read
+            return static_cast<uint8_t>((value & ~1) | (hook(port, value & 1) & 1));
+        });
+    }
+}
+
+HookPageDevice * PluginHost::page(uint8_t page_no) {
+    auto found = m_pages.find(page_no);
+    if (found != m_pages.end()) {
+        return found->second.get();
+    }
+    auto device = std::make_unique<HookPageDevice>(m_nes->mem.get_page_device(page_no));
+    HookPageDevice * hooked = device.get();
+    m_nes->mem.set_page_device(page_no, hooked);
+    m_pages[page_no] = std::move(device);
+    return hooked;
+}
+
+void PluginHost::install() {
+    if (m_installed) {
+        return;
+    }
+    for (const auto& hook : m_read_hooks) {
+        page(hook.first >> 8)->add_read_hook(hook.first, hook.second);
+    }
+    for (const auto& hook : m_write_hooks) {
+        page(hook.first >> 8)->add_write_hook(hook.first, hook.second);
+    }
+    if (!m_frame_hooks.empty()) {
+        m_next_observer = m_nes->ppu.get_frame_observer();
+        m_nes->ppu.set_frame_observer(this);
+    }
+    m_installed = true;
+}
+
+void PluginHost::uninstall() {
+    if (!m_installed) {
+        return;
+    }
+    for (auto& pair : m_pages) {
+        // as CheatEngine::uninstall
+        Device * inner = pair.second->get_inner();
+        m_nes->mem.reset_page_device(pair.first);
+        if (m_nes->mem.get_page_device(pair.first) != inner) {
+            m_nes->mem.set_page_device(pair.first, inner);
+        }
+    }
+    m_pages.clear();
+    if (!m_frame_hooks.empty()) {
+        m_nes->ppu.set_frame_observer(m_next_observer);
+        m_next_observer = nullptr;
+    }
+    m_installed = false;
+}
+
+void PluginHost::vblank_started(long frame_no) {
+    // the observer set before first, e.g. the snapshots the hooks may read
+    if (m_next_observer != nullptr) {
+        m_next_observer->vblank_started(frame_no);
+    }
+    for (const auto& hook : m_frame_hooks) {
+        hook(frame_no);
+    }
+}
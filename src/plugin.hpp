@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "device.hpp"
+#include "cpumem.hpp"
+#include "ppu.hpp"
+
+class Nes;
+class PluginHost;
+
+// the hook points, all on the emulation thread
+typedef std::function<void(long frame_no)> FrameEndHook;
+// after the write reached the device
+typedef std::function<void(uint16_t addr, uint8_t value)> WriteHook;
+// value : what the device returned, the hook returns what the cpu reads
+typedef std::function<uint8_t(uint16_t addr, uint8_t value)> ReadHook;
+// port 0 or 1, value : the button bit of this read, the hook returns the bit the game reads
+typedef std::function<uint8_t(int port, uint8_t value)> ControllerReadHook;
+
+// scoring, telemetry, automation... : registers its hooks at setup
+class Plugin {
+ public:
+    virtual ~Plugin() {}
+    virtual void setup(PluginHost * host) = 0;
+};
+
+// Overlay for a page holding at least one read or write hook
+class HookPageDevice : public Device {
+ public:
+    HookPageDevice(Device * inner) : m_inner(inner) {}
+    uint8_t get(uint16_t addr);
+    // the hooks aren't called
+    uint8_t peek(uint16_t addr) { return m_inner->peek(addr); }
+    void set(uint16_t addr, uint8_t val);
+    void add_read_hook(uint16_t addr, const ReadHook& hook);
+    void add_write_hook(uint16_t addr, const WriteHook& hook);
+    Device * get_inner() { return m_inner; }
+
+ private:
+    Device * m_inner;
+    // the offsets with a hook, the others only pay the lookup
+    bool m_read_hooked[256] = {false};
+    bool m_write_hooked[256] = {false};
+    std::vector<std::pair<uint16_t, ReadHook>> m_read_hooks;
+    std::vector<std::pair<uint16_t, WriteHook>> m_write_hooks;
+};
+
+/*
+The hooks are registered at setup then installed like the cheats : a
+memory hook redirects its page only (to a HookPageDevice), the other
+pages keep their direct pointers, and the controller hooks are read hooks
+of $4016 / $4017. The frame end hooks are called by the frame observer
+of the PPU, chained to the observer that was set before.
+Nothing is added to the hot paths : a hook point nobody registered costs
+nothing, a registered one the calls to its hooks and the slower accesses
+to its page. The frames a rollback (netplay) or a time travel emulates
+again call the hooks again.
+*/
+class PluginHost : public PpuFrameObserver {
+ public:
+    PluginHost(Nes * nes);
+    ~PluginHost();
+
+    // calls plugin->setup, before install
+    void add(Plugin * plugin);
+    void on_frame_end(const FrameEndHook& hook);
+    void on_read(uint16_t addr, const ReadHook& hook);
+    void on_write(uint16_t addr, const WriteHook& hook);
+    void on_controller_read(const ControllerReadHook& hook);
+
+    // after the cheats, if any : the overlays wrap theirs
+    void install();
+    void uninstall();
+
+    void vblank_started(long frame_no) override;
+
+ private:
+    HookPageDevice * page(uint8_t page_no);
+
+    Nes * m_nes;
+    std::vector<FrameEndHook> m_frame_hooks;
+    std::vector<std::pair<uint16_t, ReadHook>> m_read_hooks;
+    std::vector<std::pair<uint16_t, WriteHook>> m_write_hooks;
+    std::map<uint8_t, std::unique_ptr<HookPageDevice>> m_pages;
+    PpuFrameObserver * m_next_observer = nullptr;
+    bool m_installed = false;
+};
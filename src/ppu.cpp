@@ -1,21 +1,191 @@
 #include <cstdlib>
+#include <cstring>
 
 #include "ppu.hpp"
+#include "pputhread.hpp"
+#include "framepipeline.hpp"
 
 PpuDevice::PpuDevice(uint8_t * _chr_rom, Device * cpu_ram, Device * apu) : 
-    cpu_ram(cpu_ram), cpu(nullptr), m_apu(apu), frame(30*8, 32*8, CV_8UC3) {
+    cpu_ram(cpu_ram), cpu(nullptr), m_apu(apu), frame(30*8, 32*8, CV_8UC1), m_dot_frame(30*8, 32*8, CV_8UC1) {
 
     for (uint16_t addr = 0; addr < 0x4000; addr ++) {
         chr_rom[addr] = _chr_rom[addr];
     }
+    for (int slot = 0; slot < 8; slot++) {
+        chr_banks[slot] = &chr_rom[slot * 0x400];
+    }
+}
+
+void PpuDevice::set_chr_bank(int slot, const uint8_t * bank) {
+    if (m_render_thread != nullptr) {
+        render_state_changing();
+        m_render_thread->log(get_tick(), PPU_LOG_CHR_BANK, slot, 0, bank);
+    }
+    chr_banks[slot] = bank;
+}
+
+void PpuDevice::set_chr_nametable(int slot, int nametable) {
+    if (m_render_thread != nullptr) {
+        render_state_changing();
+        // the replica maps its own nametable RAM
+        m_render_thread->log(get_tick(), PPU_LOG_CHR_NAMETABLE, slot, nametable);
+    }
+    chr_banks[slot] = &vram[0x2000 + (nametable & 0b11) * 0x400];
+}
+
+int PpuDevice::get_chr_nametable(int slot) const {
+    if (chr_banks[slot] < &vram[0x2000] || chr_banks[slot] >= &vram[0x3000]) {
+        return -1;
+    }
+    return (chr_banks[slot] - &vram[0x2000]) / 0x400;
+}
+
+void PpuDevice::set_setup_observer(PpuSetupObserver * observer) {
+    m_setup_observer = observer;
+}
+
+void PpuDevice::set_frame_observer(PpuFrameObserver * observer) {
+    m_frame_observer = observer;
+}
+
+void PpuDevice::set_dot_renderer(bool enable) {
+    m_dot_renderer = enable;
+    update_dot_position();
+}
+
+void PpuDevice::set_render_thread(PpuRenderThread * render_thread) {
+    m_render_thread = render_thread;
+    reset_prediction();
 }
 
 void PpuDevice::set_cpu(Emu6502 *_cpu) {
     cpu = _cpu;
 }
 
-void PpuDevice::set_kb_state(uint8_t kb_state) {
-    m_kb_state = kb_state;
+void PpuDevice::set_cdl(CodeDataLogger * _cdl) {
+    cdl = _cdl;
+}
+
+void PpuDevice::set_kb_state(uint8_t kb_state, int port) {
+    if (port == 0) {
+        m_kb_state = kb_state;
+    } else {
+        m_kb2_state = kb_state;
+    }
+}
+
+void PpuDevice::set_input_log(std::vector<uint8_t> * input_log) {
+    m_input_log = input_log;
+}
+
+void PpuDevice::set_snapshot_exchange(PpuSnapshotExchange * snapshots) {
+    m_snapshots = snapshots;
+}
+
+void PpuDevice::set_frame_pipeline(FramePipeline * pipeline) {
+    m_pipeline = pipeline;
+}
+
+void PpuDevice::set_beam_slices(int nslices) {
+    if (nslices < 0 || (nslices != 0 && 240 % nslices != 0)) {
+        throw std::runtime_error("Bad beam racing slice count");
+    }
+    m_slice_rows = (nslices == 0) ? 0 : 240 / nslices;
+}
+
+void PpuDevice::publish_snapshot() {
+    PpuSnapshot * snapshot = m_snapshots->get_write_buffer();
+    std::memcpy(snapshot->vram, vram, sizeof(vram));
+    std::memcpy(snapshot->oam, ppuoam, sizeof(ppuoam));
+    for (int slot = 0; slot < 8; slot++) {
+        std::memcpy(&snapshot->chr[slot * 0x400], chr_banks[slot], 0x400);
+    }
+    snapshot->ppuctrl = ppuctrl;
+    snapshot->ppu_tmp_addr = ppu_tmp_addr;
+    snapshot->fine_x = fine_x;
+    snapshot->frame_no = m_frame_no;
+    m_snapshots->publish();
+}
+
+long PpuDevice::get_strobe_count() {
+    return controller_strobe_count;
+}
+
+void PpuDevice::get_state(State * state) {
+    std::memcpy(state->vram, vram, sizeof(vram));
+    state->ntick = ntick;
+    state->ppu_reg_w = ppu_reg_w;
+    state->ppuaddr = ppuaddr;
+    state->ppu_tmp_addr = ppu_tmp_addr;
+    state->fine_x = fine_x;
+    state->oamaddr = oamaddr;
+    state->ppuctrl = ppuctrl;
+    state->ppumask = ppumask;
+    state->ppustatus = ppustatus;
+    std::memcpy(state->ppuoam, ppuoam, sizeof(ppuoam));
+    state->ppudata_buffer = ppudata_buffer;
+    state->controller_strobe = controller_strobe;
+    state->controller_read_no = controller_read_no;
+    state->controller_state = controller_state;
+    state->controller_strobe_count = controller_strobe_count;
+    state->controller2_read_no = controller2_read_no;
+    state->controller2_state = controller2_state;
+    state->controller_polled = controller_polled;
+    state->lag_frame = lag_frame;
+    state->lag_frame_count = lag_frame_count;
+    state->frame_no = m_frame_no;
+    state->bg_nt = m_bg_nt;
+    state->bg_attr = m_bg_attr;
+    state->bg_pattern_lo = m_bg_pattern_lo;
+    state->bg_pattern_hi = m_bg_pattern_hi;
+    state->bg_shift_lo = m_bg_shift_lo;
+    state->bg_shift_hi = m_bg_shift_hi;
+    state->attr_shift_lo = m_attr_shift_lo;
+    state->attr_shift_hi = m_attr_shift_hi;
+    std::memcpy(state->sprite_slots, m_sprite_slots, sizeof(m_sprite_slots));
+    state->sprite_count = m_sprite_count;
+    std::memcpy(state->sprite_line, m_sprite_line, sizeof(m_sprite_line));
+}
+
+void PpuDevice::set_state(const State& state) {
+    std::memcpy(vram, state.vram, sizeof(vram));
+    ntick = state.ntick;
+    ppu_reg_w = state.ppu_reg_w;
+    ppuaddr = state.ppuaddr;
+    ppu_tmp_addr = state.ppu_tmp_addr;
+    fine_x = state.fine_x;
+    oamaddr = state.oamaddr;
+    ppuctrl = state.ppuctrl;
+    ppumask = state.ppumask;
+    ppustatus = state.ppustatus;
+    std::memcpy(ppuoam, state.ppuoam, sizeof(ppuoam));
+    ppudata_buffer = state.ppudata_buffer;
+    controller_strobe = state.controller_strobe;
+    controller_read_no = state.controller_read_no;
+    controller_state = state.controller_state;
+    controller_strobe_count = state.controller_strobe_count;
+    controller2_read_no = state.controller2_read_no;
+    controller2_state = state.controller2_state;
+    controller_polled = state.controller_polled;
+    lag_frame = state.lag_frame;
+    lag_frame_count = state.lag_frame_count;
+    m_frame_no = state.frame_no;
+    m_bg_nt = state.bg_nt;
+    m_bg_attr = state.bg_attr;
+    m_bg_pattern_lo = state.bg_pattern_lo;
+    m_bg_pattern_hi = state.bg_pattern_hi;
+    m_bg_shift_lo = state.bg_shift_lo;
+    m_bg_shift_hi = state.bg_shift_hi;
+    m_attr_shift_lo = state.attr_shift_lo;
+    m_attr_shift_hi = state.attr_shift_hi;
+    std::memcpy(m_sprite_slots, state.sprite_slots, sizeof(m_sprite_slots));
+    m_sprite_count = state.sprite_count;
+    std::memcpy(m_sprite_line, state.sprite_line, sizeof(m_sprite_line));
+    update_dot_position();
+    if (m_render_thread != nullptr) {
+        m_render_thread->resync();
+        reset_prediction();
+    }
 }
 
 bool PpuDevice::get_ppuctrl_bit(uint8_t status_bit) {
@@ -36,43 +206,82 @@ void PpuDevice::set(uint16_t addr, uint8_t value) {
     //     key %= 8
     // }
     uint16_t oamdma_source_addr;
+    if (m_render_thread != nullptr && ((addr >= KEY_PPUCTRL && addr <= KEY_PPUDATA) || addr == KEY_OAMDMA)) {
+        render_state_changing();
+        if (addr != KEY_OAMDMA) {
+            m_render_thread->log(get_tick(), PPU_LOG_WRITE, addr, value);
+        }
+    }
     switch (addr)
     {
     case KEY_PPUCTRL:
+        if (m_setup_observer != nullptr) {
+            m_setup_observer->ppu_setup_changing();
+        }
+        // enabling the NMI during vblank triggers it at once
+        // (the replica of the render thread has no cpu)
+        if (m_dot_renderer && cpu != nullptr && (ppustatus & PPUSTATUS_VBLANK) && !get_ppuctrl_bit(PPUCTRL_VBLANKNMI) && (value & PPUCTRL_VBLANKNMI)) {
+            cpu->nmi();
+        }
         ppuctrl = value;
+        ppu_tmp_addr = (ppu_tmp_addr & 0xf3ff) | (static_cast<uint16_t>(value & 0b11) << 10);
+        if (m_setup_observer != nullptr) {
+            m_setup_observer->ppu_setup_changed();
+        }
         break;
     
     case KEY_PPUMASK:
+        if (m_setup_observer != nullptr) {
+            m_setup_observer->ppu_setup_changing();
+        }
+        ppumask = value;
+        if (m_setup_observer != nullptr) {
+            m_setup_observer->ppu_setup_changed();
+        }
         break;
     
     case KEY_PPUADDR:
-        // done in two reads : msb, then lsb
+        // done in two writes : msb, then lsb, v is only set by the second
         if (ppu_reg_w == 1) {
             //we are reading the lsb
-            ppuaddr = (ppuaddr << 8) + static_cast<uint16_t>(value);
+            ppu_tmp_addr = (ppu_tmp_addr & 0xff00) | static_cast<uint16_t>(value);
+            ppuaddr = ppu_tmp_addr;
             ppu_reg_w = 0;
         } else {
             // msb, null the most signifants two bits (14 bit long addr space)
-            ppuaddr = static_cast<uint16_t>(value & 0b00111111);
+            ppu_tmp_addr = (ppu_tmp_addr & 0x00ff) | (static_cast<uint16_t>(value & 0b00111111) << 8);
             ppu_reg_w = 1;
         }
         break;
 
     case KEY_PPUDATA:
-        vram[ppuaddr] = value;
+        // TODO : during rendering, the dot renderer should increment v as its fetches do
+        vram[ppuaddr & 0x3fff] = value;
         inc_ppuaddr();
         break;
 
     case KEY_PPUSCROLL:
-        if (value != 0) {
+        if (!m_dot_renderer && m_render_thread == nullptr && value != 0) {
             throw std::runtime_error("scroll not implemented");
         }
+        if (ppu_reg_w == 0) {
+            // x : coarse x in t, fine x apart
+            ppu_tmp_addr = (ppu_tmp_addr & ~0x001f) | (value >> 3);
+            fine_x = value & 0b111;
+            ppu_reg_w = 1;
+        } else {
+            // y : coarse and fine y in t
+            ppu_tmp_addr = (ppu_tmp_addr & 0x0c1f) | (static_cast<uint16_t>(value & 0b111) << 12) | (static_cast<uint16_t>(value & 0xf8) << 2);
+            ppu_reg_w = 0;
+        }
         break;
 
     case KEY_OAMADDR:
+        oamaddr = value;
         break;
 
     case KEY_OAMDATA:
+        ppuoam[oamaddr++] = value;
         break;
 
     case KEY_OAMDMA:
@@ -81,21 +290,43 @@ void PpuDevice::set(uint16_t addr, uint8_t value) {
         for (uint16_t i = 0; i < 256; i ++) {
             ppuoam[i] = cpu_ram->get(oamdma_source_addr + i);
         }
+        if (m_render_thread != nullptr) {
+            for (uint16_t i = 0; i < 256; i ++) {
+                m_render_thread->log(get_tick(), PPU_LOG_OAM, i, ppuoam[i]);
+            }
+        }
         break;
 
     case KEY_CTRL1:
+        controller_polled = true;
         controller_strobe = (value & 1); // get lsb
         if (controller_strobe == 1) {
             controller_read_no = 0;
+            // TODO : the input log only has the first controller
+            controller2_read_no = 0;
+            controller2_state = m_kb2_state;
+            // the controller shift register is loaded here, so the input
+            // only changes at strobe points and can be logged / replayed
+            if (m_input_log == nullptr) {
+                controller_state = m_kb_state;
+            } else if (controller_strobe_count < static_cast<long>(m_input_log->size())) {
+                controller_state = (*m_input_log)[controller_strobe_count];
+            } else {
+                controller_state = m_kb_state;
+                m_input_log->push_back(controller_state);
+            }
+            controller_strobe_count++;
         }
         break;
 
     case KEY_APU_STATUS:
         m_apu->set(addr, value);
+        break;
 
     case KEY_CTRL2:
         // this write corresponds to the APU set mode and interrupt...
         m_apu->set(addr, value);
+        break;
 
     default:
         break;
@@ -104,26 +335,46 @@ void PpuDevice::set(uint16_t addr, uint8_t value) {
 
 uint8_t PpuDevice::get(uint16_t addr) {
     uint8_t retval;
-    uint8_t controller_state;
     switch (addr) {
     case KEY_PPUDATA:
+        if (cdl != nullptr && ppuaddr < 0x2000) {
+            cdl->log_chr(ppuaddr, 1, CDL_CHR_READ);
+        }
         // get buffer value
         retval = ppudata_buffer;
         // update buffer AFTER the read
-        ppudata_buffer = vram[ppuaddr];
+        ppudata_buffer = vram[ppuaddr & 0x3fff];
         // increase ppuaddr after access
         inc_ppuaddr();
+        if (m_render_thread != nullptr) {
+            render_state_changing();
+            m_render_thread->log(get_tick(), PPU_LOG_READ, addr, 0);
+        }
         break;
     
     case KEY_PPUSTATUS:
-        // TODO : implement PPUSTATUS for real
-        retval = 0b10000000;
+        ppu_reg_w = 0;
+        if (m_render_thread != nullptr) {
+            retval = speculated_status() | (ppudata_buffer & 0b00011111);
+            break;
+        }
+        if (!m_dot_renderer) {
+            // the frame renderer has no timing, always in vblank
+            retval = PPUSTATUS_VBLANK;
+            break;
+        }
+        // the low bits are whatever was last on the PPU bus
+        retval = (ppustatus & 0b11100000) | (ppudata_buffer & 0b00011111);
+        ppustatus &= ~PPUSTATUS_VBLANK;
+        break;
+
+    case KEY_OAMDATA:
+        retval = ppuoam[oamaddr];
         break;
     
     case KEY_CTRL1:
         // TODO : In the NES and Famicom, the top three (or five) bits are not driven, and so retain the bits of the previous byte on the bus. Usually this is the most significant byte of the address of the controller port—0x40. Certain games (such as Paperboy) rely on this behavior and require that reads from the controller ports return exactly $40 or $41 as appropriate. See: Controller reading: unconnected data lines.
-        controller_state = m_kb_state; // TODO link to a keyboard this
-
+        controller_polled = true;
         if (controller_read_no > 7) {
             retval = 1;
         }
@@ -134,6 +385,22 @@ uint8_t PpuDevice::get(uint16_t addr) {
             }
         }
         break;
+
+    case KEY_CTRL2:
+        controller_polled = true;
+        if (controller2_read_no > 7) {
+            retval = 1;
+        } else {
+            retval = ((controller2_state >> controller2_read_no) & 1);
+            if (controller_strobe == 0) {
+                controller2_read_no += 1;
+            }
+        }
+        break;
+
+    case KEY_APU_STATUS:
+        retval = m_apu->get(addr);
+        break;
         
     default:
         break;
@@ -141,16 +408,556 @@ uint8_t PpuDevice::get(uint16_t addr) {
     return retval;
 }
 
+uint8_t PpuDevice::peek(uint16_t addr) {
+    // what get would return, leaving the flags, the buffer, the address
+    // and the controller shift registers as they are
+    switch (addr) {
+    case KEY_PPUDATA:
+        return ppudata_buffer;
+
+    case KEY_PPUSTATUS:
+        if (m_render_thread != nullptr) {
+            // the sprite flags as last predicted, the render thread isn't synced
+            uint8_t status = ntick < PPU_PRERENDER_TICK ? ppustatus & PPUSTATUS_VBLANK : 0;
+            if (m_prediction.valid) {
+                int64_t tick = get_tick();
+                status |= (tick >= m_prediction.hit_tick ? PPUSTATUS_SPRITE0_HIT : 0)
+                        | (tick >= m_prediction.overflow_tick ? PPUSTATUS_OVERFLOW : 0);
+            }
+            return status | (ppudata_buffer & 0b00011111);
+        }
+        if (!m_dot_renderer) {
+            return PPUSTATUS_VBLANK;
+        }
+        return (ppustatus & 0b11100000) | (ppudata_buffer & 0b00011111);
+
+    case KEY_OAMDATA:
+        return ppuoam[oamaddr];
+
+    case KEY_CTRL1:
+        return controller_read_no > 7 ? 1 : (controller_state >> controller_read_no) & 1;
+
+    case KEY_CTRL2:
+        return controller2_read_no > 7 ? 1 : (controller2_state >> controller2_read_no) & 1;
+
+    case KEY_APU_STATUS:
+        return m_apu->peek(addr);
+
+    default:
+        return 0;
+    }
+}
+
 void PpuDevice::tick() {
+    if (m_dot_renderer) {
+        tick_dot();
+        return;
+    }
+    ntick += 1;
+    if (ntick == PPU_FRAME_TICKS){
+        ntick = 0;
+        start_vblank();
+    }
+}
+
+void PpuDevice::start_vblank() {
+    m_frame_no++;
+    // before the observers, they may skip the lag frames
+    lag_frame = !controller_polled;
+    lag_frame_count += lag_frame;
+    controller_polled = false;
+    if (m_dot_renderer) {
+        ppustatus |= PPUSTATUS_VBLANK;
+        if (m_pipeline != nullptr) {
+            if (m_slice_rows == 0) {
+                m_pipeline->push_emulated(&m_dot_frame, m_frame_no);
+            }
+        } else {
+            cv::swap(frame, m_dot_frame);
+        }
+    } else if (m_render_thread != nullptr) {
+        // the replica draws the frame up to here
+        ppustatus |= PPUSTATUS_VBLANK;
+        m_render_thread->log(get_tick(), PPU_LOG_SYNC, 0, 0);
+    } else if (m_pipeline != nullptr) {
+        // drawn here from the state of the frame end, not by the UI while it runs
+        render_nametable(&frame);
+        render_oam(&frame);
+        m_pipeline->push_emulated(&frame, m_frame_no);
+    }
+    if (m_snapshots != nullptr) {
+        publish_snapshot();
+    }
+    if (m_frame_observer != nullptr) {
+        m_frame_observer->vblank_started(m_frame_no);
+    }
+    if (get_ppuctrl_bit(PPUCTRL_VBLANKNMI) && cpu != nullptr) {
+        cpu->nmi();
+    }
+}
+
+// m_sprite_line flags, next to the palette of the sprite
+enum {
+    SPRITE_LINE_BEHIND_BG = BIT5,
+    SPRITE_LINE_ZERO = BIT6, // the pixel is from sprite 0
+};
+
+/*
+Priority between the background and the sprite pixels, for every
+background pixel (palette in bits 2-3) and sprite line entry : the
+palette index, and PIXEL_MIX_SPRITE0_HIT if both sprite 0 and the
+background are opaque. The visible dots look it up instead of branching.
+*/
+static const uint8_t PIXEL_MIX_SPRITE0_HIT = BIT7;
+
+struct PixelMixTable {
+    uint8_t table[16][128];
+
+    PixelMixTable() {
+        for (int bg = 0; bg < 16; bg++) {
+            for (int sprite = 0; sprite < 128; sprite++) {
+                bool bg_opaque = (bg & 0b11) != 0;
+                bool sprite_opaque = (sprite & 0b11) != 0;
+                uint8_t mixed = 0;
+                if (sprite_opaque && (!bg_opaque || (sprite & SPRITE_LINE_BEHIND_BG) == 0)) {
+                    mixed = 0x10 | (sprite & 0xf);
+                } else if (bg_opaque) {
+                    mixed = bg;
+                }
+                if (sprite_opaque && bg_opaque && (sprite & SPRITE_LINE_ZERO)) {
+                    mixed |= PIXEL_MIX_SPRITE0_HIT;
+                }
+                table[bg][sprite] = mixed;
+            }
+        }
+    }
+};
+static const PixelMixTable PIXEL_MIX;
+
+void PpuDevice::update_dot_position() {
+    // dots since the dot 0 of the vblank line, the pre-render line is one dot short
+    long pos = ntick + 1;
+    long prerender_end = (PPU_PRERENDER_LINE - PPU_VBLANK_LINE + 1) * PPU_SCANLINE_TICKS - 1;
+    if (pos < prerender_end) {
+        m_scanline = PPU_VBLANK_LINE + pos / PPU_SCANLINE_TICKS;
+        m_dot = pos % PPU_SCANLINE_TICKS;
+    } else {
+        m_scanline = (pos - prerender_end) / PPU_SCANLINE_TICKS;
+        m_dot = (pos - prerender_end) % PPU_SCANLINE_TICKS;
+    }
+}
+
+void PpuDevice::tick_dot() {
     ntick += 1;
-    if (ntick % 89342 == 89341){
+    m_dot++;
+    if (m_dot == PPU_SCANLINE_TICKS || (m_dot == PPU_SCANLINE_TICKS - 1 && m_scanline == PPU_PRERENDER_LINE)) {
+        m_dot = 0;
+        m_scanline = (m_scanline == PPU_PRERENDER_LINE) ? 0 : m_scanline + 1;
+    }
+    if (ntick == PPU_FRAME_TICKS) {
+        // line 241, dot 1
         ntick = 0;
-        if (get_ppuctrl_bit(PPUCTRL_VBLANKNMI)) {
-            cpu->interrupt(false);
+        start_vblank();
+        return;
+    }
+    if (m_scanline < 240) {
+        if (static_cast<unsigned>(m_dot - 1) < 256) {
+            visible_dot();
+            return;
+        }
+    } else if (m_scanline != PPU_PRERENDER_LINE) {
+        // post-render and vblank lines, nothing happens
+        return;
+    }
+    line_end_dot();
+}
+
+void PpuDevice::visible_dot() {
+    /*
+    Dots 1-256 of the lines 0-239, one pixel each
+    The fetches of the tile after next go on, the pixel is taken from the
+    top of the shift registers and mixed with the sprite line.
+    */
+    int x = m_dot - 1;
+    uint8_t palette_index = 0;
+    if (ppumask & (PPUMASK_SHOWBG | PPUMASK_SHOWSPRITES)) {
+        if (m_dot >= 2) {
+            shift_bg();
+            fetch_bg(x & 0b111);
+        }
+        if (m_dot == 256) {
+            inc_y();
+        }
+
+        int shift = 15 - fine_x;
+        uint8_t bg = ((m_bg_shift_lo >> shift) & 1) | (((m_bg_shift_hi >> shift) & 1) << 1)
+                   | (((m_attr_shift_lo >> shift) & 1) << 2) | (((m_attr_shift_hi >> shift) & 1) << 3);
+        uint8_t sprite = m_sprite_line[x];
+        // the left columns are shown if both the layer and its left bits are set
+        uint8_t show = (x < 8) ? ppumask & (ppumask << 2) : ppumask;
+        bg = (show & PPUMASK_SHOWBG) ? bg : 0;
+        sprite = (show & PPUMASK_SHOWSPRITES) ? sprite : 0;
+
+        uint8_t mixed = PIXEL_MIX.table[bg][sprite];
+        ppustatus |= (x != 255) ? (mixed & PIXEL_MIX_SPRITE0_HIT) >> 1 : 0;
+        palette_index = mixed & 0x1f;
+    }
+    m_dot_frame.ptr<uint8_t>(m_scanline)[x] = vram[0x3f00 + palette_index] & 0x3f;
+}
+
+void PpuDevice::line_end_dot() {
+    /*
+    Dots 0 and 257-340 of the lines 0-239 and the whole pre-render line :
+    sprite evaluation and fetches for the next line, prefetch of its first
+    two tiles, and the copies of t to v
+    TODO : the sprites are evaluated at once at dot 257 instead of 65-256
+    */
+    bool prerender = (m_scanline == PPU_PRERENDER_LINE);
+    if (prerender && m_dot == 1) {
+        ppustatus &= ~(PPUSTATUS_VBLANK | PPUSTATUS_SPRITE0_HIT | PPUSTATUS_OVERFLOW);
+    }
+    bool rendering = (ppumask & (PPUMASK_SHOWBG | PPUMASK_SHOWSPRITES)) != 0;
+    if (m_dot == 257) {
+        std::memset(m_sprite_line, 0, sizeof(m_sprite_line));
+        m_sprite_count = 0;
+        if (rendering && !prerender) {
+            evaluate_sprites();
+        }
+        if (m_slice_rows != 0 && m_pipeline != nullptr && !prerender && (m_scanline + 1) % m_slice_rows == 0) {
+            // beam racing, the last line of the slice is drawn
+            m_pipeline->push_slice(m_dot_frame, m_scanline + 1 - m_slice_rows, m_scanline + 1, m_frame_no);
+        }
+    }
+    if (!rendering) {
+        return;
+    }
+    if ((m_dot >= 2 && m_dot <= 257) || (m_dot >= 321 && m_dot <= 337)) {
+        shift_bg();
+        fetch_bg((m_dot - 1) & 0b111);
+    }
+    if (m_dot == 256) {
+        inc_y();
+    } else if (m_dot == 257) {
+        // horizontal bits of t
+        ppuaddr = (ppuaddr & ~0x041f) | (ppu_tmp_addr & 0x041f);
+    } else if (prerender && m_dot >= 280 && m_dot <= 304) {
+        // vertical bits of t
+        ppuaddr = (ppuaddr & ~0x7be0) | (ppu_tmp_addr & 0x7be0);
+    } else if (m_dot >= 257 && m_dot <= 320 && ((m_dot - 257) & 0b111) == 7) {
+        // the sprite patterns, one sprite per 8 dots
+        fetch_sprite((m_dot - 257) >> 3);
+    }
+}
+
+void PpuDevice::fetch_bg(int step) {
+    // one 8 dots cycle per tile : nametable, attribute, pattern low and high
+    uint16_t pattern_addr;
+    switch (step) {
+    case 0:
+        load_bg_shifters();
+        m_bg_nt = vram[0x2000 | (ppuaddr & 0x0fff)];
+        break;
+    case 2: {
+        uint8_t attr = vram[0x23c0 | (ppuaddr & 0x0c00) | ((ppuaddr >> 4) & 0x38) | ((ppuaddr >> 2) & 0x07)];
+        // quadrant of the 32x32 pixels area
+        m_bg_attr = (attr >> (((ppuaddr >> 4) & 0b100) | (ppuaddr & 0b10))) & 0b11;
+        break;
+    }
+    case 4:
+    case 6:
+        pattern_addr = (get_ppuctrl_bit(PPUCTRL_BGPATTTABLE) ? 0x1000 : 0) + (static_cast<uint16_t>(m_bg_nt) << 4) + ((ppuaddr >> 12) & 0b111);
+        if (step == 4) {
+            m_bg_pattern_lo = read_chr(pattern_addr);
+        } else {
+            m_bg_pattern_hi = read_chr(pattern_addr + 8);
+            if (cdl != nullptr) {
+                cdl->log_chr(pattern_addr, 1, CDL_CHR_RENDERED);
+                cdl->log_chr(pattern_addr + 8, 1, CDL_CHR_RENDERED);
+            }
+        }
+        break;
+    case 7:
+        inc_coarse_x();
+        break;
+    }
+}
+
+void PpuDevice::load_bg_shifters() {
+    m_bg_shift_lo = (m_bg_shift_lo & 0xff00) | m_bg_pattern_lo;
+    m_bg_shift_hi = (m_bg_shift_hi & 0xff00) | m_bg_pattern_hi;
+    m_attr_shift_lo = (m_attr_shift_lo & 0xff00) | ((m_bg_attr & 0b01) ? 0xff : 0x00);
+    m_attr_shift_hi = (m_attr_shift_hi & 0xff00) | ((m_bg_attr & 0b10) ? 0xff : 0x00);
+}
+
+void PpuDevice::shift_bg() {
+    m_bg_shift_lo <<= 1;
+    m_bg_shift_hi <<= 1;
+    m_attr_shift_lo <<= 1;
+    m_attr_shift_hi <<= 1;
+}
+
+void PpuDevice::inc_coarse_x() {
+    if ((ppuaddr & 0x001f) == 31) {
+        // next horizontal nametable
+        ppuaddr &= ~0x001f;
+        ppuaddr ^= 0x0400;
+    } else {
+        ppuaddr++;
+    }
+}
+
+// v moved to the next pixel line
+static uint16_t next_line_addr(uint16_t addr) {
+    if ((addr & 0x7000) != 0x7000) {
+        return addr + 0x1000;
+    }
+    addr &= ~0x7000;
+    uint16_t coarse_y = (addr & 0x03e0) >> 5;
+    if (coarse_y == 29) {
+        // next vertical nametable
+        coarse_y = 0;
+        addr ^= 0x0800;
+    } else if (coarse_y == 31) {
+        // in the attributes, wraps without switching
+        coarse_y = 0;
+    } else {
+        coarse_y++;
+    }
+    return (addr & ~0x03e0) | (coarse_y << 5);
+}
+
+void PpuDevice::inc_y() {
+    ppuaddr = next_line_addr(ppuaddr);
+}
+
+void PpuDevice::evaluate_sprites() {
+    // the first 8 sprites of OAM covering the next line
+    // TODO : the hardware overflow flag is buggy past the 8th sprite
+    unsigned height = get_ppuctrl_bit(PPUCTRL_SPRITESIZE) ? 16 : 8;
+    for (uint8_t sprite_no = 0; sprite_no < 64; sprite_no++) {
+        if (static_cast<unsigned>(m_scanline - ppuoam[sprite_no * 4]) >= height) {
+            continue;
         }
+        if (m_sprite_count == 8) {
+            ppustatus |= PPUSTATUS_OVERFLOW;
+            break;
+        }
+        m_sprite_slots[m_sprite_count++] = sprite_no;
     }
 }
 
+void PpuDevice::fetch_sprite(int slot) {
+    // fetch the pattern row of the sprite and draw it in the sprite line
+    if (slot >= m_sprite_count) {
+        return;
+    }
+    uint8_t sprite_no = m_sprite_slots[slot];
+    const uint8_t * sprite = &ppuoam[sprite_no * 4];
+    uint8_t attr = sprite[2];
+    // OAM y is the line before the sprite top
+    uint16_t addr = sprite_pattern_addr(sprite, m_scanline - sprite[0]);
+    uint8_t lo = read_chr(addr);
+    uint8_t hi = read_chr(addr + 8);
+    if (cdl != nullptr) {
+        cdl->log_chr(addr, 1, CDL_CHR_RENDERED);
+        cdl->log_chr(addr + 8, 1, CDL_CHR_RENDERED);
+    }
+
+    uint8_t flags = ((attr & 0b11) << 2) | ((attr & PPUOAM_ATT_BEHIND_BG) ? SPRITE_LINE_BEHIND_BG : 0) | (sprite_no == 0 ? SPRITE_LINE_ZERO : 0);
+    for (int i = 0; i < 8 && sprite[3] + i < 256; i++) {
+        int bit = (attr & PPUOAM_ATT_HFLIP) ? i : 7 - i;
+        uint8_t color = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+        // the lowest OAM index wins, whatever its priority
+        if (color != 0 && m_sprite_line[sprite[3] + i] == 0) {
+            m_sprite_line[sprite[3] + i] = flags | color;
+        }
+    }
+}
+
+uint16_t PpuDevice::sprite_pattern_addr(const uint8_t * sprite, int row) {
+    // low plane of the row of the sprite, the high one is 8 bytes after
+    bool tall = get_ppuctrl_bit(PPUCTRL_SPRITESIZE);
+    if (sprite[2] & PPUOAM_ATT_VFLIP) {
+        row = (tall ? 15 : 7) - row;
+    }
+    uint16_t addr;
+    if (tall) {
+        // 8x16 : the table is bit 0 of the tile number
+        addr = ((sprite[1] & 1) << 12) | ((sprite[1] & 0xfe) << 4);
+        if (row >= 8) {
+            addr += 16;
+            row -= 8;
+        }
+    } else {
+        addr = (get_ppuctrl_bit(PPUCTRL_OAMPATTTABLE) ? 0x1000 : 0) | (sprite[1] << 4);
+    }
+    return addr + row;
+}
+
+// ticks from the pre-render dot 1 to a dot of a visible line, the pre-render line is one dot short
+static int64_t line_dot_offset(int line, int dot) {
+    return PPU_SCANLINE_TICKS - 2 + line * PPU_SCANLINE_TICKS + dot;
+}
+
+static const int64_t PREDICTION_NEVER = INT64_MAX;
+
+int64_t PpuDevice::next_slice_tick() const {
+    // the slices are handed over at the dot 257 of their last line
+    int rows = (m_slice_rows != 0) ? m_slice_rows : 240;
+    int64_t now = get_tick();
+    int64_t frame_start = now - ntick + PPU_PRERENDER_TICK;
+    for (int end_row = rows; ; end_row += rows) {
+        if (end_row > 240) {
+            end_row = rows;
+            frame_start += PPU_FRAME_TICKS;
+        }
+        int64_t tick = frame_start + line_dot_offset(end_row - 1, 257);
+        if (tick > now) {
+            return tick;
+        }
+    }
+}
+
+void PpuDevice::render_state_changing() {
+    // the flags still to come this frame may depend on the change
+    int64_t tick = get_tick();
+    update_prediction();
+    if (tick < m_prediction.render_end && (tick < m_prediction.hit_tick || tick < m_prediction.overflow_tick)) {
+        m_prediction.valid = false;
+    }
+}
+
+int64_t PpuDevice::flags_frame_start() {
+    // the frame of the flags starts at the pre-render line
+    int64_t frame_start = get_tick() - ntick + PPU_PRERENDER_TICK;
+    if (ntick < PPU_PRERENDER_TICK) {
+        frame_start -= PPU_FRAME_TICKS;
+    }
+    return frame_start;
+}
+
+void PpuDevice::reset_prediction() {
+    // the state of the frame so far is unknown, the replica has the flags
+    m_prediction.frame_start = flags_frame_start();
+    m_prediction.valid = false;
+}
+
+void PpuDevice::update_prediction() {
+    /*
+    Every change of the rendering state updates the prediction first, so
+    when the frame has none yet, the current state is the one since it
+    started.
+    */
+    int64_t frame_start = flags_frame_start();
+    if (frame_start != m_prediction.frame_start) {
+        predict_status(frame_start);
+    }
+}
+
+void PpuDevice::predict_status(int64_t frame_start) {
+    /*
+    Ticks at which the dot renderer sets the sprite 0 hit and overflow
+    flags, if the rendering state stays the current one all the frame
+    Overflow : first line evaluating a 9th sprite, at its dot 257
+    Sprite 0 hit : first opaque pixel of sprite 0 over an opaque background
+    pixel, both layers shown, not at x 255. The background pixel is found
+    as the fetches do : t horizontally, v of line 0 moved line by line.
+    */
+    m_prediction.frame_start = frame_start;
+    m_prediction.render_end = frame_start + line_dot_offset(240, 0);
+    m_prediction.hit_tick = PREDICTION_NEVER;
+    m_prediction.overflow_tick = PREDICTION_NEVER;
+    m_prediction.valid = true;
+    if ((ppumask & (PPUMASK_SHOWBG | PPUMASK_SHOWSPRITES)) == 0) {
+        return;
+    }
+
+    int height = get_ppuctrl_bit(PPUCTRL_SPRITESIZE) ? 16 : 8;
+    uint8_t line_sprites[240] = {0};
+    for (int sprite_no = 0; sprite_no < 64; sprite_no++) {
+        for (int line = ppuoam[sprite_no * 4]; line < ppuoam[sprite_no * 4] + height && line < 240; line++) {
+            line_sprites[line]++;
+        }
+    }
+    for (int line = 0; line < 240; line++) {
+        if (line_sprites[line] > 8) {
+            m_prediction.overflow_tick = frame_start + line_dot_offset(line, 257);
+            break;
+        }
+    }
+
+    if ((ppumask & (PPUMASK_SHOWBG | PPUMASK_SHOWSPRITES)) != (PPUMASK_SHOWBG | PPUMASK_SHOWSPRITES)) {
+        return;
+    }
+    const uint8_t * sprite = ppuoam;
+    uint8_t left_masks = PPUMASK_SHOWBG_LEFT | PPUMASK_SHOWSPRITES_LEFT;
+    uint16_t line_addr = ppu_tmp_addr & 0x7be0;
+    int addr_line = 0;
+    for (int row = 0; row < height; row++) {
+        // evaluated on the line before
+        int line = sprite[0] + row + 1;
+        if (line >= 240) {
+            break;
+        }
+        for (; addr_line < line; addr_line++) {
+            line_addr = next_line_addr(line_addr);
+        }
+        uint16_t addr = sprite_pattern_addr(sprite, row);
+        uint8_t opaque = read_chr(addr) | read_chr(addr + 8);
+        for (int i = 0; i < 8 && sprite[3] + i < 255; i++) {
+            int x = sprite[3] + i;
+            int bit = (sprite[2] & PPUOAM_ATT_HFLIP) ? i : 7 - i;
+            if (((opaque >> bit) & 1) == 0 || (x < 8 && (ppumask & left_masks) != left_masks)) {
+                continue;
+            }
+            if (bg_opaque(line_addr, x)) {
+                m_prediction.hit_tick = frame_start + line_dot_offset(line, x + 1);
+                return;
+            }
+        }
+    }
+}
+
+bool PpuDevice::bg_opaque(uint16_t line_addr, int x) {
+    // v when the tile under x is fetched, line_addr has its vertical bits
+    int coarse_x = (ppu_tmp_addr & 0x001f) + ((x + fine_x) >> 3);
+    uint16_t addr = line_addr | (ppu_tmp_addr & 0x0400);
+    if (coarse_x >= 32) {
+        coarse_x -= 32;
+        addr ^= 0x0400;
+    }
+    addr |= coarse_x;
+    uint8_t tile = vram[0x2000 | (addr & 0x0fff)];
+    uint16_t pattern_addr = (get_ppuctrl_bit(PPUCTRL_BGPATTTABLE) ? 0x1000 : 0) + (static_cast<uint16_t>(tile) << 4) + ((addr >> 12) & 0b111);
+    int bit = 7 - ((x + fine_x) & 0b111);
+    return (((read_chr(pattern_addr) | read_chr(pattern_addr + 8)) >> bit) & 1) != 0;
+}
+
+uint8_t PpuDevice::speculated_status() {
+    // parallel renderer PPUSTATUS, without the low bits
+    int64_t tick = get_tick();
+    update_prediction();
+    uint8_t status;
+    if (m_prediction.valid) {
+        status = (tick >= m_prediction.hit_tick ? PPUSTATUS_SPRITE0_HIT : 0)
+               | (tick >= m_prediction.overflow_tick ? PPUSTATUS_OVERFLOW : 0);
+    } else {
+        status = m_render_thread->sync(tick) & (PPUSTATUS_SPRITE0_HIT | PPUSTATUS_OVERFLOW);
+        if (tick >= m_prediction.render_end) {
+            // past the rendered lines, the flags of the frame are known
+            m_prediction.hit_tick = (status & PPUSTATUS_SPRITE0_HIT) ? tick : PREDICTION_NEVER;
+            m_prediction.overflow_tick = (status & PPUSTATUS_OVERFLOW) ? tick : PREDICTION_NEVER;
+            m_prediction.valid = true;
+        }
+    }
+    m_render_thread->log(tick, PPU_LOG_READ, KEY_PPUSTATUS, 0);
+    // the vblank flag is set at vblank, cleared by the pre-render line or a read
+    if (ntick < PPU_PRERENDER_TICK) {
+        status |= ppustatus & PPUSTATUS_VBLANK;
+    }
+    ppustatus &= ~PPUSTATUS_VBLANK;
+    return status;
+}
 
 void PpuDevice::render_nametable(cv::Mat * frame) {
     // # x is left to right
@@ -228,23 +1035,18 @@ void PpuDevice::add_sprite(cv::Mat * frame, uint8_t sprite_no, bool table_no, ui
             } else { // vflip and hflip
                 pix_color = sprite[7-y][7-x];
             }
-            uint8_t r = 0;
-            uint8_t g = 0;
-            uint8_t b = 0; // TODO : set here transparent bg
+            uint8_t color_no = 0x0f; // black, TODO : set here transparent bg
             if (pix_color != 0) {
                 // 0x3f00 : palettes location in vram
                 // a palette : a set of 4 colors (4 bytes then)
                 // palette_no : the index of the palette in the palette list
                 // pix_color : the color in the palette
-                uint8_t color_no = vram[0x3f00 + static_cast<uint16_t>(palette_no) * 4 + static_cast<uint16_t>(pix_color)];
-                r = NES_COLORS[color_no][0]; // TODO : get pointer
-                g = NES_COLORS[color_no][1];
-                b = NES_COLORS[color_no][2];
+                color_no = vram[0x3f00 + static_cast<uint16_t>(palette_no) * 4 + static_cast<uint16_t>(pix_color)] & 0x3f;
             } else if (transparent_bg) {
                 continue;
             }
             // TODO there are fatser ways to populate a frame
-            frame->at<cv::Vec3b>(sprite_y + y, sprite_x + x) = cv::Vec3b(r, g, b);
+            frame->at<uint8_t>(sprite_y + y, sprite_x + x) = color_no;
         }
     }
 }
@@ -259,9 +1061,12 @@ void PpuDevice::get_sprite(uint8_t sprite[8][8], uint8_t sprite_no, bool table_n
     }
 
     uint16_t plane0_addr = (sprite_no + 256*table_no) << 4;
+    if (cdl != nullptr) {
+        cdl->log_chr(plane0_addr, 16, CDL_CHR_RENDERED);
+    }
     for (uint8_t j = 0; j < 8; j++) {
-        uint8_t plane0 = chr_rom[plane0_addr + j];
-        uint8_t plane1 = chr_rom[plane0_addr + j + 8];
+        uint8_t plane0 = chr_banks[plane0_addr >> 10][(plane0_addr + j) & 0x3ff];
+        uint8_t plane1 = chr_banks[plane0_addr >> 10][(plane0_addr + j + 8) & 0x3ff];
         for (uint8_t i = 0; i < 8; i++) {
             uint8_t color0 = (plane0 >> i) & 1;
             uint8_t color1 = (plane1 >> i) & 1;
@@ -272,6 +1077,10 @@ void PpuDevice::get_sprite(uint8_t sprite[8][8], uint8_t sprite_no, bool table_n
 }
 
 void PpuDevice::render() {
+    if (m_dot_renderer || m_render_thread != nullptr || m_pipeline != nullptr) {
+        // drawn as the frame goes, or at vblank for the pipeline
+        return;
+    }
     render_nametable(&frame);
     render_oam(&frame);
     // cv::imshow("prout", frame);
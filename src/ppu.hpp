@@ -1,9 +1,13 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
 #include <opencv2/opencv.hpp> 
 
 #include "device.hpp"
 #include "cpu.hpp"
+#include "cdl.hpp"
+#include "ppusnapshot.hpp"
 
 
 enum {
@@ -28,15 +32,57 @@ static const uint8_t PPUCTRL_BGPATTTABLE   = 0b00010000; // Pattern table no sel
 static const uint8_t PPUCTRL_OAMPATTTABLE  = 0b00001000; // Pattern table no select in 8x8 mode
 static const uint8_t PPUCTRL_VRAMINC       = 0b00000100;
 
+static const uint8_t PPUMASK_SHOWSPRITES   = 0b00010000;
+static const uint8_t PPUMASK_SHOWBG        = 0b00001000;
+static const uint8_t PPUMASK_SHOWSPRITES_LEFT = 0b00000100; // 0 : hide the 8 leftmost pixels
+static const uint8_t PPUMASK_SHOWBG_LEFT   = 0b00000010;
+
+static const uint8_t PPUSTATUS_VBLANK      = 0b10000000;
+static const uint8_t PPUSTATUS_SPRITE0_HIT = 0b01000000;
+static const uint8_t PPUSTATUS_OVERFLOW    = 0b00100000;
+
+// ticks between two vblanks, ntick 0 is the first dot of vblank (scanline 241)
+static const long PPU_FRAME_TICKS = 89341;
+static const long PPU_SCANLINE_TICKS = 341;
+// the frame has 262 lines, the last dot of the pre-render line is skipped
+static const int PPU_VBLANK_LINE = 241;
+static const int PPU_PRERENDER_LINE = 261;
+// ntick of the dot 1 of the pre-render line, where the status flags are cleared
+static const long PPU_PRERENDER_TICK = (PPU_PRERENDER_LINE - PPU_VBLANK_LINE) * PPU_SCANLINE_TICKS;
+
 static const uint8_t PPUOAM_ATT_HFLIP = 0b01000000;
 static const uint8_t PPUOAM_ATT_VFLIP = 0b10000000;
+static const uint8_t PPUOAM_ATT_BEHIND_BG = 0b00100000;
 
 const uint8_t NES_COLORS[64][3] = {{124, 124, 124}, {0, 0, 252}, {0, 0, 188}, {68, 40, 188}, {148, 0, 132}, {168, 0, 32}, {168, 16, 0}, {136, 20, 0}, {80, 48, 0}, {0, 120, 0}, {0, 104, 0}, {0, 88, 0}, {0, 64, 88}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {188, 188, 188}, {0, 120, 248}, {0, 88, 248}, {104, 68, 252}, {216, 0, 204}, {228, 0, 88}, {248, 56, 0}, {228, 92, 16}, {172, 124, 0}, {0, 184, 0}, {0, 168, 0}, {0, 168, 68}, {0, 136, 136}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {248, 248, 248}, {60, 188, 252}, {104, 136, 252}, {152, 120, 248}, {248, 120, 248}, {248, 88, 152}, {248, 120, 88}, {252, 160, 68}, {248, 184, 0}, {184, 248, 24}, {88, 216, 84}, {88, 248, 152}, {0, 232, 216}, {120, 120, 120}, {0, 0, 0}, {0, 0, 0}, {252, 252, 252}, {164, 228, 252}, {184, 184, 248}, {216, 184, 248}, {248, 184, 248}, {248, 164, 192}, {240, 208, 176}, {252, 224, 168}, {248, 216, 120}, {216, 248, 120}, {184, 248, 184}, {184, 248, 216}, {0, 252, 252}, {248, 216, 248}, {0, 0, 0}, {0, 0, 0}};
 
 
+/*
+Told about the changes of the rendering setup (PPUCTRL, PPUMASK), for
+the mappers which predict the PPU memory accesses (MMC3 IRQ counter)
+*/
+class PpuSetupObserver {
+ public:
+    virtual void ppu_setup_changing() = 0;
+    virtual void ppu_setup_changed() = 0;
+};
+
+// Told at each vblank, with the frame just drawn complete
+class PpuFrameObserver {
+ public:
+    virtual void vblank_started(long frame_no) = 0;
+};
+
+class PpuRenderThread;
+class FramePipeline;
+
 class PpuDevice : public Device {
 private:
     uint8_t chr_rom[0x4000];
+    // 1 KB CHR banks, all in chr_rom unless a mapper switched them
+    const uint8_t * chr_banks[8];
+    PpuSetupObserver * m_setup_observer = nullptr;
+    PpuFrameObserver * m_frame_observer = nullptr;
 
     // TODO : this is quite bad, we share here cpuram for OAMDMA
     Device * cpu_ram;
@@ -44,6 +90,8 @@ private:
     Device * m_apu;
     // this is used to call the interrupt, same, could do better (interface ?)
     Emu6502 * cpu;
+    // optional, logs the CHR bytes used for rendering
+    CodeDataLogger * cdl = nullptr;
 
     // cpu_interrupt = None
     // cpu_ram = None
@@ -51,19 +99,96 @@ private:
     uint8_t vram[0x4000] = {0}; // 14 bit addr space
     long ntick = 0;
     uint8_t ppu_reg_w = 0;
+    /*
+    ppuaddr is the current VRAM address (v), ppu_tmp_addr the one written
+    by PPUSCROLL / PPUADDR (t), copied to v during rendering
+    yyy NN YYYYY XXXXX : fine y, nametable, coarse y, coarse x
+    https://www.nesdev.org/wiki/PPU_scrolling
+    */
     uint16_t ppuaddr = 0;
+    uint16_t ppu_tmp_addr = 0;
+    uint8_t fine_x = 0;
+    uint8_t oamaddr = 0;
     uint8_t ppuctrl = 0;
+    uint8_t ppumask = 0;
     uint8_t ppustatus = 0;
     uint8_t ppuoam[256] = {0};
     uint8_t ppudata_buffer = 0; // ppudata does not read directly ram but a buffer that is updated after each read
 
     uint8_t controller_strobe = 0;
     uint8_t controller_read_no = 0;
+    uint8_t controller_state = 0; // latched from m_kb_state by the strobe
+    long controller_strobe_count = 0;
+    // second controller, read at 0x4017, latched by the same strobe
+    uint8_t controller2_read_no = 0;
+    uint8_t controller2_state = 0;
+    // lag frames : the game neither strobed nor read the controllers between two vblanks
+    bool controller_polled = false;
+    bool lag_frame = false;    // the frame ended by the last vblank
+    long lag_frame_count = 0;
 
     uint8_t m_kb_state = 0;
+    uint8_t m_kb2_state = 0;
+    // optional, controller states latched so far indexed by strobe count
+    // entries already logged are replayed instead of the live keyboard
+    std::vector<uint8_t> * m_input_log = nullptr;
+    // optional, receives a copy of the PPU memories at each vblank
+    PpuSnapshotExchange * m_snapshots = nullptr;
+    long m_frame_no = 0;
     
+    // NES color indices, converted to RGB by the FramePipeline
     cv::Mat frame;
-    
+    // optional, takes the frames at vblank instead of frame
+    FramePipeline * m_pipeline = nullptr;
+    // beam racing, the dot renderer hands slices of rows to the pipeline, 0 : whole frames
+    int m_slice_rows = 0;
+
+    /*
+    Parallel renderer : a PpuRenderThread replays the writes changing the
+    rendering on a replica which draws the frame, this PPU only keeps the
+    timing. The sprite 0 hit and overflow flags are predicted from the
+    rendering state of the frame (see predict_status), the reads only wait
+    for the render thread when it changed during the rendered lines before
+    the predicted flags. The ticks here count from power on, see get_tick.
+    */
+    PpuRenderThread * m_render_thread = nullptr;
+    struct StatusPrediction {
+        int64_t frame_start; // dot 1 of the pre-render line
+        int64_t render_end;  // past the last dot which can set a flag
+        int64_t hit_tick;
+        int64_t overflow_tick;
+        bool valid;
+    };
+    StatusPrediction m_prediction = {0, 0, 0, 0, false};
+
+    /*
+    Dot renderer : the 341 dots x 262 lines pipeline, with the background
+    fetches at their dots, the shift registers and the sprite evaluation of
+    each line, so that the register writes take effect mid-line. The frame
+    is drawn in m_dot_frame, swapped with frame at vblank.
+    The sprites of a line are rasterised once (m_sprite_line) when their
+    patterns are fetched, so that a visible dot only combines two pixels.
+    */
+    bool m_dot_renderer = false;
+    int m_scanline = PPU_VBLANK_LINE;
+    int m_dot = 1;
+    cv::Mat m_dot_frame;
+    // fetched for the next tile
+    uint8_t m_bg_nt = 0;
+    uint8_t m_bg_attr = 0;
+    uint8_t m_bg_pattern_lo = 0;
+    uint8_t m_bg_pattern_hi = 0;
+    // two tiles, the pixel is at bit 15 - fine_x
+    uint16_t m_bg_shift_lo = 0;
+    uint16_t m_bg_shift_hi = 0;
+    uint16_t m_attr_shift_lo = 0;
+    uint16_t m_attr_shift_hi = 0;
+    // OAM index of the sprites of the next line
+    uint8_t m_sprite_slots[8];
+    uint8_t m_sprite_count = 0;
+    // per pixel : color (bits 0-1), palette (2-3) and the SPRITE_LINE_* flags
+    uint8_t m_sprite_line[256] = {0};
+
     bool get_ppuctrl_bit(uint8_t status_bit);
 
     void inc_ppuaddr();
@@ -71,14 +196,125 @@ private:
     void render_nametable(cv::Mat * frame);
     void add_sprite(cv::Mat * frame, uint8_t sprite_no, bool table_no, uint8_t sprite_x, uint8_t sprite_y, uint8_t palette_no, bool hflip, bool vflip, bool transparent_bg);
     void get_sprite(uint8_t sprite[8][8], uint8_t sprite_no, bool table_no, bool doubletile);
+    void publish_snapshot();
+    void start_vblank();
+
+    void tick_dot();
+    void visible_dot();
+    void line_end_dot();
+    void update_dot_position();
+    void fetch_bg(int step);
+    void load_bg_shifters();
+    void shift_bg();
+    void inc_coarse_x();
+    void inc_y();
+    void evaluate_sprites();
+    void fetch_sprite(int slot);
+    uint16_t sprite_pattern_addr(const uint8_t * sprite, int row);
+
+    void render_state_changing();
+    int64_t flags_frame_start();
+    void reset_prediction();
+    void update_prediction();
+    void predict_status(int64_t frame_start);
+    bool bg_opaque(uint16_t line_addr, int x);
+    uint8_t speculated_status();
+    uint8_t read_chr(uint16_t addr) { return chr_banks[(addr >> 10) & 0b111][addr & 0x3ff]; }
 
  public:
+    // the live keyboard and the rendered frame are not part of the state
+    struct State {
+        uint8_t vram[0x4000];
+        long ntick;
+        uint8_t ppu_reg_w;
+        uint16_t ppuaddr;
+        uint16_t ppu_tmp_addr;
+        uint8_t fine_x;
+        uint8_t oamaddr;
+        uint8_t ppuctrl;
+        uint8_t ppumask;
+        uint8_t ppustatus;
+        uint8_t ppuoam[256];
+        uint8_t ppudata_buffer;
+        uint8_t controller_strobe;
+        uint8_t controller_read_no;
+        uint8_t controller_state;
+        long controller_strobe_count;
+        uint8_t controller2_read_no;
+        uint8_t controller2_state;
+        bool controller_polled;
+        bool lag_frame;
+        long lag_frame_count;
+        long frame_no;
+        // dot renderer pipeline
+        uint8_t bg_nt;
+        uint8_t bg_attr;
+        uint8_t bg_pattern_lo;
+        uint8_t bg_pattern_hi;
+        uint16_t bg_shift_lo;
+        uint16_t bg_shift_hi;
+        uint16_t attr_shift_lo;
+        uint16_t attr_shift_hi;
+        uint8_t sprite_slots[8];
+        uint8_t sprite_count;
+        uint8_t sprite_line[256];
+    };
+
     PpuDevice(uint8_t * chr_rom, Device * cpu_ram, Device * apu);
     uint8_t get(uint16_t addr);
+    uint8_t peek(uint16_t addr);
     void set(uint16_t addr, uint8_t val);
     void tick();
     void set_cpu(Emu6502 * cpu);
-    void set_kb_state(uint8_t kb_state);
+    void set_cdl(CodeDataLogger * cdl);
+    // port 0 : first controller, 1 : second
+    void set_kb_state(uint8_t kb_state, int port = 0);
+    void set_input_log(std::vector<uint8_t> * input_log);
+    void set_snapshot_exchange(PpuSnapshotExchange * snapshots);
+    void set_frame_pipeline(FramePipeline * pipeline);
+    FramePipeline * get_frame_pipeline() const { return m_pipeline; }
+    // 240 must be a multiple of nslices, 0 : whole frames
+    void set_beam_slices(int nslices);
+    int get_beam_slices() const { return m_slice_rows == 0 ? 0 : 240 / m_slice_rows; }
+    // first tick after now at which a slice is handed over
+    int64_t next_slice_tick() const;
+    // CHR banking, slot i covers 0x400*i - 0x400*i + 0x3ff
+    void set_chr_bank(int slot, const uint8_t * bank);
+    const uint8_t * get_chr_bank(int slot) const { return chr_banks[slot]; }
+    // maps the nametable RAM (0 - 3) as the CHR of the slot, e.g. the Namco 163 does
+    void set_chr_nametable(int slot, int nametable);
+    // the nametable the slot maps, -1 if it maps CHR
+    int get_chr_nametable(int slot) const;
+    // what an OAMDMA writes, for the replica of the render thread
+    void write_oam(uint8_t addr, uint8_t value) { ppuoam[addr] = value; }
+    void set_setup_observer(PpuSetupObserver * observer);
+    void set_frame_observer(PpuFrameObserver * observer);
+    PpuFrameObserver * get_frame_observer() const { return m_frame_observer; }
+    // false : the frame is drawn at once by render(), without scrolling
+    void set_dot_renderer(bool enable);
+    bool is_dot_renderer() const { return m_dot_renderer; }
+    // set by PpuRenderThread::start / stop
+    void set_render_thread(PpuRenderThread * render_thread);
+    uint8_t get_ppuctrl() const { return ppuctrl; }
+    uint8_t get_ppumask() const { return ppumask; }
+    // position in the frame, see PPU_FRAME_TICKS
+    long get_frame_tick() const { return ntick; }
+    // ticks since power on, not part of the state
+    int64_t get_tick() const { return static_cast<int64_t>(m_frame_no) * PPU_FRAME_TICKS + ntick; }
+    long get_frame_no() const { return m_frame_no; }
+    uint8_t get_ppustatus() const { return ppustatus; }
+    // v and t, see ppuaddr
+    uint16_t get_vram_addr() const { return ppuaddr; }
+    uint16_t get_tmp_addr() const { return ppu_tmp_addr; }
+    uint8_t get_fine_x() const { return fine_x; }
+    const uint8_t * get_oam() const { return ppuoam; }
+    const uint8_t * get_palette() const { return &vram[0x3f00]; }
+    long get_strobe_count();
+    // the frame ended by the last vblank didn't poll the controllers (input ignored)
+    bool is_lag_frame() const { return lag_frame; }
+    long get_lag_frame_count() const { return lag_frame_count; }
+    void get_state(State * state);
+    void set_state(const State& state);
     void render();
     cv::Mat *getFrame();
 };
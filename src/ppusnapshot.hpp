@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// what the debug viewers need from the PPU, copied at each vblank
+struct PpuSnapshot {
+    uint8_t vram[0x4000];
+    uint8_t oam[256];
+    uint8_t chr[0x4000];
+    uint8_t ppuctrl;
+    // t and fine x at vblank : the scroll of the frame drawn, or of its
+    // last split when the game changes it mid-frame
+    uint16_t ppu_tmp_addr;
+    uint8_t fine_x;
+    long frame_no;
+};
+
+/*
+Single producer / single consumer triple buffer
+The emulation thread fills the write buffer then publishes it, the viewer
+thread picks the latest published one. Neither side ever waits for the
+other : a frame the viewer did not pick in time is simply replaced.
+m_middle holds the index of the buffer in between, plus SNAPSHOT_FRESH when
+it was published and not picked yet.
+*/
+class PpuSnapshotExchange {
+ public:
+    // producer side
+    PpuSnapshot * get_write_buffer() {
+        return &m_buffers[m_write];
+    }
+
+    void publish() {
+        int prev = m_middle.exchange(m_write | SNAPSHOT_FRESH, std::memory_order_acq_rel);
+        m_write = prev & SNAPSHOT_INDEX;
+    }
+
+    // consumer side, nullptr if nothing new since the last call
+    const PpuSnapshot * acquire() {
+        if ((m_middle.load(std::memory_order_relaxed) & SNAPSHOT_FRESH) == 0) {
+            return nullptr;
+        }
+        int prev = m_middle.exchange(m_read, std::memory_order_acq_rel);
+        m_read = prev & SNAPSHOT_INDEX;
+        return &m_buffers[m_read];
+    }
+
+ private:
+    enum {
+        SNAPSHOT_INDEX = 0b011,
+        SNAPSHOT_FRESH = 0b100,
+    };
+
+    PpuSnapshot m_buffers[3];
+    int m_write = 0;
+    int m_read = 1;
+    std::atomic<int> m_middle {2};
+};
@@ -0,0 +1,132 @@
+#include "pputhread.hpp"
+
+// the replica CHR banks are the console PPU ones, set by copy_state
+static uint8_t NO_CHR[0x4000] = {0};
+
+PpuRenderThread::PpuRenderThread(PpuDevice * ppu) : m_ppu(ppu), m_replica(NO_CHR, nullptr, nullptr) {
+    m_replica.set_dot_renderer(true);
+}
+
+PpuRenderThread::~PpuRenderThread() {
+    stop();
+}
+
+void PpuRenderThread::start() {
+    if (m_thread.joinable()) {
+        return;
+    }
+    // the console PPU keeps the timing only
+    m_was_dot_renderer = m_ppu->is_dot_renderer();
+    m_ppu->set_dot_renderer(false);
+    // the replica hands its frames over itself
+    m_replica.set_frame_pipeline(m_ppu->get_frame_pipeline());
+    m_replica.set_beam_slices(m_ppu->get_beam_slices());
+    copy_state();
+    m_ppu->set_render_thread(this);
+    start_thread();
+}
+
+void PpuRenderThread::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    m_ppu->set_render_thread(nullptr);
+    stop_thread();
+    m_log.clear();
+    m_ppu->set_dot_renderer(m_was_dot_renderer);
+}
+
+void PpuRenderThread::resync() {
+    // the pending writes belong to the replaced state
+    stop_thread();
+    m_log.clear();
+    copy_state();
+    start_thread();
+}
+
+void PpuRenderThread::copy_state() {
+    PpuDevice::State state;
+    m_ppu->get_state(&state);
+    m_replica.set_state(state);
+    for (int slot = 0; slot < 8; slot++) {
+        int nametable = m_ppu->get_chr_nametable(slot);
+        if (nametable >= 0) {
+            m_replica.set_chr_nametable(slot, nametable);
+        } else {
+            m_replica.set_chr_bank(slot, m_ppu->get_chr_bank(slot));
+        }
+    }
+    m_tick = m_ppu->get_tick();
+    m_frame_no = m_replica.get_frame_no();
+    m_synced_tick = -1;
+}
+
+void PpuRenderThread::start_thread() {
+    m_done = false;
+    m_thread = std::thread(&PpuRenderThread::run, this);
+}
+
+void PpuRenderThread::stop_thread() {
+    m_done = true;
+    m_thread.join();
+}
+
+void PpuRenderThread::log(int64_t tick, uint8_t type, uint16_t addr, uint8_t value, const uint8_t * chr_bank) {
+    PpuLogEntry entry = {tick, chr_bank, addr, value, type};
+    // a whole log behind, let the replica catch up
+    while (!m_log.push(entry)) {
+        std::this_thread::yield();
+    }
+}
+
+uint8_t PpuRenderThread::sync(int64_t tick) {
+    log(tick, PPU_LOG_SYNC, 0, 0);
+    while (m_synced_tick.load(std::memory_order_acquire) < tick) {
+        std::this_thread::yield();
+    }
+    return m_synced_status.load(std::memory_order_relaxed);
+}
+
+void PpuRenderThread::run() {
+    PpuLogEntry entry;
+    while (!m_done) {
+        if (!m_log.pop(&entry)) {
+            std::this_thread::yield();
+            continue;
+        }
+        // render up to the write, then apply it
+        for (; m_tick < entry.tick; m_tick++) {
+            m_replica.tick();
+        }
+        if (m_replica.get_frame_no() != m_frame_no && m_replica.get_frame_pipeline() == nullptr) {
+            // same size, copyTo reuses the console PPU frame buffer
+            m_frame_no = m_replica.get_frame_no();
+            m_replica.getFrame()->copyTo(*m_ppu->getFrame());
+        }
+        apply(entry);
+    }
+}
+
+void PpuRenderThread::apply(const PpuLogEntry& entry) {
+    switch (entry.type) {
+    case PPU_LOG_SYNC:
+        m_synced_status.store(m_replica.get_ppustatus(), std::memory_order_relaxed);
+        m_synced_tick.store(entry.tick, std::memory_order_release);
+        break;
+    case PPU_LOG_WRITE:
+        m_replica.set(entry.addr, entry.value);
+        break;
+    case PPU_LOG_READ:
+        m_replica.get(entry.addr);
+        break;
+    case PPU_LOG_OAM:
+        m_replica.write_oam(entry.addr, entry.value);
+        break;
+    case PPU_LOG_CHR_BANK:
+        m_replica.set_chr_bank(entry.addr, entry.chr_bank);
+        break;
+    case PPU_LOG_CHR_NAMETABLE:
+        m_replica.set_chr_nametable(entry.addr, entry.value);
+        break;
+    }
+}
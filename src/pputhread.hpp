@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "ppu.hpp"
+#include "spscring.hpp"
+
+enum {
+    PPU_LOG_SYNC,          // nothing to apply, the emulation thread may wait for it
+    PPU_LOG_WRITE,         // register write
+    PPU_LOG_READ,          // register read, for its side effects on w and v
+    PPU_LOG_OAM,           // byte written by an OAMDMA, addr is the OAM index
+    PPU_LOG_CHR_BANK,      // addr is the slot
+    PPU_LOG_CHR_NAMETABLE, // addr is the slot, value the nametable
+};
+
+struct PpuLogEntry {
+    int64_t tick; // see PpuDevice::get_tick
+    const uint8_t * chr_bank;
+    uint16_t addr;
+    uint8_t value;
+    uint8_t type;
+};
+
+typedef SpscRing<PpuLogEntry, 16384> PpuLog;
+
+/*
+Dot renderer on a second core
+The console PPU logs the timestamped writes changing the rendering and
+keeps running its timing only, the thread replays them on a replica in
+dot renderer mode which draws the frames behind the emulation, at most one
+frame late (the console PPU logs a sync at each vblank). The frames go to
+the frame pipeline of the console PPU, else are copied into its frame.
+The emulation only waits for the replica when a PPUSTATUS read needs its
+sprite 0 hit / overflow flags and the console PPU could not predict them.
+TODO : the CHR reads of the replica are not logged to the CDL
+*/
+class PpuRenderThread {
+ public:
+    PpuRenderThread(PpuDevice * ppu);
+    ~PpuRenderThread();
+
+    void start();
+    void stop();
+
+    // emulation thread side
+    void log(int64_t tick, uint8_t type, uint16_t addr, uint8_t value, const uint8_t * chr_bank = nullptr);
+    // waits until the replica reached tick, returns its PPUSTATUS then
+    uint8_t sync(int64_t tick);
+    // the console PPU state was replaced (save states, time travel)
+    void resync();
+
+ private:
+    void run();
+    void apply(const PpuLogEntry& entry);
+    void copy_state();
+    void start_thread();
+    void stop_thread();
+
+    PpuDevice * m_ppu;
+    PpuDevice m_replica;
+    PpuLog m_log;
+    bool m_was_dot_renderer = false;
+    int64_t m_tick = 0; // of the replica
+    long m_frame_no = 0; // of the replica, last copied frame
+    std::thread m_thread;
+    std::atomic<bool> m_done {false};
+    std::atomic<int64_t> m_synced_tick {-1};
+    std::atomic<uint8_t> m_synced_status {0};
+};
@@ -0,0 +1,174 @@
+#include <chrono>
+
+#include "ppuviewer.hpp"
+
+static const int PPUVIEWER_REFRESH_MS = 16;
+
+PpuViewer::PpuViewer(PpuDevice * ppu) : m_ppu(ppu),
+    m_patterns(16*8, 2*16*8, CV_8UC3),
+    m_nametables(2*30*8, 2*32*8, CV_8UC3),
+    m_oam(8*16, 8*8, CV_8UC3),
+    m_palettes(2*16, 16*16, CV_8UC3) {
+}
+
+PpuViewer::~PpuViewer() {
+    stop();
+}
+
+void PpuViewer::start() {
+    if (m_thread.joinable()) {
+        return;
+    }
+    m_done = false;
+    m_ppu->set_snapshot_exchange(&m_snapshots);
+    m_thread = std::thread(&PpuViewer::run, this);
+}
+
+void PpuViewer::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    // the PPU may still be publishing the last snapshot, it only touches
+    // its own write buffer which stays valid as long as this object
+    m_ppu->set_snapshot_exchange(nullptr);
+    m_done = true;
+    m_thread.join();
+}
+
+void PpuViewer::run() {
+    while (!m_done) {
+        const PpuSnapshot * snapshot = m_snapshots.acquire();
+        if (snapshot != nullptr) {
+            draw(*snapshot);
+        }
+        // also runs the highgui event loop
+        cv::waitKey(PPUVIEWER_REFRESH_MS);
+    }
+    cv::destroyAllWindows();
+}
+
+void PpuViewer::draw(const PpuSnapshot& snapshot) {
+    draw_patterns(snapshot);
+    draw_nametables(snapshot);
+    draw_oam(snapshot);
+    draw_palettes(snapshot);
+    show("pattern tables", m_patterns, 3);
+    show("nametables", m_nametables, 2);
+    show("oam", m_oam, 4);
+    show("palettes", m_palettes, 2);
+}
+
+void PpuViewer::show(const char * name, const cv::Mat& image, int scale) {
+    cv::Mat scaled;
+    cv::resize(image, scaled, cv::Size(image.cols * scale, image.rows * scale), 0, 0, cv::INTER_NEAREST);
+    cv::imshow(name, scaled);
+}
+
+void PpuViewer::draw_patterns(const PpuSnapshot& snapshot) {
+    // background palette 0, as most games keep their main colors there
+    for (int table_no = 0; table_no < 2; table_no++) {
+        for (int tile_no = 0; tile_no < 256; tile_no++) {
+            int x = table_no*16*8 + (tile_no % 16)*8;
+            int y = (tile_no / 16)*8;
+            draw_tile(&m_patterns, snapshot, tile_no, table_no, x, y, 0, false, false);
+        }
+    }
+}
+
+void PpuViewer::draw_nametables(const PpuSnapshot& snapshot) {
+    bool table_no = (snapshot.ppuctrl & PPUCTRL_BGPATTTABLE) != 0;
+    for (int nametable_no = 0; nametable_no < 4; nametable_no++) {
+        uint16_t nametable_base_addr = 0x2000 + 0x400*nametable_no;
+        int origin_x = (nametable_no % 2)*32*8;
+        int origin_y = (nametable_no / 2)*30*8;
+        for (int tile_y = 0; tile_y < 30; tile_y++) {
+            for (int tile_x = 0; tile_x < 32; tile_x++) {
+                uint8_t tile_no = snapshot.vram[nametable_base_addr + tile_x + tile_y*32];
+                // same attribute table layout as PpuDevice::render_nametable
+                uint16_t attribute_table_addr = 0x3c0 + (tile_y / 4)*8 + tile_x / 4;
+                uint8_t attr_bitshift = 0;
+                if (tile_y % 4 > 1) {
+                    attr_bitshift += 4;
+                }
+                if (tile_x % 4 > 1) {
+                    attr_bitshift += 2;
+                }
+                uint8_t palette_no = (snapshot.vram[nametable_base_addr + attribute_table_addr] >> attr_bitshift) & 0b11;
+                draw_tile(&m_nametables, snapshot, tile_no, table_no, origin_x + tile_x*8, origin_y + tile_y*8, palette_no, false, false);
+            }
+        }
+    }
+    // the visible screen, from the scroll in t : its outline wraps around
+    // the four nametables as the rendering does
+    uint16_t t = snapshot.ppu_tmp_addr;
+    int nametable_no = (t >> 10) & 0b11;
+    int x = (nametable_no % 2)*32*8 + (t & 0x1f)*8 + snapshot.fine_x;
+    int y = (nametable_no / 2)*30*8 + ((t >> 5) & 0x1f)*8 + ((t >> 12) & 0b111);
+    int width = 2*32*8;
+    int height = 2*30*8;
+    cv::Vec3b red(0, 0, 255);
+    for (int i = 0; i < 32*8; i++) {
+        m_nametables.at<cv::Vec3b>(y % height, (x + i) % width) = red;
+        m_nametables.at<cv::Vec3b>((y + 30*8 - 1) % height, (x + i) % width) = red;
+    }
+    for (int i = 0; i < 30*8; i++) {
+        m_nametables.at<cv::Vec3b>((y + i) % height, x % width) = red;
+        m_nametables.at<cv::Vec3b>((y + i) % height, (x + 32*8 - 1) % width) = red;
+    }
+}
+
+void PpuViewer::draw_oam(const PpuSnapshot& snapshot) {
+    // one 8x16 cell per sprite, the bottom half is only used in 8x16 mode
+    bool doubletile = (snapshot.ppuctrl & PPUCTRL_SPRITESIZE) != 0;
+    bool table_no = (snapshot.ppuctrl & PPUCTRL_OAMPATTTABLE) != 0;
+    m_oam.setTo(cv::Scalar(0, 0, 0));
+    for (int i = 0; i < 64; i++) {
+        uint8_t tile_no = snapshot.oam[i*4+1];
+        uint8_t attr = snapshot.oam[i*4+2];
+        bool hflip = (attr & PPUOAM_ATT_HFLIP) != 0;
+        bool vflip = (attr & PPUOAM_ATT_VFLIP) != 0;
+        uint8_t palette_no = (attr & 0b11) + 4;
+        int x = (i % 8)*8;
+        int y = (i / 8)*16;
+        if (!doubletile) {
+            draw_tile(&m_oam, snapshot, tile_no, table_no, x, y, palette_no, hflip, vflip);
+        } else {
+            // 8x16 : bit 0 selects the table, the vertical flip swaps the halves
+            bool tile_table_no = tile_no & 1;
+            uint8_t top = tile_no & 0xfe;
+            draw_tile(&m_oam, snapshot, vflip ? top + 1 : top, tile_table_no, x, y, palette_no, hflip, vflip);
+            draw_tile(&m_oam, snapshot, vflip ? top : top + 1, tile_table_no, x, y + 8, palette_no, hflip, vflip);
+        }
+    }
+}
+
+void PpuViewer::draw_palettes(const PpuSnapshot& snapshot) {
+    for (int i = 0; i < 32; i++) {
+        const uint8_t * color = NES_COLORS[snapshot.vram[0x3f00 + i] & 0x3f];
+        int x0 = (i % 16)*16;
+        int y0 = (i / 16)*16;
+        for (int y = y0; y < y0 + 16; y++) {
+            for (int x = x0; x < x0 + 16; x++) {
+                m_palettes.at<cv::Vec3b>(y, x) = cv::Vec3b(color[2], color[1], color[0]);
+            }
+        }
+    }
+}
+
+void PpuViewer::draw_tile(cv::Mat * image, const PpuSnapshot& snapshot, uint8_t tile_no, bool table_no, int x, int y, uint8_t palette_no, bool hflip, bool vflip) {
+    // imshow expects BGR, unlike the SDL frame
+    uint16_t plane0_addr = (tile_no + 256*table_no) << 4;
+    for (int j = 0; j < 8; j++) {
+        uint8_t plane0 = snapshot.chr[plane0_addr + j];
+        uint8_t plane1 = snapshot.chr[plane0_addr + j + 8];
+        int py = y + (vflip ? 7 - j : j);
+        for (int i = 0; i < 8; i++) {
+            uint8_t pix_color = (((plane1 >> i) & 1) << 1) | ((plane0 >> i) & 1);
+            // 0x3f00 is the universal background color
+            uint16_t palette_addr = pix_color == 0 ? 0x3f00 : 0x3f00 + palette_no*4 + pix_color;
+            const uint8_t * color = NES_COLORS[snapshot.vram[palette_addr] & 0x3f];
+            int px = x + (hflip ? i : 7 - i);
+            image->at<cv::Vec3b>(py, px) = cv::Vec3b(color[2], color[1], color[0]);
+        }
+    }
+}
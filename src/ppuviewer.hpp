@@ -0,0 +1,43 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <opencv2/opencv.hpp>
+
+#include "ppu.hpp"
+#include "ppusnapshot.hpp"
+
+/*
+PPU debug viewers : pattern tables, nametables, OAM and palettes
+The PPU only copies its memories into a PpuSnapshotExchange at vblank, the
+decoding and drawing happen here on a thread of their own, so the viewers
+cost the emulation one memcpy per frame whatever they show.
+*/
+class PpuViewer {
+ public:
+    PpuViewer(PpuDevice * ppu);
+    ~PpuViewer();
+
+    void start();
+    void stop();
+
+ private:
+    void run();
+    void draw(const PpuSnapshot& snapshot);
+    void draw_patterns(const PpuSnapshot& snapshot);
+    void draw_nametables(const PpuSnapshot& snapshot);
+    void draw_oam(const PpuSnapshot& snapshot);
+    void draw_palettes(const PpuSnapshot& snapshot);
+    void draw_tile(cv::Mat * image, const PpuSnapshot& snapshot, uint8_t tile_no, bool table_no, int x, int y, uint8_t palette_no, bool hflip, bool vflip);
+    void show(const char * name, const cv::Mat& image, int scale);
+
+    PpuDevice * m_ppu;
+    PpuSnapshotExchange m_snapshots;
+    std::thread m_thread;
+    std::atomic<bool> m_done {false};
+
+    cv::Mat m_patterns;   // both pattern tables side by side
+    cv::Mat m_nametables; // the four nametables, 2x2
+    cv::Mat m_oam;        // the 64 sprites, 8x8
+    cv::Mat m_palettes;   // background palettes then sprite palettes
+};
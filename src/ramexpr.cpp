@@ -0,0 +1,485 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <stdexcept>
+
+#include "ramexpr.hpp"
+
+/*
+Recursive descent, one function per precedence level, emitting the
+bytecode as it goes. Every operand ends with its operator, so an operand
+ending with a RAMEXPR_CONST is that constant alone : when all the operands
+of an operator are, it is evaluated at once and replaced by its result.
+*/
+
+namespace {
+
+struct Parser {
+    const std::string& src;
+    size_t pos = 0;
+    std::vector<RamExpression::Op> code;
+    int nslots = 0;
+
+    Parser(const std::string& source) : src(source) {}
+
+    [[noreturn]] void error(const std::string& message) {
+        throw std::runtime_error("Expression error at " + std::to_string(pos) + ": " + message + " in \"" + src + "\"");
+    }
+
+    void skip_spaces() {
+        while (pos < src.size() && std::isspace(static_cast<unsigned char>(src[pos]))) {
+            pos++;
+        }
+    }
+
+    // consumes op if next, not a prefix of a longer operator
+    bool accept(const char * op) {
+        skip_spaces();
+        size_t len = std::char_traits<char>::length(op);
+        if (src.compare(pos, len, op) != 0) {
+            return false;
+        }
+        char next = pos + len < src.size() ? src[pos + len] : '\0';
+        if ((len == 1 && (op[0] == '<' || op[0] == '>') && (next == op[0] || next == '=')) ||
+            (len == 1 && (op[0] == '&' || op[0] == '|') && next == op[0]) ||
+            (len == 1 && op[0] == '!' && next == '=')) {
+            return false;
+        }
+        pos += len;
+        return true;
+    }
+
+    void expect(const char * op) {
+        if (!accept(op)) {
+            error(std::string("expected ") + op);
+        }
+    }
+
+    void emit(uint8_t op_code, int64_t arg, int noperands);
+
+    void parse_or();
+    void parse_and();
+    void parse_bit_or();
+    void parse_bit_xor();
+    void parse_bit_and();
+    void parse_equality();
+    void parse_relational();
+    void parse_shift();
+    void parse_additive();
+    void parse_multiplicative();
+    void parse_unary();
+    void parse_primary();
+    int64_t parse_number();
+};
+
+int64_t run(const RamExpression::Op * code, size_t n, const uint8_t * ram, int64_t prev, int64_t * slots) {
+    int64_t stack[RAMEXPR_MAX_STACK];
+    int sp = 0;
+    for (size_t i = 0; i < n; i++) {
+        const RamExpression::Op& op = code[i];
+        // the operands of the binary operators
+        int64_t a = sp >= 2 ? stack[sp - 2] : 0;
+        int64_t b = sp >= 1 ? stack[sp - 1] : 0;
+        uint64_t ua = a;
+        uint64_t ub = b;
+        switch (op.code) {
+        case RAMEXPR_CONST:   stack[sp++] = op.arg; break;
+        case RAMEXPR_RAM:     stack[sp++] = ram[op.arg]; break;
+        case RAMEXPR_RAM_AT:  stack[sp - 1] = ram[b & (RAMEXPR_RAM_SIZE - 1)]; break;
+        case RAMEXPR_PREV:    stack[sp++] = prev; break;
+        case RAMEXPR_PREV_OF: stack[sp - 1] = slots[op.arg]; slots[op.arg] = b; break;
+        case RAMEXPR_NEG:     stack[sp - 1] = static_cast<int64_t>(0 - ub); break;
+        case RAMEXPR_NOT:     stack[sp - 1] = (b == 0); break;
+        case RAMEXPR_BIT_NOT: stack[sp - 1] = ~b; break;
+        case RAMEXPR_ABS:     stack[sp - 1] = b < 0 ? static_cast<int64_t>(0 - ub) : b; break;
+        case RAMEXPR_S8:      stack[sp - 1] = static_cast<int8_t>(b & 0xff); break;
+        case RAMEXPR_ADD:     stack[--sp - 1] = static_cast<int64_t>(ua + ub); break;
+        case RAMEXPR_SUB:     stack[--sp - 1] = static_cast<int64_t>(ua - ub); break;
+        case RAMEXPR_MUL:     stack[--sp - 1] = static_cast<int64_t>(ua * ub); break;
+        case RAMEXPR_DIV:     stack[--sp - 1] = b == 0 ? 0 : (b == -1 ? static_cast<int64_t>(0 - ua) : a / b); break;
+        case RAMEXPR_MOD:     stack[--sp - 1] = (b == 0 || b == -1) ? 0 : a % b; break;
+        case RAMEXPR_SHL:     stack[--sp - 1] = static_cast<int64_t>(ua << (b & 63)); break;
+        case RAMEXPR_SHR:     stack[--sp - 1] = a >> (b & 63); break;
+        case RAMEXPR_BIT_AND: stack[--sp - 1] = a & b; break;
+        case RAMEXPR_BIT_OR:  stack[--sp - 1] = a | b; break;
+        case RAMEXPR_BIT_XOR: stack[--sp - 1] = a ^ b; break;
+        case RAMEXPR_EQ:      stack[--sp - 1] = (a == b); break;
+        case RAMEXPR_NE:      stack[--sp - 1] = (a != b); break;
+        case RAMEXPR_LT:      stack[--sp - 1] = (a < b); break;
+        case RAMEXPR_LE:      stack[--sp - 1] = (a <= b); break;
+        case RAMEXPR_GT:      stack[--sp - 1] = (a > b); break;
+        case RAMEXPR_GE:      stack[--sp - 1] = (a >= b); break;
+        case RAMEXPR_AND:     stack[--sp - 1] = (a != 0 && b != 0); break;
+        case RAMEXPR_OR:      stack[--sp - 1] = (a != 0 || b != 0); break;
+        case RAMEXPR_MIN:     stack[--sp - 1] = a < b ? a : b; break;
+        case RAMEXPR_MAX:     stack[--sp - 1] = a > b ? a : b; break;
+        case RAMEXPR_U16:     stack[--sp - 1] = (a & 0xff) | ((b & 0xff) << 8); break;
+        case RAMEXPR_BCD:
+        case RAMEXPR_DIGITS: {
+            // wraps around as the other operators, past 19 digits
+            uint64_t value = 0;
+            for (int64_t k = op.arg; k > 0; k--) {
+                uint64_t byte = stack[sp - k] & 0xff;
+                value = op.code == RAMEXPR_BCD ? value * 100 + (byte >> 4) * 10 + (byte & 0xf) : value * 10 + byte;
+            }
+            sp -= op.arg;
+            stack[sp++] = static_cast<int64_t>(value);
+            break;
+        }
+        default:
+            throw std::runtime_error("Invalid expression opcode");
+        }
+    }
+    return stack[0];
+}
+
+void Parser::emit(uint8_t op_code, int64_t arg, int noperands) {
+    code.push_back({op_code, arg});
+    if (noperands == 0) {
+        return;
+    }
+    for (int k = 2; k <= noperands + 1; k++) {
+        if (code[code.size() - k].code != RAMEXPR_CONST) {
+            return;
+        }
+    }
+    // all the operands are constants
+    int64_t value = run(&code[code.size() - noperands - 1], noperands + 1, nullptr, 0, nullptr);
+    code.resize(code.size() - noperands - 1);
+    code.push_back({RAMEXPR_CONST, value});
+}
+
+void Parser::parse_or() {
+    parse_and();
+    while (accept("||")) {
+        parse_and();
+        emit(RAMEXPR_OR, 0, 2);
+    }
+}
+
+void Parser::parse_and() {
+    parse_bit_or();
+    while (accept("&&")) {
+        parse_bit_or();
+        emit(RAMEXPR_AND, 0, 2);
+    }
+}
+
+void Parser::parse_bit_or() {
+    parse_bit_xor();
+    while (accept("|")) {
+        parse_bit_xor();
+        emit(RAMEXPR_BIT_OR, 0, 2);
+    }
+}
+
+void Parser::parse_bit_xor() {
+    parse_bit_and();
+    while (accept("^")) {
+        parse_bit_and();
+        emit(RAMEXPR_BIT_XOR, 0, 2);
+    }
+}
+
+void Parser::parse_bit_and() {
+    parse_equality();
+    while (accept("&")) {
+        parse_equality();
+        emit(RAMEXPR_BIT_AND, 0, 2);
+    }
+}
+
+void Parser::parse_equality() {
+    parse_relational();
+    for (;;) {
+        uint8_t op_code;
+        if (accept("==")) {
+            op_code = RAMEXPR_EQ;
+        } else if (accept("!=")) {
+            op_code = RAMEXPR_NE;
+        } else {
+            return;
+        }
+        parse_relational();
+        emit(op_code, 0, 2);
+    }
+}
+
+void Parser::parse_relational() {
+    parse_shift();
+    for (;;) {
+        uint8_t op_code;
+        if (accept("<=")) {
+            op_code = RAMEXPR_LE;
+        } else if (accept(">=")) {
+            op_code = RAMEXPR_GE;
+        } else if (accept("<")) {
+            op_code = RAMEXPR_LT;
+        } else if (accept(">")) {
+            op_code = RAMEXPR_GT;
+        } else {
+            return;
+        }
+        parse_shift();
+        emit(op_code, 0, 2);
+    }
+}
+
+void Parser::parse_shift() {
+    parse_additive();
+    for (;;) {
+        uint8_t op_code;
+        if (accept("<<")) {
+            op_code = RAMEXPR_SHL;
+        } else if (accept(">>")) {
+            op_code = RAMEXPR_SHR;
+        } else {
+            return;
+        }
+        parse_additive();
+        emit(op_code, 0, 2);
+    }
+}
+
+void Parser::parse_additive() {
+    parse_multiplicative();
+    for (;;) {
+        uint8_t op_code;
+        if (accept("+")) {
+            op_code = RAMEXPR_ADD;
+        } else if (accept("-")) {
+            op_code = RAMEXPR_SUB;
+        } else {
+            return;
+        }
+        parse_multiplicative();
+        emit(op_code, 0, 2);
+    }
+}
+
+void Parser::parse_multiplicative() {
+    parse_unary();
+    for (;;) {
+        uint8_t op_code;
+        if (accept("*")) {
+            op_code = RAMEXPR_MUL;
+        } else if (accept("/")) {
+            op_code = RAMEXPR_DIV;
+        } else if (accept("%")) {
+            op_code = RAMEXPR_MOD;
+        } else {
+            return;
+        }
+        parse_unary();
+        emit(op_code, 0, 2);
+    }
+}
+
+void Parser::parse_unary() {
+    if (accept("-")) {
+        parse_unary();
+        emit(RAMEXPR_NEG, 0, 1);
+    } else if (accept("!")) {
+        parse_unary();
+        emit(RAMEXPR_NOT, 0, 1);
+    } else if (accept("~")) {
+        parse_unary();
+        emit(RAMEXPR_BIT_NOT, 0, 1);
+    } else if (accept("+")) {
+        parse_unary();
+    } else {
+        parse_primary();
+    }
+}
+
+int64_t Parser::parse_number() {
+    // 42, 0x2a, $2a, 0b101010
+    int base = 10;
+    if (src[pos] == '$') {
+        base = 16;
+        pos++;
+    } else if (src.compare(pos, 2, "0x") == 0 || src.compare(pos, 2, "0X") == 0) {
+        base = 16;
+        pos += 2;
+    } else if (src.compare(pos, 2, "0b") == 0 || src.compare(pos, 2, "0B") == 0) {
+        base = 2;
+        pos += 2;
+    }
+    size_t start = pos;
+    int64_t value = 0;
+    while (pos < src.size() && std::isxdigit(static_cast<unsigned char>(src[pos]))) {
+        int digit = std::isdigit(static_cast<unsigned char>(src[pos])) ? src[pos] - '0' : std::tolower(src[pos]) - 'a' + 10;
+        if (digit >= base) {
+            break;
+        }
+        if (value > (INT64_MAX - digit) / base) {
+            error("number too large");
+        }
+        value = value * base + digit;
+        pos++;
+    }
+    if (pos == start) {
+        error("bad number");
+    }
+    return value;
+}
+
+void Parser::parse_primary() {
+    skip_spaces();
+    if (pos >= src.size()) {
+        error("unexpected end");
+    }
+    if (accept("(")) {
+        parse_or();
+        expect(")");
+        return;
+    }
+    if (std::isdigit(static_cast<unsigned char>(src[pos])) || src[pos] == '$') {
+        emit(RAMEXPR_CONST, parse_number(), 0);
+        return;
+    }
+    size_t start = pos;
+    while (pos < src.size() && (std::isalnum(static_cast<unsigned char>(src[pos])) || src[pos] == '_')) {
+        pos++;
+    }
+    std::string name = src.substr(start, pos - start);
+    if (name.empty()) {
+        error("unexpected character");
+    }
+    if (name == "prev") {
+        if (accept("(")) {
+            // never folded, the value changes from 0 to x
+            parse_or();
+            expect(")");
+            code.push_back({RAMEXPR_PREV_OF, nslots++});
+            return;
+        }
+        emit(RAMEXPR_PREV, 0, 0);
+        return;
+    }
+    if (name == "ram") {
+        expect("[");
+        parse_or();
+        expect("]");
+        if (code.back().code == RAMEXPR_CONST) {
+            // the common case, no address on the stack
+            code.back() = {RAMEXPR_RAM, code.back().arg & (RAMEXPR_RAM_SIZE - 1)};
+        } else {
+            code.push_back({RAMEXPR_RAM_AT, 0});
+        }
+        return;
+    }
+    struct Function {
+        const char * name;
+        uint8_t code;
+        int nargs; // 0 : any number, at least 1
+    };
+    static const Function FUNCTIONS[] = {
+        {"bcd", RAMEXPR_BCD, 0}, {"digits", RAMEXPR_DIGITS, 0}, {"u16", RAMEXPR_U16, 2}, {"s8", RAMEXPR_S8, 1},
+        {"min", RAMEXPR_MIN, 2}, {"max", RAMEXPR_MAX, 2}, {"abs", RAMEXPR_ABS, 1},
+    };
+    for (const Function& function : FUNCTIONS) {
+        if (name != function.name) {
+            continue;
+        }
+        expect("(");
+        int nargs = 0;
+        do {
+            parse_or();
+            nargs++;
+        } while (accept(","));
+        expect(")");
+        if (function.nargs != 0 && nargs != function.nargs) {
+            error(name + " takes " + std::to_string(function.nargs) + " arguments");
+        }
+        // before emit, which may fold the call on the evaluation stack
+        if (nargs > RAMEXPR_MAX_STACK) {
+            error(name + " takes at most " + std::to_string(RAMEXPR_MAX_STACK) + " arguments");
+        }
+        emit(function.code, function.nargs == 0 ? nargs : 0, nargs);
+        return;
+    }
+    pos = start;
+    error("unknown name " + name);
+}
+
+}
+
+RamExpression::RamExpression(const std::string& source) : m_source(source) {
+    Parser parser(m_source);
+    parser.parse_or();
+    parser.skip_spaces();
+    if (parser.pos != m_source.size()) {
+        parser.error("unexpected character");
+    }
+    m_code = std::move(parser.code);
+    m_nslots = parser.nslots;
+    // the stack needed, at most RAMEXPR_MAX_STACK
+    int depth = 0;
+    for (const Op& op : m_code) {
+        switch (op.code) {
+        case RAMEXPR_CONST:
+        case RAMEXPR_RAM:
+        case RAMEXPR_PREV:
+            depth++;
+            break;
+        case RAMEXPR_RAM_AT:
+        case RAMEXPR_PREV_OF:
+        case RAMEXPR_NEG:
+        case RAMEXPR_NOT:
+        case RAMEXPR_BIT_NOT:
+        case RAMEXPR_ABS:
+        case RAMEXPR_S8:
+            break;
+        case RAMEXPR_BCD:
+        case RAMEXPR_DIGITS:
+            depth -= op.arg - 1;
+            break;
+        default:
+            depth--;
+        }
+        if (depth > RAMEXPR_MAX_STACK) {
+            throw std::runtime_error("Expression too deep: \"" + m_source + "\"");
+        }
+    }
+}
+
+int64_t RamExpression::evaluate(const uint8_t * ram, int64_t prev, int64_t * slots) const {
+    if (m_nslots > 0 && slots == nullptr) {
+        throw std::runtime_error("No prev slots for \"" + m_source + "\"");
+    }
+    return run(m_code.data(), m_code.size(), ram, prev, slots);
+}
+
+RamExpressionBatch::RamExpressionBatch(const std::vector<std::string>& sources, int ninstances) : m_ninstances(ninstances) {
+    for (const std::string& source : sources) {
+        m_expressions.emplace_back(source);
+    }
+    m_prev.assign(m_expressions.size() * ninstances, 0);
+    for (const RamExpression& expression : m_expressions) {
+        m_slot_offsets.push_back(m_instance_slots);
+        m_instance_slots += expression.get_slot_count();
+    }
+    m_slots.assign(static_cast<size_t>(m_instance_slots) * ninstances, 0);
+}
+
+void RamExpressionBatch::evaluate(const uint8_t * const * rams, int64_t * results, const bool * skip) {
+    size_t nexpressions = m_expressions.size();
+    for (int instance = 0; instance < m_ninstances; instance++) {
+        if (skip != nullptr && skip[instance]) {
+            continue;
+        }
+        int64_t * prev = &m_prev[instance * nexpressions];
+        int64_t * out = &results[instance * nexpressions];
+        int64_t * slots = m_slots.data() + static_cast<size_t>(instance) * m_instance_slots;
+        for (size_t e = 0; e < nexpressions; e++) {
+            out[e] = m_expressions[e].evaluate(rams[instance], prev[e], slots + m_slot_offsets[e]);
+            prev[e] = out[e];
+        }
+    }
+}
+
+void RamExpressionBatch::reset() {
+    std::fill(m_prev.begin(), m_prev.end(), 0);
+    std::fill(m_slots.begin(), m_slots.end(), 0);
+}
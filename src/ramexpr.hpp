@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// the 2KB of internal RAM the expressions read, addresses are masked to it
+static const int RAMEXPR_RAM_SIZE = 0x800;
+// deepest evaluation stack, checked at compile
+static const int RAMEXPR_MAX_STACK = 32;
+
+// RamExpression opcodes
+enum {
+    RAMEXPR_CONST = 0,   // push arg
+    RAMEXPR_RAM,         // push ram[arg], the address known at compile
+    RAMEXPR_RAM_AT,      // pop the address, push ram[address]
+    RAMEXPR_PREV,        // push the previous value of the expression
+    RAMEXPR_PREV_OF,     // pop a value, push the one of slot arg, keep the popped one there
+    RAMEXPR_NEG,
+    RAMEXPR_NOT,
+    RAMEXPR_BIT_NOT,
+    RAMEXPR_ADD,
+    RAMEXPR_SUB,
+    RAMEXPR_MUL,
+    RAMEXPR_DIV,         // 0 when dividing by 0
+    RAMEXPR_MOD,         // 0 when dividing by 0
+    RAMEXPR_SHL,
+    RAMEXPR_SHR,
+    RAMEXPR_BIT_AND,
+    RAMEXPR_BIT_OR,
+    RAMEXPR_BIT_XOR,
+    RAMEXPR_EQ,
+    RAMEXPR_NE,
+    RAMEXPR_LT,
+    RAMEXPR_LE,
+    RAMEXPR_GT,
+    RAMEXPR_GE,
+    RAMEXPR_AND,         // both evaluated, there are no side effects
+    RAMEXPR_OR,
+    RAMEXPR_MIN,
+    RAMEXPR_MAX,
+    RAMEXPR_ABS,
+    RAMEXPR_S8,          // byte as signed
+    RAMEXPR_U16,         // pop high, pop low
+    RAMEXPR_BCD,         // pop arg bytes, 2 decimal digits each, the first the most significant
+    RAMEXPR_DIGITS,      // pop arg bytes, 1 decimal digit each
+};
+
+/*
+An expression over the RAM, compiled once to a stack bytecode, e.g.
+    bcd(ram[0x25], ram[0x26]) - prev(bcd(ram[0x25], ram[0x26]))
+    ram[0x55] == 0
+Integers (64 bits), C operators and precedence (?: and assignments
+excepted), true is 1. ram[a] is the byte at a, prev(x) the value of x at
+the previous evaluation, prev alone the value of the whole expression at
+the previous evaluation (0 at first for both). Functions : bcd(bytes...),
+digits(bytes...), u16(low, high), s8(byte), min(a, b), max(a, b), abs(a).
+Constant subexpressions are folded at compile.
+Each prev(x) has a slot holding x between two evaluations, owned by the
+caller (see RamExpressionBatch).
+*/
+class RamExpression {
+ public:
+    struct Op {
+        uint8_t code;
+        int64_t arg;
+    };
+
+    // throws std::runtime_error with the position of the error
+    RamExpression(const std::string& source);
+
+    // slots : get_slot_count() values, zeroed before the first evaluation,
+    // may be nullptr without prev(x)
+    int64_t evaluate(const uint8_t * ram, int64_t prev, int64_t * slots = nullptr) const;
+
+    const std::string& get_source() const { return m_source; }
+    const std::vector<Op>& get_code() const { return m_code; }
+    int get_slot_count() const { return m_nslots; }
+
+ private:
+    std::string m_source;
+    std::vector<Op> m_code;
+    int m_nslots = 0;
+};
+
+/*
+Many expressions over many instances (rewards, termination, telemetry)
+evaluated at frame end : the results go to a single array, one row of
+get_expression_count() values per instance. Each instance has its own
+prev and prev(x) slots per expression.
+*/
+class RamExpressionBatch {
+ public:
+    RamExpressionBatch(const std::vector<std::string>& sources, int ninstances);
+
+    int get_expression_count() const { return m_expressions.size(); }
+    int get_instance_count() const { return m_ninstances; }
+    const RamExpression& get_expression(int i) const { return m_expressions[i]; }
+
+    // rams[i] : the RAM of instance i, e.g. RamDevice::State::mem
+    // results[i * get_expression_count() + e] : expression e on instance i
+    // skip : optional, the instances to skip (e.g. on a lag frame), their
+    // results and prevs are left as they are
+    void evaluate(const uint8_t * const * rams, int64_t * results, const bool * skip = nullptr);
+    // the prevs back to 0
+    void reset();
+
+ private:
+    std::vector<RamExpression> m_expressions;
+    int m_ninstances;
+    std::vector<int64_t> m_prev;
+    // the prev(x) slots of an instance, expression after expression
+    std::vector<int> m_slot_offsets;
+    int m_instance_slots = 0;
+    std::vector<int64_t> m_slots;
+};
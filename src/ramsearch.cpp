@@ -0,0 +1,188 @@
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAMSEARCH_HAS_AVX2_PATH
+#endif
+
+#include "ramsearch.hpp"
+
+/*
+Candidates are kept as a bitset, one uint32_t per block of 32 bytes.
+Filtering compares the whole snapshot against the previous one (or a constant)
+block by block and ANDs the resulting mask into the candidate word.
+With AVX2 a block is a single 256 bits compare + movemask.
+*/
+
+static uint32_t block_mask_scalar(const uint8_t * cur, const uint8_t * prev, int predicate, uint8_t value) {
+    uint32_t mask = 0;
+    for (int i = 0; i < RAMSEARCH_BLOCK_SIZE; i++) {
+        bool keep = false;
+        switch (predicate) {
+        case RAMSEARCH_EQUAL:     keep = (cur[i] == value);   break;
+        case RAMSEARCH_NOT_EQUAL: keep = (cur[i] != value);   break;
+        case RAMSEARCH_CHANGED:   keep = (cur[i] != prev[i]); break;
+        case RAMSEARCH_UNCHANGED: keep = (cur[i] == prev[i]); break;
+        case RAMSEARCH_INCREASED: keep = (cur[i] > prev[i]);  break;
+        case RAMSEARCH_DECREASED: keep = (cur[i] < prev[i]);  break;
+        default:
+            throw std::runtime_error("Invalid ram search predicate");
+        }
+        mask |= (static_cast<uint32_t>(keep) << i);
+    }
+    return mask;
+}
+
+static void filter_blocks_scalar(const uint8_t * cur, const uint8_t * prev, uint32_t * candidates, size_t nblocks, int predicate, uint8_t value) {
+    for (size_t block = 0; block < nblocks; block++) {
+        if (candidates[block] == 0) {
+            continue;
+        }
+        size_t offset = block * RAMSEARCH_BLOCK_SIZE;
+        candidates[block] &= block_mask_scalar(cur + offset, prev + offset, predicate, value);
+    }
+}
+
+#ifdef RAMSEARCH_HAS_AVX2_PATH
+__attribute__((target("avx2")))
+static void filter_blocks_avx2(const uint8_t * cur, const uint8_t * prev, uint32_t * candidates, size_t nblocks, int predicate, uint8_t value) {
+    const __m256i n = _mm256_set1_epi8(static_cast<char>(value));
+    for (size_t block = 0; block < nblocks; block++) {
+        if (candidates[block] == 0) {
+            continue;
+        }
+        size_t offset = block * RAMSEARCH_BLOCK_SIZE;
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur + offset));
+        __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + offset));
+        __m256i keep;
+        switch (predicate) {
+        case RAMSEARCH_EQUAL:
+        case RAMSEARCH_NOT_EQUAL:
+            keep = _mm256_cmpeq_epi8(c, n);
+            break;
+        case RAMSEARCH_CHANGED:
+        case RAMSEARCH_UNCHANGED:
+            keep = _mm256_cmpeq_epi8(c, p);
+            break;
+        case RAMSEARCH_INCREASED:
+            // there is no unsigned byte compare: c > p <=> max(c, p) == c and c != p
+            keep = _mm256_andnot_si256(_mm256_cmpeq_epi8(c, p), _mm256_cmpeq_epi8(_mm256_max_epu8(c, p), c));
+            break;
+        case RAMSEARCH_DECREASED:
+            keep = _mm256_andnot_si256(_mm256_cmpeq_epi8(c, p), _mm256_cmpeq_epi8(_mm256_min_epu8(c, p), c));
+            break;
+        default:
+            throw std::runtime_error("Invalid ram search predicate");
+        }
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(keep));
+        if (predicate == RAMSEARCH_NOT_EQUAL || predicate == RAMSEARCH_CHANGED) {
+            mask = ~mask;
+        }
+        candidates[block] &= mask;
+    }
+}
+#endif
+
+RamSearch::RamSearch(Device * ram, uint16_t base_addr, uint16_t size) {
+    add_region(ram, base_addr, size);
+}
+
+void RamSearch::add_region(Device * device, uint16_t base_addr, uint16_t size) {
+    m_regions.push_back({device, base_addr, size, m_size});
+    m_size += size;
+    reset();
+}
+
+void RamSearch::take_snapshot(std::vector<uint8_t> * snapshot) {
+    // padding bytes stay at 0, their candidate bits are never set
+    snapshot->assign(m_candidates.size() * RAMSEARCH_BLOCK_SIZE, 0);
+    for (const auto& region : m_regions) {
+        for (uint16_t i = 0; i < region.size; i++) {
+            (*snapshot)[region.offset + i] = region.device->get(region.base_addr + i);
+        }
+    }
+}
+
+void RamSearch::reset() {
+    size_t nblocks = (m_size + RAMSEARCH_BLOCK_SIZE - 1) / RAMSEARCH_BLOCK_SIZE;
+    m_candidates.assign(nblocks, 0xffffffff);
+    if (m_size % RAMSEARCH_BLOCK_SIZE != 0) {
+        m_candidates.back() = (1u << (m_size % RAMSEARCH_BLOCK_SIZE)) - 1;
+    }
+    take_snapshot(&m_snapshot);
+}
+
+void RamSearch::filter(int predicate, uint8_t value) {
+    take_snapshot(&m_current);
+#ifdef RAMSEARCH_HAS_AVX2_PATH
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2) {
+        filter_blocks_avx2(m_current.data(), m_snapshot.data(), m_candidates.data(), m_candidates.size(), predicate, value);
+    } else {
+        filter_blocks_scalar(m_current.data(), m_snapshot.data(), m_candidates.data(), m_candidates.size(), predicate, value);
+    }
+#else
+    filter_blocks_scalar(m_current.data(), m_snapshot.data(), m_candidates.data(), m_candidates.size(), predicate, value);
+#endif
+    m_snapshot.swap(m_current);
+}
+
+/*
+A loop is enough: filter() is already one AVX2 pass over the candidate
+bitmap of a search, 32 bytes per iteration, and the searches don't share
+their snapshots, so a pass across them would only interleave the same loads
+and stores. A 2 KB + 8 KB search is 320 blocks, the batch is bound by the
+take_snapshot() reads through Device::get, not by the filter.
+*/
+void RamSearch::filter_batch(const std::vector<RamSearch*>& searches, int predicate, uint8_t value) {
+    for (auto search : searches) {
+        search->filter(predicate, value);
+    }
+}
+
+size_t RamSearch::count() const {
+    size_t n = 0;
+    for (uint32_t word : m_candidates) {
+        n += __builtin_popcount(word);
+    }
+    return n;
+}
+
+uint16_t RamSearch::index_to_addr(size_t index) const {
+    for (const auto& region : m_regions) {
+        if (index >= region.offset && index < region.offset + region.size) {
+            return region.base_addr + (index - region.offset);
+        }
+    }
+    throw std::runtime_error("Bad ram search index");
+}
+
+long RamSearch::addr_to_index(uint16_t addr) const {
+    for (const auto& region : m_regions) {
+        if (addr >= region.base_addr && addr < region.base_addr + region.size) {
+            return region.offset + (addr - region.base_addr);
+        }
+    }
+    return -1;
+}
+
+std::vector<uint16_t> RamSearch::candidates() const {
+    std::vector<uint16_t> addrs;
+    for (size_t block = 0; block < m_candidates.size(); block++) {
+        uint32_t word = m_candidates[block];
+        while (word != 0) {
+            int bit = __builtin_ctz(word);
+            addrs.push_back(index_to_addr(block * RAMSEARCH_BLOCK_SIZE + bit));
+            word &= word - 1;
+        }
+    }
+    return addrs;
+}
+
+uint8_t RamSearch::get_value(uint16_t addr) const {
+    long index = addr_to_index(addr);
+    if (index < 0) {
+        throw std::runtime_error("Address not in ram search");
+    }
+    return m_snapshot[index];
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "device.hpp"
+
+// Predicates applied by RamSearch::filter
+// the current values are compared either against the value passed
+// to filter() or against the snapshot taken by the previous filter/reset
+enum {
+    RAMSEARCH_EQUAL = 0,     // value == N
+    RAMSEARCH_NOT_EQUAL,     // value != N
+    RAMSEARCH_CHANGED,       // value != previous
+    RAMSEARCH_UNCHANGED,     // value == previous
+    RAMSEARCH_INCREASED,     // value > previous (unsigned)
+    RAMSEARCH_DECREASED,     // value < previous (unsigned)
+};
+
+// addresses are compared by blocks of 32 bytes, one candidate word per block
+static const int RAMSEARCH_BLOCK_SIZE = 32;
+
+class RamSearch {
+ public:
+    // by default, search the 2KB of internal RAM
+    RamSearch(Device * ram, uint16_t base_addr = 0x0000, uint16_t size = 0x800);
+
+    // append another searched region (e.g. cartridge PRG-RAM at 0x6000)
+    void add_region(Device * device, uint16_t base_addr, uint16_t size);
+
+    // mark every address as a candidate and snapshot the current values
+    void reset();
+    // drop the candidates that don't satisfy the predicate, then snapshot
+    void filter(int predicate, uint8_t value = 0);
+
+    size_t count() const;
+    std::vector<uint16_t> candidates() const;
+    // value of addr in the last snapshot
+    uint8_t get_value(uint16_t addr) const;
+
+    // apply the same filter to many searches (one per emulator instance)
+    static void filter_batch(const std::vector<RamSearch*>& searches, int predicate, uint8_t value = 0);
+
+ private:
+    struct Region {
+        Device * device;
+        uint16_t base_addr;
+        uint16_t size;
+        size_t offset; // offset of the region in the snapshot
+    };
+
+    void take_snapshot(std::vector<uint8_t> * snapshot);
+    long addr_to_index(uint16_t addr) const;
+    uint16_t index_to_addr(size_t index) const;
+
+    std::vector<Region> m_regions;
+    size_t m_size = 0; // number of searched bytes, without padding
+
+    // snapshots are padded to a multiple of RAMSEARCH_BLOCK_SIZE
+    std::vector<uint8_t> m_snapshot;
+    std::vector<uint8_t> m_current;
+    // bit i of word j : address at index j*32+i is still a candidate
+    std::vector<uint32_t> m_candidates;
+};
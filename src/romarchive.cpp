@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+
+#ifdef NESQUICK_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#include "romarchive.hpp"
+#include "utils.hpp"
+
+static const size_t CHUNK_SIZE = 65536;
+
+typedef std::unique_ptr<FILE, int(*)(FILE*)> File;
+
+static uint32_t le32(const uint8_t * bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+static uint16_t le16(const uint8_t * bytes) {
+    return bytes[0] | (bytes[1] << 8);
+}
+
+static void read_raw(FILE * file, uint64_t size, std::vector<uint8_t> * data, const std::string& filename) {
+    // size : UINT64_MAX up to the end of the file
+    uint8_t chunk[CHUNK_SIZE];
+    while (size > 0) {
+        size_t n = std::fread(chunk, 1, std::min<uint64_t>(sizeof(chunk), size), file);
+        if (n == 0) {
+            if (size != UINT64_MAX) {
+                throw std::runtime_error("Truncated file " + filename);
+            }
+            break;
+        }
+        if (data->size() + n > ROM_FILE_MAX_SIZE) {
+            throw std::runtime_error("ROM too large " + filename);
+        }
+        data->insert(data->end(), chunk, chunk + n);
+        if (size != UINT64_MAX) {
+            size -= n;
+        }
+    }
+}
+
+#ifdef NESQUICK_HAS_ZLIB
+// one deflate stream from the current position, the file is left just after it
+static void inflate_stream(FILE * file, int window_bits, std::vector<uint8_t> * data, const std::string& filename) {
+    z_stream stream = {};
+    if (inflateInit2(&stream, window_bits) != Z_OK) {
+        throw std::runtime_error("inflateInit2 failed");
+    }
+    std::unique_ptr<z_stream, int(*)(z_stream*)> guard(&stream, inflateEnd);
+    uint8_t in[CHUNK_SIZE];
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+        if (stream.avail_in == 0) {
+            stream.avail_in = std::fread(in, 1, sizeof(in), file);
+            stream.next_in = in;
+            if (stream.avail_in == 0) {
+                throw std::runtime_error("Truncated archive " + filename);
+            }
+        }
+        // straight into data, grown by chunks
+        size_t size = data->size();
+        if (size >= ROM_FILE_MAX_SIZE) {
+            throw std::runtime_error("ROM too large " + filename);
+        }
+        data->resize(size + CHUNK_SIZE);
+        stream.next_out = data->data() + size;
+        stream.avail_out = CHUNK_SIZE;
+        ret = inflate(&stream, Z_NO_FLUSH);
+        data->resize(size + CHUNK_SIZE - stream.avail_out);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            throw std::runtime_error("Corrupted archive " + filename);
+        }
+    }
+    // read past the end of the stream, given back
+    std::fseek(file, -static_cast<long>(stream.avail_in), SEEK_CUR);
+}
+#endif
+
+static bool is_nes_name(const std::string& name) {
+    if (name.size() < 4) {
+        return false;
+    }
+    std::string ext = name.substr(name.size() - 4);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext == ".nes";
+}
+
+static void read_zip(FILE * file, std::vector<uint8_t> * data, const std::string& filename) {
+    /*
+    Through the local headers, no seeking to the central directory : the
+    entries before the .nes are skipped, their compressed size must be in
+    their header (no data descriptor), true of the usual single ROM zips.
+    */
+    for (;;) {
+        uint8_t header[30];
+        if (std::fread(header, sizeof(header), 1, file) != 1 || le32(header) != 0x04034b50) {
+            throw std::runtime_error("No .nes file in " + filename);
+        }
+        uint16_t flags = le16(header + 6);
+        uint16_t method = le16(header + 8);
+        uint32_t crc = le32(header + 14);
+        uint32_t compressed_size = le32(header + 18);
+        uint32_t size = le32(header + 22);
+        std::string name(le16(header + 26), '\0');
+        if (std::fread(&name[0], 1, name.size(), file) != name.size() || std::fseek(file, le16(header + 28), SEEK_CUR) != 0) {
+            throw std::runtime_error("Truncated archive " + filename);
+        }
+        if (flags & 1) {
+            throw std::runtime_error("Encrypted archive " + filename);
+        }
+        if (compressed_size == 0xffffffff || size == 0xffffffff) {
+            throw std::runtime_error("Zip64 archive unsupported " + filename);
+        }
+        bool descriptor = flags & 0x8;
+        if (!is_nes_name(name)) {
+            if (descriptor) {
+                throw std::runtime_error("No .nes file before a streamed entry in " + filename);
+            }
+            std::fseek(file, compressed_size, SEEK_CUR);
+            continue;
+        }
+
+        if (method == 0 && !descriptor) {
+            read_raw(file, size, data, filename);
+#ifdef NESQUICK_HAS_ZLIB
+        } else if (method == 8) {
+            inflate_stream(file, -MAX_WBITS, data, filename);
+#endif
+        } else {
+            throw std::runtime_error("Zip compression method " + std::to_string(method) + " unsupported by this build " + filename);
+        }
+        if (descriptor) {
+            // crc, sizes, after an optional signature
+            uint8_t trailer[16];
+            if (std::fread(trailer, 1, sizeof(trailer), file) < 12) {
+                throw std::runtime_error("Truncated archive " + filename);
+            }
+            crc = le32(trailer) == 0x08074b50 ? le32(trailer + 4) : le32(trailer);
+        }
+        if (crc32(data->data(), data->size()) != crc) {
+            throw std::runtime_error("Corrupted archive " + filename);
+        }
+        return;
+    }
+}
+
+void read_rom_file(const std::string& filename, std::vector<uint8_t> * data) {
+    File file(std::fopen(filename.c_str(), "rb"), std::fclose);
+    if (!file) {
+        throw std::runtime_error("Unable to open file " + filename);
+    }
+    data->clear();
+    uint8_t magic[4] = {0};
+    size_t nmagic = std::fread(magic, 1, sizeof(magic), file.get());
+    std::rewind(file.get());
+    if (nmagic >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+#ifdef NESQUICK_HAS_ZLIB
+        // gzip header and trailer (crc included) checked by zlib
+        inflate_stream(file.get(), 16 + MAX_WBITS, data, filename);
+#else
+        throw std::runtime_error("gzip unsupported by this build " + filename);
+#endif
+    } else if (nmagic == 4 && le32(magic) == 0x04034b50) {
+        read_zip(file.get(), data, filename);
+    } else {
+        read_raw(file.get(), UINT64_MAX, data, filename);
+    }
+}
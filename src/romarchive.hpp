@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// largest ROM image accepted, an archive inflating to more is rejected
+static const size_t ROM_FILE_MAX_SIZE = 16 * 1024 * 1024;
+
+/*
+The image of a ROM file into data : a .nes as is, a gzip (.nes.gz) or a
+zip (its first .nes entry), decompressed chunk by chunk as the file is
+read, never whole in memory. Recognized by their magic, not their name.
+gzip and zip need zlib at build time (NESQUICK_HAS_ZLIB).
+Throws std::runtime_error.
+*/
+void read_rom_file(const std::string& filename, std::vector<uint8_t> * data);
@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "romindex.hpp"
+#include "romarchive.hpp"
+
+static const char ROMINDEX_MAGIC[8] = "NESRIDX";
+static const uint32_t ROMINDEX_VERSION = 1;
+
+static uint32_t sha1_bucket_hash(const uint8_t sha1[SHA1_DIGEST_SIZE]) {
+    // already uniformly distributed
+    return sha1[0] | (sha1[1] << 8) | (sha1[2] << 16) | (static_cast<uint32_t>(sha1[3]) << 24);
+}
+
+static bool is_rom_name(const std::string& name) {
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    for (const char * ext : {".nes", ".gz", ".zip"}) {
+        size_t n = std::strlen(ext);
+        if (lower.size() > n && lower.compare(lower.size() - n, n, ext) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void find_roms(const std::string& dir, std::vector<std::string> * paths) {
+    DIR * d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return;
+    }
+    while (dirent * entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string path = dir + "/" + name;
+        // the linked directories aren't followed, no loops
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            find_roms(path, paths);
+        } else if (is_rom_name(name) && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            paths->push_back(path);
+        }
+    }
+    closedir(d);
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = std::tolower(static_cast<unsigned char>(c));
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+RomIndex::~RomIndex() {
+    close();
+}
+
+void RomIndex::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open ROM index " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(RomIndexHeader)) {
+        ::close(fd);
+        throw std::runtime_error("Not a ROM index " + path);
+    }
+    void * map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("Unable to map ROM index " + path);
+    }
+    m_map = map;
+    m_map_size = st.st_size;
+
+    const RomIndexHeader * header = static_cast<const RomIndexHeader*>(m_map);
+    uint64_t expected = sizeof(RomIndexHeader) + static_cast<uint64_t>(header->count) * sizeof(RomIndexEntry)
+        + 2 * static_cast<uint64_t>(header->nbuckets) * sizeof(uint32_t) + header->paths_size;
+    if (std::memcmp(header->magic, ROMINDEX_MAGIC, sizeof(header->magic)) != 0 || header->version != ROMINDEX_VERSION
+            || header->nbuckets == 0 || (header->nbuckets & (header->nbuckets - 1)) != 0 || header->nbuckets <= header->count
+            || expected != m_map_size) {
+        close();
+        throw std::runtime_error("Not a ROM index or of another version " + path);
+    }
+    m_header = header;
+    m_entries = reinterpret_cast<const RomIndexEntry*>(m_header + 1);
+    m_crc32_buckets = reinterpret_cast<const uint32_t*>(m_entries + m_header->count);
+    m_sha1_buckets = m_crc32_buckets + m_header->nbuckets;
+    m_paths = reinterpret_cast<const char*>(m_sha1_buckets + m_header->nbuckets);
+    if (!is_valid()) {
+        close();
+        throw std::runtime_error("Corrupted ROM index " + path);
+    }
+}
+
+bool RomIndex::is_valid() const {
+    // a lookup must end on an empty bucket, and not read past the map
+    for (const uint32_t * buckets : {m_crc32_buckets, m_sha1_buckets}) {
+        bool empty = false;
+        for (uint32_t i = 0; i < m_header->nbuckets; i++) {
+            if (buckets[i] > m_header->count) {
+                return false;
+            }
+            empty |= buckets[i] == 0;
+        }
+        if (!empty) {
+            return false;
+        }
+    }
+    if (m_header->count == 0) {
+        return true;
+    }
+    // the last path is NUL terminated, so are the others
+    if (m_header->paths_size == 0 || m_paths[m_header->paths_size - 1] != '\0') {
+        return false;
+    }
+    for (uint32_t i = 0; i < m_header->count; i++) {
+        if (m_entries[i].path_offset >= m_header->paths_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RomIndex::close() {
+    if (m_map != nullptr) {
+        munmap(m_map, m_map_size);
+    }
+    m_map = nullptr;
+    m_map_size = 0;
+    m_header = nullptr;
+}
+
+const RomIndexEntry * RomIndex::find_crc32(uint32_t crc) const {
+    if (m_header == nullptr) {
+        return nullptr;
+    }
+    uint32_t mask = m_header->nbuckets - 1;
+    for (uint32_t bucket = crc & mask; m_crc32_buckets[bucket] != 0; bucket = (bucket + 1) & mask) {
+        const RomIndexEntry * entry = &m_entries[m_crc32_buckets[bucket] - 1];
+        if (entry->crc32 == crc) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+const RomIndexEntry * RomIndex::find_sha1(const uint8_t sha1[SHA1_DIGEST_SIZE]) const {
+    if (m_header == nullptr) {
+        return nullptr;
+    }
+    uint32_t mask = m_header->nbuckets - 1;
+    for (uint32_t bucket = sha1_bucket_hash(sha1) & mask; m_sha1_buckets[bucket] != 0; bucket = (bucket + 1) & mask) {
+        const RomIndexEntry * entry = &m_entries[m_sha1_buckets[bucket] - 1];
+        if (std::memcmp(entry->sha1, sha1, SHA1_DIGEST_SIZE) == 0) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+const RomIndexEntry * RomIndex::find(const std::string& hash) const {
+    if (hash.size() != 8 && hash.size() != 2 * SHA1_DIGEST_SIZE) {
+        return nullptr;
+    }
+    uint8_t bytes[SHA1_DIGEST_SIZE];
+    for (size_t i = 0; i < hash.size(); i += 2) {
+        int high = hex_digit(hash[i]);
+        int low = hex_digit(hash[i + 1]);
+        if (high < 0 || low < 0) {
+            return nullptr;
+        }
+        bytes[i / 2] = (high << 4) | low;
+    }
+    if (hash.size() == 8) {
+        return find_crc32((bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3]);
+    }
+    return find_sha1(bytes);
+}
+
+void RomIndex::load(const std::string& hash, InesRom * rom) const {
+    const RomIndexEntry * entry = find(hash);
+    if (entry == nullptr) {
+        throw std::runtime_error("No ROM " + hash + " in the index");
+    }
+    loadInes(get_path(entry), rom);
+    // the file may have changed since the index was built
+    if (rom_crc32(*rom) != entry->crc32) {
+        throw std::runtime_error(std::string("ROM changed since indexed, ") + get_path(entry));
+    }
+}
+
+RomIndex::BuildStats RomIndex::build(const std::string& dir, const std::string& path, int nthreads, std::ostream& errors) {
+    auto start = std::chrono::steady_clock::now();
+    BuildStats stats;
+    char root[PATH_MAX];
+    if (realpath(dir.c_str(), root) == nullptr) {
+        throw std::runtime_error("Unable to open directory " + dir);
+    }
+    std::vector<std::string> paths;
+    find_roms(root, &paths);
+    // the same index for the same collection
+    std::sort(paths.begin(), paths.end());
+    stats.files = paths.size();
+
+    struct Result {
+        bool ok = false;
+        RomIndexEntry entry;
+    };
+    std::vector<Result> results(paths.size());
+    std::atomic<size_t> next {0};
+    std::atomic<uint64_t> bytes {0};
+    std::mutex errors_mutex;
+    auto worker = [&]() {
+        std::vector<uint8_t> data;
+        InesRom rom;
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            try {
+                read_rom_file(paths[i], &data);
+                loadInes(data, &rom);
+            } catch (const std::runtime_error& ex) {
+                std::lock_guard<std::mutex> lock(errors_mutex);
+                errors << paths[i] << ": " << ex.what() << std::endl;
+                continue;
+            }
+            RomIndexEntry& entry = results[i].entry;
+            entry = {};
+            Sha1 sha1;
+            sha1.update(rom.prg.data(), rom.prg.size());
+            sha1.update(rom.chr.data(), rom.chr.size());
+            sha1.finish(entry.sha1);
+            entry.prg_crc32 = crc32(rom.prg.data(), rom.prg.size());
+            entry.chr_crc32 = crc32(rom.chr.data(), rom.chr.size());
+            entry.crc32 = crc32(rom.chr.data(), rom.chr.size(), entry.prg_crc32);
+            entry.prg_size = rom.prg.size();
+            entry.chr_size = rom.chr.size();
+            entry.mapper = rom.mapper;
+            results[i].ok = true;
+            bytes += rom.prg.size() + rom.chr.size();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < std::max(1, nthreads); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    stats.bytes = bytes;
+
+    std::vector<RomIndexEntry> entries;
+    std::string paths_data;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!results[i].ok) {
+            stats.failed++;
+            continue;
+        }
+        results[i].entry.path_offset = paths_data.size();
+        paths_data += paths[i];
+        paths_data += '\0';
+        entries.push_back(results[i].entry);
+    }
+    stats.roms = entries.size();
+
+    RomIndexHeader header = {};
+    std::memcpy(header.magic, ROMINDEX_MAGIC, sizeof(header.magic));
+    header.version = ROMINDEX_VERSION;
+    header.count = entries.size();
+    header.nbuckets = 1;
+    while (header.nbuckets < 2 * entries.size() + 1) {
+        header.nbuckets *= 2;
+    }
+    header.paths_size = paths_data.size();
+    // a duplicate (same ROM in two archives) is inserted too, found after the first
+    uint32_t mask = header.nbuckets - 1;
+    std::vector<uint32_t> crc32_buckets(header.nbuckets, 0);
+    std::vector<uint32_t> sha1_buckets(header.nbuckets, 0);
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        uint32_t bucket = entries[i].crc32 & mask;
+        while (crc32_buckets[bucket] != 0) {
+            bucket = (bucket + 1) & mask;
+        }
+        crc32_buckets[bucket] = i + 1;
+        bucket = sha1_bucket_hash(entries[i].sha1) & mask;
+        while (sha1_buckets[bucket] != 0) {
+            bucket = (bucket + 1) & mask;
+        }
+        sha1_buckets[bucket] = i + 1;
+    }
+
+    std::string tmp_path = path + ".tmp";
+    std::unique_ptr<FILE, int(*)(FILE*)> file(std::fopen(tmp_path.c_str(), "wb"), std::fclose);
+    if (!file) {
+        throw std::runtime_error("Unable to write " + tmp_path);
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file.get()) == 1
+        && std::fwrite(entries.data(), sizeof(RomIndexEntry), entries.size(), file.get()) == entries.size()
+        && std::fwrite(crc32_buckets.data(), sizeof(uint32_t), crc32_buckets.size(), file.get()) == crc32_buckets.size()
+        && std::fwrite(sha1_buckets.data(), sizeof(uint32_t), sha1_buckets.size(), file.get()) == sha1_buckets.size()
+        && std::fwrite(paths_data.data(), 1, paths_data.size(), file.get()) == paths_data.size();
+    if (std::fclose(file.release()) != 0 || !ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Unable to write " + path);
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
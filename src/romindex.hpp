@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "sha1.hpp"
+#include "utils.hpp"
+
+// one ROM, hashed over its PRG then its CHR without the iNES header, as
+// in the No-Intro databases
+struct RomIndexEntry {
+    uint8_t sha1[SHA1_DIGEST_SIZE];
+    uint32_t crc32;
+    uint32_t prg_crc32;
+    uint32_t chr_crc32;
+    uint32_t prg_size;
+    uint32_t chr_size;
+    uint16_t mapper;
+    uint16_t reserved;
+    uint32_t path_offset;   // in the paths, NUL terminated
+};
+
+struct RomIndexHeader {
+    char magic[8];          // "NESRIDX"
+    uint32_t version;
+    uint32_t count;         // of entries
+    uint32_t nbuckets;      // of each table, a power of 2
+    uint32_t paths_size;
+};
+
+/*
+The index of a ROM collection, written by build() and mapped by open() :
+    header, entries[count], crc32 buckets[nbuckets], sha1 buckets[nbuckets], paths
+A bucket holds an entry index + 1, 0 when empty. The tables are at most
+half full, open addressing with linear probing : a lookup reads a bucket
+or two and the entry, whatever the size of the collection, nothing is
+parsed nor loaded at open, only the bounds checked. The paths are absolute.
+*/
+class RomIndex {
+ public:
+    struct BuildStats {
+        long files = 0;         // candidates : .nes, .gz, .zip
+        long roms = 0;          // indexed
+        long failed = 0;
+        uint64_t bytes = 0;     // of PRG and CHR hashed
+        double seconds = 0;
+    };
+
+    RomIndex() {}
+    ~RomIndex();
+
+    // throws std::runtime_error
+    void open(const std::string& path);
+    void close();
+
+    int get_count() const { return m_header != nullptr ? m_header->count : 0; }
+    const RomIndexEntry * get_entry(int i) const { return &m_entries[i]; }
+    const char * get_path(const RomIndexEntry * entry) const { return m_paths + entry->path_offset; }
+    // nullptr if unknown
+    const RomIndexEntry * find_crc32(uint32_t crc) const;
+    const RomIndexEntry * find_sha1(const uint8_t sha1[SHA1_DIGEST_SIZE]) const;
+    // hash : 8 hex digits for a CRC32, 40 for a SHA-1
+    const RomIndexEntry * find(const std::string& hash) const;
+    // the ROM of hash, its CRC32 checked against the index, throws
+    void load(const std::string& hash, InesRom * rom) const;
+
+    /*
+    Scans dir and its subdirectories, the files decompressed, parsed and
+    hashed by nthreads threads, then writes the index to path (a temp
+    file renamed). The files that fail are reported to errors and skipped.
+    */
+    static BuildStats build(const std::string& dir, const std::string& path, int nthreads, std::ostream& errors);
+
+ private:
+    // the buckets and path offsets of the mapped index within bounds
+    bool is_valid() const;
+
+    void * m_map = nullptr;
+    size_t m_map_size = 0;
+    const RomIndexHeader * m_header = nullptr;
+    const RomIndexEntry * m_entries = nullptr;
+    const uint32_t * m_crc32_buckets = nullptr;
+    const uint32_t * m_sha1_buckets = nullptr;
+    const char * m_paths = nullptr;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+static const uint64_t SCHEDULER_NEVER = UINT64_MAX;
+
+// one slot per event source, an event is pending at most once
+enum {
+    EVENT_MAPPER_IRQ = 0,
+    EVENT_APU_FRAME,
+    EVENT_COUNT,
+};
+
+/*
+Timed events, in cpu cycles
+Devices which know in advance when something will happen (a counter
+reaching zero...) schedule it here instead of checking it at each tick :
+the console loop only compares the cycle count to next_cycle().
+*/
+class Scheduler {
+ public:
+    // the pending cycle of each event, part of the console state
+    struct State {
+        uint64_t cycles[EVENT_COUNT];
+    };
+
+    // clock : the cpu cycle counter of the console
+    Scheduler(const uint64_t * clock) : m_clock(clock) {
+        for (int event = 0; event < EVENT_COUNT; event++) {
+            m_cycles[event] = SCHEDULER_NEVER;
+        }
+    }
+
+    uint64_t now() const { return *m_clock; }
+    uint64_t next_cycle() const { return m_next; }
+
+    // handler(cycle) is called once now() reaches cycle
+    void set_handler(int event, std::function<void(uint64_t)> handler) {
+        m_handlers[event] = handler;
+    }
+
+    // replaces the previous schedule of the event, if any
+    void schedule(int event, uint64_t cycle) {
+        m_cycles[event] = cycle;
+        update_next();
+    }
+
+    void cancel(int event) {
+        schedule(event, SCHEDULER_NEVER);
+    }
+
+    // run the events due, a handler may schedule again
+    void run() {
+        uint64_t cycle = now();
+        for (int event = 0; event < EVENT_COUNT; event++) {
+            if (m_cycles[event] <= cycle) {
+                uint64_t due = m_cycles[event];
+                m_cycles[event] = SCHEDULER_NEVER;
+                m_handlers[event](due);
+            }
+        }
+        update_next();
+    }
+
+    void get_state(State * state) {
+        for (int event = 0; event < EVENT_COUNT; event++) {
+            state->cycles[event] = m_cycles[event];
+        }
+    }
+
+    void set_state(const State& state) {
+        for (int event = 0; event < EVENT_COUNT; event++) {
+            m_cycles[event] = state.cycles[event];
+        }
+        update_next();
+    }
+
+ private:
+    void update_next() {
+        m_next = SCHEDULER_NEVER;
+        for (int event = 0; event < EVENT_COUNT; event++) {
+            if (m_cycles[event] < m_next) {
+                m_next = m_cycles[event];
+            }
+        }
+    }
+
+    const uint64_t * m_clock;
+    uint64_t m_cycles[EVENT_COUNT];
+    uint64_t m_next = SCHEDULER_NEVER;
+    std::function<void(uint64_t)> m_handlers[EVENT_COUNT];
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+/*
+Sequence lock, one writer and any number of readers : the writer bumps
+the sequence to odd, writes in place and bumps it to even again, a reader
+copies the value and keeps it only if the sequence was the same even
+number before and after. The writer never waits for the readers, a reader
+only retries when its copy overlapped a write.
+The value is copied as bytes, so it must be trivially copyable.
+*/
+template <typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+ public:
+    // writer side, fill the returned value then end_write
+    T * begin_write() {
+        uint32_t seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        // the value writes can't move before the odd sequence
+        std::atomic_thread_fence(std::memory_order_release);
+        return &m_value;
+    }
+
+    void end_write() {
+        m_seq.store(m_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // reader side, false if a write was in progress, value is then garbage
+    bool try_read(T * value, uint32_t * seq = nullptr) const {
+        uint32_t before = m_seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            return false;
+        }
+        std::memcpy(value, &m_value, sizeof(T));
+        // the copy can't move after the second load
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_seq.load(std::memory_order_relaxed) != before) {
+            return false;
+        }
+        if (seq != nullptr) {
+            *seq = before;
+        }
+        return true;
+    }
+
+    // retries until a torn-free copy, returns its sequence (twice the
+    // number of writes before it, 0 : never written)
+    uint32_t read(T * value) const {
+        uint32_t seq;
+        while (!try_read(value, &seq)) {
+            std::this_thread::yield();
+        }
+        return seq;
+    }
+
+    // cheap check for a new value, without copying
+    uint32_t get_sequence() const {
+        return m_seq.load(std::memory_order_acquire);
+    }
+
+ private:
+    alignas(64) std::atomic<uint32_t> m_seq {0};
+    T m_value;
+};
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA1_HAS_SHANI_PATH
+#endif
+
+#include "sha1.hpp"
+
+static inline uint32_t rol(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_blocks_scalar(uint32_t state[5], const uint8_t * data, size_t nblocks) {
+    for (; nblocks > 0; nblocks--, data += 64) {
+        uint32_t w[80];
+        for (int t = 0; t < 16; t++) {
+            w[t] = (data[4 * t] << 24) | (data[4 * t + 1] << 16) | (data[4 * t + 2] << 8) | data[4 * t + 3];
+        }
+        for (int t = 16; t < 80; t++) {
+            w[t] = rol(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        auto round = [&](uint32_t f, uint32_t k, uint32_t w) {
+            uint32_t temp = rol(a, 5) + f + e + k + w;
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = temp;
+        };
+        for (int t = 0; t < 20; t++) {
+            round((b & c) | (~b & d), 0x5a827999, w[t]);
+        }
+        for (int t = 20; t < 40; t++) {
+            round(b ^ c ^ d, 0x6ed9eba1, w[t]);
+        }
+        for (int t = 40; t < 60; t++) {
+            round((b & c) | (b & d) | (c & d), 0x8f1bbcdc, w[t]);
+        }
+        for (int t = 60; t < 80; t++) {
+            round(b ^ c ^ d, 0xca62c1d6, w[t]);
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#ifdef SHA1_HAS_SHANI_PATH
+__attribute__((target("sha,ssse3,sse4.1")))
+static inline __m128i sha1_rounds4(__m128i abcd, __m128i e, int group) {
+    // the round function is an immediate
+    switch (group / 5) {
+    case 0:
+        return _mm_sha1rnds4_epu32(abcd, e, 0);
+    case 1:
+        return _mm_sha1rnds4_epu32(abcd, e, 1);
+    case 2:
+        return _mm_sha1rnds4_epu32(abcd, e, 2);
+    default:
+        return _mm_sha1rnds4_epu32(abcd, e, 3);
+    }
+}
+
+/*
+20 groups of 4 rounds. The message words of group g are in msg[g % 4],
+W[g + 4] is computed there over the 3 next groups (msg1, xor, msg2) as
+the words it depends on are loaded or computed. e[] alternate : the E of
+this group, then the A of the previous one rotated, for the next.
+*/
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha1_blocks_shani(uint32_t state[5], const uint8_t * data, size_t nblocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1b);
+    __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+    for (; nblocks > 0; nblocks--, data += 64) {
+        __m128i abcd_save = abcd;
+        __m128i e0_save = e0;
+        __m128i msg[4];
+        __m128i e[2] = {e0, e0};
+        // unrolled, the registers stay registers and the switch goes away
+#pragma GCC unroll 20
+        for (int g = 0; g < 20; g++) {
+            __m128i& w = msg[g % 4];
+            if (g < 4) {
+                w = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * g)), byte_swap);
+            }
+            if (g == 0) {
+                e[0] = _mm_add_epi32(e[0], w);
+            } else {
+                e[g % 2] = _mm_sha1nexte_epu32(e[g % 2], w);
+            }
+            e[(g + 1) % 2] = abcd;
+            if (g >= 3 && g <= 18) {
+                msg[(g + 1) % 4] = _mm_sha1msg2_epu32(msg[(g + 1) % 4], w);
+            }
+            abcd = sha1_rounds4(abcd, e[g % 2], g);
+            if (g >= 1 && g <= 16) {
+                msg[(g + 3) % 4] = _mm_sha1msg1_epu32(msg[(g + 3) % 4], w);
+            }
+            if (g >= 2 && g <= 17) {
+                msg[(g + 2) % 4] = _mm_xor_si128(msg[(g + 2) % 4], w);
+            }
+        }
+        e0 = _mm_sha1nexte_epu32(e[0], e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+#endif
+
+Sha1::Sha1() : m_state{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0} {
+}
+
+void Sha1::blocks(const uint8_t * data, size_t nblocks) {
+#ifdef SHA1_HAS_SHANI_PATH
+    static const bool has_shani = __builtin_cpu_supports("sha");
+    if (has_shani) {
+        sha1_blocks_shani(m_state, data, nblocks);
+        return;
+    }
+#endif
+    sha1_blocks_scalar(m_state, data, nblocks);
+}
+
+void Sha1::update(const uint8_t * data, size_t size) {
+    m_size += size;
+    if (m_buffered > 0) {
+        size_t n = std::min(size, sizeof(m_buffer) - m_buffered);
+        std::memcpy(m_buffer + m_buffered, data, n);
+        m_buffered += n;
+        data += n;
+        size -= n;
+        if (m_buffered < sizeof(m_buffer)) {
+            return;
+        }
+        blocks(m_buffer, 1);
+        m_buffered = 0;
+    }
+    // the whole blocks straight from the data
+    blocks(data, size / 64);
+    data += size / 64 * 64;
+    size %= 64;
+    std::memcpy(m_buffer, data, size);
+    m_buffered = size;
+}
+
+void Sha1::finish(uint8_t digest[SHA1_DIGEST_SIZE]) {
+    uint64_t bits = m_size * 8;
+    // 0x80, zeros up to 56 mod 64, the size in bits big endian
+    uint8_t padding[72] = {0x80};
+    size_t npadding = (m_buffered < 56 ? 56 : 120) - m_buffered;
+    for (int i = 0; i < 8; i++) {
+        padding[npadding + i] = bits >> (56 - 8 * i);
+    }
+    update(padding, npadding + 8);
+    for (int i = 0; i < 5; i++) {
+        digest[4 * i] = m_state[i] >> 24;
+        digest[4 * i + 1] = m_state[i] >> 16;
+        digest[4 * i + 2] = m_state[i] >> 8;
+        digest[4 * i + 3] = m_state[i];
+    }
+}
+
+std::string Sha1::to_hex(const uint8_t digest[SHA1_DIGEST_SIZE]) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (int i = 0; i < SHA1_DIGEST_SIZE; i++) {
+        hex += digits[digest[i] >> 4];
+        hex += digits[digest[i] & 0xf];
+    }
+    return hex;
+}
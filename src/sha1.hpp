@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+static const int SHA1_DIGEST_SIZE = 20;
+
+/*
+SHA-1, incremental : update() as many times as needed then finish().
+With the SHA extensions (SHA-NI) a 64 bytes block is 20 sha1rnds4
+instead of 80 scalar rounds, chosen at run time.
+*/
+class Sha1 {
+ public:
+    Sha1();
+
+    void update(const uint8_t * data, size_t size);
+    void finish(uint8_t digest[SHA1_DIGEST_SIZE]);
+
+    // e.g. "da39a3ee5e6b4b0d3255bfef95601890afd80709", the SHA-1 of nothing
+    static std::string to_hex(const uint8_t digest[SHA1_DIGEST_SIZE]);
+
+ private:
+    void blocks(const uint8_t * data, size_t nblocks);
+
+    uint32_t m_state[5];
+    uint8_t m_buffer[64];
+    size_t m_buffered = 0;
+    uint64_t m_size = 0;
+};
@@ -0,0 +1,117 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shmexport.hpp"
+#include "audio.hpp"
+
+ShmExporter::ShmExporter(const ConsoleSnapshotPublisher * snapshots) : m_snapshots(snapshots) {
+}
+
+ShmExporter::~ShmExporter() {
+    close();
+}
+
+void ShmExporter::open(const std::string& name) {
+    close();
+    // a fresh one, the consumers still mapping the previous one keep it
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create shared memory " + name);
+    }
+    if (ftruncate(fd, sizeof(nes_shm)) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Unable to size shared memory " + name);
+    }
+    void * addr = mmap(nullptr, sizeof(nes_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Unable to map shared memory " + name);
+    }
+    m_name = name;
+    m_shm = static_cast<nes_shm*>(addr);
+    // zeroed by ftruncate
+    m_shm->version = NES_SHM_VERSION;
+    m_shm->width = NES_SHM_WIDTH;
+    m_shm->height = NES_SHM_HEIGHT;
+    m_shm->frame_slots = NES_SHM_FRAME_SLOTS;
+    m_shm->audio_samples = NES_SHM_AUDIO_SAMPLES;
+    m_shm->sample_rate = SAMPLE_RATE;
+    // last, nes_shm_open checks it
+    __atomic_store_n(&m_shm->magic, NES_SHM_MAGIC, __ATOMIC_RELEASE);
+    m_slot = nullptr;
+}
+
+void ShmExporter::close() {
+    if (m_shm == nullptr) {
+        return;
+    }
+    munmap(m_shm, sizeof(nes_shm));
+    shm_unlink(m_name.c_str());
+    m_shm = nullptr;
+    m_slot = nullptr;
+}
+
+void ShmExporter::write_rows(const cv::Mat& rgb, int first_row, int end_row, long frame_no) {
+    if (m_shm == nullptr) {
+        return;
+    }
+    if (first_row == 0 && m_slot == nullptr) {
+        // the slot after the last published one, odd while written
+        m_slot = &m_shm->frames[m_shm->frame_count % NES_SHM_FRAME_SLOTS];
+        __atomic_store_n(&m_slot->seq, m_slot->seq + 1, __ATOMIC_RELAXED);
+        // the row writes can't move before the odd seq
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+    if (first_row == 0) {
+        m_next_row = 0;
+    }
+    if (m_slot == nullptr || first_row != m_next_row) {
+        // a slice was dropped by the pipeline, the slot waits for the next frame
+        m_next_row = -1;
+        return;
+    }
+    for (int y = first_row; y < end_row; y++) {
+        std::memcpy(m_slot->rgb[y], rgb.ptr<uint8_t>(y), sizeof(m_slot->rgb[y]));
+    }
+    m_slot->frame_no = frame_no;
+    m_next_row = end_row;
+    if (end_row == NES_SHM_HEIGHT) {
+        end_frame();
+    }
+}
+
+void ShmExporter::end_frame() {
+    if (m_snapshots != nullptr && m_snapshots->get_sequence() != 0) {
+        m_snapshots->read(&m_snapshot);
+        std::memcpy(m_slot->ram, m_snapshot.ram, sizeof(m_slot->ram));
+        m_slot->ram_frame_no = m_snapshot.frame_no;
+        m_slot->cycles = m_snapshot.cycles;
+    } else {
+        m_slot->ram_frame_no = -1;
+    }
+    __atomic_store_n(&m_slot->seq, m_slot->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&m_shm->frame_count, m_shm->frame_count + 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &m_shm->frame_count, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    m_slot = nullptr;
+}
+
+void ShmExporter::write_audio(const int16_t * samples, int n) {
+    if (m_shm == nullptr) {
+        return;
+    }
+    uint64_t write = m_shm->audio_write;
+    for (int i = 0; i < n; i++) {
+        m_shm->audio[(write + i) & (NES_SHM_AUDIO_SAMPLES - 1)] = samples[i];
+    }
+    __atomic_store_n(&m_shm->audio_write, write + n, __ATOMIC_RELEASE);
+}
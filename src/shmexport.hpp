@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+#include "nesshm.h"
+#include "consolesnapshot.hpp"
+
+/*
+Writes the frames, the audio and the RAM snapshots into the shared memory
+of nesshm.h, for the consumers of other processes. The frames come from
+the FramePipeline worker once converted (slices are assembled in their
+slot), with the last ConsoleSnapshot, the audio from the SoundEngine on
+the emulation thread. Neither waits for the consumers : a futex wake per
+frame, and the copies a frame and its samples would need anyway.
+*/
+class ShmExporter {
+ public:
+    // snapshots : optional, for the RAM of the frames
+    ShmExporter(const ConsoleSnapshotPublisher * snapshots = nullptr);
+    ~ShmExporter();
+
+    // creates (or replaces) the shared memory name, e.g. "/nesquick"
+    void open(const std::string& name);
+    void close();
+    bool is_open() const { return m_shm != nullptr; }
+
+    // post-process thread, rows first_row to end_row - 1 of a frame in RGB
+    void write_rows(const cv::Mat& rgb, int first_row, int end_row, long frame_no);
+    // emulation thread
+    void write_audio(const int16_t * samples, int n);
+
+ private:
+    void end_frame();
+
+    const ConsoleSnapshotPublisher * m_snapshots;
+    std::string m_name;
+    nes_shm * m_shm = nullptr;
+    nes_shm_frame * m_slot = nullptr; // being written, nullptr between frames
+    int m_next_row = 0;
+    ConsoleSnapshot m_snapshot;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/*
+Single producer / single consumer ring, for the hand-overs between two
+threads (as AudioRing for the samples) : neither side ever locks, push
+fails when full and pop when empty.
+*/
+template <typename T, size_t CAPACITY>
+class SpscRing {
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+
+ public:
+    bool push(const T& item) {
+        size_t write = m_write.load(std::memory_order_relaxed);
+        if (write - m_read.load(std::memory_order_acquire) == CAPACITY) {
+            return false;
+        }
+        m_items[write & (CAPACITY - 1)] = item;
+        m_write.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T * item) {
+        size_t read = m_read.load(std::memory_order_relaxed);
+        if (read == m_write.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *item = m_items[read & (CAPACITY - 1)];
+        m_read.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+    // only while nobody pops
+    void clear() {
+        m_read.store(m_write.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+ private:
+    T m_items[CAPACITY];
+    // apart, the two threads write one each
+    alignas(64) std::atomic<size_t> m_read {0};
+    alignas(64) std::atomic<size_t> m_write {0};
+};
@@ -0,0 +1,130 @@
+#include <chrono>
+
+#include "timetravel.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+TimeTravel::TimeTravel(Nes * nes, uint64_t interval, size_t max_checkpoints)
+    : m_nes(nes), m_interval(interval), m_max_checkpoints(max_checkpoints) {
+    m_nes->ppu.set_input_log(&m_input_log);
+    record();
+}
+
+TimeTravel::~TimeTravel() {
+    m_nes->ppu.set_input_log(nullptr);
+}
+
+void TimeTravel::set_checkpoint_interval(uint64_t interval) {
+    m_interval = interval;
+}
+
+long TimeTravel::get_last_replay_us() {
+    return m_last_replay_us;
+}
+
+void TimeTravel::record() {
+    uint64_t now = m_nes->get_cycles();
+    if (!m_checkpoints.empty() && now < m_checkpoints.back()->cycles + m_interval) {
+        return;
+    }
+    auto state = std::make_unique<Nes::State>();
+    m_nes->get_state(state.get());
+    m_checkpoints.push_back(std::move(state));
+    if (m_checkpoints.size() > m_max_checkpoints) {
+        m_checkpoints.pop_front();
+    }
+}
+
+void TimeTravel::truncate() {
+    uint64_t now = m_nes->get_cycles();
+    while (!m_checkpoints.empty() && m_checkpoints.back()->cycles > now) {
+        m_checkpoints.pop_back();
+    }
+    m_input_log.resize(m_nes->ppu.get_strobe_count());
+}
+
+int TimeTravel::find_checkpoint(uint64_t cycle) {
+    // latest checkpoint taken at or before cycle, -1 if none
+    for (int i = m_checkpoints.size() - 1; i >= 0; i--) {
+        if (m_checkpoints[i]->cycles <= cycle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void TimeTravel::seek(uint64_t cycle) {
+    m_nes->set_state(*m_checkpoints[find_checkpoint(cycle)]);
+    while (m_nes->get_cycles() < cycle) {
+        m_nes->cpu_cycle();
+    }
+}
+
+void TimeTravel::seek_oldest() {
+    m_nes->set_state(*m_checkpoints.front());
+    while (!m_nes->cpu.at_instruction_start()) {
+        m_nes->cpu_cycle();
+    }
+}
+
+bool TimeTravel::find_back(uint64_t target, const std::vector<bool> * breakpoints, uint64_t * found) {
+    /*
+    Replay the intervals before target, latest first, and keep the last
+    instruction start (on a breakpoint if given) strictly before target
+    */
+    if (target == 0) {
+        return false;
+    }
+    for (int i = find_checkpoint(target - 1); i >= 0; i--) {
+        uint64_t end = target;
+        if (i + 1 < static_cast<int>(m_checkpoints.size()) && m_checkpoints[i + 1]->cycles < target) {
+            end = m_checkpoints[i + 1]->cycles;
+        }
+        m_nes->set_state(*m_checkpoints[i]);
+        bool hit = false;
+        while (true) {
+            uint64_t cycles = m_nes->get_cycles();
+            if (m_nes->cpu.at_instruction_start()) {
+                if (breakpoints == nullptr || (*breakpoints)[m_nes->cpu.get_prgm_ctr()]) {
+                    *found = cycles;
+                    hit = true;
+                }
+            }
+            if (cycles + 1 >= end) {
+                break;
+            }
+            m_nes->cpu_cycle();
+        }
+        if (hit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TimeTravel::reverse(const std::vector<bool> * breakpoints) {
+    auto start_t = Clock::now();
+    // the replayed samples were already played and the frames observed, not again
+    PpuFrameObserver * observer = m_nes->ppu.get_frame_observer();
+    m_nes->ppu.set_frame_observer(nullptr);
+    m_nes->apu.set_audio_muted(true);
+    uint64_t found;
+    bool ok = find_back(m_nes->get_cycles(), breakpoints, &found);
+    if (ok) {
+        seek(found);
+    } else {
+        seek_oldest();
+    }
+    m_nes->apu.set_audio_muted(false);
+    m_nes->ppu.set_frame_observer(observer);
+    m_last_replay_us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start_t).count();
+    return ok;
+}
+
+bool TimeTravel::reverse_step() {
+    return reverse(nullptr);
+}
+
+bool TimeTravel::reverse_continue(const std::vector<bool>& breakpoints) {
+    return reverse(&breakpoints);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "nes.hpp"
+
+// replaying one interval takes at most a few ms, see get_last_replay_us
+static const uint64_t TIMETRAVEL_DEFAULT_INTERVAL = 60000; // cpu cycles
+static const size_t TIMETRAVEL_DEFAULT_MAX_CHECKPOINTS = 512; // ~35 MB
+
+/*
+Reverse execution
+Full console checkpoints are taken periodically (record()) and the
+controller states are logged at each strobe. Going back restores the
+nearest checkpoint and replays deterministically up to the wanted
+instruction : the console has no other source of non determinism, the
+interrupts are raised by the PPU/APU state which is checkpointed.
+*/
+class TimeTravel {
+ public:
+    TimeTravel(Nes * nes, uint64_t interval = TIMETRAVEL_DEFAULT_INTERVAL, size_t max_checkpoints = TIMETRAVEL_DEFAULT_MAX_CHECKPOINTS);
+    ~TimeTravel();
+
+    void set_checkpoint_interval(uint64_t interval);
+    // take a checkpoint if the last one is older than the interval
+    void record();
+    // drop the recorded future, after the state was edited (e.g. by a debugger)
+    void truncate();
+
+    // both return false when the start of the history was reached instead
+    bool reverse_step();
+    bool reverse_continue(const std::vector<bool>& breakpoints);
+
+    // duration of the last reverse operation
+    long get_last_replay_us();
+
+ private:
+    bool reverse(const std::vector<bool> * breakpoints);
+    bool find_back(uint64_t target, const std::vector<bool> * breakpoints, uint64_t * found);
+    void seek(uint64_t cycle);
+    void seek_oldest();
+    int find_checkpoint(uint64_t cycle);
+
+    Nes * m_nes;
+    uint64_t m_interval;
+    size_t m_max_checkpoints;
+    std::deque<std::unique_ptr<Nes::State>> m_checkpoints;
+    std::vector<uint8_t> m_input_log;
+    long m_last_replay_us = 0;
+};
@@ -5,7 +5,14 @@
 #include <cstdint>
 #include <iomanip>
 #include <bitset>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTILS_HAS_CLMUL_PATH
+#endif
+
 #include "utils.hpp"
+#include "romarchive.hpp"
 
 // Utility functions
 uint8_t byte_not(uint8_t val) {
@@ -57,12 +64,8 @@ std::string hexstr(uint16_t value) {
 }
 
 void parseInes(const std::string& filename, uint8_t * prg, uint8_t * chr) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Unable to open file");
-    }
-
-    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<uint8_t> data;
+    read_rom_file(filename, &data);
 
     if (data.size() < 16 || data[0] != 'N' || data[1] != 'E' || data[2] != 'S' || data[3] != 0x1A) {
         throw std::runtime_error("Bad file header");
@@ -82,3 +85,117 @@ void parseInes(const std::string& filename, uint8_t * prg, uint8_t * chr) {
         chr[addr] = data[16 + prgLen + addr];
     }
 }
+
+void loadInes(const std::string& filename, InesRom * rom) {
+    std::vector<uint8_t> data;
+    read_rom_file(filename, &data);
+    loadInes(data, rom);
+}
+
+void loadInes(const std::vector<uint8_t>& data, InesRom * rom) {
+    if (data.size() < 16 || data[0] != 'N' || data[1] != 'E' || data[2] != 'S' || data[3] != 0x1A) {
+        throw std::runtime_error("Bad file header");
+    }
+
+    size_t prgLen = data[4] * 16384;
+    size_t chrLen = data[5] * 8192;
+    // flags 6 bit 2 : 512 bytes trainer before PRG
+    size_t prgStart = (data[6] & 0b100) ? 16 + 512 : 16;
+
+    if (data.size() < prgStart + prgLen + chrLen) {
+        throw std::runtime_error("Unsupported file format");
+    }
+    rom->prg.assign(data.begin() + prgStart, data.begin() + prgStart + prgLen);
+    rom->chr.assign(data.begin() + prgStart + prgLen, data.begin() + prgStart + prgLen + chrLen);
+    rom->mapper = (data[6] >> 4) | (data[7] & 0xf0);
+}
+
+uint32_t rom_crc32(const InesRom& rom) {
+    return crc32(rom.chr.data(), rom.chr.size(), crc32(rom.prg.data(), rom.prg.size()));
+}
+
+struct Crc32Table {
+    uint32_t table[256];
+
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+            }
+            table[i] = crc;
+        }
+    }
+};
+static const Crc32Table CRC32_TABLE;
+
+static uint32_t crc32_scalar(const uint8_t * data, size_t size, uint32_t crc) {
+    for (size_t i = 0; i < size; i++) {
+        crc = CRC32_TABLE.table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef UTILS_HAS_CLMUL_PATH
+/*
+Folding with carry-less multiplies (Intel, "Fast CRC Computation for Generic
+Polynomials Using PCLMULQDQ"), the constants of the paper for the reflected
+0xedb88320 : 4 x 128 bits folded 64 bytes at a time, then into 128 bits,
+64 bits and a Barrett reduction. size >= 64 and a multiple of 16, crc
+already inverted. The SSE 4.2 crc32 instruction is CRC-32C, another
+polynomial, of no use for the zip / No-Intro CRC.
+*/
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i crc32_fold(__m128i x, __m128i k, __m128i next) {
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), next);
+}
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_clmul(const uint8_t * data, size_t size, uint32_t crc) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), _mm_cvtsi32_si128(crc));
+    __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+    __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32));
+    __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48));
+    data += 64;
+    size -= 64;
+    for (; size >= 64; data += 64, size -= 64) {
+        x1 = crc32_fold(x1, k1k2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+        x2 = crc32_fold(x2, k1k2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)));
+        x3 = crc32_fold(x3, k1k2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)));
+        x4 = crc32_fold(x4, k1k2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)));
+    }
+    x1 = crc32_fold(x1, k3k4, x2);
+    x1 = crc32_fold(x1, k3k4, x3);
+    x1 = crc32_fold(x1, k3k4, x4);
+    for (; size >= 16; data += 16, size -= 16) {
+        x1 = crc32_fold(x1, k3k4, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+    }
+    // 128 -> 64 bits
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5k0, 0x00), _mm_srli_si128(x1, 4));
+    // Barrett, 64 -> 32 bits
+    __m128i x2b = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+    x2b = _mm_clmulepi64_si128(_mm_and_si128(x2b, low32), poly, 0x00);
+    return _mm_extract_epi32(_mm_xor_si128(x1, x2b), 1);
+}
+#endif
+
+uint32_t crc32(const uint8_t * data, size_t size, uint32_t crc) {
+    crc = ~crc;
+#ifdef UTILS_HAS_CLMUL_PATH
+    static const bool has_clmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    if (has_clmul && size >= 64) {
+        size_t folded = size & ~static_cast<size_t>(15);
+        crc = crc32_clmul(data, folded, crc);
+        data += folded;
+        size -= folded;
+    }
+#endif
+    return ~crc32_scalar(data, size, crc);
+}
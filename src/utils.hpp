@@ -2,6 +2,9 @@
 
 #include <cctype>
 #include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
 
 uint8_t byte_not(uint8_t val);
 std::string dec2hex(uint16_t val);
@@ -13,4 +16,19 @@ uint16_t lstAddrToVal(const std::string& strAddr);
 std::string hexstr(uint8_t value);
 std::string binstr(uint8_t value);
 std::string hexstr(uint16_t value);
+// CRC-32 (zlib's), crc : of the data before, to chain the calls
+uint32_t crc32(const uint8_t * data, size_t size, uint32_t crc = 0);
 void parseInes(const std::string& filename, uint8_t * prg, uint8_t * chr);
+
+// a whole iNES file, whatever its PRG/CHR sizes
+struct InesRom {
+    std::vector<uint8_t> prg;
+    std::vector<uint8_t> chr; // empty : CHR RAM
+    int mapper;
+};
+// filename : a .nes, or a .nes in a gzip or zip, see read_rom_file
+void loadInes(const std::string& filename, InesRom * rom);
+// data : the image of a .nes file
+void loadInes(const std::vector<uint8_t>& data, InesRom * rom);
+// CRC-32 of the PRG then the CHR, without the iNES header (as No-Intro)
+uint32_t rom_crc32(const InesRom& rom);
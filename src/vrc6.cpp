@@ -0,0 +1,158 @@
+#include "vrc6.hpp"
+
+static const int VRC_PRESCALER_PERIOD = 341;
+
+Vrc6Device::Vrc6Device(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler, ApuDevice * apu, bool swap_a0a1)
+    : MapperDevice(prg, chr, ppu, scheduler), m_apu(apu), m_swap_a0a1(swap_a0a1) {
+    update_banks();
+    m_apu->set_expansion_audio(&m_audio);
+}
+
+Vrc6Device::~Vrc6Device() {
+    m_apu->set_expansion_audio(nullptr);
+}
+
+void Vrc6Device::write_register(uint16_t addr, uint8_t val) {
+    if (addr < 0x8000) {
+        return;
+    }
+    addr &= 0xf003;
+    if (m_swap_a0a1) {
+        addr = (addr & 0xf000) | ((addr & 1) << 1) | ((addr >> 1) & 1);
+    }
+    switch (addr & 0xf000) {
+    case KEY_VRC6_PRG_16K:
+        m_regs.prg_16k = val;
+        update_banks();
+        return;
+    case KEY_VRC6_PRG_8K:
+        m_regs.prg_8k = val;
+        update_banks();
+        return;
+    case KEY_VRC6_CHR_LOW:
+    case KEY_VRC6_CHR_HIGH:
+        m_regs.chr[(addr & 0b11) + (addr >= KEY_VRC6_CHR_HIGH ? 4 : 0)] = val;
+        update_banks();
+        return;
+    }
+    switch (addr) {
+    case KEY_VRC6_PPU_BANKING:
+        m_regs.ppu_banking = val;
+        update_banks();
+        break;
+    case KEY_VRC6_IRQ_LATCH:
+        sync();
+        m_regs.irq_latch = val;
+        schedule_irq();
+        break;
+    case KEY_VRC6_IRQ_CONTROL:
+        sync();
+        m_regs.irq_control = val & 0b111;
+        if (val & VRC6_IRQ_ENABLE) {
+            m_regs.irq_counter = m_regs.irq_latch;
+            m_regs.irq_prescaler = VRC_PRESCALER_PERIOD;
+        }
+        m_cpu->set_irq_line(IRQ_SOURCE_MAPPER, false);
+        schedule_irq();
+        break;
+    case KEY_VRC6_IRQ_ACK:
+        sync();
+        if (m_regs.irq_control & VRC6_IRQ_ENABLE_AFTER_ACK) {
+            m_regs.irq_control |= VRC6_IRQ_ENABLE;
+        } else {
+            m_regs.irq_control &= ~VRC6_IRQ_ENABLE;
+        }
+        m_cpu->set_irq_line(IRQ_SOURCE_MAPPER, false);
+        schedule_irq();
+        break;
+    default:
+        // the sound registers, from 0x9000 to 0xb002
+        m_apu->sync();
+        m_audio.write(addr, val);
+        break;
+    }
+}
+
+void Vrc6Device::update_banks() {
+    // 16 KB at 0x8000, 8 KB at 0xc000, the last 8 KB fixed
+    set_prg_bank(0, (m_regs.prg_16k & 0xf) * 2);
+    set_prg_bank(1, (m_regs.prg_16k & 0xf) * 2 + 1);
+    set_prg_bank(2, m_regs.prg_8k & 0x1f);
+    set_prg_bank(3, get_prg_bank_count() - 1);
+    // which register each 1 KB slot uses
+    static const int CHR_REGS[4][8] = {
+        {0, 1, 2, 3, 4, 5, 6, 7},
+        {0, 0, 1, 1, 2, 2, 3, 3},
+        {0, 1, 2, 3, 4, 4, 5, 5},
+        {0, 1, 2, 3, 4, 4, 5, 5},
+    };
+    const int * regs = CHR_REGS[m_regs.ppu_banking & VRC6_CHR_MODE_MASK];
+    for (int slot = 0; slot < 8; slot++) {
+        int bank = m_regs.chr[regs[slot]];
+        // the 2 KB banks cover aligned pairs of slots
+        bool is_2k = regs[slot ^ 1] == regs[slot];
+        if (is_2k && (m_regs.ppu_banking & VRC6_CHR_2K_A10)) {
+            bank = (bank & ~1) | (slot & 1);
+        }
+        set_chr_bank(slot, bank);
+    }
+}
+
+void Vrc6Device::sync() {
+    uint64_t now = m_scheduler->now();
+    uint64_t elapsed = now - m_regs.sync_cycle;
+    m_regs.sync_cycle = now;
+    if ((m_regs.irq_control & VRC6_IRQ_ENABLE) == 0) {
+        return;
+    }
+    uint64_t nclocks = elapsed;
+    if ((m_regs.irq_control & VRC6_IRQ_CYCLE_MODE) == 0) {
+        // scanline mode : 3 dots per cycle
+        int64_t prescaler = m_regs.irq_prescaler - 3 * static_cast<int64_t>(elapsed);
+        nclocks = 0;
+        if (prescaler <= 0) {
+            nclocks = -prescaler / VRC_PRESCALER_PERIOD + 1;
+            prescaler += nclocks * VRC_PRESCALER_PERIOD;
+        }
+        m_regs.irq_prescaler = prescaler;
+    }
+    // the counter counts up and reloads from the latch after 0xff
+    uint64_t to_overflow = 0x100 - m_regs.irq_counter;
+    if (nclocks < to_overflow) {
+        m_regs.irq_counter += nclocks;
+        return;
+    }
+    m_cpu->set_irq_line(IRQ_SOURCE_MAPPER, true);
+    m_regs.irq_counter = m_regs.irq_latch + (nclocks - to_overflow) % (0x100 - m_regs.irq_latch);
+}
+
+void Vrc6Device::schedule_irq() {
+    // must follow a sync
+    if ((m_regs.irq_control & VRC6_IRQ_ENABLE) == 0) {
+        m_scheduler->cancel(EVENT_MAPPER_IRQ);
+        return;
+    }
+    uint64_t nclocks = 0x100 - m_regs.irq_counter;
+    uint64_t ncycles = nclocks;
+    if ((m_regs.irq_control & VRC6_IRQ_CYCLE_MODE) == 0) {
+        uint64_t dots = m_regs.irq_prescaler + (nclocks - 1) * VRC_PRESCALER_PERIOD;
+        ncycles = (dots + 2) / 3;
+    }
+    m_scheduler->schedule(EVENT_MAPPER_IRQ, m_regs.sync_cycle + ncycles);
+}
+
+void Vrc6Device::irq_event(uint64_t cycle) {
+    sync();
+    schedule_irq();
+}
+
+void Vrc6Device::save_regs(uint8_t * regs) {
+    m_audio.get_state(&m_regs.audio);
+    std::memcpy(regs, &m_regs, sizeof(m_regs));
+}
+
+void Vrc6Device::load_regs(const uint8_t * regs) {
+    std::memcpy(&m_regs, regs, sizeof(m_regs));
+    m_audio.set_state(m_regs.audio);
+    update_banks();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "mapper.hpp"
+#include "expaudio.hpp"
+
+enum {
+    KEY_VRC6_PRG_16K = 0x8000,
+    KEY_VRC6_PPU_BANKING = 0xb003,
+    KEY_VRC6_PRG_8K = 0xc000,
+    KEY_VRC6_CHR_LOW = 0xd000,
+    KEY_VRC6_CHR_HIGH = 0xe000,
+    KEY_VRC6_IRQ_LATCH = 0xf000,
+    KEY_VRC6_IRQ_CONTROL = 0xf001,
+    KEY_VRC6_IRQ_ACK = 0xf002,
+
+    VRC6_IRQ_ENABLE_AFTER_ACK = BIT0,
+    VRC6_IRQ_ENABLE = BIT1,
+    VRC6_IRQ_CYCLE_MODE = BIT2,
+
+    // 0xb003 : bits 0 - 1 CHR mode, 0 : 1 KB banks, 1 : 2 KB banks, 2 / 3 : 1 KB then 2 KB
+    VRC6_CHR_MODE_MASK = 0b11,
+    // the 2 KB banks take A10 from the PPU, else they repeat a 1 KB bank
+    VRC6_CHR_2K_A10 = BIT5,
+};
+
+/*
+Konami VRC6 (iNES mappers 24 and 26, the latter with A0 and A1 swapped) :
+PRG/CHR banking, the VRC IRQ counter and two pulses and a saw of audio
+https://www.nesdev.org/wiki/VRC6
+
+The IRQ counter is clocked at each cpu cycle, or at each scanline through a
+prescaler of 341 PPU dots. Like the MMC3 one, it is brought up to date on
+the register writes and its overflow is scheduled.
+*/
+class Vrc6Device : public MapperDevice {
+ public:
+    Vrc6Device(const std::vector<uint8_t>& prg, const std::vector<uint8_t>& chr, PpuDevice * ppu, Scheduler * scheduler, ApuDevice * apu, bool swap_a0a1);
+    ~Vrc6Device();
+
+    void irq_event(uint64_t cycle);
+
+ protected:
+    void write_register(uint16_t addr, uint8_t val);
+    void save_regs(uint8_t * regs);
+    void load_regs(const uint8_t * regs);
+
+ private:
+    void update_banks();
+    void sync();
+    void schedule_irq();
+
+    struct Regs {
+        uint8_t prg_16k;
+        uint8_t prg_8k;
+        uint8_t chr[8];
+        // TODO : the PPU has no nametable mirroring yet
+        uint8_t ppu_banking;
+        uint8_t irq_latch;
+        uint8_t irq_control;
+        uint8_t irq_counter;
+        int16_t irq_prescaler;
+        uint64_t sync_cycle;
+        Vrc6Audio::State audio;
+    };
+    static_assert(sizeof(Regs) <= MAPPER_REGS_SIZE, "VRC6 registers don't fit in the mapper state");
+
+    ApuDevice * m_apu;
+    bool m_swap_a0a1;
+    Vrc6Audio m_audio;
+    Regs m_regs = {};
+};